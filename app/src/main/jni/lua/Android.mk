@@ -33,6 +33,7 @@ LOCAL_SRC_FILES := \
 	lfunc.c \
 	lgc.c \
 	linit.c \
+	ljit.c \
 	liolib.c \
 	llex.c \
 	lmathlib.c \
@@ -40,6 +41,8 @@ LOCAL_SRC_FILES := \
 	loadlib.c \
 	lobject.c \
 	lopcodes.c \
+	lopt.c \
+	lprof.c \
 	loslib.c \
 	lparser.c \
 	lstate.c \
@@ -61,6 +64,7 @@ LOCAL_SRC_FILES := \
 	lnamespace.c\
 	lthread.c \
 	lthreadlib.c \
+	lasynclib.c \
 	lproclib.c\
 	lptrlib.c \
 	lsmgrlib.c \
@@ -0,0 +1,42 @@
+-- Instruction-cache benchmark for the compact instruction encoding
+-- (LUAI_COMPACTINST). Runs the same straight-line code over working
+-- sets of growing size: once the bytecode no longer fits in the caches
+-- the time per statement rises, and it rises sooner with 8-byte
+-- instructions than with 4-byte ones. Compare a default and a compact
+-- build:
+--   lxclua bench_icache.lua
+--   make clean && make linux MYCFLAGS=-DLUAI_COMPACTINST
+--   lxclua bench_icache.lua
+local STMTS = 100           -- statements per function
+local INSTS = 4 * STMTS + 4 -- MULK, MMBINK, ADD, MMBIN each (see luac -l)
+local WORK = 10000000       -- statements executed per timing
+local REPEAT = 5            -- timings per working set; the best is kept
+
+local body = {}
+for i = 1, STMTS do
+  body[i] = string.format("a = %s + %s * %d", i % 2 == 0 and "b" or "c",
+                          i % 2 == 0 and "c" or "b", i % 7 + 2)
+end
+local src = "local a, b, c = ... " .. table.concat(body, " ") ..
+            " return a"
+
+local fs = {}
+print(string.format("%9s %9s %9s %9s %9s", "functions", "insts",
+                    "KB(4B)", "KB(8B)", "ns/stmt"))
+local n = 4
+while n <= 4096 do
+  for i = #fs + 1, n do fs[i] = assert(load(src)) end  -- distinct code
+  local rounds = WORK // (n * STMTS) + 1
+  local t = math.huge
+  for _ = 1, REPEAT do
+    local t0 = os.clock()
+    for _ = 1, rounds do
+      for i = 1, n do fs[i](i, 3, 5) end
+    end
+    t = math.min(t, os.clock() - t0)
+  end
+  print(string.format("%9d %9d %9d %9d %9.2f", n, n * INSTS,
+                      n * INSTS * 4 // 1024, n * INSTS * 8 // 1024,
+                      t * 1e9 / (rounds * n * STMTS)))
+  n = n * 2
+end
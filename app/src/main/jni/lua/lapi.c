@@ -1039,16 +1039,16 @@ l_sinline int auxgetstr (lua_State *L, const TValue *t, const char *k) {
   TString *str = luaS_new(L, k);
   if (ttistable(t)) {
      Table *h = hvalue(t);
-     l_rwlock_rdlock(&h->lock);
+     luaH_rdlock(L, h);
      const TValue *res = luaH_getstr(h, str);
      if (!isempty(res)) {
         setobj2s(L, L->top.p, res);
-        l_rwlock_unlock(&h->lock);
+        luaH_unlock(L, h);
         api_incr_top(L);
         lua_unlock(L);
         return ttype(s2v(L->top.p - 1));
      }
-     l_rwlock_unlock(&h->lock);
+     luaH_unlock(L, h);
   }
   setsvalue2s(L, L->top.p, str);
   api_incr_top(L);
@@ -1101,15 +1101,15 @@ LUA_API int lua_gettable (lua_State *L, int idx) {
   t = index2value(L, idx);
   if (ttistable(t)) {
      Table *h = hvalue(t);
-     l_rwlock_rdlock(&h->lock);
+     luaH_rdlock(L, h);
      const TValue *res = luaH_get(h, s2v(L->top.p - 1));
      if (!isempty(res)) {
         setobj2s(L, L->top.p - 1, res);
-        l_rwlock_unlock(&h->lock);
+        luaH_unlock(L, h);
         lua_unlock(L);
         return ttype(s2v(L->top.p - 1));
      }
-     l_rwlock_unlock(&h->lock);
+     luaH_unlock(L, h);
   }
   luaV_finishget(L, t, s2v(L->top.p - 1), L->top.p - 1, NULL);
   lua_unlock(L);
@@ -1145,16 +1145,16 @@ LUA_API int lua_geti (lua_State *L, int idx, lua_Integer n) {
   t = index2value(L, idx);
   if (ttistable(t)) {
      Table *h = hvalue(t);
-     l_rwlock_rdlock(&h->lock);
+     luaH_rdlock(L, h);
      const TValue *res = luaH_getint(h, n);
      if (!isempty(res)) {
         setobj2s(L, L->top.p, res);
-        l_rwlock_unlock(&h->lock);
+        luaH_unlock(L, h);
         api_incr_top(L);
         lua_unlock(L);
         return ttype(s2v(L->top.p - 1));
      }
-     l_rwlock_unlock(&h->lock);
+     luaH_unlock(L, h);
   }
   TValue aux;
   setivalue(&aux, n);
@@ -1195,14 +1195,14 @@ LUA_API int lua_rawget (lua_State *L, int idx) {
   lua_lock(L);
   api_checknelems(L, 1);
   t = gettable(L, idx);
-  l_rwlock_rdlock(&t->lock);
+  luaH_rdlock(L, t);
   const TValue *val = luaH_get(t, s2v(L->top.p - 1));
   if (isempty(val)) {
      setnilvalue(s2v(L->top.p - 1));
   } else {
      setobj2s(L, L->top.p - 1, val);
   }
-  l_rwlock_unlock(&t->lock);
+  luaH_unlock(L, t);
   // Stack top is already updated (we overwrote key)
   // finishrawget did api_incr_top and unlock.
   // We overwrote key at top-1. We don't need to push.
@@ -1234,14 +1234,14 @@ LUA_API int lua_rawgeti (lua_State *L, int idx, lua_Integer n) {
   Table *t;
   lua_lock(L);
   t = gettable(L, idx);
-  l_rwlock_rdlock(&t->lock);
+  luaH_rdlock(L, t);
   const TValue *val = luaH_getint(t, n);
   if (isempty(val)) {
      setnilvalue(s2v(L->top.p));
   } else {
      setobj2s(L, L->top.p, val);
   }
-  l_rwlock_unlock(&t->lock);
+  luaH_unlock(L, t);
   api_incr_top(L);
   lua_unlock(L);
   return ttype(s2v(L->top.p - 1));
@@ -1262,14 +1262,14 @@ LUA_API int lua_rawgetp (lua_State *L, int idx, const void *p) {
   lua_lock(L);
   t = gettable(L, idx);
   setpvalue(&k, cast_voidp(p));
-  l_rwlock_rdlock(&t->lock);
+  luaH_rdlock(L, t);
   const TValue *val = luaH_get(t, &k);
   if (isempty(val)) {
      setnilvalue(s2v(L->top.p));
   } else {
      setobj2s(L, L->top.p, val);
   }
-  l_rwlock_unlock(&t->lock);
+  luaH_unlock(L, t);
   api_incr_top(L);
   lua_unlock(L);
   return ttype(s2v(L->top.p - 1));
@@ -1374,17 +1374,17 @@ static void auxsetstr (lua_State *L, const TValue *t, const char *k) {
   api_checknelems(L, 1);
   if (ttistable(t)) {
      Table *h = hvalue(t);
-     l_rwlock_wrlock(&h->lock);
+     luaH_wrlock(L, h);
      const TValue *res = luaH_getstr(h, str);
      if (!isempty(res) && !isabstkey(res)) {
         setobj2t(L, cast(TValue *, res), s2v(L->top.p - 1));
         luaC_barrierback(L, obj2gco(h), s2v(L->top.p - 1));
-        l_rwlock_unlock(&h->lock);
+        luaH_unlock(L, h);
         L->top.p--;
         lua_unlock(L);
         return;
      }
-     l_rwlock_unlock(&h->lock);
+     luaH_unlock(L, h);
   }
   setsvalue2s(L, L->top.p, str);  /* push 'str' (to make it a TValue) */
   api_incr_top(L);
@@ -1421,17 +1421,17 @@ LUA_API void lua_settable (lua_State *L, int idx) {
   t = index2value(L, idx);
   if (ttistable(t)) {
      Table *h = hvalue(t);
-     l_rwlock_wrlock(&h->lock);
+     luaH_wrlock(L, h);
      const TValue *res = luaH_get(h, s2v(L->top.p - 2));
      if (!isempty(res) && !isabstkey(res)) {
         setobj2t(L, cast(TValue *, res), s2v(L->top.p - 1));
         luaC_barrierback(L, obj2gco(h), s2v(L->top.p - 1));
-        l_rwlock_unlock(&h->lock);
+        luaH_unlock(L, h);
         L->top.p -= 2;
         lua_unlock(L);
         return;
      }
-     l_rwlock_unlock(&h->lock);
+     luaH_unlock(L, h);
   }
   luaV_finishset(L, t, s2v(L->top.p - 2), s2v(L->top.p - 1), NULL);
   L->top.p -= 2;  /* pop index and value */
@@ -1466,17 +1466,17 @@ LUA_API void lua_seti (lua_State *L, int idx, lua_Integer n) {
   t = index2value(L, idx);
   if (ttistable(t)) {
      Table *h = hvalue(t);
-     l_rwlock_wrlock(&h->lock);
+     luaH_wrlock(L, h);
      const TValue *res = luaH_getint(h, n);
      if (!isempty(res) && !isabstkey(res)) {
         setobj2t(L, cast(TValue *, res), s2v(L->top.p - 1));
         luaC_barrierback(L, obj2gco(h), s2v(L->top.p - 1));
-        l_rwlock_unlock(&h->lock);
+        luaH_unlock(L, h);
         L->top.p--;
         lua_unlock(L);
         return;
      }
-     l_rwlock_unlock(&h->lock);
+     luaH_unlock(L, h);
   }
   TValue aux;
   setivalue(&aux, n);
@@ -1491,11 +1491,11 @@ static void aux_rawset (lua_State *L, int idx, TValue *key, int n) {
   lua_lock(L);
   api_checknelems(L, n);
   t = gettable(L, idx);
-  l_rwlock_wrlock(&t->lock);
+  luaH_wrlock(L, t);
   luaH_set(L, t, key, s2v(L->top.p - 1));
   invalidateTMcache(t);
   luaC_barrierback(L, obj2gco(t), s2v(L->top.p - 1));
-  l_rwlock_unlock(&t->lock);
+  luaH_unlock(L, t);
   L->top.p -= n;
   lua_unlock(L);
 }
@@ -1562,10 +1562,10 @@ LUA_API void lua_rawseti (lua_State *L, int idx, lua_Integer n) {
   lua_lock(L);
   api_checknelems(L, 1);
   t = gettable(L, idx);
-  l_rwlock_wrlock(&t->lock);
+  luaH_wrlock(L, t);
   luaH_setint(L, t, n, s2v(L->top.p - 1));
   luaC_barrierback(L, obj2gco(t), s2v(L->top.p - 1));
-  l_rwlock_unlock(&t->lock);
+  luaH_unlock(L, t);
   L->top.p--;
   lua_unlock(L);
 }
@@ -1587,7 +1587,7 @@ LUA_API void lua_table_iextend (lua_State *L, int idx, int n) {
   lua_lock(L);
   api_check(L, n >= 0, "negative n in lua_table_iextend");
   t = gettable(L, idx);
-  l_rwlock_wrlock(&t->lock);
+  luaH_wrlock(L, t);
   if (n > 0) {
     unsigned int old_size = t->alimit;
     unsigned int new_size = old_size + n;
@@ -1598,7 +1598,7 @@ LUA_API void lua_table_iextend (lua_State *L, int idx, int n) {
     }
     luaC_barrierback(L, obj2gco(t), s2v(L->top.p - 1));
   }
-  l_rwlock_unlock(&t->lock);
+  luaH_unlock(L, t);
   lua_unlock(L);
 }
 
@@ -1625,13 +1625,13 @@ LUA_API int lua_setmetatable (lua_State *L, int objindex) {
   switch (ttype(obj)) {
     case LUA_TTABLE: {
       Table *h = hvalue(obj);
-      l_rwlock_wrlock(&h->lock);
+      luaH_wrlock(L, h);
       h->metatable = mt;
       if (mt) {
         luaC_objbarrier(L, gcvalue(obj), mt);
         luaC_checkfinalizer(L, gcvalue(obj), mt);
       }
-      l_rwlock_unlock(&h->lock);
+      luaH_unlock(L, h);
       break;
     }
     case LUA_TUSERDATA: {
@@ -2002,7 +2002,49 @@ LUA_API int lua_gc (lua_State *L, int what, ...) {
       luaC_changemode(L, KGC_INC);
       break;
     }
-  
+    case LUA_GCPARAM: {
+      int param = va_arg(argp, int);
+      int value = va_arg(argp, int);  /* negative: only query */
+      switch (param) {
+        case LUA_GCPMINORMUL: {
+          res = g->genminormul;
+          if (value >= 0) g->genminormul = cast_byte(value);
+          break;
+        }
+        case LUA_GCPMAJORMINOR: {
+          res = getgcparam(g->genmajormul);
+          if (value >= 0) setgcparam(g->genmajormul, value);
+          break;
+        }
+        case LUA_GCPPAUSE: {
+          res = getgcparam(g->gcpause);
+          if (value >= 0) setgcparam(g->gcpause, value);
+          break;
+        }
+        case LUA_GCPSTEPMUL: {
+          res = getgcparam(g->gcstepmul);
+          if (value >= 0) setgcparam(g->gcstepmul, value);
+          break;
+        }
+        case LUA_GCPSTEPSIZE: {
+          res = g->gcstepsize;
+          if (value >= 0) g->gcstepsize = cast_byte(value);
+          break;
+        }
+        case LUA_GCPMARKTHREADS: {
+          res = g->gcmarkthreads;
+          if (value >= 0) luaC_setmarkthreads(L, value);
+          break;
+        }
+        case LUA_GCPBGSWEEP: {
+          res = g->gcbgsweep;
+          if (value >= 0) luaC_setbgsweep(L, value);
+          break;
+        }
+        default: res = -1;  /* not a parameter of this collector */
+      }
+      break;
+    }
     default: res = -1;  /* invalid option */
   }
   va_end(argp);
@@ -0,0 +1,1008 @@
+/*
+** $Id: lasynclib.c $
+** Scheduler for async functions
+** See Copyright Notice in lua.h
+*/
+
+#define lasynclib_c
+#define LUA_LIB
+
+#include "lprefix.h"
+
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__linux__)
+#include <errno.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#define ASYNC_EPOLL	1
+#else
+#define ASYNC_EPOLL	0
+#endif
+
+#if defined(_WIN32)
+#include <windows.h>
+#endif
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+/*
+** Tasks are coroutines (an async function returns one). The scheduler
+** resumes them and looks at what they 'await' (i.e., yield):
+**   - another task: park until it finishes; 'await' gives its results;
+**   - asyncio.sleep(s): park on a timer;
+**   - asyncio.readable(fd) / asyncio.writable(fd): park on the fd;
+**   - ch:recv() / ch:send(v): park on a channel;
+**   - anything else: requeue; 'await' gives the same value back.
+** Nothing here uses OS threads: parked tasks cost only their coroutine.
+*/
+
+
+#define SCHEDMT		"asyncio.scheduler"
+#define OPMT		"asyncio.op"
+#define CHANMT		"asyncio.channel"
+
+
+/* user values of the scheduler */
+#define S_READY		1  /* queue of (task, nargs) pairs */
+#define S_TIMERS	2  /* timer id -> parked task */
+#define S_FDS		3  /* fd -> parked task */
+#define S_TASKS		4  /* live task -> list of tasks joining it */
+#define S_DONE		5  /* finished task -> packed results (weak keys) */
+#define S_N		5
+
+/* user values of a channel */
+#define C_BUF		1  /* buffered values */
+#define C_RECV		2  /* parked receivers */
+#define C_SEND		3  /* parked (sender, value) pairs */
+
+
+/* maximum number of fd events taken by one 'epoll_wait' */
+#define MAXEVENTS	64
+
+
+/**
+ * @brief A FIFO kept in a Lua table: items live at [head, tail).
+ */
+typedef struct Queue {
+  lua_Integer head;
+  lua_Integer tail;
+} Queue;
+
+
+/**
+ * @brief A pending timer (entry of a binary min-heap).
+ */
+typedef struct Timer {
+  double when;  /**< Expiration time (see 'nowtime'). */
+  lua_Integer id;  /**< Key of the parked task in S_TIMERS. */
+} Timer;
+
+
+/**
+ * @brief State of the scheduler (one per library instance).
+ */
+typedef struct Scheduler {
+  Queue ready;  /**< Runnable tasks (two slots per task). */
+  Timer *timers;  /**< Heap ordered by (when, id). */
+  int ntimers;
+  int sizetimers;
+  lua_Integer nextid;  /**< Next timer id (also keeps FIFO order). */
+  int nfds;  /**< Tasks parked on file descriptors. */
+  int epfd;  /**< epoll instance (-1 until first fd wait). */
+  int running;  /**< Inside 'asyncio.run' or 'asyncio.step'. */
+} Scheduler;
+
+
+enum { OP_SLEEP, OP_READ, OP_WRITE, OP_RECV, OP_SEND };
+
+/**
+ * @brief Something a task can await. Channel operations keep the
+ * channel (and the value to send) as user values.
+ */
+typedef struct AsyncOp {
+  int kind;
+  int fd;
+  double secs;
+} AsyncOp;
+
+
+/**
+ * @brief A channel between tasks of the same scheduler.
+ */
+typedef struct AsyncChan {
+  Queue buf;
+  Queue recv;
+  Queue send;
+  lua_Integer cap;  /**< Buffer capacity (0: rendezvous). */
+  int closed;
+} AsyncChan;
+
+
+#define getsched(L)	((Scheduler *)lua_touserdata(L, lua_upvalueindex(1)))
+
+#define pushslot(L,n)	lua_getiuservalue(L, lua_upvalueindex(1), n)
+
+#define qsize(q)	((q)->tail - (q)->head)
+
+
+/*
+** {======================================================
+** Helpers
+** =======================================================
+*/
+
+static double nowtime (void) {
+#if defined(_WIN32)
+  return (double)GetTickCount64() / 1000.0;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+#endif
+}
+
+
+static void sleepfor (double secs) {
+#if defined(_WIN32)
+  Sleep((DWORD)ceil(secs * 1000.0));
+#else
+  struct timespec ts;
+  ts.tv_sec = (time_t)secs;
+  ts.tv_nsec = (long)((secs - (double)ts.tv_sec) * 1e9);
+  nanosleep(&ts, NULL);
+#endif
+}
+
+
+/* pops a value and appends it to the queue in the table at 't' */
+static void qpush (lua_State *L, Queue *q, int t) {
+  lua_rawseti(L, t, q->tail++);
+}
+
+
+/* removes the first item of the queue in the table at 't' and pushes it */
+static void qpop (lua_State *L, Queue *q, int t) {
+  t = lua_absindex(L, t);
+  lua_rawgeti(L, t, q->head);
+  lua_pushnil(L);
+  lua_rawseti(L, t, q->head++);
+}
+
+
+/*
+** Makes the task at 'idx' runnable. Its 'nargs' resume values must
+** already be on its stack.
+*/
+static void wake (lua_State *L, Scheduler *s, int idx, int nargs) {
+  idx = lua_absindex(L, idx);
+  pushslot(L, S_READY);
+  lua_pushvalue(L, idx);
+  qpush(L, &s->ready, -2);
+  lua_pushinteger(L, nargs);
+  qpush(L, &s->ready, -2);
+  lua_pop(L, 1);
+}
+
+
+/* wakes the task at 'idx' with the value at the top (popped) */
+static void wakewith (lua_State *L, Scheduler *s, int idx) {
+  lua_State *co;
+  idx = lua_absindex(L, idx);
+  co = lua_tothread(L, idx);
+  lua_xmove(L, co, 1);
+  wake(L, s, idx, 1);
+}
+
+
+/*
+** Number of values a fresh task 'co' (function plus arguments on its
+** stack) must be resumed with; 0 for a suspended one.
+*/
+static int startargs (lua_State *L, lua_State *co) {
+  if (lua_status(co) == LUA_YIELD)
+    return 0;
+  else if (lua_status(co) == LUA_OK && lua_gettop(co) > 0)
+    return lua_gettop(co) - 1;
+  luaL_error(L, "cannot schedule a %s coroutine",
+                lua_status(co) == LUA_OK ? "dead" : "running");
+  return 0;
+}
+
+
+/* registers the thread at 'idx' as a live task */
+static void addtask (lua_State *L, int idx) {
+  idx = lua_absindex(L, idx);
+  pushslot(L, S_TASKS);
+  lua_pushvalue(L, idx);
+  lua_newtable(L);
+  lua_rawset(L, -3);
+  lua_pop(L, 1);
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Timers
+** =======================================================
+*/
+
+#define timerless(a,b)  \
+	((a)->when < (b)->when || ((a)->when == (b)->when && (a)->id < (b)->id))
+
+
+static void heapup (Timer *h, int i) {
+  Timer t = h[i];
+  while (i > 0) {
+    int parent = (i - 1) / 2;
+    if (!timerless(&t, &h[parent])) break;
+    h[i] = h[parent];
+    i = parent;
+  }
+  h[i] = t;
+}
+
+
+static void heapdown (Timer *h, int n, int i) {
+  Timer t = h[i];
+  for (;;) {
+    int child = 2 * i + 1;
+    if (child >= n) break;
+    if (child + 1 < n && timerless(&h[child + 1], &h[child]))
+      child++;
+    if (!timerless(&h[child], &t)) break;
+    h[i] = h[child];
+    i = child;
+  }
+  h[i] = t;
+}
+
+
+/* parks the task at 'idx' until 'secs' seconds from now */
+static void addtimer (lua_State *L, Scheduler *s, int idx, double secs) {
+  lua_Integer id = s->nextid++;
+  if (s->ntimers == s->sizetimers) {
+    int newsize = s->sizetimers ? s->sizetimers * 2 : 16;
+    Timer *nt = (Timer *)realloc(s->timers, newsize * sizeof(Timer));
+    if (nt == NULL)
+      luaL_error(L, "not enough memory");
+    s->timers = nt;
+    s->sizetimers = newsize;
+  }
+  s->timers[s->ntimers].when = nowtime() + (secs > 0 ? secs : 0);
+  s->timers[s->ntimers].id = id;
+  heapup(s->timers, s->ntimers++);
+  pushslot(L, S_TIMERS);
+  lua_pushvalue(L, idx);
+  lua_rawseti(L, -2, id);
+  lua_pop(L, 1);
+}
+
+
+/* wakes every task whose timer expired at 'now' */
+static void expiretimers (lua_State *L, Scheduler *s, double now) {
+  if (s->ntimers == 0 || s->timers[0].when > now)
+    return;
+  pushslot(L, S_TIMERS);
+  while (s->ntimers > 0 && s->timers[0].when <= now) {
+    lua_Integer id = s->timers[0].id;
+    s->timers[0] = s->timers[--s->ntimers];
+    if (s->ntimers > 0)
+      heapdown(s->timers, s->ntimers, 0);
+    lua_rawgeti(L, -1, id);
+    lua_pushnil(L);
+    lua_rawseti(L, -3, id);
+    wake(L, s, -1, 0);
+    lua_pop(L, 1);
+  }
+  lua_pop(L, 1);
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** File descriptors
+** =======================================================
+*/
+
+static void addfdwait (lua_State *L, Scheduler *s, int idx, int fd,
+                       int write) {
+#if ASYNC_EPOLL
+  struct epoll_event ev;
+  idx = lua_absindex(L, idx);
+  pushslot(L, S_FDS);
+  if (lua_rawgeti(L, -1, fd) != LUA_TNIL)
+    luaL_error(L, "fd %d is already awaited by another task", fd);
+  lua_pop(L, 1);
+  if (s->epfd < 0) {
+    s->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (s->epfd < 0)
+      luaL_error(L, "epoll_create1: %s", strerror(errno));
+  }
+  ev.events = (write ? EPOLLOUT : EPOLLIN) | EPOLLONESHOT;
+  ev.data.fd = fd;
+  /* a fired one-shot fd stays registered (disabled): re-arm it */
+  if (epoll_ctl(s->epfd, EPOLL_CTL_ADD, fd, &ev) != 0 &&
+      (errno != EEXIST || epoll_ctl(s->epfd, EPOLL_CTL_MOD, fd, &ev) != 0))
+    luaL_error(L, "cannot wait on fd %d: %s", fd, strerror(errno));
+  lua_pushvalue(L, idx);
+  lua_rawseti(L, -2, fd);
+  lua_pop(L, 1);
+  s->nfds++;
+#else
+  (void)s; (void)idx; (void)write;
+  luaL_error(L, "waiting on fd %d is not supported on this platform", fd);
+#endif
+}
+
+
+/*
+** Waits up to 'secs' seconds (forever if negative) for a parked fd to
+** become ready, waking its task. Without fds it just sleeps.
+*/
+static void waitevents (lua_State *L, Scheduler *s, double secs) {
+#if ASYNC_EPOLL
+  if (s->nfds > 0) {
+    struct epoll_event evs[MAXEVENTS];
+    int ms = (secs < 0) ? -1 : (int)ceil(secs * 1000.0);
+    int n = epoll_wait(s->epfd, evs, MAXEVENTS, ms);
+    int i;
+    if (n <= 0)
+      return;  /* timeout or signal: caller just loops again */
+    pushslot(L, S_FDS);
+    for (i = 0; i < n; i++) {
+      int fd = evs[i].data.fd;
+      if (lua_rawgeti(L, -1, fd) == LUA_TTHREAD) {
+        lua_pushnil(L);
+        lua_rawseti(L, -3, fd);
+        s->nfds--;
+        lua_pushboolean(L, 1);
+        wakewith(L, s, -2);
+      }
+      lua_pop(L, 1);
+    }
+    lua_pop(L, 1);
+    return;
+  }
+#endif
+  (void)L; (void)s;
+  if (secs > 0)
+    sleepfor(secs);
+}
+
+
+static int getfd (lua_State *L, int arg) {
+  luaL_Stream *p = (luaL_Stream *)luaL_testudata(L, arg, LUA_FILEHANDLE);
+  if (p != NULL) {
+    if (p->closef == NULL || p->f == NULL)
+      luaL_argerror(L, arg, "file is closed");
+#if defined(_WIN32)
+    return _fileno(p->f);
+#else
+    return fileno(p->f);
+#endif
+  }
+  return (int)luaL_checkinteger(L, arg);
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Running tasks
+** =======================================================
+*/
+
+/* pushes the results packed in the table at 't' onto 'co' */
+static int unpackto (lua_State *L, int t, lua_State *co) {
+  int i, n;
+  lua_getfield(L, t, "n");
+  n = (int)lua_tointeger(L, -1);
+  lua_pop(L, 1);
+  if (!lua_checkstack(co, n) || !lua_checkstack(L, n))
+    luaL_error(L, "too many results to await");
+  for (i = 1; i <= n; i++)
+    lua_rawgeti(L, t, i);
+  lua_xmove(L, co, n);
+  return n;
+}
+
+
+/*
+** Task at 'idx' (thread 'co') returned 'nres' values: record them and
+** wake its joiners.
+*/
+static void finishtask (lua_State *L, Scheduler *s, int idx, lua_State *co,
+                        int nres) {
+  int i, n, res;
+  lua_createtable(L, nres, 1);
+  res = lua_gettop(L);
+  lua_checkstack(L, nres);
+  lua_xmove(co, L, nres);
+  for (i = nres; i >= 1; i--)
+    lua_rawseti(L, res, i);
+  lua_pushinteger(L, nres);
+  lua_setfield(L, res, "n");
+  pushslot(L, S_DONE);
+  lua_pushvalue(L, idx);
+  lua_pushvalue(L, res);
+  lua_rawset(L, -3);
+  lua_pop(L, 1);
+  pushslot(L, S_TASKS);
+  lua_pushvalue(L, idx);
+  lua_rawget(L, -2);  /* joiners */
+  n = lua_istable(L, -1) ? (int)lua_rawlen(L, -1) : 0;
+  for (i = 1; i <= n; i++) {
+    lua_rawgeti(L, -1, i);
+    wake(L, s, -1, unpackto(L, res, lua_tothread(L, -1)));
+    lua_pop(L, 1);
+  }
+  lua_pop(L, 1);
+  lua_pushvalue(L, idx);
+  lua_pushnil(L);
+  lua_rawset(L, -3);
+  lua_pop(L, 2);  /* S_TASKS and results */
+}
+
+
+/* task at 'idx' awaits the thread at the top (popped) */
+static void awaittask (lua_State *L, Scheduler *s, int idx) {
+  lua_State *t = lua_tothread(L, -1);
+  if (t == lua_tothread(L, idx))
+    luaL_error(L, "a task cannot await itself");
+  pushslot(L, S_DONE);
+  lua_pushvalue(L, -2);
+  if (lua_rawget(L, -2) == LUA_TTABLE) {  /* already finished? */
+    wake(L, s, idx, unpackto(L, lua_gettop(L), lua_tothread(L, idx)));
+    lua_pop(L, 3);
+    return;
+  }
+  lua_pop(L, 2);
+  pushslot(L, S_TASKS);
+  lua_pushvalue(L, -2);
+  if (lua_rawget(L, -2) != LUA_TTABLE) {  /* not a task yet? */
+    int nargs = startargs(L, t);
+    lua_pop(L, 1);
+    addtask(L, -2);
+    wake(L, s, -2, nargs);
+    lua_pushvalue(L, -2);
+    lua_rawget(L, -2);
+  }
+  lua_pushvalue(L, idx);
+  lua_rawseti(L, -2, lua_rawlen(L, -2) + 1);
+  lua_pop(L, 3);
+}
+
+
+static void chanrecv (lua_State *L, Scheduler *s, int idx, AsyncChan *ch,
+                      int c) {
+  if (qsize(&ch->buf) > 0) {
+    lua_getiuservalue(L, c, C_BUF);
+    qpop(L, &ch->buf, -1);
+    wakewith(L, s, idx);
+    if (qsize(&ch->send) > 0) {  /* refill from a parked sender */
+      lua_getiuservalue(L, c, C_SEND);
+      qpop(L, &ch->send, -1);  /* sender */
+      qpop(L, &ch->send, -2);  /* its value */
+      qpush(L, &ch->buf, -4);
+      lua_pushboolean(L, 1);
+      wakewith(L, s, -2);
+      lua_pop(L, 2);
+    }
+    lua_pop(L, 1);
+  }
+  else if (qsize(&ch->send) > 0) {  /* rendezvous with a sender */
+    lua_getiuservalue(L, c, C_SEND);
+    qpop(L, &ch->send, -1);
+    qpop(L, &ch->send, -2);
+    wakewith(L, s, idx);
+    lua_pushboolean(L, 1);
+    wakewith(L, s, -2);
+    lua_pop(L, 2);
+  }
+  else if (ch->closed) {
+    lua_pushnil(L);
+    wakewith(L, s, idx);
+  }
+  else {
+    lua_getiuservalue(L, c, C_RECV);
+    lua_pushvalue(L, idx);
+    qpush(L, &ch->recv, -2);
+    lua_pop(L, 1);
+  }
+}
+
+
+static void chansend (lua_State *L, Scheduler *s, int idx, AsyncChan *ch,
+                      int c, int v) {
+  if (ch->closed) {
+    lua_pushboolean(L, 0);
+    wakewith(L, s, idx);
+  }
+  else if (qsize(&ch->recv) > 0) {
+    lua_getiuservalue(L, c, C_RECV);
+    qpop(L, &ch->recv, -1);
+    lua_pushvalue(L, v);
+    wakewith(L, s, -2);
+    lua_pop(L, 2);
+    lua_pushboolean(L, 1);
+    wakewith(L, s, idx);
+  }
+  else if (qsize(&ch->buf) < ch->cap) {
+    lua_getiuservalue(L, c, C_BUF);
+    lua_pushvalue(L, v);
+    qpush(L, &ch->buf, -2);
+    lua_pop(L, 1);
+    lua_pushboolean(L, 1);
+    wakewith(L, s, idx);
+  }
+  else {
+    lua_getiuservalue(L, c, C_SEND);
+    lua_pushvalue(L, idx);
+    qpush(L, &ch->send, -2);
+    lua_pushvalue(L, v);
+    qpush(L, &ch->send, -2);
+    lua_pop(L, 1);
+  }
+}
+
+
+/* task at 'idx' awaits the value at the top (popped) */
+static void dispatch (lua_State *L, Scheduler *s, int idx) {
+  AsyncOp *op = (AsyncOp *)luaL_testudata(L, -1, OPMT);
+  if (op != NULL) {
+    int o = lua_gettop(L);
+    switch (op->kind) {
+      case OP_SLEEP:
+        addtimer(L, s, idx, op->secs);
+        break;
+      case OP_READ: case OP_WRITE:
+        addfdwait(L, s, idx, op->fd, op->kind == OP_WRITE);
+        break;
+      default: {
+        AsyncChan *ch;
+        lua_getiuservalue(L, o, 1);
+        ch = (AsyncChan *)lua_touserdata(L, -1);
+        if (op->kind == OP_RECV)
+          chanrecv(L, s, idx, ch, o + 1);
+        else {
+          lua_getiuservalue(L, o, 2);
+          chansend(L, s, idx, ch, o + 1, o + 2);
+          lua_pop(L, 1);
+        }
+        lua_pop(L, 1);
+        break;
+      }
+    }
+    lua_pop(L, 1);
+  }
+  else if (lua_type(L, -1) == LUA_TTHREAD)
+    awaittask(L, s, idx);
+  else  /* plain value: let others run, then give it back */
+    wakewith(L, s, idx);
+}
+
+
+/* resumes the task at the top (popped) with 'nargs' values */
+static void runtask (lua_State *L, Scheduler *s, int nargs) {
+  int idx = lua_gettop(L);
+  lua_State *co = lua_tothread(L, idx);
+  int nres;
+  int status = lua_resume(co, L, nargs, &nres);
+  if (status == LUA_YIELD) {
+    if (nres == 0)
+      wake(L, s, idx, 0);
+    else {
+      lua_pop(co, nres - 1);  /* only the first value is awaited */
+      lua_xmove(co, L, 1);
+      dispatch(L, s, idx);
+    }
+  }
+  else if (status == LUA_OK)
+    finishtask(L, s, idx, co, nres);
+  else {
+    lua_xmove(co, L, 1);
+    pushslot(L, S_TASKS);
+    lua_pushvalue(L, idx);
+    lua_pushnil(L);
+    lua_rawset(L, -3);
+    lua_pop(L, 1);
+    s->running = 0;
+    if (lua_type(L, -1) == LUA_TSTRING)
+      luaL_traceback(L, co, lua_tostring(L, -1), 0);
+    lua_error(L);
+  }
+  lua_settop(L, idx - 1);
+}
+
+
+/* runs the tasks that are ready now (not the ones they wake) */
+static void runready (lua_State *L, Scheduler *s) {
+  lua_Integer n = qsize(&s->ready) / 2;
+  while (n-- > 0) {
+    int nargs;
+    pushslot(L, S_READY);
+    qpop(L, &s->ready, -1);
+    qpop(L, &s->ready, -2);
+    nargs = (int)lua_tointeger(L, -1);
+    lua_pop(L, 1);
+    lua_remove(L, -2);
+    runtask(L, s, nargs);
+  }
+}
+
+
+/*
+** One turn of the loop: runs ready tasks; if none is left, waits up to
+** 'timeout' seconds (forever if negative) for timers and fds.
+*/
+static void loopstep (lua_State *L, Scheduler *s, double timeout) {
+  expiretimers(L, s, nowtime());
+  runready(L, s);
+  if (qsize(&s->ready) == 0 && timeout != 0) {
+    double wait = timeout;
+    if (s->ntimers > 0) {
+      double t = s->timers[0].when - nowtime();
+      if (t < 0) t = 0;
+      if (wait < 0 || t < wait) wait = t;
+    }
+    if (wait != 0)
+      waitevents(L, s, wait);
+    expiretimers(L, s, nowtime());
+  }
+}
+
+
+#define haswork(s)	(qsize(&(s)->ready) > 0 || (s)->ntimers > 0 || (s)->nfds > 0)
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Library functions
+** =======================================================
+*/
+
+/*
+** Pushes a task for the value at 'arg': a coroutine, or a function
+** (called with the remaining arguments in a new coroutine). Returns
+** the number of values to start it with.
+*/
+static int newtask (lua_State *L, int arg) {
+  int n = lua_gettop(L);
+  lua_State *co;
+  if (lua_type(L, arg) == LUA_TTHREAD) {
+    co = lua_tothread(L, arg);
+    lua_pushvalue(L, arg);
+    return startargs(L, co);
+  }
+  luaL_checktype(L, arg, LUA_TFUNCTION);
+  co = lua_newthread(L);
+  lua_insert(L, arg);  /* thread below the function and its arguments */
+  lua_xmove(L, co, n - arg + 1);
+  return n - arg;
+}
+
+
+/**
+ * @brief Schedules a task. asyncio.spawn(co | f, ...) -> co
+ */
+static int async_spawn (lua_State *L) {
+  Scheduler *s = getsched(L);
+  int nargs = newtask(L, 1);
+  pushslot(L, S_TASKS);
+  lua_pushvalue(L, -2);
+  if (lua_rawget(L, -2) != LUA_TNIL)
+    return luaL_error(L, "coroutine is already a task");
+  lua_pop(L, 2);
+  addtask(L, -1);
+  wake(L, s, -1, nargs);
+  return 1;
+}
+
+
+/**
+ * @brief Runs the loop. asyncio.run([co | f, ...]) runs until the given
+ * task finishes and returns its results; without arguments it runs
+ * until no task is runnable, sleeping or waiting on an fd.
+ */
+static int async_run (lua_State *L) {
+  Scheduler *s = getsched(L);
+  int main = 0;
+  if (s->running)
+    return luaL_error(L, "scheduler is already running");
+  if (!lua_isnoneornil(L, 1)) {
+    async_spawn(L);
+    main = lua_gettop(L);
+  }
+  s->running = 1;
+  for (;;) {
+    if (main) {
+      pushslot(L, S_DONE);
+      lua_pushvalue(L, main);
+      if (lua_rawget(L, -2) == LUA_TTABLE) {
+        s->running = 0;
+        return unpackto(L, lua_gettop(L), L);
+      }
+      lua_pop(L, 2);
+    }
+    if (!haswork(s)) {
+      s->running = 0;
+      if (main)
+        return luaL_error(L, "all tasks are blocked (deadlock)");
+      return 0;
+    }
+    loopstep(L, s, -1);
+  }
+}
+
+
+/**
+ * @brief One turn of the loop, for embedding in another event loop.
+ * asyncio.step([timeout]) -> whether tasks are still pending
+ */
+static int async_step (lua_State *L) {
+  Scheduler *s = getsched(L);
+  double timeout = luaL_optnumber(L, 1, 0);
+  if (s->running)
+    return luaL_error(L, "scheduler is already running");
+  s->running = 1;
+  loopstep(L, s, timeout);
+  s->running = 0;
+  lua_pushboolean(L, haswork(s));
+  return 1;
+}
+
+
+/**
+ * @brief Seconds until the loop has something to do: 0 if tasks are
+ * ready, the time to the next timer, or nil.
+ */
+static int async_timeout (lua_State *L) {
+  Scheduler *s = getsched(L);
+  if (qsize(&s->ready) > 0)
+    lua_pushnumber(L, 0);
+  else if (s->ntimers > 0) {
+    double t = s->timers[0].when - nowtime();
+    lua_pushnumber(L, t > 0 ? t : 0);
+  }
+  else
+    luaL_pushfail(L);
+  return 1;
+}
+
+
+/**
+ * @brief The epoll descriptor of the scheduler (readable when a parked
+ * fd is ready), so an outer loop such as luv can poll it; nil if none.
+ */
+static int async_fd (lua_State *L) {
+  Scheduler *s = getsched(L);
+  if (s->epfd >= 0)
+    lua_pushinteger(L, s->epfd);
+  else
+    luaL_pushfail(L);
+  return 1;
+}
+
+
+static AsyncOp *newop (lua_State *L, int kind, int nuv) {
+  AsyncOp *op = (AsyncOp *)lua_newuserdatauv(L, sizeof(AsyncOp), nuv);
+  op->kind = kind;
+  op->fd = -1;
+  op->secs = 0;
+  luaL_setmetatable(L, OPMT);
+  return op;
+}
+
+
+/**
+ * @brief await asyncio.sleep(secs)
+ */
+static int async_sleep (lua_State *L) {
+  newop(L, OP_SLEEP, 0)->secs = luaL_optnumber(L, 1, 0);
+  return 1;
+}
+
+
+/**
+ * @brief await asyncio.readable(fd | file) -> true
+ */
+static int async_readable (lua_State *L) {
+  int fd = getfd(L, 1);
+  newop(L, OP_READ, 0)->fd = fd;
+  return 1;
+}
+
+
+/**
+ * @brief await asyncio.writable(fd | file) -> true
+ */
+static int async_writable (lua_State *L) {
+  int fd = getfd(L, 1);
+  newop(L, OP_WRITE, 0)->fd = fd;
+  return 1;
+}
+
+
+/**
+ * @brief Creates a channel. asyncio.channel([capacity]) -> channel
+ */
+static int async_channel (lua_State *L) {
+  lua_Integer cap = luaL_optinteger(L, 1, 0);
+  AsyncChan *ch;
+  int i;
+  luaL_argcheck(L, cap >= 0, 1, "capacity must be non-negative");
+  ch = (AsyncChan *)lua_newuserdatauv(L, sizeof(AsyncChan), 3);
+  ch->buf.head = ch->buf.tail = 1;
+  ch->recv.head = ch->recv.tail = 1;
+  ch->send.head = ch->send.tail = 1;
+  ch->cap = cap;
+  ch->closed = 0;
+  for (i = 1; i <= 3; i++) {
+    lua_newtable(L);
+    lua_setiuservalue(L, -2, i);
+  }
+  luaL_setmetatable(L, CHANMT);
+  return 1;
+}
+
+
+/**
+ * @brief await ch:send(v) -> true, or false if the channel is closed
+ */
+static int chan_send (lua_State *L) {
+  luaL_checkudata(L, 1, CHANMT);
+  luaL_checkany(L, 2);
+  newop(L, OP_SEND, 2);
+  lua_pushvalue(L, 1);
+  lua_setiuservalue(L, -2, 1);
+  lua_pushvalue(L, 2);
+  lua_setiuservalue(L, -2, 2);
+  return 1;
+}
+
+
+/**
+ * @brief await ch:recv() -> value, or nil once closed and drained
+ */
+static int chan_recv (lua_State *L) {
+  luaL_checkudata(L, 1, CHANMT);
+  newop(L, OP_RECV, 1);
+  lua_pushvalue(L, 1);
+  lua_setiuservalue(L, -2, 1);
+  return 1;
+}
+
+
+/**
+ * @brief Closes a channel, waking every parked task.
+ */
+static int chan_close (lua_State *L) {
+  Scheduler *s = getsched(L);
+  AsyncChan *ch = (AsyncChan *)luaL_checkudata(L, 1, CHANMT);
+  if (ch->closed)
+    return 0;
+  ch->closed = 1;
+  lua_getiuservalue(L, 1, C_RECV);
+  while (qsize(&ch->recv) > 0) {
+    qpop(L, &ch->recv, -1);
+    lua_pushnil(L);
+    wakewith(L, s, -2);
+    lua_pop(L, 1);
+  }
+  lua_getiuservalue(L, 1, C_SEND);
+  while (qsize(&ch->send) > 0) {
+    qpop(L, &ch->send, -1);
+    qpop(L, &ch->send, -2);
+    lua_pop(L, 1);  /* value is dropped */
+    lua_pushboolean(L, 0);
+    wakewith(L, s, -2);
+    lua_pop(L, 1);
+  }
+  return 0;
+}
+
+
+static int chan_len (lua_State *L) {
+  AsyncChan *ch = (AsyncChan *)luaL_checkudata(L, 1, CHANMT);
+  lua_pushinteger(L, qsize(&ch->buf));
+  return 1;
+}
+
+
+static int sched_gc (lua_State *L) {
+  Scheduler *s = (Scheduler *)luaL_checkudata(L, 1, SCHEDMT);
+  free(s->timers);
+  s->timers = NULL;
+  s->ntimers = s->sizetimers = 0;
+#if ASYNC_EPOLL
+  if (s->epfd >= 0)
+    close(s->epfd);
+#endif
+  s->epfd = -1;
+  return 0;
+}
+
+
+static const luaL_Reg async_funcs[] = {
+  {"spawn", async_spawn},
+  {"run", async_run},
+  {"step", async_step},
+  {"timeout", async_timeout},
+  {"fd", async_fd},
+  {"sleep", async_sleep},
+  {"readable", async_readable},
+  {"writable", async_writable},
+  {"channel", async_channel},
+  {NULL, NULL}
+};
+
+
+static const luaL_Reg chan_methods[] = {
+  {"send", chan_send},
+  {"recv", chan_recv},
+  {"close", chan_close},
+  {"__len", chan_len},
+  {NULL, NULL}
+};
+
+
+static void newscheduler (lua_State *L) {
+  Scheduler *s = (Scheduler *)lua_newuserdatauv(L, sizeof(Scheduler), S_N);
+  int i;
+  s->ready.head = s->ready.tail = 1;
+  s->timers = NULL;
+  s->ntimers = s->sizetimers = 0;
+  s->nextid = 1;
+  s->nfds = 0;
+  s->epfd = -1;
+  s->running = 0;
+  luaL_newmetatable(L, SCHEDMT);
+  lua_pushcfunction(L, sched_gc);
+  lua_setfield(L, -2, "__gc");
+  lua_setmetatable(L, -2);
+  for (i = 1; i <= S_N; i++) {
+    lua_newtable(L);
+    if (i == S_DONE) {  /* results die with their task */
+      lua_createtable(L, 0, 1);
+      lua_pushliteral(L, "k");
+      lua_setfield(L, -2, "__mode");
+      lua_setmetatable(L, -2);
+    }
+    lua_setiuservalue(L, -2, i);
+  }
+}
+
+
+LUAMOD_API int luaopen_asyncio (lua_State *L) {
+  newscheduler(L);
+  luaL_newmetatable(L, OPMT);
+  lua_pop(L, 1);
+  luaL_newmetatable(L, CHANMT);
+  lua_pushvalue(L, -1);
+  lua_setfield(L, -2, "__index");
+  lua_pushvalue(L, -2);
+  luaL_setfuncs(L, chan_methods, 1);
+  lua_pop(L, 1);
+  luaL_newlibtable(L, async_funcs);
+  lua_pushvalue(L, -2);
+  luaL_setfuncs(L, async_funcs, 1);
+  return 1;
+}
+
+/* }====================================================== */
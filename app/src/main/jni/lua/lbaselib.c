@@ -470,10 +470,11 @@ static int luaB_collectgarbage (lua_State *L) {
     case LUA_GCPARAM: {
       static const char *const params[] = {
         "minormul", "majorminor", "minormajor",
-        "pause", "stepmul", "stepsize", NULL};
+        "pause", "stepmul", "stepsize", "markthreads", "bgsweep", NULL};
       static const char pnum[] = {
         LUA_GCPMINORMUL, LUA_GCPMAJORMINOR, LUA_GCPMINORMAJOR,
-        LUA_GCPPAUSE, LUA_GCPSTEPMUL, LUA_GCPSTEPSIZE};
+        LUA_GCPPAUSE, LUA_GCPSTEPMUL, LUA_GCPSTEPSIZE, LUA_GCPMARKTHREADS,
+        LUA_GCPBGSWEEP};
       int p = pnum[luaL_checkoption(L, 2, NULL, params)];
       lua_Integer value = luaL_optinteger(L, 3, -1);
       lua_pushinteger(L, lua_gc(L, o, p, (int)value));
@@ -2229,71 +2230,75 @@ static int do_file_test(const char *path, int op_type) {
 }
 
 /*
-** __test__ - 条件测试表达式求值函数
-** 支持文件测试、数值比较、字符串比较、Lua类型测试等
-** 
-** 语法形式：
-**   [ -f "path" ]           -> __test__("-f", "path")
-**   [ a -eq b ]             -> __test__(a, "-eq", b)
-**   [ str1 = str2 ]         -> __test__(str1, "=", str2)
-**   [ -type var "table" ]   -> __test__("-type", var, "table")
-**   [ ! condition ]         -> __test__("!", condition)
-**   [ cond1 -a cond2 ]      -> __test__(cond1, "-a", cond2)
-**
-** 参数：
-**   可变参数，根据测试类型不同
-** 返回值：
-**   布尔值，表示测试结果
+** Body of an async task: suspends once right after creation (so the
+** creator gets a suspended task), then calls the function with the
+** creation arguments, ignoring the values of the first resume.
+*/
+static int async_finish (lua_State *L, int status, lua_KContext ctx) {
+    (void)status; (void)ctx;
+    return lua_gettop(L);
+}
+
+static int async_run (lua_State *L, int status, lua_KContext ctx) {
+    int n = (int)ctx;
+    (void)status;
+    lua_settop(L, n);
+    lua_pushvalue(L, lua_upvalueindex(1));
+    lua_insert(L, 1);
+    lua_callk(L, n, LUA_MULTRET, 0, async_finish);
+    return async_finish(L, LUA_OK, 0);
+}
+
+static int async_body (lua_State *L) {
+    return lua_yieldk(L, 0, (lua_KContext)lua_gettop(L), async_run);
+}
+
+/*
+** An async function: each call returns a suspended task (see
+** lasynclib.c). Also made directly by OP_ASYNCWRAP when '__async_wrap'
+** is the built-in one or not a function.
 */
-static int async_start(lua_State *L) {
+int luaB_async_start (lua_State *L) {
     int n = lua_gettop(L);
     lua_State *co = lua_newthread(L);
     lua_insert(L, 1); /* Move thread to bottom (stack: thread, arg1, arg2...) */
-
-    /* Get wrapper from registry */
-    lua_getfield(L, LUA_REGISTRYINDEX, "_ASYNC_LAZY_WRAPPER");
-    if (lua_isnil(L, -1)) {
-        lua_pop(L, 1);
-        /* Create wrapper if not exists (lazy init) */
-        if (luaL_dostring(L, "return function(f, ...) coroutine.yield(); return f(...) end") != LUA_OK) {
-            return lua_error(L);
-        }
-        lua_pushvalue(L, -1);
-        lua_setfield(L, LUA_REGISTRYINDEX, "_ASYNC_LAZY_WRAPPER");
-    }
-    lua_xmove(L, co, 1);
-
-    /* Push function */
     lua_pushvalue(L, lua_upvalueindex(1));
+    lua_pushcclosure(L, async_body, 1);
     lua_xmove(L, co, 1);
-
-    /* Move arguments */
     lua_xmove(L, co, n);
-
+    /* Run up to the first suspension, so any resume starts the body */
     int nres;
-    int status = lua_resume(co, L, n + 1, &nres);
-
-    if (status != LUA_YIELD) {
-        if (status != LUA_OK) {
-            lua_xmove(co, L, 1);
-            return lua_error(L);
-        }
+    if (lua_resume(co, L, n, &nres) != LUA_YIELD) {
+        lua_xmove(co, L, 1);
+        return lua_error(L);
     }
-
-    if (nres > 0) {
-        lua_pop(co, nres);
-    }
-
     return 1;
 }
 
-static int luaB_async_wrap(lua_State *L) {
+int luaB_async_wrap (lua_State *L) {
     luaL_checktype(L, 1, LUA_TFUNCTION);
     lua_pushvalue(L, 1);
-    lua_pushcclosure(L, async_start, 1);
+    lua_pushcclosure(L, luaB_async_start, 1);
     return 1;
 }
 
+/*
+** __test__ - 条件测试表达式求值函数
+** 支持文件测试、数值比较、字符串比较、Lua类型测试等
+** 
+** 语法形式：
+**   [ -f "path" ]           -> __test__("-f", "path")
+**   [ a -eq b ]             -> __test__(a, "-eq", b)
+**   [ str1 = str2 ]         -> __test__(str1, "=", str2)
+**   [ -type var "table" ]   -> __test__("-type", var, "table")
+**   [ ! condition ]         -> __test__("!", condition)
+**   [ cond1 -a cond2 ]      -> __test__(cond1, "-a", cond2)
+**
+** 参数：
+**   可变参数，根据测试类型不同
+** 返回值：
+**   布尔值，表示测试结果
+*/
 static int luaB_test (lua_State *L) {
   int nargs = lua_gettop(L);
   
@@ -16,14 +16,18 @@
 #define LUAC_DATA       "\x19\x93\r\n\x1a\n"
 
 /*
-** 指令格式定义（64位指令）
+** 指令格式定义（64位宽指令，或 LUAI_COMPACTINST 构建的32位紧凑指令）
+** 实际宽度由文件头部的指令大小决定，参见 setInstLayout
 */
-#define SIZE_OP     9
-#define SIZE_A      16
-#define SIZE_B      16
-#define SIZE_C      16
-#define SIZE_Bx     33
-#define SIZE_sJ     49
+static int SIZE_OP = 9;
+static int SIZE_A = 16;
+static int SIZE_B = 16;
+static int SIZE_C = 16;
+static int inst_bytes = 8;
+
+#define SIZE_Bx     (SIZE_C + SIZE_B + 1)
+#define SIZE_Ax     (SIZE_Bx + SIZE_A)
+#define SIZE_sJ     SIZE_Ax
 
 #define POS_OP      0
 #define POS_A       (POS_OP + SIZE_OP)
@@ -47,6 +51,23 @@
 #define OFFSET_sC   (((1<<SIZE_C)-1) >> 1)
 #define sC2int(i)   ((i) - OFFSET_sC)
 
+/*
+** 根据头部的指令大小选择指令格式
+** @param size 指令字节数（8 = 宽指令, 4 = 紧凑指令）
+** @return 支持返回1，否则返回0
+*/
+static int setInstLayout(int size) {
+    if (size == 8) {
+        SIZE_OP = 9; SIZE_A = 16; SIZE_B = 16; SIZE_C = 16;
+    } else if (size == 4) {
+        SIZE_OP = 7; SIZE_A = 8; SIZE_B = 8; SIZE_C = 8;
+    } else {
+        return 0;
+    }
+    inst_bytes = size;
+    return 1;
+}
+
 /*
 ** 操作码名称表（需要与lopcodes.h保持同步）
 */
@@ -352,7 +373,7 @@ static void printInstruction(int pc, uint64_t inst) {
             break;
         }
         case iFMT_Ax: {
-            int ax = (int)((inst >> POS_A) & MASK1(49, 0));
+            int ax = (int)((inst >> POS_A) & MASK1(SIZE_Ax, 0));
             printf("%-12s\t%d", name, ax);
             break;
         }
@@ -529,19 +550,23 @@ static void dumpFunction(LoadState *S, const char *func_name, int depth) {
     int code_size = loadInt(S);
     printf("%s指令数量: %d\n", indent, code_size);
     
-    if (code_size > 0 && S->pos + code_size * 8 <= (int)S->size) {
+    if (code_size > 0 && S->pos + code_size * inst_bytes <= (int)S->size) {
         printf("\n%sPC\tOpcode\t\tArguments\n", indent);
         printf("%s--\t------\t\t---------\n", indent);
         
         for (int i = 0; i < code_size; i++) {
+            unsigned char buf[8];
             uint64_t inst = 0;
-            loadBlock(S, &inst, sizeof(inst));
+            loadBlock(S, buf, inst_bytes);
+            for (int j = 0; j < inst_bytes; j++) {
+                inst |= (uint64_t)buf[j] << (j * 8);
+            }
             printf("%s", indent);
             printInstruction(i, inst);
         }
     } else {
         printf("%s错误: 指令数据不完整\n", indent);
-        S->pos += code_size * 8;
+        S->pos += code_size * inst_bytes;
     }
     
     /* 跳过其他段 */
@@ -615,6 +640,11 @@ static void dumpBytecodeFile(const char *filename) {
     int int_size = loadByte(&S);
     int num_size = loadByte(&S);
     printf("指令大小: %d 字节\n", inst_size);
+    if (!setInstLayout(inst_size)) {
+        fprintf(stderr, "错误: 不支持的指令大小 %d\n", inst_size);
+        free(data);
+        return;
+    }
     printf("整数大小: %d 字节\n", int_size);
     printf("浮点数大小: %d 字节\n", num_size);
     
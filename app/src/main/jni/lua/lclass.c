@@ -249,6 +249,7 @@ static int class_newindex(lua_State *L) {
   
   /* 如果值是函数，设置到方法表（使用rawget/rawset避免递归） */
   if (lua_isfunction(L, 3)) {
+    luaC_classchanged(L);  /* 方法缓存失效 */
     lua_pushstring(L, CLASS_KEY_METHODS);
     lua_rawget(L, 1);
     if (!lua_istable(L, -1)) {
@@ -311,86 +312,89 @@ static int class_tostring(lua_State *L) {
 
 
 /*
-** 获取调用栈中调用者所属的类
+** 根据 self 对象判断调用者对目标类的访问级别
 ** 参数：
 **   L - Lua状态机
-**   obj_class_idx - 被访问对象的类在栈中的索引
+**   obj_class_idx - 被访问对象的类在栈中的索引（绝对索引）
+** 说明：
+**   self 位于栈顶，函数返回前将其弹出
 ** 返回值：
-**   ACCESS_PUBLIC - 外部调用，只能访问公开成员
-**   ACCESS_PROTECTED - 子类调用，可访问公开和受保护成员
-**   ACCESS_PRIVATE - 同类调用，可访问所有成员
+**   ACCESS_PRIVATE/ACCESS_PROTECTED，或 -1 表示 self 与目标类无关
+*/
+static int self_access_level(lua_State *L, int obj_class_idx) {
+  if (!lua_istable(L, -1)) {
+    lua_pop(L, 1);
+    return -1;
+  }
+  /* 获取 self 对象的类 */
+  lua_pushstring(L, OBJ_KEY_CLASS);
+  lua_rawget(L, -2);
+  
+  if (lua_istable(L, -1)) {
+    int caller_class_idx = lua_gettop(L);
+    
+    /* 检查是否是同一个类 */
+    if (lua_rawequal(L, caller_class_idx, obj_class_idx)) {
+      lua_pop(L, 2);  /* 移除 caller_class 和 self */
+      return ACCESS_PRIVATE;  /* 同类，可访问私有成员 */
+    }
+    
+    /* 检查调用者类是否是目标类的子类 */
+    lua_pushstring(L, CLASS_KEY_PARENT);
+    lua_rawget(L, caller_class_idx);
+    while (lua_istable(L, -1)) {
+      if (lua_rawequal(L, -1, obj_class_idx)) {
+        lua_pop(L, 3);  /* 移除 parent, caller_class, self */
+        return ACCESS_PROTECTED;  /* 子类，可访问受保护成员 */
+      }
+      lua_pushstring(L, CLASS_KEY_PARENT);
+      lua_rawget(L, -2);
+      lua_remove(L, -2);
+    }
+    lua_pop(L, 1);  /* 移除 nil（非表值） */
+    
+    /* 检查目标类是否是调用者类的子类（即调用者是父类方法） */
+    lua_pushstring(L, CLASS_KEY_PARENT);
+    lua_rawget(L, obj_class_idx);
+    while (lua_istable(L, -1)) {
+      if (lua_rawequal(L, -1, caller_class_idx)) {
+        lua_pop(L, 3);  /* 移除 parent, caller_class, self */
+        return ACCESS_PROTECTED;  /* 父类方法访问子类对象，允许受保护访问 */
+      }
+      lua_pushstring(L, CLASS_KEY_PARENT);
+      lua_rawget(L, -2);
+      lua_remove(L, -2);
+    }
+    lua_pop(L, 1);  /* 移除 nil */
+  }
+  lua_pop(L, 2);  /* 移除 caller_class（或非表值）和 self */
+  return -1;
+}
+
+
+/*
+** 遍历调用栈确定调用者的访问级别（慢速路径）
 ** 说明：
-**   通过遍历调用栈，查找是否存在当前对象或其子类的方法调用
-**   使用 self 参数来判断调用者上下文
+**   查找第一个名为 self 的局部变量与目标类相关的栈帧；
+**   仅在嵌套函数的上值名已被剥离、无法直接找到 self 时使用
 */
-static int get_caller_access_level(lua_State *L, int obj_class_idx) {
+static int walk_caller_access_level(lua_State *L, int obj_class_idx) {
   lua_Debug ar;
   int level = 1;  /* 从调用者开始（跳过当前函数） */
   
-  obj_class_idx = absindex(L, obj_class_idx);
-  
   /* 遍历调用栈 */
   while (lua_getstack(L, level, &ar)) {
-    /* 获取栈帧的函数信息 */
-    if (lua_getinfo(L, "nSlu", &ar) == 0) {
-      level++;
-      continue;
-    }
-    
     /* 检查第一个局部变量（通常是 self） */
     const char *name = lua_getlocal(L, &ar, 1);
     if (name != NULL) {
-      /* 检查是否是 self 参数 */
-      if (strcmp(name, "self") == 0 && lua_istable(L, -1)) {
-        /* 获取 self 对象的类 */
-        lua_pushstring(L, OBJ_KEY_CLASS);
-        lua_rawget(L, -2);
-        
-        if (lua_istable(L, -1)) {
-          int caller_class_idx = lua_gettop(L);
-          
-          /* 检查是否是同一个类 */
-          if (lua_rawequal(L, caller_class_idx, obj_class_idx)) {
-            lua_pop(L, 2);  /* 移除 caller_class 和 self */
-            return ACCESS_PRIVATE;  /* 同类，可访问私有成员 */
-          }
-          
-          /* 检查调用者类是否是目标类的子类 */
-          lua_pushstring(L, CLASS_KEY_PARENT);
-          lua_rawget(L, caller_class_idx);
-          while (lua_istable(L, -1)) {
-            if (lua_rawequal(L, -1, obj_class_idx)) {
-              lua_pop(L, 3);  /* 移除 parent, caller_class, self */
-              return ACCESS_PROTECTED;  /* 子类，可访问受保护成员 */
-            }
-            lua_pushstring(L, CLASS_KEY_PARENT);
-            lua_rawget(L, -2);
-            lua_remove(L, -2);
-          }
-          lua_pop(L, 1);  /* 移除 nil（非表值） */
-          
-          /* 检查目标类是否是调用者类的子类（即调用者是父类方法） */
-          lua_pushstring(L, CLASS_KEY_PARENT);
-          lua_rawget(L, obj_class_idx);
-          while (lua_istable(L, -1)) {
-            if (lua_rawequal(L, -1, caller_class_idx)) {
-              lua_pop(L, 3);  /* 移除 parent, caller_class, self */
-              return ACCESS_PROTECTED;  /* 父类方法访问子类对象，允许受保护访问 */
-            }
-            lua_pushstring(L, CLASS_KEY_PARENT);
-            lua_rawget(L, -2);
-            lua_remove(L, -2);
-          }
-          lua_pop(L, 1);  /* 移除 nil */
-          
-          lua_pop(L, 1);  /* 移除 caller_class */
-        } else {
-          lua_pop(L, 1);  /* 移除非表值 */
-        }
+      if (strcmp(name, "self") == 0) {
+        int access = self_access_level(L, obj_class_idx);
+        if (access >= 0)
+          return access;
       }
-      lua_pop(L, 1);  /* 移除局部变量值 */
+      else
+        lua_pop(L, 1);  /* 移除局部变量值 */
     }
-    
     level++;
   }
   
@@ -399,6 +403,58 @@ static int get_caller_access_level(lua_State *L, int obj_class_idx) {
 }
 
 
+/*
+** 获取调用者对被访问对象的类的访问级别
+** 参数：
+**   L - Lua状态机
+**   obj_class_idx - 被访问对象的类在栈中的索引
+** 返回值：
+**   ACCESS_PUBLIC - 外部调用，只能访问公开成员
+**   ACCESS_PROTECTED - 子类调用，可访问公开和受保护成员
+**   ACCESS_PRIVATE - 同类调用，可访问所有成员
+** 说明：
+**   只检查触发本次访问的那一层函数，与调用栈深度无关。解析器在编译时
+**   标记函数：PF_METHOD 表示第一个参数是 self（self 就在第一个寄存器），
+**   PF_CLASSCODE 表示函数嵌套在方法中（self 是名为 "self" 的上值）。
+**   其他函数一律视为外部调用。
+*/
+static int get_caller_access_level(lua_State *L, int obj_class_idx) {
+  CallInfo *ci = L->ci->previous;  /* 触发元方法的函数 */
+  LClosure *cl;
+  Proto *p;
+  int access;
+  
+  obj_class_idx = absindex(L, obj_class_idx);
+  if (ci == NULL || !isLua(ci))
+    return ACCESS_PUBLIC;
+  cl = ci_func(ci);
+  p = cl->p;
+  if (p->flag & PF_METHOD) {
+    setobj2s(L, L->top.p, s2v(ci->func.p + 1));  /* self */
+    api_incr_top(L);
+  }
+  else if (p->flag & PF_CLASSCODE) {
+    TString *selfname = luaS_newliteral(L, "self");
+    int i;
+    for (i = 0; i < p->sizeupvalues; i++) {
+      TString *name = p->upvalues[i].name;
+      if (name == NULL)  /* 调试信息已剥离？ */
+        return walk_caller_access_level(L, obj_class_idx);
+      if (eqshrstr(name, selfname))
+        break;
+    }
+    if (i == p->sizeupvalues)  /* 没有捕获 self？ */
+      return ACCESS_PUBLIC;
+    setobj2s(L, L->top.p, cl->upvals[i]->v.p);
+    api_incr_top(L);
+  }
+  else
+    return ACCESS_PUBLIC;
+  access = self_access_level(L, obj_class_idx);
+  return (access >= 0) ? access : ACCESS_PUBLIC;
+}
+
+
 /*
 ** 检查成员存在于哪个访问级别表中
 ** 参数：
@@ -1056,6 +1112,7 @@ void luaC_inherit(lua_State *L, int child_idx, int parent_idx) {
   lua_pushstring(L, CLASS_KEY_PARENT);
   lua_pushvalue(L, parent_idx);
   lua_rawset(L, child_idx);
+  luaC_classchanged(L);  /* 方法缓存失效 */
   
   /* 获取子类的方法表用于检查final方法重写 */
   lua_pushstring(L, CLASS_KEY_METHODS);
@@ -1277,57 +1334,66 @@ void luaC_inherit(lua_State *L, int child_idx, int parent_idx) {
 
 
 /*
-** 创建类的实例对象
-** 支持自动调用父类构造函数链
+** 实例化计划
+** 每个类在 CLASS_KEY_PLAN 中缓存一张表，保存只需做一次的准备工作：
+** 抽象方法与接口的验证、所有实例共享的元表、需要依次调用的构造函数，
+** 以及实例的形状。计划在全局类版本变化后重新构建（见
+** luaC_classchanged），之后每次实例化只需分配对象表并调用构造函数。
+**
+** 形状（shape）是一张表，键为实例已知的全部字段，布局与实例相同。
+** 新实例用 luaH_setshape 复制这一布局：每个字段预先占好自己的节点，
+** 同一个类的所有实例中同名字段位于同一槽位，GETFIELD/SETFIELD 的内联
+** 缓存因此可以跨实例命中。构造后如果实例出现了形状中没有的字段，
+** 就以该实例为准生成新的形状（形状迁移），字段数只增不减。
 */
-void luaC_newobject(lua_State *L, int class_idx, int nargs) {
-  class_idx = absindex(L, class_idx);
-  
-  /* 检查是否是有效的类 */
-  if (!luaC_isclass(L, class_idx)) {
-    luaL_error(L, "尝试实例化非类值");
-    return;
-  }
-  
-  /* 检查是否是抽象类（使用rawget避免触发类的__index） */
-  lua_pushstring(L, CLASS_KEY_FLAGS);
-  lua_rawget(L, class_idx);
-  if (lua_isinteger(L, -1)) {
-    int flags = (int)lua_tointeger(L, -1);
-    if (flags & CLASS_FLAG_ABSTRACT) {
-      luaL_error(L, "不能实例化抽象类");
-      return;
-    }
-  }
-  lua_pop(L, 1);
-  
-  /* 验证所有抽象方法都已实现（包括参数数量验证） */
-  luaC_verify_abstracts(L, class_idx);
-  
-  /* 验证所有接口方法都已正确实现（包括参数数量验证） */
-  luaC_verify_interfaces(L, class_idx);
-  
-  /* 创建对象表 */
-  lua_newtable(L);
-  int obj_idx = lua_gettop(L);
-  
-  /* 保存对类的引用（使用rawset因为对象还没有元表） */
-  lua_pushstring(L, OBJ_KEY_CLASS);
-  lua_pushvalue(L, class_idx);
-  lua_rawset(L, obj_idx);
-  
-  /* 标记为对象 */
-  lua_pushstring(L, OBJ_KEY_ISOBJ);
-  lua_pushboolean(L, 1);
-  lua_rawset(L, obj_idx);
-  
-  /* 创建对象私有数据表 */
-  lua_pushstring(L, OBJ_KEY_PRIVATES);
-  lua_newtable(L);
-  lua_rawset(L, obj_idx);
-  
-  /* 创建并设置对象的元表 */
-  lua_newtable(L);
+#define PLAN_VERSION	1  /* 构建计划时的类版本 */
+#define PLAN_MT		2  /* 实例共享的元表 */
+#define PLAN_INITS	3  /* 构造函数序列（从最顶层父类开始） */
+#define PLAN_ARGINIT	4  /* 最后一个构造函数是否是类自己的（接收构造参数） */
+#define PLAN_SHAPE	5  /* 实例的形状 */
+#define PLAN_NKEYS	6  /* 形状中的字段数 */
+#define PLAN_N		6
+
+
+/*
+** 统计表哈希部分中非空的字段数
+*/
+static int countfields (const Table *t) {
+  int n = 0;
+  unsigned int i;
+  for (i = 0; i < cast_uint(allocsizenode(t)); i++) {
+    if (!isempty(gval(gnode(t, i))))
+      n++;
+  }
+  return n;
+}
+
+
+/*
+** 以实例 'o' 为准生成新的形状并存入计划
+** 形状与实例布局相同，值统一为 true（空值的键会被垃圾回收器清除）
+*/
+static void newshape (lua_State *L, int plan_idx, Table *o, int nkeys) {
+  Table *shape = luaH_new(L);
+  unsigned int i;
+  sethvalue2s(L, L->top.p, shape);
+  api_incr_top(L);
+  luaH_setshape(L, shape, o);
+  for (i = 0; i < cast_uint(allocsizenode(o)); i++) {
+    if (!isempty(gval(gnode(o, i))))
+      setbtvalue(gval(gnode(shape, i)));
+  }
+  lua_rawseti(L, plan_idx, PLAN_SHAPE);
+  lua_pushinteger(L, nkeys);
+  lua_rawseti(L, plan_idx, PLAN_NKEYS);
+}
+
+
+/*
+** 创建实例共享的元表并压栈
+*/
+static void newinstancemt (lua_State *L, int class_idx) {
+  lua_createtable(L, 0, 4);
   int mt_idx = lua_gettop(L);
   
   /* 设置__index元方法 */
@@ -1355,16 +1421,22 @@ void luaC_newobject(lua_State *L, int class_idx, int nargs) {
     }
   }
   lua_pop(L, 1);
-  
-  /* 应用元表 */
-  lua_setmetatable(L, obj_idx);
-  
-  /* 收集继承链中的所有类（从最顶层父类到当前类） */
-  lua_newtable(L);  /* 构造函数调用链 */
-  int chain_idx = lua_gettop(L);
+}
+
+
+/*
+** 收集需要调用的构造函数并压栈（一个序列，从最顶层父类到当前类）
+** 从父类继承而来（与父类相同）的构造函数不会重复调用。
+** 返回最后一个构造函数是否属于类本身（只有它接收构造参数）。
+*/
+static int newinitchain (lua_State *L, int class_idx) {
   int chain_len = 0;
+  int ninits = 0;
+  int own = 0;
   
-  /* 遍历继承链，将所有类压入链表（逆序，最后转为正序） */
+  /* 收集继承链中的所有类（从当前类到最顶层父类） */
+  lua_newtable(L);
+  int chain_idx = lua_gettop(L);
   lua_pushvalue(L, class_idx);
   while (lua_istable(L, -1)) {
     chain_len++;
@@ -1377,7 +1449,10 @@ void luaC_newobject(lua_State *L, int class_idx, int nargs) {
   }
   lua_pop(L, 1);  /* 移除非表值 */
   
-  /* 从最顶层父类开始调用构造函数（chain_len到1） */
+  lua_newtable(L);  /* 构造函数序列 */
+  int inits_idx = lua_gettop(L);
+  
+  /* 从最顶层父类开始（chain_len到1） */
   for (int i = chain_len; i >= 1; i--) {
     lua_rawgeti(L, chain_idx, i);
     int current_class = lua_gettop(L);
@@ -1409,17 +1484,8 @@ void luaC_newobject(lua_State *L, int class_idx, int nargs) {
         }
         
         if (is_own_init) {
-          /* 调用构造函数 */
-          lua_pushvalue(L, obj_idx);  /* self */
-          
-          /* 只有当前类（i==1）才传递构造参数 */
-          int args_count = (i == 1) ? nargs : 0;
-          int first_arg = class_idx + 1;
-          for (int j = 0; j < args_count; j++) {
-            lua_pushvalue(L, first_arg + j);
-          }
-          
-          lua_call(L, args_count + 1, 0);
+          lua_rawseti(L, inits_idx, ++ninits);
+          own = (i == 1);
         } else {
           lua_pop(L, 1);  /* 移除继承的构造函数 */
         }
@@ -1431,11 +1497,146 @@ void luaC_newobject(lua_State *L, int class_idx, int nargs) {
     lua_pop(L, 1);  /* 移除当前类 */
   }
   
-  lua_pop(L, 1);  /* 移除chain表 */
+  lua_remove(L, chain_idx);  /* 移除chain表 */
+  return own;
+}
+
+
+/*
+** 将类的实例化计划压栈，必要时（重新）构建
+*/
+static void pushplan (lua_State *L, int class_idx) {
+  lua_pushstring(L, CLASS_KEY_PLAN);
+  lua_rawget(L, class_idx);
+  if (lua_istable(L, -1)) {
+    lua_rawgeti(L, -1, PLAN_VERSION);
+    if (lua_tointeger(L, -1) == cast(lua_Integer, G(L)->classversion)) {
+      lua_pop(L, 1);
+      return;  /* 计划仍然有效 */
+    }
+    lua_pop(L, 1);
+  }
+  lua_pop(L, 1);
+  
+  /* 检查是否是抽象类（使用rawget避免触发类的__index） */
+  lua_pushstring(L, CLASS_KEY_FLAGS);
+  lua_rawget(L, class_idx);
+  if (lua_isinteger(L, -1)) {
+    int flags = (int)lua_tointeger(L, -1);
+    if (flags & CLASS_FLAG_ABSTRACT) {
+      luaL_error(L, "不能实例化抽象类");
+      return;
+    }
+  }
+  lua_pop(L, 1);
+  
+  /* 验证所有抽象方法都已实现（包括参数数量验证） */
+  luaC_verify_abstracts(L, class_idx);
+  
+  /* 验证所有接口方法都已正确实现（包括参数数量验证） */
+  luaC_verify_interfaces(L, class_idx);
+  
+  lua_createtable(L, PLAN_N, 0);
+  int plan_idx = lua_gettop(L);
+  lua_pushinteger(L, cast(lua_Integer, G(L)->classversion));
+  lua_rawseti(L, plan_idx, PLAN_VERSION);
+  newinstancemt(L, class_idx);
+  lua_rawseti(L, plan_idx, PLAN_MT);
+  int own = newinitchain(L, class_idx);
+  lua_rawseti(L, plan_idx, PLAN_INITS);
+  lua_pushboolean(L, own);
+  lua_rawseti(L, plan_idx, PLAN_ARGINIT);
+  
+  /* 初始形状只有 __class 与 __isobject */
+  lua_createtable(L, 0, 2);
+  lua_pushstring(L, OBJ_KEY_CLASS);
+  lua_pushboolean(L, 1);
+  lua_rawset(L, -3);
+  lua_pushstring(L, OBJ_KEY_ISOBJ);
+  lua_pushboolean(L, 1);
+  lua_rawset(L, -3);
+  lua_rawseti(L, plan_idx, PLAN_SHAPE);
+  lua_pushinteger(L, 2);
+  lua_rawseti(L, plan_idx, PLAN_NKEYS);
+  
+  lua_pushstring(L, CLASS_KEY_PLAN);
+  lua_pushvalue(L, plan_idx);
+  lua_rawset(L, class_idx);
+}
+
+
+/*
+** 创建类的实例对象
+** 支持自动调用父类构造函数链
+*/
+void luaC_newobject(lua_State *L, int class_idx, int nargs) {
+  class_idx = absindex(L, class_idx);
+  
+  /* 检查是否是有效的类 */
+  if (!luaC_isclass(L, class_idx)) {
+    luaL_error(L, "尝试实例化非类值");
+    return;
+  }
+  
+  pushplan(L, class_idx);
+  int plan_idx = lua_gettop(L);
+  
+  /* 按形状创建对象表 */
+  lua_rawgeti(L, plan_idx, PLAN_SHAPE);
+  Table *o = luaH_new(L);
+  sethvalue2s(L, L->top.p, o);
+  api_incr_top(L);
+  luaH_setshape(L, o, hvalue(s2v(L->top.p - 2)));
+  lua_remove(L, -2);  /* 移除形状 */
+  int obj_idx = lua_gettop(L);
+  luaC_checkGC(L);
+  
+  /* 保存对类的引用（使用rawset因为对象还没有元表） */
+  lua_pushstring(L, OBJ_KEY_CLASS);
+  lua_pushvalue(L, class_idx);
+  lua_rawset(L, obj_idx);
+  
+  /* 标记为对象 */
+  lua_pushstring(L, OBJ_KEY_ISOBJ);
+  lua_pushboolean(L, 1);
+  lua_rawset(L, obj_idx);
+  
+  /* 应用共享的元表 */
+  lua_rawgeti(L, plan_idx, PLAN_MT);
+  lua_setmetatable(L, obj_idx);
+  
+  /* 从最顶层父类开始调用构造函数 */
+  lua_rawgeti(L, plan_idx, PLAN_ARGINIT);
+  int own = lua_toboolean(L, -1);
+  lua_pop(L, 1);
+  lua_rawgeti(L, plan_idx, PLAN_INITS);
+  int inits_idx = lua_gettop(L);
+  int ninits = (int)lua_rawlen(L, inits_idx);
+  for (int i = 1; i <= ninits; i++) {
+    lua_rawgeti(L, inits_idx, i);
+    lua_pushvalue(L, obj_idx);  /* self */
+    
+    /* 只有当前类自己的构造函数才传递构造参数 */
+    int args_count = (i == ninits && own) ? nargs : 0;
+    int first_arg = class_idx + 1;
+    for (int j = 0; j < args_count; j++) {
+      lua_pushvalue(L, first_arg + j);
+    }
+    
+    lua_call(L, args_count + 1, 0);
+  }
+  lua_pop(L, 1);  /* 移除构造函数序列 */
+  
+  /* 实例出现了新字段？迁移到新的形状 */
+  int nkeys = countfields(o);
+  lua_rawgeti(L, plan_idx, PLAN_NKEYS);
+  int shapekeys = (int)lua_tointeger(L, -1);
+  lua_pop(L, 1);
+  if (nkeys > shapekeys)
+    newshape(L, plan_idx, o, nkeys);
   
   /* 确保对象在栈顶 */
-  lua_pushvalue(L, obj_idx);
-  lua_remove(L, obj_idx);
+  lua_remove(L, plan_idx);
 }
 
 
@@ -1504,6 +1705,7 @@ void luaC_setmethod(lua_State *L, int class_idx, TString *name, int func_idx) {
   lua_pushvalue(L, func_idx);
   lua_rawset(L, -3);
   lua_pop(L, 1);
+  luaC_classchanged(L);  /* 方法缓存失效 */
 }
 
 
@@ -1530,17 +1732,95 @@ void luaC_setstatic(lua_State *L, int class_idx, TString *name, int value_idx) {
   lua_pushvalue(L, value_idx);
   lua_rawset(L, -3);
   lua_pop(L, 1);
+  luaC_classchanged(L);  /* 方法缓存失效 */
+}
+
+
+/*
+** 扁平化方法缓存
+** 每个类在 CLASS_KEY_MCACHE 中惰性保存一张表，合并了整条继承链上的
+** 公开方法（近的类覆盖远的类），并在 CLASS_KEY_MCACHEVER 中记录构建
+** 时的全局类版本。任何类的方法或父类改变都会递增版本（见
+** luaC_classchanged），使所有缓存过期。
+** 注意：绕过类API直接修改 __methods 表不会使缓存失效。
+*/
+
+/*
+** 返回类的有效方法缓存；不存在或已过期时返回NULL
+*/
+static Table *getmcache (lua_State *L, Table *cls) {
+  TString *kver = luaS_new(L, CLASS_KEY_MCACHEVER);
+  TString *kcache = luaS_new(L, CLASS_KEY_MCACHE);
+  Table *mc = NULL;
+  const TValue *v;
+  luaH_rdlock(L, cls);
+  v = luaH_getshortstr(cls, kver);
+  if (ttisinteger(v) &&
+      ivalue(v) == cast(lua_Integer, G(L)->classversion)) {
+    v = luaH_getshortstr(cls, kcache);
+    if (ttistable(v))
+      mc = hvalue(v);
+  }
+  luaH_unlock(L, cls);
+  return mc;
+}
+
+
+/*
+** 将类的方法缓存压栈，必要时重新构建
+*/
+static void pushmcache (lua_State *L, int class_idx) {
+  Table *mc;
+  int n = 0;
+  int first, i;
+  class_idx = absindex(L, class_idx);
+  mc = getmcache(L, hvalue(index2value_helper(L, class_idx)));
+  if (mc != NULL) {
+    sethvalue2s(L, L->top.p, mc);
+    api_incr_top(L);
+    return;
+  }
+  /* 把继承链上的类依次压栈（从自身到最远的祖先） */
+  first = lua_gettop(L) + 1;
+  lua_pushvalue(L, class_idx);
+  while (lua_istable(L, -1)) {
+    luaL_checkstack(L, 2, "继承链过深");
+    lua_pushstring(L, CLASS_KEY_PARENT);
+    lua_rawget(L, -2);
+    n++;
+  }
+  lua_pop(L, 1);  /* 移除非表值 */
+  /* 从最远的祖先开始合并，近的类覆盖远的类 */
+  lua_newtable(L);
+  for (i = n - 1; i >= 0; i--) {
+    lua_pushstring(L, CLASS_KEY_METHODS);
+    lua_rawget(L, first + i);
+    if (lua_istable(L, -1))
+      copytable(L, -1, first + n);
+    lua_pop(L, 1);
+  }
+  /* 保存缓存及其版本 */
+  lua_pushstring(L, CLASS_KEY_MCACHE);
+  lua_pushvalue(L, -2);
+  lua_rawset(L, class_idx);
+  lua_pushstring(L, CLASS_KEY_MCACHEVER);
+  lua_pushinteger(L, cast(lua_Integer, G(L)->classversion));
+  lua_rawset(L, class_idx);
+  lua_replace(L, first);
+  lua_settop(L, first);
 }
 
 
 /*
 ** 获取属性（考虑继承链）
+** 对象自身没有的键只需在类的扁平化方法缓存中查找一次，与继承深度无关
 */
 void luaC_getprop(lua_State *L, int obj_idx, TString *key) {
   obj_idx = absindex(L, obj_idx);
   
-  /* 首先在对象自身查找 */
-  lua_pushlstring(L, getstr(key), tsslen(key));
+  /* 首先在对象自身查找（直接压入键，无需重新内部化） */
+  setsvalue2s(L, L->top.p, key);
+  api_incr_top(L);
   lua_rawget(L, obj_idx);
   if (!lua_isnil(L, -1)) {
     return;
@@ -1550,32 +1830,17 @@ void luaC_getprop(lua_State *L, int obj_idx, TString *key) {
   /* 在类方法中查找（使用rawget从对象获取类引用） */
   lua_pushstring(L, OBJ_KEY_CLASS);
   lua_rawget(L, obj_idx);
-  while (lua_istable(L, -1)) {
-    int current_class = lua_gettop(L);
-    
-    /* 使用rawget访问类表 */
-    lua_pushstring(L, CLASS_KEY_METHODS);
-    lua_rawget(L, current_class);
-    if (lua_istable(L, -1)) {
-      lua_pushlstring(L, getstr(key), tsslen(key));
-      lua_rawget(L, -2);
-      if (!lua_isnil(L, -1)) {
-        lua_remove(L, -2);  /* 移除methods表 */
-        lua_remove(L, -2);  /* 移除class */
-        return;
-      }
-      lua_pop(L, 1);
-    }
-    lua_pop(L, 1);
-    
-    /* 继续查找父类（使用rawget） */
-    lua_pushstring(L, CLASS_KEY_PARENT);
-    lua_rawget(L, current_class);
-    lua_remove(L, current_class);
+  if (!lua_istable(L, -1)) {
+    lua_pop(L, 1);  /* 移除非表值 */
+    lua_pushnil(L);
+    return;
   }
-  
-  lua_pop(L, 1);  /* 移除非表值 */
-  lua_pushnil(L);
+  pushmcache(L, -1);
+  setsvalue2s(L, L->top.p, key);
+  api_incr_top(L);
+  lua_rawget(L, -2);
+  lua_remove(L, -2);  /* 移除缓存表 */
+  lua_remove(L, -2);  /* 移除class */
 }
 
 
@@ -1586,7 +1851,8 @@ void luaC_setprop(lua_State *L, int obj_idx, TString *key, int value_idx) {
   obj_idx = absindex(L, obj_idx);
   value_idx = absindex(L, value_idx);
   
-  lua_pushlstring(L, getstr(key), tsslen(key));
+  setsvalue2s(L, L->top.p, key);
+  api_incr_top(L);
   lua_pushvalue(L, value_idx);
   lua_rawset(L, obj_idx);
 }
@@ -1775,6 +2041,7 @@ void luaC_implement(lua_State *L, int class_idx, int interface_idx) {
   lua_pushvalue(L, interface_idx);
   lua_rawseti(L, -2, n + 1);
   lua_pop(L, 1);
+  luaC_classchanged(L);  /* 实例化计划失效 */
 }
 
 
@@ -2112,6 +2379,7 @@ void luaC_setabstract(lua_State *L, int class_idx, TString *name, int nparams) {
   lua_pushstring(L, CLASS_KEY_FLAGS);
   lua_pushinteger(L, flags);
   lua_rawset(L, class_idx);
+  luaC_classchanged(L);  /* 实例化计划失效 */
 }
 
 
@@ -66,6 +66,9 @@
 #define CLASS_KEY_PROTECTED_GETTERS "__protected_getters" /**< Protected getter table. */
 #define CLASS_KEY_PROTECTED_SETTERS "__protected_setters" /**< Protected setter table. */
 #define CLASS_KEY_MEMBER_FLAGS "__member_flags" /**< Member flags table. */
+#define CLASS_KEY_MCACHE     "__mcache"       /**< Flattened methods of the inheritance chain. */
+#define CLASS_KEY_MCACHEVER  "__mcachever"    /**< Class version '__mcache' was built for. */
+#define CLASS_KEY_PLAN       "__plan"         /**< Cached instantiation plan. */
 /**@}*/
 
 /** @name Object Metadata Keys */
@@ -75,6 +78,15 @@
 #define OBJ_KEY_PRIVATES     "__obj_privates" /**< Object private data. */
 /**@}*/
 
+/**
+ * @brief Invalidates all flattened method caches and instantiation plans.
+ *
+ * Must be called whenever the methods, parent, abstract methods or
+ * interfaces of any class change; 'luaC_getprop' and 'luaC_newobject'
+ * rebuild what they cached for a class when it is stale.
+ */
+#define luaC_classchanged(L)	(G(L)->classversion++)
+
 /*
 ** =====================================================================
 ** Core Functions
@@ -1908,9 +1908,12 @@ void luaK_posfix (FuncState *fs, BinOpr opr,
       if (e2->k == VKSTR) {
         /* expr is "typename" - 字符串常量，使用 OP_IS */
         int r2 = luaK_stringK(fs, e2->u.strval);
+        int inreg = (r2 > MAXARG_B);  /* 常量索引放不进 B？ */
+        if (inreg)
+          r2 = luaK_exp2anyreg(fs, e2);  /* 类型名放在寄存器中（C=1） */
         freeexps(fs, e1, e2);
         /* 生成 OP_IS 指令并跳转 */
-        e1->u.info = condjump(fs, OP_IS, r1, r2, 0, 1);
+        e1->u.info = condjump(fs, OP_IS, r1, r2, inreg, 1);
         e1->k = VJMP;
       }
       else {
@@ -368,7 +368,7 @@ static void dumpCode (DumpState *D, const Proto *f) {
   /* 应用OPcode映射表 */
   for (i = 0; i < orig_size; i++) {
     Instruction inst = f->code[i];
-    OpCode op = GET_OPCODE(inst);
+    OpCode op = luaP_genericop(GET_OPCODE(inst));  /* 还原被特化(quicken)的指令 */
     /* 使用映射表替换OPcode */
     SET_OPCODE(inst, D->opcode_map[op]);
     /* 应用第三个OPcode映射表进行额外处理 */
@@ -384,11 +384,11 @@ static void dumpCode (DumpState *D, const Proto *f) {
     return;
   }
 
-  /* 序列化为Little Endian字节流 (Instruction is 64-bit) */
+  /* 序列化为Little Endian字节流 (宽度为 sizeof(Instruction)，见头部) */
   for (i = 0; i < orig_size; i++) {
     Instruction inst = mapped_code[i];
-    for (int j = 0; j < 8; j++) {
-      encrypted_data[i*8 + j] = (char)((inst >> (j * 8)) & 0xFF);
+    for (int j = 0; j < (int)sizeof(Instruction); j++) {
+      encrypted_data[i*sizeof(Instruction) + j] = (char)((inst >> (j * 8)) & 0xFF);
     }
   }
 
@@ -601,6 +601,13 @@ static void dumpFunction (DumpState *D, const Proto *f, TString *psource) {
   /* 如果启用了控制流扁平化或VM保护，先对函数进行处理 */
   Proto *work_proto = (Proto *)f;  /* 转换为非const指针以便修改 */
   if (D->obfuscate_flags & (OBFUSCATE_CFF | OBFUSCATE_VM_PROTECT)) {
+    /* 混淆只认识通用指令，先把运行时特化的指令还原 */
+    int pc;
+    for (pc = 0; pc < work_proto->sizecode; pc++) {
+      OpCode op = GET_OPCODE(work_proto->code[pc]);
+      if (luaP_isquickened(op))
+        SET_OPCODE(work_proto->code[pc], luaP_genericop(op));
+    }
     luaO_flatten(D->L, work_proto, D->obfuscate_flags, D->obfuscate_seed, D->log_path);
     /* 更新种子，使每个函数使用不同的种子 */
     D->obfuscate_seed = D->obfuscate_seed * 1664525 + 1013904223;
@@ -609,6 +616,7 @@ static void dumpFunction (DumpState *D, const Proto *f, TString *psource) {
   dumpByte(D, work_proto->numparams);
   dumpByte(D, work_proto->is_vararg);
   dumpByte(D, work_proto->maxstacksize);
+  dumpByte(D, work_proto->flag & PF_SELFMASK);  /* 方法/类代码标志（访问控制） */
   dumpInt(D, work_proto->difierline_mode);  /* 新增：写入自定义标志 */
 
   dumpInt(D, 0x1337C0DE); /* Padding */
@@ -665,7 +673,7 @@ static void dumpHeader (DumpState *D) {
   // 直接写入 LUAC_DATA（无加密）
   dumpBlock(D, LUAC_DATA, sizeof(LUAC_DATA) - 1);
   
-  dumpByte(D, 8);
+  dumpByte(D, sizeof(Instruction));  /* 8 = 宽指令, 4 = 紧凑指令 */
   dumpByte(D, 8);
   dumpByte(D, 8);
   dumpInt64(D, 0x5678);
@@ -13,6 +13,7 @@
 
 
 #include <stddef.h>
+#include <string.h>
 
 #include "lua.h"
 
@@ -20,6 +21,7 @@
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lmem.h"
 #include "lobject.h"
 #include "lstate.h"
@@ -344,6 +346,7 @@ Proto *luaF_newproto (lua_State *L) {
   f->sizeupvalues = 0;
   f->numparams = 0;
   f->is_vararg = 0;
+  f->flag = 0;
   f->maxstacksize = 0;
   f->nodiscard = 0;
   f->difierline_mode = 0;
@@ -356,10 +359,82 @@ Proto *luaF_newproto (lua_State *L) {
   f->source = NULL;
   f->is_sleeping = 0;
   f->call_queue = NULL;
+  f->icache = NULL;
+  f->sizeicache = 0;
+  f->tcache = NULL;
+  f->jit = NULL;
+  f->jitcount = 0;
   return f;
 }
 
 
+/**
+ * @brief Creates the inline-cache array of a prototype.
+ *
+ * Called by the VM the first time a cached instruction of 'p' runs.
+ * Other threads may be running the same prototype, so the array is
+ * installed under the global lock and a losing racer frees its copy.
+ *
+ * @param L The Lua state.
+ * @param p The prototype.
+ */
+void luaF_initicache (lua_State *L, Proto *p) {
+  int n = p->sizecode;
+  InlineCache *ic = luaM_newvector(L, n, InlineCache);
+  memset(ic, 0, cast_sizet(n) * sizeof(InlineCache));
+  l_mutex_lock(&G(L)->lock);
+  if (p->icache == NULL) {
+    p->icache = ic;
+    p->sizeicache = n;
+    ic = NULL;
+  }
+  l_mutex_unlock(&G(L)->lock);
+  if (ic != NULL)  /* lost the race? */
+    luaM_freearray(L, ic, n);
+}
+
+
+/**
+ * @brief Creates the OP_CHECKTYPE cache array of a prototype.
+ *
+ * Like 'luaF_initicache', one entry per instruction, installed under
+ * the global lock.
+ *
+ * @param L The Lua state.
+ * @param p The prototype.
+ */
+void luaF_inittcache (lua_State *L, Proto *p) {
+  int n = p->sizecode;
+  TypeCache *tc = luaM_newvector(L, n, TypeCache);
+  memset(tc, 0, cast_sizet(n) * sizeof(TypeCache));
+  l_mutex_lock(&G(L)->lock);
+  if (p->tcache == NULL) {
+    p->tcache = tc;
+    tc = NULL;
+  }
+  l_mutex_unlock(&G(L)->lock);
+  if (tc != NULL)  /* lost the race? */
+    luaM_freearray(L, tc, n);
+}
+
+
+/**
+ * @brief Drops the inline caches of a prototype whose code was replaced.
+ *
+ * @param L The Lua state.
+ * @param p The prototype.
+ */
+void luaF_freeicache (lua_State *L, Proto *p) {
+  luaM_freearray(L, p->icache, p->sizeicache);
+  p->icache = NULL;
+  p->sizeicache = 0;
+  if (p->tcache != NULL) {  /* sized by the old code */
+    luaM_freearray(L, p->tcache, p->sizecode);
+    p->tcache = NULL;
+  }
+}
+
+
 /**
  * @brief Calculates the memory size of a prototype.
  *
@@ -372,6 +447,9 @@ lu_mem luaF_protosize (Proto *p) {
             + cast_uint(p->sizek) * sizeof(TValue)
             + cast_uint(p->sizelocvars) * sizeof(LocVar)
             + cast_uint(p->sizeupvalues) * sizeof(Upvaldesc);
+  sz += cast_uint(p->sizeicache) * sizeof(InlineCache);
+  if (p->tcache != NULL)
+    sz += cast_uint(p->sizecode) * sizeof(TypeCache);
   if (!(p->flag & PF_FIXED)) {
     sz += cast_uint(p->sizecode) * sizeof(Instruction);
     sz += cast_uint(p->sizelineinfo) * sizeof(lu_byte);
@@ -395,6 +473,10 @@ void luaF_freeproto (lua_State *L, Proto *f) {
   luaM_freearray(L, f->abslineinfo, f->sizeabslineinfo);
   luaM_freearray(L, f->locvars, f->sizelocvars);
   luaM_freearray(L, f->upvalues, f->sizeupvalues);
+  luaM_freearray(L, f->icache, f->sizeicache);
+  if (f->tcache != NULL)
+    luaM_freearray(L, f->tcache, f->sizecode);
+  luaJ_free(L, f);
   luaF_freecallqueue(L, f->call_queue);
   luaM_free(L, f);
 }
@@ -144,6 +144,30 @@ LUAI_FUNC void luaF_unlinkupval (UpVal *uv);
  */
 LUAI_FUNC lu_mem luaF_protosize (Proto *p);
 
+/**
+ * @brief Creates the inline-cache array of a prototype.
+ *
+ * @param L The Lua state.
+ * @param p The prototype.
+ */
+LUAI_FUNC void luaF_initicache (lua_State *L, Proto *p);
+
+/**
+ * @brief Creates the OP_CHECKTYPE cache array of a prototype.
+ *
+ * @param L The Lua state.
+ * @param p The prototype.
+ */
+LUAI_FUNC void luaF_inittcache (lua_State *L, Proto *p);
+
+/**
+ * @brief Drops the inline caches of a prototype whose code was replaced.
+ *
+ * @param L The Lua state.
+ * @param p The prototype.
+ */
+LUAI_FUNC void luaF_freeicache (lua_State *L, Proto *p);
+
 /**
  * @brief Frees a prototype.
  *
@@ -12,7 +12,9 @@
 #include "lprefix.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 
 #include "lua.h"
@@ -110,8 +112,16 @@
 #define markobjectN(g,t)	{ if (t) markobject(g,t); }
 
 static void reallymarkobject (global_State *g, GCObject *o);
+static int claimobject (GCObject *o);
+static void pushgray (global_State *g, GCObject *o);
+static void syncgenlink (global_State *g, GCObject *o);
 static lu_mem atomic (lua_State *L);
 static void entersweep (lua_State *L);
+static int endbgsweep (lua_State *L, int wait);
+
+
+/* makes sure that no background sweep is running (see 'endbgsweep') */
+#define finishbgsweep(L)  { if (G(L)->bgsweeping) endbgsweep(L, 1); }
 
 
 /*
@@ -236,7 +246,7 @@ void luaC_barrier_ (lua_State *L, GCObject *o, GCObject *v) {
   }
   else {  /* sweep phase */
     lua_assert(issweepphase(g));
-    if (g->gckind == KGC_INC)  /* incremental mode? */
+    if (g->gckind == KGC_INC && !g->bgsweeping)  /* 'o' is ours to paint? */
       makewhite(g, o);  /* mark 'o' as white to avoid other barriers */
   }
 }
@@ -254,6 +264,8 @@ void luaC_barrierback_ (lua_State *L, GCObject *o) {
   global_State *g = G(L);
   lua_assert(isblack(o) && !isdead(g, o));
   lua_assert((g->gckind == KGC_GENH) == (isold(o) && getage(o) != G_TOUCHED1));
+  if (g->bgsweeping)  /* 'o' is being whitened by the sweeper? */
+    return;  /* no invariant to keep until the next cycle */
   if (getage(o) == G_TOUCHED2)  /* already in gray list? */
     set2gray(o);  /* make it gray to become touched1 */
   else  /* link it in 'grayagain' and paint it gray */
@@ -263,25 +275,107 @@ void luaC_barrierback_ (lua_State *L, GCObject *o) {
 }
 
 
+/*
+** New objects are not linked into 'allgc' when created: each Lua thread
+** keeps them in its own nursery ('L->nursery'), so that creating an
+** object takes no lock. Only the owner pushes into a nursery; the
+** collector (holding 'g->lock') takes whole nurseries and splices them
+** into 'allgc' at the start of each step, at the atomic phase, and when
+** it needs an object to be in 'allgc'. Threads whose nursery may have
+** objects are listed in 'g->nurseries' (through 'L->nurserynext');
+** 'L->innursery' tells whether a thread is listed.
+*/
+
+/*
+** Push 'o' into the nursery of 'L', listing 'L' if needed. (The flag is
+** checked after the push and cleared by the collector before it takes
+** the nursery, so an object is never left in an unlisted nursery.)
+*/
+static void nurserypush (lua_State *L, GCObject *o) {
+  GCObject *head = atomic_load_explicit(&L->nursery, memory_order_relaxed);
+  do {
+    o->next = head;
+  } while (!atomic_compare_exchange_weak(&L->nursery, &head, o));
+  if (!atomic_load(&L->innursery) && !atomic_exchange(&L->innursery, 1)) {
+    global_State *g = G(L);
+    lua_State *first = atomic_load_explicit(&g->nurseries,
+                                            memory_order_relaxed);
+    do {
+      L->nurserynext = first;
+    } while (!atomic_compare_exchange_weak(&g->nurseries, &first, L));
+  }
+}
+
+
+/*
+** Move the nursery of 'L1' into 'allgc'. An object in a nursery may be
+** marked (by a barrier) and may even have missed an atomic phase when it
+** was created concurrently with it, so its color is fixed as if it had
+** been in 'allgc' all along: outside marking it is just white; a new
+** object in generational mode cannot have a legitimate mark; otherwise
+** the mark is kept, unless the object got the white that is now dead.
+*/
+static void splicenursery (global_State *g, lua_State *L1) {
+  GCObject *o = atomic_exchange(&L1->nursery, NULL);
+  while (o != NULL) {
+    GCObject *next = o->next;
+    if (!keepinvariant(g) || (g->gckind == KGC_GENH && getage(o) == G_NEW))
+      makewhite(g, o);
+    else if (isdead(g, o))
+      changewhite(o);
+    if (g->allgc == NULL)  /* first object after a background sweep began? */
+      g->sweeptail = o;  /* it will stay the last one */
+    o->next = g->allgc;
+    g->allgc = o;
+    o = next;
+  }
+}
+
+
+/**
+ * @brief Moves the objects of all nurseries into 'allgc'.
+ *
+ * Must be called with 'g->lock' held.
+ *
+ * @param L The Lua state.
+ */
+void luaC_splicenurseries (lua_State *L) {
+  global_State *g = G(L);
+  lua_State *L1 = atomic_exchange(&g->nurseries, NULL);
+  while (L1 != NULL) {
+    lua_State *next = L1->nurserynext;  /* before the owner can relist it */
+    atomic_store(&L1->innursery, 0);
+    splicenursery(g, L1);
+    L1 = next;
+  }
+}
+
+
 /**
  * @brief Moves an object to the fixed list, so it will never be collected.
  *
  * @param L The Lua state.
- * @param o The object to fix.
+ * @param o The object to fix (a recently created one).
  */
 void luaC_fix (lua_State *L, GCObject *o) {
   global_State *g = G(L);
-  lua_assert(g->allgc == o);  /* object must be 1st in 'allgc' list! */
+  GCObject **p;
+  l_mutex_lock(&g->lock);
+  luaC_splicenurseries(L);
+  finishbgsweep(L);  /* 'o' may be the last new object in 'allgc' */
+  for (p = &g->allgc; *p != o; p = &(*p)->next) { /* empty */ }
   set2gray(o);  /* they will be gray forever */
   setage(o, G_OLD);  /* and old forever */
-  g->allgc = o->next;  /* remove object from 'allgc' list */
+  *p = o->next;  /* remove object from 'allgc' list */
   o->next = g->fixedgc;  /* link it to 'fixedgc' list */
   g->fixedgc = o;
+  l_mutex_unlock(&g->lock);
 }
 
 
 /**
- * @brief Creates a new collectable object and links it to the 'allgc' list.
+ * @brief Creates a new collectable object and puts it in the nursery of
+ * the running thread.
  *
  * @param L The Lua state.
  * @param tt Object type tag.
@@ -295,14 +389,23 @@ GCObject *luaC_newobjdt (lua_State *L, int tt, size_t sz, size_t offset) {
   GCObject *o = cast(GCObject *, p + offset);
   o->marked = luaC_white(g);
   o->tt = tt;
-  l_mutex_lock(&g->lock);
-  o->next = g->allgc;
-  g->allgc = o;
-  l_mutex_unlock(&g->lock);
+  nurserypush(L, o);
   return o;
 }
 
 
+/**
+ * @brief Hands an object allocated outside 'luaC_newobj' to the collector
+ * (through the nursery of the running thread).
+ *
+ * @param L The Lua state.
+ * @param o The object.
+ */
+void luaC_linkobj (lua_State *L, GCObject *o) {
+  nurserypush(L, o);
+}
+
+
 /**
  * @brief Creates a new collectable object.
  *
@@ -340,10 +443,16 @@ GCObject *luaC_newobj (lua_State *L, int tt, size_t sz) {
  * for at most two levels: An upvalue cannot refer to another upvalue
  * (only closures can), and a userdata's metatable must be a table.
  *
+ * While helper threads are marking ('g->parmarking'), the object is
+ * first claimed atomically, as several markers may reach it at once, and
+ * objects to be visited go to the stack of the current marker.
+ *
  * @param g The global state.
  * @param o The object to mark.
  */
 static void reallymarkobject (global_State *g, GCObject *o) {
+  if (l_unlikely(g->parmarking) && !claimobject(o))
+    return;  /* another marker got it first */
   switch (o->tt) {
     case LUA_VSUPERSTRUCT: {
       SuperStruct *ss = gco2superstruct(o);
@@ -397,7 +506,10 @@ static void reallymarkobject (global_State *g, GCObject *o) {
     }  /* FALLTHROUGH */
     case LUA_VLCL: case LUA_VCONCEPT: case LUA_VCCL: case LUA_VTABLE:
     case LUA_VTHREAD: case LUA_VPROTO: case LUA_VNAMESPACE: {
-      linkobjgclist(o, g->gray);  /* to be visited later */
+      if (l_unlikely(g->parmarking))
+        pushgray(g, o);  /* to be visited by this marker */
+      else
+        linkobjgclist(o, g->gray);  /* to be visited later */
       break;
     }
     default: lua_assert(0); break;
@@ -527,7 +639,10 @@ static void restartcollection (global_State *g) {
 static void genlink (global_State *g, GCObject *o) {
   lua_assert(isblack(o));
   if (getage(o) == G_TOUCHED1) {  /* touched in this cycle? */
-    linkobjgclist(o, g->grayagain);  /* link it back in 'grayagain' */
+    if (g->parmarking)  /* other markers may be linking too? */
+      syncgenlink(g, o);
+    else
+      linkobjgclist(o, g->grayagain);  /* link it back in 'grayagain' */
   }  /* everything else do not need to be linked back */
   else if (getage(o) == G_TOUCHED2)
     changeage(o, G_TOUCHED2, G_OLD);  /* advance age */
@@ -652,6 +767,22 @@ static void traversestrongtable (global_State *g, Table *h) {
 }
 
 
+/*
+** The '__mode' field of metatable 'mt'. 'gfasttm' caches an absent
+** field in 'mt->flags', which markers running in parallel must not
+** write; they only read the cached bit and look the field up.
+*/
+static const TValue *getmode (global_State *g, GCObject *mt) {
+  const TValue *mode;
+  if (!g->parmarking || mt == NULL || mt->tt != LUA_VTABLE)
+    return gfasttm(g, mt, TM_MODE);  /* no cache written in parallel */
+  if (gco2t(mt)->flags & (1u<<TM_MODE))
+    return NULL;
+  mode = luaH_getshortstr(gco2t(mt), g->tmname[TM_MODE]);
+  return notm(mode) ? NULL : mode;
+}
+
+
 /**
  * @brief Traverse a table.
  *
@@ -663,8 +794,8 @@ static lu_mem traversetable (global_State *g, Table *h) {
   const char *weakkey, *weakvalue;
   const TValue *mode;
   TString *smode;
-  l_rwlock_rdlock(&h->lock); /* Lock table for traversal */
-  mode = gfasttm(g, h->metatable, TM_MODE);
+  luaH_grdlock(g, h); /* Lock table for traversal */
+  mode = getmode(g, h->metatable);
   markobjectN(g, h->metatable);
   markobjectN(g, h->using_next);
   if (mode && ttisshrstring(mode) &&  /* is there a weak mode? */
@@ -681,7 +812,7 @@ static lu_mem traversetable (global_State *g, Table *h) {
   }
   else  /* not weak */
     traversestrongtable(g, h);
-  l_rwlock_unlock(&h->lock);
+  luaH_gunlock(g, h);
   return 1 + h->alimit + 2 * allocsizenode(h);
 }
 
@@ -828,15 +959,15 @@ static int traversethread (global_State *g, lua_State *th) {
 
 
 /**
- * @brief Traverse one gray object, turning it to black.
+ * @brief Traverse a gray object (already out of any gray list), turning
+ * it to black.
  *
  * @param g The global state.
+ * @param o The object.
  * @return The work done.
  */
-static lu_mem propagatemark (global_State *g) {
-  GCObject *o = g->gray;
+static lu_mem traverseobj (global_State *g, GCObject *o) {
   nw2black(o);
-  g->gray = *getgclist(o);  /* remove from 'gray' list */
   switch (o->tt) {
     case LUA_VTABLE: return traversetable(g, gco2t(o));
     case LUA_VUSERDATA: return traverseudata(g, gco2u(o));
@@ -851,16 +982,438 @@ static lu_mem propagatemark (global_State *g) {
 }
 
 
+/**
+ * @brief Traverse one gray object, turning it to black.
+ *
+ * @param g The global state.
+ * @return The work done.
+ */
+static lu_mem propagatemark (global_State *g) {
+  GCObject *o = g->gray;
+  g->gray = *getgclist(o);  /* remove from 'gray' list */
+  return traverseobj(g, o);
+}
+
+
+/*
+** {======================================================
+** Parallel marking
+** =======================================================
+*/
+
+/*
+** When 'g->gcmarkthreads' is larger than 1 (see LUA_GCPMARKTHREADS) and
+** the heap is large enough, 'propagateall' runs marking rounds shared
+** by the collector and 'gcmarkthreads - 1' helper threads. Each marker
+** keeps its own stack of gray objects; a marker that runs out of work
+** waits for work offered by the busy ones, which give away the bottom
+** half of their stacks (the oldest, usually largest, subgraphs) whenever
+** some marker is idle. The round ends when all markers are idle with
+** nothing offered. Objects are claimed by an atomic white-to-gray
+** transition, so each one is traversed by a single marker. Threads and
+** tables with a '__mode' are not traversed in parallel, as they go to
+** the global gray lists: they are left gray for the collector, which
+** traverses them after the round. Helper threads are started at the
+** first parallel round and wait between rounds; they never run Lua code
+** nor allocate Lua memory (their stacks come from 'malloc').
+*/
+
+/* heaps smaller than this are marked serially */
+#if !defined(LUAI_PARMARKMIN)
+#define LUAI_PARMARKMIN		(4 * 1024 * 1024)
+#endif
+
+/* maximum value for LUA_GCPMARKTHREADS */
+#define MAXMARKTHREADS		64
+
+/* initial size of a marker stack */
+#define MARKSTACKMIN		1024
+
+
+#if defined(_MSC_VER)
+#define gc_threadlocal	__declspec(thread)
+#else
+#define gc_threadlocal	_Thread_local
+#endif
+
+
+typedef struct GCMarker {
+  GCObject **stack;  /* gray objects to be traversed by this marker */
+  size_t n;  /* number of objects in 'stack' */
+  size_t size;  /* size of 'stack' */
+  GCObject *deferred;  /* gray objects left for the collector */
+  lu_mem work;  /* work done in the current round */
+  struct GCMarkers *ms;
+} GCMarker;
+
+
+typedef struct GCMarkers {
+  global_State *g;
+  l_mutex_t lock;
+  l_cond_t wake;  /* helpers wait here for work or a new round */
+  l_cond_t done;  /* the collector waits here for the end of a round */
+  GCObject **shared;  /* gray objects offered by busy markers */
+  size_t nshared;  /* number of objects in 'shared' */
+  size_t sizeshared;  /* size of 'shared' */
+  GCObject *orphans;  /* objects grayed by non-markers during a round */
+  atomic_int nidle;  /* number of markers waiting for work */
+  int nmarkers;  /* number of markers (helpers plus the collector) */
+  int nfinished;  /* helpers that finished the current round */
+  unsigned int round;  /* number of the current round */
+  int quit;  /* true when helpers must exit */
+  l_thread_t *threads;  /* helper threads */
+  GCMarker marker[1];  /* marker 0 is the collector itself */
+} GCMarkers;
+
+
+/* marker run by the current OS thread during a round (or NULL) */
+static gc_threadlocal GCMarker *curmarker = NULL;
+
+
+/*
+** Atomically turns a white object gray. Returns false if it was not
+** white anymore (another marker got it first).
+*/
+static int claimobject (GCObject *o) {
+  _Atomic lu_byte *p = cast(_Atomic lu_byte *, &o->marked);
+  lu_byte old = atomic_load_explicit(p, memory_order_relaxed);
+  do {
+    if (!(old & WHITEBITS))
+      return 0;
+  } while (!atomic_compare_exchange_weak(p, &old,
+                                          cast_byte(old & ~WHITEBITS)));
+  return 1;
+}
+
+
+static int growmarkstack (GCMarker *m) {
+  size_t newsize = (m->size == 0) ? MARKSTACKMIN : 2 * m->size;
+  GCObject **newstack = cast(GCObject **,
+                             realloc(m->stack, newsize * sizeof(GCObject *)));
+  if (newstack == NULL)
+    return 0;
+  m->stack = newstack;
+  m->size = newsize;
+  return 1;
+}
+
+
+/* Leaves gray object 'o' for the collector to traverse after the round. */
+static void deferobj (GCMarker *m, GCObject *o) {
+  *getgclist(o) = m->deferred;
+  m->deferred = o;
+}
+
+
+/*
+** Pushes gray object 'o' to the stack of the current marker. A thread
+** that is not a marker (a barrier in a running Lua thread) hands the
+** object to the collector instead.
+*/
+static void pushgray (global_State *g, GCObject *o) {
+  GCMarker *m = curmarker;
+  if (m == NULL) {
+    GCMarkers *ms = g->markers;
+    l_mutex_lock(&ms->lock);
+    *getgclist(o) = ms->orphans;
+    ms->orphans = o;
+    l_mutex_unlock(&ms->lock);
+  }
+  else if (m->n == m->size && !growmarkstack(m))
+    deferobj(m, o);  /* no memory; traverse it serially */
+  else
+    m->stack[m->n++] = o;
+}
+
+
+/* Links 'o' back in 'grayagain' (see 'genlink') during a round. */
+static void syncgenlink (global_State *g, GCObject *o) {
+  l_mutex_lock(&g->markers->lock);
+  linkobjgclist(o, g->grayagain);
+  l_mutex_unlock(&g->markers->lock);
+}
+
+
+/* Moves the bottom half of the stack of 'm' to the shared stack. */
+static void offerwork (GCMarkers *ms, GCMarker *m) {
+  size_t k = m->n / 2;
+  l_mutex_lock(&ms->lock);
+  if (ms->nshared + k > ms->sizeshared) {  /* grow shared stack */
+    size_t newsize = ms->nshared + k + MARKSTACKMIN;
+    GCObject **newshared = cast(GCObject **,
+                    realloc(ms->shared, newsize * sizeof(GCObject *)));
+    if (newshared != NULL) {
+      ms->shared = newshared;
+      ms->sizeshared = newsize;
+    }
+    else
+      k = ms->sizeshared - ms->nshared;  /* offer what fits */
+  }
+  memcpy(ms->shared + ms->nshared, m->stack, k * sizeof(GCObject *));
+  memmove(m->stack, m->stack + k, (m->n - k) * sizeof(GCObject *));
+  ms->nshared += k;
+  m->n -= k;
+  l_cond_broadcast(&ms->wake);
+  l_mutex_unlock(&ms->lock);
+}
+
+
+/*
+** Called by a marker with an empty stack: waits until some work is
+** offered (taking up to half of it) or all markers are idle. Returns
+** false in the latter case, which ends the round.
+*/
+static int getwork (GCMarkers *ms, GCMarker *m) {
+  int found;
+  l_mutex_lock(&ms->lock);
+  atomic_fetch_add(&ms->nidle, 1);
+  while (ms->nshared == 0 && atomic_load(&ms->nidle) < ms->nmarkers)
+    l_cond_wait(&ms->wake, &ms->lock);
+  if (ms->nshared > 0) {
+    size_t k = (ms->nshared + 1) / 2;
+    while (m->size < k && growmarkstack(m)) { /* empty */ }
+    if (k > m->size)
+      k = m->size;  /* take what fits */
+    ms->nshared -= k;
+    memcpy(m->stack, ms->shared + ms->nshared, k * sizeof(GCObject *));
+    m->n = k;
+    atomic_fetch_sub(&ms->nidle, 1);
+    found = 1;
+  }
+  else {  /* everybody is idle */
+    l_cond_broadcast(&ms->wake);
+    found = 0;
+  }
+  l_mutex_unlock(&ms->lock);
+  return found;
+}
+
+
+/*
+** Traverses a gray object popped by a marker, unless it must be left
+** to the collector.
+*/
+static lu_mem ptraverse (global_State *g, GCMarker *m, GCObject *o) {
+  if (o->tt == LUA_VTHREAD ||
+      (o->tt == LUA_VTABLE && getmode(g, gco2t(o)->metatable))) {
+    deferobj(m, o);
+    return 0;
+  }
+  return traverseobj(g, o);
+}
+
+
+static void markloop (GCMarkers *ms, GCMarker *m) {
+  global_State *g = ms->g;
+  do {
+    while (m->n > 0) {
+      GCObject *o = m->stack[--m->n];
+      m->work += ptraverse(g, m, o);
+      if (m->n > 1 && atomic_load_explicit(&ms->nidle,
+                                           memory_order_relaxed) > 0)
+        offerwork(ms, m);  /* somebody is waiting for work */
+    }
+  } while (getwork(ms, m));
+}
+
+
+static void *markhelper (void *ud) {
+  GCMarker *m = cast(GCMarker *, ud);
+  GCMarkers *ms = m->ms;
+  unsigned int round = 0;
+  curmarker = m;
+  l_mutex_lock(&ms->lock);
+  for (;;) {
+    while (ms->round == round && !ms->quit)
+      l_cond_wait(&ms->wake, &ms->lock);
+    if (ms->quit)
+      break;
+    round = ms->round;
+    l_mutex_unlock(&ms->lock);
+    markloop(ms, m);
+    l_mutex_lock(&ms->lock);
+    ms->nfinished++;
+    l_cond_signal(&ms->done);
+  }
+  l_mutex_unlock(&ms->lock);
+  return NULL;
+}
+
+
+static void freemarkers (GCMarkers *ms) {
+  int i;
+  for (i = 0; i < ms->nmarkers; i++)
+    free(ms->marker[i].stack);
+  free(ms->shared);
+  free(ms->threads);
+  l_cond_destroy(&ms->wake);
+  l_cond_destroy(&ms->done);
+  l_mutex_destroy(&ms->lock);
+  free(ms);
+}
+
+
+/*
+** Starts the helper threads of 'g'. Returns NULL if not even one
+** helper could be started.
+*/
+static GCMarkers *startmarkers (global_State *g) {
+  int n = g->gcmarkthreads;
+  int i;
+  GCMarkers *ms = cast(GCMarkers *, calloc(1, sizeof(GCMarkers) +
+                                              (n - 1) * sizeof(GCMarker)));
+  if (ms == NULL)
+    return NULL;
+  ms->g = g;
+  l_mutex_init(&ms->lock);
+  l_cond_init(&ms->wake);
+  l_cond_init(&ms->done);
+  atomic_init(&ms->nidle, 0);
+  ms->nmarkers = 1;
+  ms->marker[0].ms = ms;
+  ms->threads = cast(l_thread_t *, calloc(n, sizeof(l_thread_t)));
+  for (i = 1; ms->threads != NULL && i < n; i++) {
+    ms->marker[i].ms = ms;
+    if (l_thread_create(&ms->threads[i], markhelper, &ms->marker[i]) != 0)
+      break;
+    ms->nmarkers++;
+  }
+  if (ms->nmarkers == 1) {  /* no helpers? */
+    freemarkers(ms);
+    return NULL;
+  }
+  return ms;
+}
+
+
+static void stopmarkers (global_State *g) {
+  GCMarkers *ms = g->markers;
+  int i;
+  l_mutex_lock(&ms->lock);
+  ms->quit = 1;
+  l_cond_broadcast(&ms->wake);
+  l_mutex_unlock(&ms->lock);
+  for (i = 1; i < ms->nmarkers; i++)
+    l_thread_join(ms->threads[i], NULL);
+  freemarkers(ms);
+  g->markers = NULL;
+}
+
+
+/* Whether the next marking round should run in parallel. */
+static int useparallel (global_State *g) {
+  if (g->gcmarkthreads <= 1 || gettotalbytes(g) < LUAI_PARMARKMIN)
+    return 0;
+  if (g->markers == NULL && (g->markers = startmarkers(g)) == NULL) {
+    g->gcmarkthreads = 1;  /* cannot start helpers; mark serially */
+    return 0;
+  }
+  return 1;
+}
+
+
+static void splicegray (global_State *g, GCObject *l) {
+  while (l != NULL) {
+    GCObject *next = *getgclist(l);
+    *getgclist(l) = g->gray;
+    g->gray = l;
+    l = next;
+  }
+}
+
+
+/*
+** Runs a parallel marking round over the objects in the 'gray' list.
+** Afterwards, 'gray' has only the objects left for the collector.
+*/
+static lu_mem parallelpropagate (global_State *g) {
+  GCMarkers *ms = g->markers;
+  GCMarker *m0 = &ms->marker[0];
+  lu_mem work = 0;
+  int i;
+  curmarker = m0;
+  while (g->gray != NULL) {  /* the collector starts with all the work */
+    GCObject *o = g->gray;
+    g->gray = *getgclist(o);
+    pushgray(g, o);
+  }
+  l_mutex_lock(&ms->lock);
+  ms->nshared = 0;
+  ms->orphans = NULL;
+  atomic_store(&ms->nidle, 0);
+  ms->nfinished = 0;
+  ms->round++;
+  g->parmarking = 1;
+  l_cond_broadcast(&ms->wake);
+  l_mutex_unlock(&ms->lock);
+  markloop(ms, m0);
+  l_mutex_lock(&ms->lock);
+  while (ms->nfinished < ms->nmarkers - 1)
+    l_cond_wait(&ms->done, &ms->lock);
+  g->parmarking = 0;
+  l_mutex_unlock(&ms->lock);
+  curmarker = NULL;
+  for (i = 0; i < ms->nmarkers; i++) {
+    GCMarker *m = &ms->marker[i];
+    work += m->work;
+    m->work = 0;
+    splicegray(g, m->deferred);
+    m->deferred = NULL;
+  }
+  splicegray(g, ms->orphans);
+  ms->orphans = NULL;
+  return work;
+}
+
+
+/**
+ * @brief Sets the number of threads used for marking.
+ *
+ * @param L The Lua state.
+ * @param n Number of threads (the collector included); 0 or 1 makes
+ * marking serial.
+ */
+void luaC_setmarkthreads (lua_State *L, int n) {
+  global_State *g = G(L);
+  l_mutex_lock(&g->lock);
+  if (n > MAXMARKTHREADS)
+    n = MAXMARKTHREADS;
+  if (g->markers != NULL && g->gcmarkthreads != n)
+    stopmarkers(g);  /* new helpers will be started when needed */
+  g->gcmarkthreads = n;
+  l_mutex_unlock(&g->lock);
+}
+
+/* }====================================================== */
+
+
 /**
  * @brief Propagate mark for all gray objects.
  *
+ * Marking runs in parallel when enabled (see 'parallelpropagate'); the
+ * objects left by a parallel round are traversed here, and whatever
+ * they gray goes to the next round.
+ *
  * @param g The global state.
  * @return The total work done.
  */
 static lu_mem propagateall (global_State *g) {
   lu_mem tot = 0;
-  while (g->gray)
-    tot += propagatemark(g);
+  while (g->gray) {
+    if (useparallel(g)) {
+      GCObject *l;
+      tot += parallelpropagate(g);
+      l = g->gray;  /* objects left for the collector */
+      g->gray = NULL;
+      while (l != NULL) {
+        GCObject *o = l;
+        l = *getgclist(o);
+        tot += traverseobj(g, o);
+      }
+    }
+    else
+      tot += propagatemark(g);
+  }
   return tot;
 }
 
@@ -1012,9 +1565,13 @@ static void freeobj (lua_State *L, GCObject *o) {
     case LUA_VTABLE:
       luaH_free(L, gco2t(o));
       break;
-    case LUA_VTHREAD:
-      luaE_freethread(L, gco2th(o));
+    case LUA_VTHREAD: {
+      lua_State *L1 = gco2th(o);
+      if (atomic_load(&L1->innursery))  /* may be listed in 'g->nurseries'? */
+        luaC_splicenurseries(L);
+      luaE_freethread(L, L1);
       break;
+    }
     case LUA_VNAMESPACE:
       luaN_free(L, gco2ns(o));
       break;
@@ -1108,6 +1665,425 @@ static GCObject **sweeptolive (lua_State *L, GCObject **p) {
 /* }=========================================== */
 
 
+/*
+** {======================================================
+** Background sweeping
+** =======================================================
+*/
+
+/*
+** When 'g->gcbgsweep' is set (see LUA_GCPBGSWEEP), an incremental cycle
+** hands the whole 'allgc' list to a sweeper thread at the end of its
+** atomic phase. 'allgc' then restarts empty (new objects keep coming
+** from the nurseries) and the collector takes the old objects back only
+** when the sweeper is done, appending the survivors after the new
+** objects, so that the main thread is still the last one in the list.
+** Meanwhile, barriers leave the old objects alone, as the sweeper is
+** whitening them, and anything that must walk 'allgc' waits for the
+** sweep to finish first. The sweeper frees objects through a private
+** (fixed) thread, whose cached blocks go back to the pool after each
+** sweep. It never takes 'g->lock' (the collector may be waiting for it
+** while holding that lock): a short string is removed from the string
+** table only if it is still dead under the shard lock, as a mutator may
+** resurrect it, and dead threads are left for the collector to free.
+** Lists 'finobj' and 'tobefnz' are always swept by the collector.
+** The sweep is paced as a serial one: the sweeper counts the objects it
+** goes through, and collector steps take them as their work, waiting
+** for the sweeper when the mutator allocated more than that work pays
+** for (see 'sweepcredit').
+*/
+
+/* objects the sweeper goes through between reports of its progress */
+#define SWEEPCHUNK	(8 * GCSWEEPMAX)
+
+
+typedef struct GCSweeper {
+  l_mutex_t lock;
+  l_cond_t wake;  /* the sweeper waits here for a list to sweep */
+  l_cond_t done;  /* the collector waits here for the end of a sweep */
+  lua_State *L;  /* thread used to free objects */
+  lu_mem freed;  /* bytes freed by the last sweep */
+  lu_mem swept;  /* objects gone through in the current sweep */
+  lu_mem credited;  /* part of 'swept' already taken by the collector */
+  GCObject *list;  /* objects to be swept */
+  GCObject *survivors;  /* live objects of the last sweep */
+  GCObject *deadthreads;  /* dead threads, freed by the collector */
+  int busy;  /* true while sweeping */
+  int quit;  /* true when the sweeper must exit */
+  l_thread_t thread;
+} GCSweeper;
+
+
+/*
+** Sweeps the list given to the sweeper: dead objects are freed (or put
+** aside, for threads) and live ones are whitened and kept in order.
+*/
+static void bgsweeplist (GCSweeper *sw) {
+  lua_State *L = sw->L;
+  global_State *g = G(L);
+  int ow = otherwhite(g);
+  int white = luaC_white(g);  /* current white */
+  GCObject *curr = sw->list;
+  GCObject **p = &sw->survivors;
+  lu_mem nfreed = L->nfreed;
+  int n = 0;
+  sw->list = NULL;
+  while (curr != NULL) {
+    GCObject *next = curr->next;
+    if (++n == SWEEPCHUNK) {  /* publish progress */
+      l_mutex_lock(&sw->lock);
+      sw->swept += n;
+      l_cond_signal(&sw->done);
+      l_mutex_unlock(&sw->lock);
+      n = 0;
+    }
+    if (!isdeadm(ow, curr->marked) ||
+        (curr->tt == LUA_VSHRSTR && !luaS_removedead(L, gco2ts(curr)))) {
+      curr->marked = cast_byte((curr->marked & ~maskgcbits) | white);
+      *p = curr;
+      p = &curr->next;
+    }
+    else if (curr->tt == LUA_VSHRSTR)  /* already out of the table? */
+      luaM_freemem(L, curr, sizelstring(gco2ts(curr)->shrlen));
+    else if (curr->tt == LUA_VTHREAD) {
+      curr->next = sw->deadthreads;
+      sw->deadthreads = curr;
+    }
+    else
+      freeobj(L, curr);
+    curr = next;
+  }
+  *p = NULL;
+  sw->freed = L->nfreed - nfreed;
+  luaM_poolflush(L);  /* give the freed blocks back to the pool */
+}
+
+
+static void *sweephelper (void *ud) {
+  GCSweeper *sw = cast(GCSweeper *, ud);
+  l_mutex_lock(&sw->lock);
+  for (;;) {
+    while (!sw->busy && !sw->quit)
+      l_cond_wait(&sw->wake, &sw->lock);
+    if (sw->quit)
+      break;
+    l_mutex_unlock(&sw->lock);
+    bgsweeplist(sw);
+    l_mutex_lock(&sw->lock);
+    sw->busy = 0;
+    l_cond_signal(&sw->done);
+  }
+  l_mutex_unlock(&sw->lock);
+  return NULL;
+}
+
+
+static void freesweeper (GCSweeper *sw) {
+  l_cond_destroy(&sw->wake);
+  l_cond_destroy(&sw->done);
+  l_mutex_destroy(&sw->lock);
+  free(sw);
+}
+
+
+/*
+** Starts a sweeper that frees objects through thread 'L1'. Returns
+** NULL if the sweeper could not be started.
+*/
+static GCSweeper *startsweeper (lua_State *L1) {
+  GCSweeper *sw = cast(GCSweeper *, calloc(1, sizeof(GCSweeper)));
+  if (sw == NULL)
+    return NULL;
+  sw->L = L1;
+  l_mutex_init(&sw->lock);
+  l_cond_init(&sw->wake);
+  l_cond_init(&sw->done);
+  if (l_thread_create(&sw->thread, sweephelper, sw) != 0) {
+    freesweeper(sw);
+    return NULL;
+  }
+  return sw;
+}
+
+
+/* Stops the sweeper of 'g' (which must not be sweeping). */
+static void stopsweeper (global_State *g) {
+  GCSweeper *sw = g->sweeper;
+  lua_assert(!g->bgsweeping);
+  l_mutex_lock(&sw->lock);
+  sw->quit = 1;
+  l_cond_signal(&sw->wake);
+  l_mutex_unlock(&sw->lock);
+  l_thread_join(sw->thread, NULL);
+  freesweeper(sw);
+  g->sweeper = NULL;
+  g->gcbgsweep = 0;
+}
+
+
+/* Hands the objects in 'allgc' to the sweeper. */
+static void startbgsweep (global_State *g) {
+  GCSweeper *sw = g->sweeper;
+  l_mutex_lock(&sw->lock);
+  sw->list = g->allgc;
+  sw->swept = sw->credited = 0;
+  sw->busy = 1;
+  l_cond_signal(&sw->wake);
+  l_mutex_unlock(&sw->lock);
+  g->allgc = NULL;
+  g->sweeptail = NULL;
+  g->bgsweeping = 1;
+}
+
+
+/*
+** Returns the objects the sweeper went through since the last call, as
+** work done for the collector. While the sweep is running, waits until
+** they are at least 'want'.
+*/
+static l_mem sweepcredit (global_State *g, l_mem want) {
+  GCSweeper *sw = g->sweeper;
+  l_mem credit;
+  l_mutex_lock(&sw->lock);
+  while (sw->busy && cast(l_mem, sw->swept - sw->credited) < want)
+    l_cond_wait(&sw->done, &sw->lock);
+  credit = cast(l_mem, sw->swept - sw->credited);
+  sw->credited = sw->swept;
+  l_mutex_unlock(&sw->lock);
+  return credit;
+}
+
+
+/*
+** Takes back the objects swept in the background, waiting for the
+** sweeper if 'wait' is true; otherwise, returns 0 if it is still busy.
+** Dead threads are freed here, and the estimate is corrected.
+*/
+static int endbgsweep (lua_State *L, int wait) {
+  global_State *g = G(L);
+  GCSweeper *sw = g->sweeper;
+  GCObject *dead;
+  lu_mem freed;
+  l_mutex_lock(&sw->lock);
+  if (sw->busy && !wait) {
+    l_mutex_unlock(&sw->lock);
+    return 0;
+  }
+  while (sw->busy)
+    l_cond_wait(&sw->done, &sw->lock);
+  l_mutex_unlock(&sw->lock);
+  if (sw->survivors != NULL) {
+    if (g->allgc == NULL)  /* no new objects? */
+      g->allgc = sw->survivors;
+    else
+      g->sweeptail->next = sw->survivors;
+  }
+  g->bgsweeping = 0;
+  dead = sw->deadthreads;
+  sw->survivors = sw->deadthreads = NULL;
+  freed = sw->freed - L->nfreed;
+  while (dead != NULL) {
+    GCObject *next = dead->next;
+    freeobj(L, dead);
+    dead = next;
+  }
+  freed += L->nfreed;
+  if (g->gcstats)
+    g->gcstats->swept += sw->freed;
+  /* objects created meanwhile are not in the estimate, as in a serial sweep */
+  g->GCestimate = (g->GCestimate > freed) ? g->GCestimate - freed : 0;
+  return 1;
+}
+
+
+/**
+ * @brief Turns background sweeping on or off.
+ *
+ * Experimental, off by default: on a single core the sweeper only
+ * competes with the mutator, and the longest pauses get longer.
+ * The sweeper is started the first time; turned off, it just stays
+ * idle (a sweep already handed to it still finishes normally).
+ *
+ * @param L The Lua state.
+ * @param on Non-zero to sweep 'allgc' in a background thread.
+ */
+void luaC_setbgsweep (lua_State *L, int on) {
+  global_State *g = G(L);
+  lua_State *L1 = NULL;
+  if (on && g->sweeper == NULL) {
+    L1 = lua_newthread(L);  /* thread for the sweeper (may raise an error) */
+    luaC_fix(L, obj2gco(L1));
+    L->top.p--;  /* it is fixed; no need to keep it in the stack */
+  }
+  l_mutex_lock(&g->lock);
+  if (L1 != NULL && g->sweeper == NULL)
+    g->sweeper = startsweeper(L1);
+  g->gcbgsweep = (on && g->sweeper != NULL);
+  l_mutex_unlock(&g->lock);
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Telemetry
+** =======================================================
+*/
+
+/*
+** While 'g->gcstats' is set (see 'luaC_setstats'), each call into the
+** collector from 'luaC_step' or 'luaC_fullgc' is timed as a pause and
+** kept in a ring with the most recent ones. Inside a pause in
+** incremental mode, 'singlestep' notes phase changes, so that the time
+** is split among phases; generational collections are timed only as
+** whole pauses. With the telemetry off, each hook costs a single test
+** of 'g->gcstats'. Everything here runs with 'g->lock' held.
+*/
+
+static double gcclock (void) {
+#if defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#else
+  return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+
+static int phaseof (int state) {
+  switch (state) {
+    case GCSenteratomic: case GCSatomic: return GCPHATOMIC;
+    case GCScallfin: return GCPHCALLFIN;
+    default:
+      return (GCSswpallgc <= state && state <= GCSswpend) ? GCPHSWEEP
+                                                           : GCPHPROPAGATE;
+  }
+}
+
+
+/* Charges the time since the last change to the phase being timed. */
+static void closephase (GCStats *st, double now) {
+  if (st->phase >= 0) {
+    double d = now - st->phasestart;
+    st->phasetime[st->phase] += d;
+    if (d > st->phasemax[st->phase])
+      st->phasemax[st->phase] = d;
+  }
+  st->phasestart = now;
+}
+
+
+/* Called by 'singlestep' before each step. */
+static void notephase (global_State *g) {
+  GCStats *st = g->gcstats;
+  int phase = phaseof(g->gcstate);
+  if (st->phase >= 0 && phase != st->phase) {  /* timing a new phase? */
+    closephase(st, gcclock());
+    st->phase = phase;
+  }
+}
+
+
+/* Called when an incremental cycle finishes its sweep. */
+static void statcycle (global_State *g) {
+  GCStats *st = g->gcstats;
+  st->ncycles++;
+  st->lastmarked = g->GCestimate;  /* what survived the cycle */
+  st->marked += st->lastmarked;
+}
+
+
+/* Called after a minor or major generational collection. */
+static void statgen (global_State *g, int major) {
+  GCStats *st = g->gcstats;
+  if (major)
+    st->nmajor++;
+  else
+    st->nminor++;
+  st->lastmarked = gettotalbytes(g);
+  st->marked += st->lastmarked;
+}
+
+
+/*
+** Runs 'f' as a pause of the given kind (a plain step that did a
+** minor or major collection is recorded as such). If a finalizer
+** switched the telemetry during the pause, the pause is not recorded.
+*/
+static void timedpause (lua_State *L, global_State *g, int kind,
+                        void (*f) (lua_State *L, global_State *g)) {
+  GCStats *st = g->gcstats;
+  lu_mem nfreed = L->nfreed;
+  lu_mem ncycles = st->ncycles;
+  lu_mem nminor = st->nminor;
+  lu_mem nmajor = st->nmajor;
+  double start = gcclock();
+  double now;
+  GCPause *p;
+  st->phase = isdecGCmodegen(g) ? -1 : phaseof(g->gcstate);
+  st->phasestart = start;
+  f(L, g);
+  if (g->gcstats != st)  /* telemetry switched meanwhile? */
+    return;
+  now = gcclock();
+  closephase(st, now);
+  st->phase = -1;
+  if (kind != GCPSTEP && st->ncycles == ncycles &&
+      st->nminor == nminor && st->nmajor == nmajor)
+    statgen(g, 1);  /* full GC in generational mode after a bad major one */
+  if (kind == GCPSTEP)
+    kind = (st->nmajor != nmajor) ? GCPMAJOR
+         : (st->nminor != nminor) ? GCPMINOR : GCPSTEP;
+  st->npauses[kind]++;
+  st->pausetime += now - start;
+  st->swept += L->nfreed - nfreed;
+  p = &st->ring[st->nring++ % GCSTATSRING];
+  p->time = now - start;
+  p->kind = kind;
+}
+
+
+/**
+ * @brief Turns the collector telemetry on (cleared) or off.
+ *
+ * @param L The Lua state.
+ * @param on Non-zero to record collector metrics.
+ */
+void luaC_setstats (lua_State *L, int on) {
+  global_State *g = G(L);
+  GCStats *st = NULL;
+  if (on && (st = cast(GCStats *, calloc(1, sizeof(GCStats)))) != NULL)
+    st->phase = -1;  /* not inside a pause */
+  l_mutex_lock(&g->lock);
+  free(g->gcstats);
+  g->gcstats = st;
+  l_mutex_unlock(&g->lock);
+}
+
+
+/**
+ * @brief Copies the collector telemetry.
+ *
+ * @param L The Lua state.
+ * @param s Receives the metrics.
+ * @return 1 if the telemetry is on; 0 otherwise.
+ */
+int luaC_getstats (lua_State *L, GCStats *s) {
+  global_State *g = G(L);
+  int on;
+  l_mutex_lock(&g->lock);
+  on = (g->gcstats != NULL);
+  if (on)
+    *s = *g->gcstats;
+  l_mutex_unlock(&g->lock);
+  return on;
+}
+
+/* }====================================================== */
+
+
 /*
 ** {===========================================
 ** Finalization
@@ -1122,11 +2098,9 @@ static GCObject **sweeptolive (lua_State *L, GCObject **p) {
  */
 static void checkSizes (lua_State *L, global_State *g) {
   if (!g->gcemergency) {
-    if (g->strt.nuse < g->strt.size / 4) {  /* string table too big? */
-      l_mem olddebt = l_atomic_load(&g->GCdebt);
-      luaS_resize(L, g->strt.size / 2);
-      g->GCestimate += l_atomic_load(&g->GCdebt) - olddebt;  /* correct estimate */
-    }
+    l_mem olddebt = l_atomic_load(&g->GCdebt);
+    luaS_shrink(L);  /* shrink shards that are too big */
+    g->GCestimate += l_atomic_load(&g->GCdebt) - olddebt;  /* correct estimate */
   }
 }
 
@@ -1309,6 +2283,9 @@ void luaC_checkfinalizer (lua_State *L, GCObject *o, GCObject *mt) {
     return;  /* nothing to be done */
   else {  /* move 'o' to 'finobj' list */
     GCObject **p;
+    l_mutex_lock(&g->lock);
+    luaC_splicenurseries(L);  /* 'o' may still be in a nursery */
+    finishbgsweep(L);  /* 'o' may be with the sweeper */
     if (issweepphase(g)) {
       makewhite(g, o);  /* "sweep" object 'o' */
       if (g->sweepgc == &o->next)  /* should not remove 'sweepgc' object */
@@ -1322,6 +2299,7 @@ void luaC_checkfinalizer (lua_State *L, GCObject *o, GCObject *mt) {
     o->next = g->finobj;  /* link it in 'finobj' list */
     g->finobj = o;
     l_setbit(o->marked, FINALIZEDBIT);  /* mark it as such */
+    l_mutex_unlock(&g->lock);
   }
 }
 
@@ -1602,6 +2580,8 @@ static void youngcollection (lua_State *L, global_State *g) {
 
   sweepgen(L, g, &g->tobefnz, NULL, &dummy);
   finishgencycle(L, g);
+  if (g->gcstats)
+    statgen(g, 0);
 }
 
 
@@ -1716,8 +2696,12 @@ void luaC_changemode (lua_State *L, int newmode) {
  * @return The number of objects traversed.
  */
 static lu_mem fullgen (lua_State *L, global_State *g) {
+  lu_mem numobjs;
   enterinc(g);
-  return entergen(L, g);
+  numobjs = entergen(L, g);
+  if (g->gcstats)
+    statgen(g, 1);
+  return numobjs;
 }
 
 
@@ -1763,6 +2747,8 @@ static void stepgenfull (lua_State *L, global_State *g) {
     setpause(g);
     g->lastatomic = newatomic;
   }
+  if (g->gcstats)
+    statgen(g, 1);
 }
 
 
@@ -1840,7 +2826,10 @@ static void entersweep (lua_State *L) {
   global_State *g = G(L);
   g->gcstate = GCSswpallgc;
   lua_assert(g->sweepgc == NULL);
-  g->sweepgc = sweeptolive(L, &g->allgc);
+  if (g->gcbgsweep && g->gckind == KGC_INC && !g->gcemergency)
+    startbgsweep(g);  /* 'allgc' is swept in the background */
+  else
+    g->sweepgc = sweeptolive(L, &g->allgc);
 }
 
 
@@ -1867,6 +2856,8 @@ static void deletelist (lua_State *L, GCObject *p, GCObject *limit) {
  */
 void luaC_freeallobjects (lua_State *L) {
   global_State *g = G(L);
+  luaC_splicenurseries(L);
+  finishbgsweep(L);
   g->gcstp = GCSTPCLS;  /* no extra finalizers after here */
   luaC_changemode(L, KGC_INC);
   separatetobefnz(g, 1);  /* separate all objects with finalizers */
@@ -1874,8 +2865,14 @@ void luaC_freeallobjects (lua_State *L) {
   callallpendingfinalizers(L);
   deletelist(L, g->allgc, obj2gco(g->mainthread));
   lua_assert(g->finobj == NULL);  /* no new finalizers */
+  if (g->sweeper != NULL)
+    stopsweeper(g);  /* before its thread goes with 'fixedgc' */
   deletelist(L, g->fixedgc, NULL);  /* collect fixed objects */
-  lua_assert(g->strt.nuse == 0);
+  lua_assert(luaS_nuse(g) == 0);
+  if (g->markers != NULL)
+    stopmarkers(g);
+  free(g->gcstats);
+  g->gcstats = NULL;
 }
 
 
@@ -1890,6 +2887,7 @@ static lu_mem atomic (lua_State *L) {
   lu_mem work = 0;
   GCObject *origweak, *origall;
   GCObject *grayagain = g->grayagain;  /* save original list */
+  luaC_splicenurseries(L);
   g->grayagain = NULL;
   lua_assert(g->ephemeron == NULL && g->weak == NULL);
   lua_assert(!iswhite(g->mainthread));
@@ -1965,6 +2963,8 @@ static lu_mem singlestep (lua_State *L) {
   lu_mem work;
   lua_assert(!g->gcstopem);  /* collector is not reentrant */
   g->gcstopem = 1;  /* no emergency collections while collecting */
+  if (g->gcstats)
+    notephase(g);
   switch (g->gcstate) {
     case GCSpause: {
       restartcollection(g);
@@ -1983,12 +2983,17 @@ static lu_mem singlestep (lua_State *L) {
     }
     case GCSenteratomic: {
       work = atomic(L);  /* work is what was traversed by 'atomic' */
-      entersweep(L);
       g->GCestimate = gettotalbytes(g);  /* first estimate */
+      entersweep(L);
       break;
     }
     case GCSswpallgc: {  /* sweep "regular" objects */
-      work = sweepstep(L, g, GCSswpfinobj, &g->finobj);
+      if (g->bgsweeping) {  /* the sweeper has them? */
+        work = sweepcredit(g, 0);  /* what it swept since last step */
+        endbgsweep(L, 0);  /* take them back if it is done */
+      }
+      else
+        work = sweepstep(L, g, GCSswpfinobj, &g->finobj);
       break;
     }
     case GCSswpfinobj: {  /* sweep objects with finalizers */
@@ -2000,6 +3005,8 @@ static lu_mem singlestep (lua_State *L) {
       break;
     }
     case GCSswpend: {  /* finish sweeps */
+      if (g->gcstats && !isdecGCmodegen(g))
+        statcycle(g);
       checkSizes(L, g);
       luaM_poolgc(L);  /* 回收内存池缓存 */
       g->gcstate = GCScallfin;
@@ -2032,8 +3039,10 @@ static lu_mem singlestep (lua_State *L) {
  */
 void luaC_runtilstate (lua_State *L, int statesmask) {
   global_State *g = G(L);
-  while (!testbit(statesmask, g->gcstate))
+  while (!testbit(statesmask, g->gcstate)) {
+    finishbgsweep(L);
     singlestep(L);
+  }
 }
 
 
@@ -2059,6 +3068,11 @@ static void incstep (lua_State *L, global_State *g) {
   do {  /* repeat until pause or enough "credit" (negative debt) */
     lu_mem work = singlestep(L);  /* perform one single step */
     debt -= work;
+    if (g->bgsweeping) {  /* the sweeper does the sweep work? */
+      if (debt > -stepsize)  /* not paid by what it swept so far? */
+        debt -= sweepcredit(g, debt + stepsize);  /* wait for it */
+      break;
+    }
   } while (debt > -stepsize && g->gcstate != GCSpause);
   if (g->gcstate == GCSpause)
     setpause(g);  /* pause until next cycle */
@@ -2068,6 +3082,14 @@ static void incstep (lua_State *L, global_State *g) {
   }
 }
 
+static void collectstep (lua_State *L, global_State *g) {
+  if(isdecGCmodegen(g))
+    genstep(L, g);
+  else
+    incstep(L, g);
+}
+
+
 /**
  * @brief Performs a basic GC step if collector is running.
  *
@@ -2078,14 +3100,13 @@ static void incstep (lua_State *L, global_State *g) {
 void luaC_step (lua_State *L) {
   global_State *g = G(L);
   l_mutex_lock(&g->lock);
+  luaC_splicenurseries(L);
   if (!gcrunning(g))  /* not running? */
     luaE_setdebt(g, -2000);
-  else {
-    if(isdecGCmodegen(g))
-      genstep(L, g);
-    else
-      incstep(L, g);
-  }
+  else if (l_unlikely(g->gcstats != NULL))
+    timedpause(L, g, GCPSTEP, collectstep);
+  else
+    collectstep(L, g);
   l_mutex_unlock(&g->lock);
 }
 
@@ -2116,6 +3137,14 @@ static void fullinc (lua_State *L, global_State *g) {
 }
 
 
+static void fullcollection (lua_State *L, global_State *g) {
+  if (g->gckind == KGC_INC)
+    fullinc(L, g);
+  else
+    fullgen(L, g);
+}
+
+
 /**
  * @brief Performs a full GC cycle.
  *
@@ -2125,12 +3154,13 @@ static void fullinc (lua_State *L, global_State *g) {
 void luaC_fullgc (lua_State *L, int isemergency) {
   global_State *g = G(L);
   l_mutex_lock(&g->lock);
+  luaC_splicenurseries(L);
   lua_assert(!g->gcemergency);
   g->gcemergency = isemergency;  /* set flag */
-  if (g->gckind == KGC_INC)
-    fullinc(L, g);
+  if (l_unlikely(g->gcstats != NULL))
+    timedpause(L, g, isemergency ? GCPEMERGENCY : GCPFULL, fullcollection);
   else
-    fullgen(L, g);
+    fullcollection(L, g);
   luaM_poolgc(L);  /* 回收内存池缓存 */
   g->gcemergency = 0;
   l_mutex_unlock(&g->lock);
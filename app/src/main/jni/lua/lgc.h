@@ -206,6 +206,63 @@
 #define gcrunning(g)	((g)->gcstp == 0)
 
 
+/**
+ * @name GC Telemetry
+ * Phases timed by the telemetry (see 'luaC_setstats') and kinds of the
+ * pauses it records.
+ * @{
+ */
+#define GCPHPROPAGATE	0  /**< Propagate (and restart) */
+#define GCPHATOMIC	1  /**< Atomic */
+#define GCPHSWEEP	2  /**< Sweep (of all lists) */
+#define GCPHCALLFIN	3  /**< Calls to finalizers */
+#define GCNPHASES	4
+
+#define GCPSTEP		0  /**< Incremental step */
+#define GCPMINOR	1  /**< Step with a minor (young) collection */
+#define GCPMAJOR	2  /**< Step with a major collection */
+#define GCPFULL		3  /**< Full collection ('collectgarbage()') */
+#define GCPEMERGENCY	4  /**< Emergency collection */
+#define GCNPAUSES	5
+
+/* number of recent pauses kept by the telemetry */
+#if !defined(GCSTATSRING)
+#define GCSTATSRING	512
+#endif
+/** @} */
+
+
+/**
+ * @brief A collector pause (one call into the collector).
+ */
+typedef struct GCPause {
+  double time;  /**< Wall time, in seconds. */
+  int kind;  /**< Kind of pause (GCPSTEP, ...). */
+} GCPause;
+
+
+/**
+ * @brief Collector telemetry, kept while enabled.
+ */
+typedef struct GCStats {
+  double phasetime[GCNPHASES];  /**< Wall time spent in each phase. */
+  double phasemax[GCNPHASES];  /**< Longest stretch of each phase in a
+                                   single pause. */
+  double pausetime;  /**< Total wall time of all pauses. */
+  lu_mem npauses[GCNPAUSES];  /**< Number of pauses of each kind. */
+  lu_mem ncycles;  /**< Incremental cycles finished (up to their sweep). */
+  lu_mem nminor;  /**< Minor generational collections. */
+  lu_mem nmajor;  /**< Major generational collections. */
+  lu_mem marked;  /**< Bytes found alive, summed over collections. */
+  lu_mem lastmarked;  /**< Bytes found alive by the last collection. */
+  lu_mem swept;  /**< Bytes freed by the collector. */
+  GCPause ring[GCSTATSRING];  /**< Most recent pauses. */
+  lu_mem nring;  /**< Number of pauses ever put in 'ring'. */
+  int phase;  /**< Phase being timed (-1: none). */
+  double phasestart;  /**< When 'phase' started being timed. */
+} GCStats;
+
+
 /**
  * @brief Does one step of collection when debt becomes positive.
  *
@@ -298,6 +355,53 @@ LUAI_FUNC GCObject *luaC_newobj (lua_State *L, int tt, size_t sz);
 LUAI_FUNC GCObject *luaC_newobjdt (lua_State *L, int tt, size_t sz,
                                                  size_t offset);
 
+/**
+ * @brief Hands an object allocated outside 'luaC_newobj' to the collector.
+ *
+ * Used for short strings, which are published in the string table
+ * before the collector knows about them.
+ *
+ * @param L The Lua state.
+ * @param o The object (with its tag and color already set).
+ */
+LUAI_FUNC void luaC_linkobj (lua_State *L, GCObject *o);
+
+/**
+ * @brief Moves the objects of all thread nurseries into 'allgc'.
+ * @param L The Lua state (with 'g->lock' held).
+ */
+LUAI_FUNC void luaC_splicenurseries (lua_State *L);
+
+/**
+ * @brief Sets the number of threads used for marking (see
+ * LUA_GCPMARKTHREADS).
+ * @param L The Lua state.
+ * @param n Number of threads; 0 or 1 makes marking serial.
+ */
+LUAI_FUNC void luaC_setmarkthreads (lua_State *L, int n);
+
+/**
+ * @brief Turns background sweeping on or off (see LUA_GCPBGSWEEP).
+ * @param L The Lua state.
+ * @param on Non-zero to sweep 'allgc' in a background thread.
+ */
+LUAI_FUNC void luaC_setbgsweep (lua_State *L, int on);
+
+/**
+ * @brief Turns the collector telemetry on (cleared) or off.
+ * @param L The Lua state.
+ * @param on Non-zero to record collector metrics.
+ */
+LUAI_FUNC void luaC_setstats (lua_State *L, int on);
+
+/**
+ * @brief Copies the collector telemetry.
+ * @param L The Lua state.
+ * @param s Receives the metrics.
+ * @return 1 if the telemetry is on; 0 otherwise ('s' is untouched).
+ */
+LUAI_FUNC int luaC_getstats (lua_State *L, GCStats *s);
+
 /**
  * @brief Barrier for object modification.
  *
@@ -89,6 +89,7 @@ static const luaL_Reg stdlibs[] = {
   {LUA_STRUCTLIBNAME, luaopen_struct},
   {"bit32", luaopen_bit},
   {"thread", luaopen_thread},
+  {LUA_ASYNCLIBNAME, luaopen_asyncio},
   {"http", luaopen_http},
   {LUA_FSLIBNAME, luaopen_fs},
   {"vmprotect", luaopen_vmprotect},
@@ -156,6 +157,7 @@ static const luaL_Reg loadedlibs[] = {
   {LUA_STRUCTLIBNAME, luaopen_struct},
   {"bit32", luaopen_bit},
   {"thread", luaopen_thread},
+  {LUA_ASYNCLIBNAME, luaopen_asyncio},
   {"http", luaopen_http},
   {LUA_FSLIBNAME, luaopen_fs},
   {"vmprotect", luaopen_vmprotect},
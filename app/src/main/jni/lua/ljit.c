@@ -0,0 +1,991 @@
+/*
+** $Id: ljit.c $
+** Baseline JIT compiler for Lua functions
+** See Copyright Notice in lua.h
+*/
+
+#define ljit_c
+#define LUA_CORE
+
+#include "lprefix.h"
+
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lua.h"
+
+#include "ldebug.h"
+#include "ljit.h"
+#include "lobfuscate.h"
+#include "lopcodes.h"
+#include "lstate.h"
+
+#if LUA_USE_JIT
+#include <sys/mman.h>
+#endif
+
+
+
+#if LUA_USE_JIT
+
+/*
+** {======================================================
+** Code generation
+**
+** Each instruction is translated into a fixed machine-code template.
+** Native code keeps no state of its own between instructions: every
+** template reads and writes the Lua stack directly, so execution can
+** enter at any translated instruction and leave before any instruction.
+** Templates never call the runtime (no allocation, no errors, no
+** metamethods); whatever they cannot do, including a failed type guard
+** or an integer overflow, is a "side exit" back to the interpreter at
+** the current instruction, which then runs it as usual.
+**
+** Native code runs as
+**   int f (StkId base, UpVal **upvals, l_signalT *trap, void *start)
+** and returns the index of the next instruction to interpret.
+** =======================================================
+*/
+
+/* x86-64 registers */
+#define RAX	0
+#define RCX	1
+#define RDX	2
+#define RSP	4
+#define RBX	3
+#define R13	13
+#define R14	14
+#define XMM0	0
+#define XMM1	1
+
+/* registers with the frame state inside native code */
+#define RBASE	RBX	/* 'base' */
+#define RTRAP	R13	/* '&ci->u.l.trap' */
+#define RUPV	R14	/* 'cl->upvals' */
+
+/* condition codes */
+#define CC_O	0x0
+#define CC_AE	0x3
+#define CC_E	0x4
+#define CC_NE	0x5
+#define CC_BE	0x6
+#define CC_A	0x7
+#define CC_NS	0x9
+#define CC_P	0xA
+#define CC_L	0xC
+#define CC_GE	0xD
+#define CC_LE	0xE
+#define CC_G	0xF
+#define CC_ALWAYS	(-1)
+
+/* opcodes (two-byte ones include their 0x0F escape) */
+#define X_ADDSTORE	0x01
+#define X_ADD		0x03
+#define X_SUB		0x2B
+#define X_XORSTORE	0x31
+#define X_CMP		0x3B
+#define X_TEST		0x85
+#define X_MOVSTORE8	0x88
+#define X_MOVSTORE	0x89
+#define X_MOVLOAD	0x8B
+#define X_GRP1_8	0x80	/* cmp r/m8, imm8 (/7) */
+#define X_GRP1_S8	0x83	/* cmp r/m32, imm8 (/7) */
+#define X_MOVIMM8	0xC6	/* mov r/m8, imm8 (/0) */
+#define X_MOVZX8	0x0FB6
+#define X_IMUL		0x0FAF
+#define X_MOVSD		0x0F10	/* F2: load; 0x0F11: store */
+#define X_CVTSI2SD	0x0F2A	/* F2 */
+#define X_UCOMISD	0x0F2E	/* 66 */
+#define X_ADDSD		0x0F58	/* F2 */
+#define X_MULSD		0x0F59	/* F2 */
+#define X_SUBSD		0x0F5C	/* F2 */
+#define X_DIVSD		0x0F5E	/* F2 */
+#define X_MOVQ		0x0F6E	/* 66 REX.W: movq xmm, r64 */
+
+/* offsets in the Lua stack */
+#define SLOT(r)		cast_int(cast_sizet(r) * sizeof(StackValue))
+#define TT		cast_int(offsetof(TValue, tt_))
+
+
+typedef int (*JitFunction) (StkId base, UpVal **upvals,
+                            volatile l_signalT *trap, void *start);
+
+
+typedef struct Fixup {
+  size_t pos;  /* position of a 'rel32' field */
+  int pc;  /* target instruction */
+  int toexit;  /* true: target is the exit stub of 'pc' */
+} Fixup;
+
+
+typedef struct JitState {
+  unsigned char *buff;  /* code being generated */
+  size_t n;  /* number of bytes in 'buff' */
+  size_t size;  /* size of 'buff' */
+  const Proto *p;
+  unsigned int *label;  /* code offset of each instruction */
+  Fixup *fix;  /* pending jumps */
+  int nfix;
+  int sizefix;
+  int pc;  /* instruction being translated */
+  int failed;  /* memory error during generation */
+} JitState;
+
+
+static void emit (JitState *J, const void *s, size_t l) {
+  if (J->failed)
+    return;
+  if (J->n + l > J->size) {
+    size_t nsize = (J->size + l) * 2;
+    unsigned char *nb = (unsigned char *)realloc(J->buff, nsize);
+    if (nb == NULL) {
+      J->failed = 1;
+      return;
+    }
+    J->buff = nb;
+    J->size = nsize;
+  }
+  memcpy(J->buff + J->n, s, l);
+  J->n += l;
+}
+
+
+static void emit1 (JitState *J, int b) {
+  unsigned char c = cast_byte(b);
+  emit(J, &c, 1);
+}
+
+
+static void emit4 (JitState *J, l_uint32 v) {
+  emit(J, &v, 4);  /* x86 is little endian */
+}
+
+
+static void emit8 (JitState *J, l_uint64 v) {
+  emit(J, &v, 8);
+}
+
+
+static void emitop (JitState *J, int prefix, int w, int op, int reg, int rm) {
+  int rex = 0x40 | (w << 3) | ((reg >> 3) << 2) | (rm >> 3);
+  if (prefix)
+    emit1(J, prefix);
+  if (rex != 0x40)
+    emit1(J, rex);
+  if (op > 0xFF)
+    emit1(J, op >> 8);
+  emit1(J, op & 0xFF);
+}
+
+
+/* 'op reg, [base + disp]' (or the reverse, as 'op' defines) */
+static void emitmem (JitState *J, int prefix, int w, int op, int reg,
+                     int base, int disp) {
+  emitop(J, prefix, w, op, reg, base);
+  emit1(J, 0x80 | ((reg & 7) << 3) | (base & 7));  /* mod = 10 (disp32) */
+  if ((base & 7) == RSP)
+    emit1(J, 0x24);  /* SIB for a base-only address */
+  emit4(J, cast(l_uint32, disp));
+}
+
+
+/* 'op reg, rm' with two registers */
+static void emitreg (JitState *J, int prefix, int w, int op, int reg, int rm) {
+  emitop(J, prefix, w, op, reg, rm);
+  emit1(J, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+
+/* mov reg, imm64 */
+static void emitmovimm (JitState *J, int reg, l_uint64 v) {
+  emit1(J, 0x48 | (reg >> 3));
+  emit1(J, 0xB8 | (reg & 7));
+  emit8(J, v);
+}
+
+
+/* load the bits of a float constant into an xmm register */
+static void emitfltimm (JitState *J, int xmm, lua_Number n) {
+  l_uint64 bits;
+  memcpy(&bits, &n, sizeof(bits));
+  emitmovimm(J, RAX, bits);
+  emitreg(J, 0x66, 1, X_MOVQ, xmm, RAX);
+}
+
+
+/* cmp byte [slot tag], tag */
+static void emittagcmp (JitState *J, int slot, int tag) {
+  emitmem(J, 0, 0, X_GRP1_8, 7, RBASE, SLOT(slot) + TT);
+  emit1(J, tag);
+}
+
+
+/* mov byte [slot tag], tag */
+static void emitsettag (JitState *J, int slot, int tag) {
+  emitmem(J, 0, 0, X_MOVIMM8, 0, RBASE, SLOT(slot) + TT);
+  emit1(J, tag);
+}
+
+
+/* copy a TValue from [src + disp] into stack slot 'slot' */
+static void emitcopy (JitState *J, int slot, int src, int disp) {
+  emitmem(J, 0, 1, X_MOVLOAD, RCX, src, disp);
+  emitmem(J, 0, 1, X_MOVSTORE, RCX, RBASE, SLOT(slot));
+  emitmem(J, 0, 0, X_MOVZX8, RCX, src, disp + TT);
+  emitmem(J, 0, 0, X_MOVSTORE8, RCX, RBASE, SLOT(slot) + TT);
+}
+
+
+/* conditional (or unconditional) jump to instruction 'pc' or its exit */
+static void emitjump (JitState *J, int cc, int pc, int toexit) {
+  if (J->failed)
+    return;
+  if (cc == CC_ALWAYS)
+    emit1(J, 0xE9);
+  else {
+    emit1(J, 0x0F);
+    emit1(J, 0x80 | cc);
+  }
+  if (J->nfix >= J->sizefix) {
+    int nsize = (J->sizefix + 8) * 2;
+    Fixup *nf = (Fixup *)realloc(J->fix, cast_sizet(nsize) * sizeof(Fixup));
+    if (nf == NULL) {
+      J->failed = 1;
+      return;
+    }
+    J->fix = nf;
+    J->sizefix = nsize;
+  }
+  J->fix[J->nfix].pos = J->n;
+  J->fix[J->nfix].pc = pc;
+  J->fix[J->nfix].toexit = toexit;
+  J->nfix++;
+  emit4(J, 0);
+}
+
+
+/* leave native code at the current instruction */
+#define sideexit(J,cc)	emitjump(J, cc, (J)->pc, 1)
+
+
+/* local forward jump; returns the position to be patched by 'here' */
+static size_t emitjcc (JitState *J, int cc) {
+  size_t pos;
+  if (cc == CC_ALWAYS)
+    emit1(J, 0xE9);
+  else {
+    emit1(J, 0x0F);
+    emit1(J, 0x80 | cc);
+  }
+  pos = J->n;
+  emit4(J, 0);
+  return pos;
+}
+
+
+static void here (JitState *J, size_t pos) {
+  if (!J->failed) {
+    l_uint32 rel = cast(l_uint32, J->n - (pos + 4));
+    memcpy(J->buff + pos, &rel, 4);
+  }
+}
+
+
+/*
+** Go to instruction 'target'. Backward jumps first check the frame's
+** trap, so that hooks and signals are served by the interpreter.
+*/
+static void emitgoto (JitState *J, int target) {
+  if (target <= J->pc) {
+    emitmem(J, 0, 0, X_GRP1_S8, 7, RTRAP, 0);
+    emit1(J, 0);
+    emitjump(J, CC_NE, target, 1);
+  }
+  emitjump(J, CC_ALWAYS, target, 0);
+}
+
+
+/* go to 'ontrue' if condition 'cc' holds, otherwise to 'onfalse' */
+static void emitbranch (JitState *J, int cc, int ontrue, int onfalse) {
+  size_t t = emitjcc(J, cc);
+  emitgoto(J, onfalse);
+  here(J, t);
+  emitgoto(J, ontrue);
+}
+
+
+/*
+** Test instruction followed by its jump: when the condition (computed
+** by condition code 'cc') differs from 'k', skip the jump; otherwise
+** take it.
+*/
+static void emitcondjump (JitState *J, Instruction i, int cc) {
+  int skip = J->pc + 2;
+  int target = J->pc + 2 + GETARG_sJ(J->p->code[J->pc + 1]);
+  if (GETARG_k(i))
+    emitbranch(J, cc, target, skip);
+  else
+    emitbranch(J, cc, skip, target);
+}
+
+
+/* same, for a float equality ('ucomisd' just done) */
+static void emitcondeqf (JitState *J, Instruction i) {
+  int skip = J->pc + 2;
+  int target = J->pc + 2 + GETARG_sJ(J->p->code[J->pc + 1]);
+  int ontrue = GETARG_k(i) ? target : skip;
+  int onfalse = GETARG_k(i) ? skip : target;
+  size_t unord = emitjcc(J, CC_P);  /* NaN: not equal */
+  size_t eq = emitjcc(J, CC_E);
+  here(J, unord);
+  emitgoto(J, onfalse);
+  here(J, eq);
+  emitgoto(J, ontrue);
+}
+
+
+/*
+** Set ZF if the value in 'slot' is false or nil, leaving the result in
+** the positions returned in 'f1'/'f2' (both jump when false).
+*/
+static void emitisfalse (JitState *J, int slot, size_t *f1, size_t *f2) {
+  emitmem(J, 0, 0, X_MOVZX8, RAX, RBASE, SLOT(slot) + TT);
+  emit1(J, 0xA8);  /* test al, 0x0F (nil variants) */
+  emit1(J, 0x0F);
+  *f1 = emitjcc(J, CC_E);
+  emit1(J, 0x3C);  /* cmp al, LUA_VFALSE */
+  emit1(J, LUA_VFALSE);
+  *f2 = emitjcc(J, CC_E);
+}
+
+
+/* an operand of an arithmetic instruction: register or constant */
+typedef struct Operand {
+  int reg;  /* register, or -1 for a constant */
+  TValue k;  /* constant value */
+} Operand;
+
+
+static Operand regop (int r) {
+  Operand o;
+  o.reg = r;
+  setnilvalue(&o.k);
+  return o;
+}
+
+
+static Operand constop (const TValue *v) {
+  Operand o;
+  o.reg = -1;
+  o.k = *v;
+  return o;
+}
+
+
+/* load operand as an integer into 'reg' (type already checked) */
+static void loadint (JitState *J, int reg, const Operand *o) {
+  if (o->reg >= 0)
+    emitmem(J, 0, 1, X_MOVLOAD, reg, RBASE, SLOT(o->reg));
+  else
+    emitmovimm(J, reg, l_castS2U(ivalue(&o->k)));
+}
+
+
+/* load operand as a float into 'xmm', converting an integer */
+static void loadnum (JitState *J, int xmm, const Operand *o) {
+  if (o->reg < 0) {
+    lua_Number n = ttisinteger(&o->k) ? cast_num(ivalue(&o->k))
+                                      : fltvalue(&o->k);
+    emitfltimm(J, xmm, n);
+  }
+  else {
+    size_t notflt, done;
+    emittagcmp(J, o->reg, LUA_VNUMFLT);
+    notflt = emitjcc(J, CC_NE);
+    emitmem(J, 0xF2, 0, X_MOVSD, xmm, RBASE, SLOT(o->reg));
+    done = emitjcc(J, CC_ALWAYS);
+    here(J, notflt);
+    emittagcmp(J, o->reg, LUA_VNUMINT);
+    sideexit(J, CC_NE);
+    emitmem(J, 0xF2, 1, X_CVTSI2SD, xmm, RBASE, SLOT(o->reg));
+    here(J, done);
+  }
+}
+
+
+/*
+** R[a] := x op y, followed by an OP_MMBIN* that is skipped on success.
+** Integers use 'iop' (with overflow check, as an overflow produces a
+** big integer); other numbers are converted to floats for 'fop'. 'iop'
+** is zero for operations that are always done on floats.
+*/
+static void emitarith (JitState *J, int a, Operand x, Operand y,
+                       int iop, int fop) {
+  if (iop != 0 && (x.reg >= 0 || ttisinteger(&x.k)) &&
+                  (y.reg >= 0 || ttisinteger(&y.k))) {
+    size_t notint1 = 0, notint2 = 0;
+    if (x.reg >= 0) {
+      emittagcmp(J, x.reg, LUA_VNUMINT);
+      notint1 = emitjcc(J, CC_NE);
+    }
+    if (y.reg >= 0) {
+      emittagcmp(J, y.reg, LUA_VNUMINT);
+      notint2 = emitjcc(J, CC_NE);
+    }
+    loadint(J, RAX, &x);
+    loadint(J, RCX, &y);
+    emitreg(J, 0, 1, iop, RAX, RCX);
+    sideexit(J, CC_O);
+    emitmem(J, 0, 1, X_MOVSTORE, RAX, RBASE, SLOT(a));
+    emitsettag(J, a, LUA_VNUMINT);
+    emitgoto(J, J->pc + 2);
+    if (notint1) here(J, notint1);
+    if (notint2) here(J, notint2);
+  }
+  loadnum(J, XMM0, &x);
+  loadnum(J, XMM1, &y);
+  emitreg(J, 0xF2, 0, fop, XMM0, XMM1);
+  emitmem(J, 0xF2, 0, X_MOVSD + 1, XMM0, RBASE, SLOT(a));
+  emitsettag(J, a, LUA_VNUMFLT);
+  emitgoto(J, J->pc + 2);
+}
+
+
+/*
+** R[a] := x % y for integers only (floats use 'fmod'), with Lua's
+** floor semantics. Divisors 0 and -1 are left to the interpreter (an
+** error and a case that traps in 'idiv', respectively).
+*/
+static void emitmod (JitState *J, int a, Operand x, Operand y) {
+  size_t store, samesign;
+  if ((x.reg < 0 && !ttisinteger(&x.k)) || (y.reg < 0 && !ttisinteger(&y.k))) {
+    sideexit(J, CC_ALWAYS);
+    return;
+  }
+  if (x.reg >= 0) {
+    emittagcmp(J, x.reg, LUA_VNUMINT);
+    sideexit(J, CC_NE);
+  }
+  if (y.reg >= 0) {
+    emittagcmp(J, y.reg, LUA_VNUMINT);
+    sideexit(J, CC_NE);
+  }
+  loadint(J, RAX, &x);
+  loadint(J, RCX, &y);
+  emitmem(J, 0, 1, 0x8D, RDX, RCX, 1);  /* lea rdx, [rcx + 1] */
+  emitreg(J, 0, 1, 0x83, 7, RDX);  /* cmp rdx, 1 */
+  emit1(J, 1);
+  sideexit(J, CC_BE);  /* divisor is 0 or -1 */
+  emit1(J, 0x48);  /* cqo */
+  emit1(J, 0x99);
+  emitreg(J, 0, 1, 0xF7, 7, RCX);  /* idiv rcx */
+  emitreg(J, 0, 1, X_TEST, RDX, RDX);
+  store = emitjcc(J, CC_E);
+  emitreg(J, 0, 1, X_MOVSTORE, RDX, RAX);  /* mov rax, rdx */
+  emitreg(J, 0, 1, X_XORSTORE, RCX, RAX);  /* xor rax, rcx */
+  samesign = emitjcc(J, CC_NS);
+  emitreg(J, 0, 1, X_ADDSTORE, RCX, RDX);  /* rdx += rcx */
+  here(J, store);
+  here(J, samesign);
+  emitmem(J, 0, 1, X_MOVSTORE, RDX, RBASE, SLOT(a));
+  emitsettag(J, a, LUA_VNUMINT);
+  emitgoto(J, J->pc + 2);
+}
+
+
+/* R[a] < R[b] (or <=): integers or floats, each without conversions */
+static void emitorder (JitState *J, Instruction i, int icc, int fcc) {
+  int a = GETARG_A(i);
+  int b = GETARG_B(i);
+  size_t notint;
+  emittagcmp(J, a, LUA_VNUMINT);
+  notint = emitjcc(J, CC_NE);
+  emittagcmp(J, b, LUA_VNUMINT);
+  sideexit(J, CC_NE);
+  emitmem(J, 0, 1, X_MOVLOAD, RAX, RBASE, SLOT(a));
+  emitmem(J, 0, 1, X_CMP, RAX, RBASE, SLOT(b));
+  emitcondjump(J, i, icc);
+  here(J, notint);
+  emittagcmp(J, a, LUA_VNUMFLT);
+  sideexit(J, CC_NE);
+  emittagcmp(J, b, LUA_VNUMFLT);
+  sideexit(J, CC_NE);
+  emitmem(J, 0xF2, 0, X_MOVSD, XMM0, RBASE, SLOT(b));
+  emitmem(J, 0x66, 0, X_UCOMISD, XMM0, RBASE, SLOT(a));
+  emitcondjump(J, i, fcc);  /* b > a, false when unordered */
+}
+
+
+/*
+** R[a] compared with an immediate. 'icc' is the integer condition;
+** 'rev' tells whether the float comparison has the immediate on the
+** left ('im > a' for '<'), and 'fcc' is its condition.
+*/
+static void emitorderI (JitState *J, Instruction i, int icc, int rev, int fcc) {
+  int a = GETARG_A(i);
+  int im = GETARG_sB(i);
+  size_t notint;
+  emittagcmp(J, a, LUA_VNUMINT);
+  notint = emitjcc(J, CC_NE);
+  emitmovimm(J, RCX, l_castS2U(cast(lua_Integer, im)));
+  emitmem(J, 0, 1, X_MOVLOAD, RAX, RBASE, SLOT(a));
+  emitreg(J, 0, 1, X_CMP, RAX, RCX);
+  emitcondjump(J, i, icc);
+  here(J, notint);
+  emittagcmp(J, a, LUA_VNUMFLT);
+  sideexit(J, CC_NE);
+  emitfltimm(J, XMM1, cast_num(im));
+  emitmem(J, 0xF2, 0, X_MOVSD, XMM0, RBASE, SLOT(a));
+  if (rev)
+    emitreg(J, 0x66, 0, X_UCOMISD, XMM1, XMM0);
+  else
+    emitreg(J, 0x66, 0, X_UCOMISD, XMM0, XMM1);
+  emitcondjump(J, i, fcc);
+}
+
+
+static void emitEQI (JitState *J, Instruction i) {
+  int a = GETARG_A(i);
+  int im = GETARG_sB(i);
+  size_t notint, notflt;
+  emittagcmp(J, a, LUA_VNUMINT);
+  notint = emitjcc(J, CC_NE);
+  emitmovimm(J, RCX, l_castS2U(cast(lua_Integer, im)));
+  emitmem(J, 0, 1, X_MOVLOAD, RAX, RBASE, SLOT(a));
+  emitreg(J, 0, 1, X_CMP, RAX, RCX);
+  emitcondjump(J, i, CC_E);
+  here(J, notint);
+  emittagcmp(J, a, LUA_VNUMFLT);
+  notflt = emitjcc(J, CC_NE);
+  emitfltimm(J, XMM1, cast_num(im));
+  emitmem(J, 0xF2, 0, X_MOVSD, XMM0, RBASE, SLOT(a));
+  emitreg(J, 0x66, 0, X_UCOMISD, XMM0, XMM1);
+  emitcondeqf(J, i);
+  here(J, notflt);  /* other types cannot be equal to a number */
+  emitgoto(J, GETARG_k(i) ? J->pc + 2
+                          : J->pc + 2 + GETARG_sJ(J->p->code[J->pc + 1]));
+}
+
+
+static void emitFORLOOP (JitState *J, Instruction i) {
+  int a = GETARG_A(i);
+  size_t done;
+  emittagcmp(J, a + 2, LUA_VNUMINT);  /* integer loop? */
+  sideexit(J, CC_NE);
+  emitmem(J, 0, 1, X_MOVLOAD, RAX, RBASE, SLOT(a + 1));  /* count */
+  emitreg(J, 0, 1, X_TEST, RAX, RAX);
+  done = emitjcc(J, CC_E);  /* no more iterations */
+  emitmem(J, 0, 1, 0x83, 5, RBASE, SLOT(a + 1));  /* sub count, 1 */
+  emit1(J, 1);
+  emitmem(J, 0, 1, X_MOVLOAD, RAX, RBASE, SLOT(a));
+  emitmem(J, 0, 1, X_ADD, RAX, RBASE, SLOT(a + 2));  /* idx += step */
+  emitmem(J, 0, 1, X_MOVSTORE, RAX, RBASE, SLOT(a));
+  emitmem(J, 0, 1, X_MOVSTORE, RAX, RBASE, SLOT(a + 3));
+  emitsettag(J, a + 3, LUA_VNUMINT);
+  emitgoto(J, J->pc + 1 - GETARG_Bx(i));
+  here(J, done);
+}
+
+
+/* does instruction 'pc' have the jump that a test instruction needs? */
+static int hasjump (const Proto *p, int pc) {
+  return (pc + 1 < p->sizecode &&
+          luaP_genericop(GET_OPCODE(p->code[pc + 1])) == OP_JMP);
+}
+
+
+/*
+** Translates one instruction. Returns false if the instruction has no
+** native translation (its code is just a side exit).
+*/
+static int translate (JitState *J, Instruction i) {
+  const Proto *p = J->p;
+  int a = GETARG_A(i);
+  switch (luaP_genericop(GET_OPCODE(i))) {
+    case OP_MOVE:
+      emitcopy(J, a, RBASE, SLOT(GETARG_B(i)));
+      return 1;
+    case OP_LOADI:
+      emitmovimm(J, RAX, l_castS2U(cast(lua_Integer, GETARG_sBx(i))));
+      emitmem(J, 0, 1, X_MOVSTORE, RAX, RBASE, SLOT(a));
+      emitsettag(J, a, LUA_VNUMINT);
+      return 1;
+    case OP_LOADF: {
+      lua_Number n = cast_num(GETARG_sBx(i));
+      l_uint64 bits;
+      memcpy(&bits, &n, sizeof(bits));
+      emitmovimm(J, RAX, bits);
+      emitmem(J, 0, 1, X_MOVSTORE, RAX, RBASE, SLOT(a));
+      emitsettag(J, a, LUA_VNUMFLT);
+      return 1;
+    }
+    case OP_LOADK: {  /* constants are immutable: embed the value */
+      const TValue *k = p->k + GETARG_Bx(i);
+      l_uint64 bits;
+      memcpy(&bits, &k->value_, sizeof(bits));
+      emitmovimm(J, RAX, bits);
+      emitmem(J, 0, 1, X_MOVSTORE, RAX, RBASE, SLOT(a));
+      emitsettag(J, a, rawtt(k));
+      return 1;
+    }
+    case OP_LOADFALSE:
+      emitsettag(J, a, LUA_VFALSE);
+      return 1;
+    case OP_LFALSESKIP:
+      emitsettag(J, a, LUA_VFALSE);
+      emitgoto(J, J->pc + 2);
+      return 1;
+    case OP_LOADTRUE:
+      emitsettag(J, a, LUA_VTRUE);
+      return 1;
+    case OP_LOADNIL: {
+      int b = GETARG_B(i);
+      do {
+        emitsettag(J, a++, LUA_VNIL);
+      } while (b--);
+      return 1;
+    }
+    case OP_GETUPVAL:
+      emitmem(J, 0, 1, X_MOVLOAD, RAX, RUPV,
+              GETARG_B(i) * cast_int(sizeof(UpVal *)));
+      emitmem(J, 0, 1, X_MOVLOAD, RAX, RAX, cast_int(offsetof(UpVal, v)));
+      emitcopy(J, a, RAX, 0);
+      return 1;
+    case OP_ADD:
+      emitarith(J, a, regop(GETARG_B(i)), regop(GETARG_C(i)), X_ADD, X_ADDSD);
+      return 1;
+    case OP_SUB:
+      emitarith(J, a, regop(GETARG_B(i)), regop(GETARG_C(i)), X_SUB, X_SUBSD);
+      return 1;
+    case OP_MUL:
+      emitarith(J, a, regop(GETARG_B(i)), regop(GETARG_C(i)), X_IMUL, X_MULSD);
+      return 1;
+    case OP_DIV:
+      emitarith(J, a, regop(GETARG_B(i)), regop(GETARG_C(i)), 0, X_DIVSD);
+      return 1;
+    case OP_ADDK:
+      emitarith(J, a, regop(GETARG_B(i)), constop(p->k + GETARG_C(i)),
+                X_ADD, X_ADDSD);
+      return 1;
+    case OP_SUBK:
+      emitarith(J, a, regop(GETARG_B(i)), constop(p->k + GETARG_C(i)),
+                X_SUB, X_SUBSD);
+      return 1;
+    case OP_MULK:
+      emitarith(J, a, regop(GETARG_B(i)), constop(p->k + GETARG_C(i)),
+                X_IMUL, X_MULSD);
+      return 1;
+    case OP_DIVK:
+      emitarith(J, a, regop(GETARG_B(i)), constop(p->k + GETARG_C(i)),
+                0, X_DIVSD);
+      return 1;
+    case OP_MOD:
+      emitmod(J, a, regop(GETARG_B(i)), regop(GETARG_C(i)));
+      return 1;
+    case OP_MODK:
+      emitmod(J, a, regop(GETARG_B(i)), constop(p->k + GETARG_C(i)));
+      return 1;
+    case OP_ADDI: {
+      TValue imm;
+      setivalue(&imm, GETARG_sC(i));
+      emitarith(J, a, regop(GETARG_B(i)), constop(&imm), X_ADD, X_ADDSD);
+      return 1;
+    }
+    case OP_NOT: {
+      size_t f1, f2, done;
+      emitisfalse(J, GETARG_B(i), &f1, &f2);
+      emitsettag(J, a, LUA_VFALSE);
+      done = emitjcc(J, CC_ALWAYS);
+      here(J, f1);
+      here(J, f2);
+      emitsettag(J, a, LUA_VTRUE);
+      here(J, done);
+      return 1;
+    }
+    case OP_JMP:
+      emitgoto(J, J->pc + 1 + GETARG_sJ(i));
+      return 1;
+    case OP_LT:
+      if (!hasjump(p, J->pc)) break;
+      emitorder(J, i, CC_L, CC_A);
+      return 1;
+    case OP_LE:
+      if (!hasjump(p, J->pc)) break;
+      emitorder(J, i, CC_LE, CC_AE);
+      return 1;
+    case OP_EQ:  /* only integers; other types may have '__eq' */
+      if (!hasjump(p, J->pc)) break;
+      emittagcmp(J, a, LUA_VNUMINT);
+      sideexit(J, CC_NE);
+      emittagcmp(J, GETARG_B(i), LUA_VNUMINT);
+      sideexit(J, CC_NE);
+      emitmem(J, 0, 1, X_MOVLOAD, RAX, RBASE, SLOT(a));
+      emitmem(J, 0, 1, X_CMP, RAX, RBASE, SLOT(GETARG_B(i)));
+      emitcondjump(J, i, CC_E);
+      return 1;
+    case OP_EQK: {  /* only integer constants */
+      const TValue *k = p->k + GETARG_B(i);
+      if (!hasjump(p, J->pc) || !ttisinteger(k)) break;
+      emittagcmp(J, a, LUA_VNUMINT);
+      sideexit(J, CC_NE);
+      emitmovimm(J, RCX, l_castS2U(ivalue(k)));
+      emitmem(J, 0, 1, X_MOVLOAD, RAX, RBASE, SLOT(a));
+      emitreg(J, 0, 1, X_CMP, RAX, RCX);
+      emitcondjump(J, i, CC_E);
+      return 1;
+    }
+    case OP_EQI:
+      if (!hasjump(p, J->pc)) break;
+      emitEQI(J, i);
+      return 1;
+    case OP_LTI:
+      if (!hasjump(p, J->pc)) break;
+      emitorderI(J, i, CC_L, 1, CC_A);
+      return 1;
+    case OP_LEI:
+      if (!hasjump(p, J->pc)) break;
+      emitorderI(J, i, CC_LE, 1, CC_AE);
+      return 1;
+    case OP_GTI:
+      if (!hasjump(p, J->pc)) break;
+      emitorderI(J, i, CC_G, 0, CC_A);
+      return 1;
+    case OP_GEI:
+      if (!hasjump(p, J->pc)) break;
+      emitorderI(J, i, CC_GE, 0, CC_AE);
+      return 1;
+    case OP_TEST: {
+      size_t f1, f2;
+      int skip = J->pc + 2;
+      int target;
+      if (!hasjump(p, J->pc)) break;
+      target = J->pc + 2 + GETARG_sJ(p->code[J->pc + 1]);
+      emitisfalse(J, a, &f1, &f2);
+      emitgoto(J, GETARG_k(i) ? target : skip);  /* value is true */
+      here(J, f1);
+      here(J, f2);
+      emitgoto(J, GETARG_k(i) ? skip : target);
+      return 1;
+    }
+    case OP_TESTSET: {
+      size_t f1, f2;
+      int b = GETARG_B(i);
+      int skip = J->pc + 2;
+      int target;
+      if (!hasjump(p, J->pc)) break;
+      target = J->pc + 2 + GETARG_sJ(p->code[J->pc + 1]);
+      emitisfalse(J, b, &f1, &f2);
+      if (GETARG_k(i))  /* true value: copy and jump */
+        emitcopy(J, a, RBASE, SLOT(b));
+      emitgoto(J, GETARG_k(i) ? target : skip);
+      here(J, f1);
+      here(J, f2);
+      if (!GETARG_k(i))  /* false value: copy and jump */
+        emitcopy(J, a, RBASE, SLOT(b));
+      emitgoto(J, GETARG_k(i) ? skip : target);
+      return 1;
+    }
+    case OP_FORLOOP:
+      emitFORLOOP(J, i);
+      return 1;
+    default:
+      break;
+  }
+  sideexit(J, CC_ALWAYS);
+  return 0;
+}
+
+
+/*
+** Prologue: save callee-saved registers, load the frame state and jump
+** to the start address; the epilogue restores them and returns 'eax'.
+*/
+static size_t emitprologue (JitState *J) {
+  static const unsigned char prologue[] = {
+    0x53,              /* push rbx */
+    0x41, 0x55,        /* push r13 */
+    0x41, 0x56,        /* push r14 */
+    0x48, 0x89, 0xFB,  /* mov rbx, rdi */
+    0x49, 0x89, 0xF6,  /* mov r14, rsi */
+    0x49, 0x89, 0xD5,  /* mov r13, rdx */
+    0xFF, 0xE1         /* jmp rcx */
+  };
+  static const unsigned char epilogue[] = {
+    0x41, 0x5E,        /* pop r14 */
+    0x41, 0x5D,        /* pop r13 */
+    0x5B,              /* pop rbx */
+    0xC3               /* ret */
+  };
+  size_t epi;
+  emit(J, prologue, sizeof(prologue));
+  epi = J->n;
+  emit(J, epilogue, sizeof(epilogue));
+  return epi;
+}
+
+
+static JitCode *compile (const Proto *p) {
+  JitState J;
+  JitCode *jc = NULL;
+  unsigned int *exits;
+  size_t epilogue, size;
+  int pc, f, native = 0;
+  if (sizeof(Value) != 8 || sizeof(lua_Integer) != 8 ||
+      sizeof(lua_Number) != 8 || (p->difierline_mode & OBFUSCATE_VM_PROTECT))
+    return NULL;
+  memset(&J, 0, sizeof(J));
+  J.p = p;
+  J.label = (unsigned int *)calloc(cast_sizet(p->sizecode),
+                                   sizeof(unsigned int));
+  exits = (unsigned int *)calloc(cast_sizet(p->sizecode),
+                                 sizeof(unsigned int));
+  jc = (JitCode *)calloc(1, sizeof(JitCode));
+  if (J.label == NULL || exits == NULL || jc == NULL)
+    goto fail;
+  jc->entry = (unsigned int *)calloc(cast_sizet(p->sizecode),
+                                     sizeof(unsigned int));
+  if (jc->entry == NULL)
+    goto fail;
+  epilogue = emitprologue(&J);
+  for (pc = 0; pc < p->sizecode; pc++) {
+    J.pc = pc;
+    J.label[pc] = cast_uint(J.n);
+    if (translate(&J, p->code[pc])) {
+      jc->entry[pc] = J.label[pc];  /* never 0 (prologue comes first) */
+      native++;
+    }
+  }
+  /* exit stubs: 'mov eax, pc; jmp epilogue' */
+  for (f = 0; f < J.nfix; f++) {
+    int target = J.fix[f].pc;
+    if (J.fix[f].toexit && exits[target] == 0) {
+      exits[target] = cast_uint(J.n);
+      emit1(&J, 0xB8);
+      emit4(&J, cast(l_uint32, target));
+      emit1(&J, 0xE9);
+      emit4(&J, cast(l_uint32, epilogue - (J.n + 4)));
+    }
+  }
+  if (J.failed || native == 0)
+    goto fail;
+  for (f = 0; f < J.nfix; f++) {
+    size_t to = J.fix[f].toexit ? exits[J.fix[f].pc] : J.label[J.fix[f].pc];
+    l_uint32 rel = cast(l_uint32, to - (J.fix[f].pos + 4));
+    memcpy(J.buff + J.fix[f].pos, &rel, 4);
+  }
+  size = J.n;
+  jc->mcode = (unsigned char *)mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (jc->mcode == (unsigned char *)MAP_FAILED)
+    goto fail;
+  memcpy(jc->mcode, J.buff, size);
+  if (mprotect(jc->mcode, size, PROT_READ | PROT_EXEC) != 0) {
+    munmap(jc->mcode, size);
+    goto fail;
+  }
+  jc->size = size;
+  free(J.buff);
+  free(J.fix);
+  free(J.label);
+  free(exits);
+  return jc;
+ fail:
+  free(J.buff);
+  free(J.fix);
+  free(J.label);
+  free(exits);
+  if (jc != NULL) {
+    free(jc->entry);
+    free(jc);
+  }
+  return NULL;
+}
+
+
+static void freecode (JitCode *jc) {
+  munmap(jc->mcode, jc->size);
+  free(jc->entry);
+  free(jc);
+}
+
+
+/* }====================================================== */
+
+
+int luaJ_setmode (lua_State *L, int on) {
+  G(L)->jitmode = cast_byte(on != 0);
+  return G(L)->jitmode;
+}
+
+
+const Instruction *luaJ_run (lua_State *L, CallInfo *ci, StkId base,
+                             const Instruction *pc) {
+  LClosure *cl = ci_func(ci);
+  Proto *p = cl->p;
+  JitCode *jc = p->jit;
+  unsigned int off;
+  if (jc == NULL) {
+    if (p->jitcount < 0 || ++p->jitcount < JITHOTCOUNT)
+      return pc;
+    jc = compile(p);
+    if (jc == NULL) {  /* nothing to compile? */
+      p->jitcount = -1;  /* do not try again */
+      return pc;
+    }
+    l_mutex_lock(&G(L)->lock);
+    if (p->jit == NULL) {
+      p->jit = jc;
+      jc = NULL;
+    }
+    l_mutex_unlock(&G(L)->lock);
+    if (jc != NULL)  /* lost the race? */
+      freecode(jc);
+    jc = p->jit;
+  }
+  off = jc->entry[pc - p->code];
+  if (off == 0)  /* instruction not translated? */
+    return pc;
+  return p->code + ((JitFunction)(void *)jc->mcode)(base, cl->upvals,
+                                                    &ci->u.l.trap,
+                                                    jc->mcode + off);
+}
+
+
+void luaJ_free (lua_State *L, Proto *p) {
+  UNUSED(L);
+  if (p->jit != NULL) {
+    freecode(p->jit);
+    p->jit = NULL;
+  }
+  p->jitcount = 0;
+}
+
+
+#else  /* }{ */
+
+
+int luaJ_setmode (lua_State *L, int on) {
+  UNUSED(on);
+  G(L)->jitmode = 0;
+  return 0;
+}
+
+
+const Instruction *luaJ_run (lua_State *L, CallInfo *ci, StkId base,
+                             const Instruction *pc) {
+  UNUSED(L); UNUSED(ci); UNUSED(base);
+  return pc;
+}
+
+
+void luaJ_free (lua_State *L, Proto *p) {
+  UNUSED(L);
+  p->jit = NULL;
+  p->jitcount = 0;
+}
+
+
+#endif  /* } */
+
@@ -0,0 +1,92 @@
+/*
+** $Id: ljit.h $
+** Baseline JIT compiler for Lua functions
+** See Copyright Notice in lua.h
+*/
+
+#ifndef ljit_h
+#define ljit_h
+
+
+#include "lobject.h"
+#include "lstate.h"
+
+
+/*
+** The JIT generates x86-64 machine code and needs Linux 'mmap' for
+** executable memory; elsewhere the interface below still exists but
+** never compiles anything.
+*/
+#if !defined(LUA_USE_JIT)
+#if defined(__x86_64__) && defined(__linux__)
+#define LUA_USE_JIT	1
+#else
+#define LUA_USE_JIT	0
+#endif
+#endif
+
+
+/*
+** A prototype is compiled after its calls plus backward jumps reach
+** JITHOTCOUNT (counted only while the JIT is enabled).
+*/
+#if !defined(JITHOTCOUNT)
+#define JITHOTCOUNT	1000
+#endif
+
+
+/**
+ * @brief Machine code of a compiled prototype.
+ */
+typedef struct JitCode {
+  unsigned char *mcode;  /**< Executable code (prologue at offset 0). */
+  size_t size;  /**< Size of the 'mcode' mapping. */
+  unsigned int *entry;  /**< Code offset of each instruction (0: none). */
+} JitCode;
+
+
+/*
+** Whether 'luaJ_run' may do anything at instruction 'pc' of 'p': the
+** prototype is still being counted, or its code has an entry there.
+*/
+#define luaJ_canenter(p,pc)  \
+	((p)->jit == NULL ? (p)->jitcount >= 0 \
+	                  : (p)->jit->entry[(pc) - (p)->code] != 0)
+
+
+/**
+ * @brief Enables or disables the JIT for a global state.
+ * @param L The Lua state.
+ * @param on Non-zero to enable.
+ * @return 1 if the JIT is now enabled; 0 otherwise (including when the
+ * platform has no JIT support).
+ */
+LUAI_FUNC int luaJ_setmode (lua_State *L, int on);
+
+/**
+ * @brief Runs machine code for the current Lua frame, when possible.
+ *
+ * Counts hotness of the frame's prototype, compiles it once it is hot,
+ * and runs its native code starting at instruction 'pc'. Native code
+ * never calls into the runtime: it leaves at the first instruction it
+ * does not handle (or whose operands fail a type guard) and the
+ * interpreter continues there.
+ *
+ * @param L The Lua state.
+ * @param ci The frame (must be a Lua function without pending traps).
+ * @param base Base of the frame.
+ * @param pc Next instruction to execute.
+ * @return The next instruction the interpreter must execute.
+ */
+LUAI_FUNC const Instruction *luaJ_run (lua_State *L, CallInfo *ci, StkId base,
+                                       const Instruction *pc);
+
+/**
+ * @brief Frees the machine code of a prototype (if any).
+ * @param L The Lua state.
+ * @param p The prototype.
+ */
+LUAI_FUNC void luaJ_free (lua_State *L, Proto *p);
+
+
+#endif
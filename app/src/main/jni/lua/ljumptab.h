@@ -16,7 +16,7 @@
 #define vmbreak		vmfetch(); vmdispatch(GET_OPCODE(i));
 
 
-static const void *const disptab[NUM_OPCODES] = {
+static const void *const disptab[NUM_VMOPCODES] = {
 
 #if 0
 ** you can update the following list with this command:
@@ -57,8 +57,8 @@ static const void *const disptab[NUM_OPCODES] = {
 &&L_OP_BANDK,
 &&L_OP_BORK,
 &&L_OP_BXORK,
-&&L_OP_SHRI,
 &&L_OP_SHLI,
+&&L_OP_SHRI,
 &&L_OP_ADD,
 &&L_OP_SUB,
 &&L_OP_MUL,
@@ -112,7 +112,6 @@ static const void *const disptab[NUM_OPCODES] = {
 &&L_OP_VARARGPREP,
 &&L_OP_IS,
 &&L_OP_TESTNIL,
-/* 面向对象系统操作码 */
 &&L_OP_NEWCLASS,
 &&L_OP_INHERIT,
 &&L_OP_GETSUPER,
@@ -134,6 +133,20 @@ static const void *const disptab[NUM_OPCODES] = {
 &&L_OP_LINKNAMESPACE,
 &&L_OP_NEWSUPER,
 &&L_OP_SETSUPER,
-&&L_OP_EXTRAARG
+&&L_OP_GETCMDS,
+&&L_OP_GETOPS,
+&&L_OP_ASYNCWRAP,
+&&L_OP_GENERICWRAP,
+&&L_OP_CHECKTYPE,
+&&L_OP_EXTRAARG,
+&&L_OP_ADDINT,
+&&L_OP_SUBINT,
+&&L_OP_MULINT,
+&&L_OP_ADDFLT,
+&&L_OP_SUBFLT,
+&&L_OP_MULFLT,
+&&L_OP_LTINT,
+&&L_OP_LEINT,
+&&L_OP_FORLOOPINT
 
 };
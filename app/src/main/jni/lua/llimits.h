@@ -261,7 +261,14 @@ typedef unsigned long l_uint64;
 typedef unsigned long l_uint32;
 #endif
 
+/*
+** Type for virtual-machine instructions; see 'LUAI_COMPACTINST'
+*/
+#if defined(LUAI_COMPACTINST)
+typedef l_uint32 Instruction;
+#else
 typedef l_uint64 Instruction;
+#endif
 
 
 
@@ -13,6 +13,7 @@
 
 
 #include <stddef.h>
+#include <string.h>
 
 #include "lua.h"
 
@@ -21,6 +22,7 @@
 #include "lgc.h"
 #include "lmem.h"
 #include "lobject.h"
+#include "lprof.h"
 #include "lstate.h"
 
 
@@ -80,6 +82,443 @@ static void *firsttry (global_State *g, void *block, size_t os, size_t ns) {
 
 
 
+/*
+** {=======================================================
+** Slab pool for small blocks
+** ========================================================
+*/
+
+/*
+** Blocks of up to LUAI_POOLMAX bytes live in the pool. Each size class
+** carves its blocks from slabs of LUAI_SLABSIZE bytes aligned to their
+** size, so the slab of a block is found by masking its address; the
+** slab header comes first. Slabs with free blocks are kept in the
+** 'partial' list of their class (full slabs are in no list). Each OS
+** thread caches free blocks in a magazine per class (see "Thread
+** magazines"), used without locks; a magazine is refilled from the
+** slabs with half its capacity when it runs empty and gives back half
+** of its blocks when it is full. The pool needs 'mmap'; elsewhere all
+** blocks come from the allocation function.
+*/
+#if !defined(LUAI_MEMPOOL)
+#if (defined(LUA_USE_POSIX) || defined(__linux__)) && !defined(LUA_USER_H)
+#define LUAI_MEMPOOL	1
+#else
+#define LUAI_MEMPOOL	0
+#endif
+#endif
+
+#define LUAI_POOLMAX	1024
+
+/* size of a slab (a power of 2 and a multiple of the page size) */
+#if !defined(LUAI_SLABSIZE)
+#define LUAI_SLABSIZE	(16 * 1024)
+#endif
+
+/* bytes a magazine may cache per class (within 4 and 64 blocks) */
+#define MAGBYTES	2048
+
+
+static const size_t size_classes[NUM_SIZE_CLASSES] = {
+  8, 16, 24, 32, 48, 64, 96, 128, 192, 256, 512, 1024
+};
+
+
+#if LUAI_MEMPOOL
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+typedef struct MemSlab {
+  struct MemSlab *next;  /* in the 'partial' list of its class */
+  struct MemSlab *prev;
+  void *free;  /* free blocks */
+  int nfree;  /* number of blocks in 'free' */
+  int cls;  /* size class */
+  int idle;  /* slab was empty at the last 'luaM_poolgc' */
+} MemSlab;
+
+/* blocks start after the header, 16-byte aligned */
+#define SLABHEADER	((sizeof(MemSlab) + 15) & ~cast_sizet(15))
+
+#define slabof(p)  \
+	cast(MemSlab *, cast(uintptr_t, p) & ~cast(uintptr_t, LUAI_SLABSIZE - 1))
+
+#define smallsize(g,s)	((g)->mempool.enabled && \
+                         cast_sizet(s) - 1 < cast_sizet(LUAI_POOLMAX))
+
+#define sizeclass(g,s)	((g)->mempool.classof[(cast_sizet(s) + 7) >> 3])
+
+#define nextblock(b)	(*cast(void **, (b)))
+
+
+static void linkslab (MemPool *pool, MemSlab *s) {
+  s->prev = NULL;
+  s->next = pool->partial;
+  if (pool->partial != NULL)
+    pool->partial->prev = s;
+  pool->partial = s;
+}
+
+
+static void unlinkslab (MemPool *pool, MemSlab *s) {
+  if (s->prev != NULL)
+    s->prev->next = s->next;
+  else
+    pool->partial = s->next;
+  if (s->next != NULL)
+    s->next->prev = s->prev;
+}
+
+
+/*
+** Maps a new slab for class 'c' and links it into the partial list.
+** (Maps twice the size and trims it to get the alignment.)
+*/
+static MemSlab *newslab (global_State *g, int c) {
+  MemPool *pool = &g->mempool.pools[c];
+  char *raw = cast_charp(mmap(NULL, 2 * LUAI_SLABSIZE, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+  char *p;
+  MemSlab *s;
+  int i;
+  if (raw == cast_charp(MAP_FAILED))
+    return NULL;
+  p = cast_charp((cast(uintptr_t, raw) + LUAI_SLABSIZE - 1) &
+                 ~cast(uintptr_t, LUAI_SLABSIZE - 1));
+  if (p > raw)
+    munmap(raw, cast_sizet(p - raw));
+  munmap(p + LUAI_SLABSIZE, cast_sizet(raw + LUAI_SLABSIZE - p));
+  s = cast(MemSlab *, p);
+  s->free = NULL;
+  for (i = pool->slabcap - 1; i >= 0; i--) {  /* lower blocks go first */
+    void *b = p + SLABHEADER + cast_sizet(i) * pool->object_size;
+    nextblock(b) = s->free;
+    s->free = b;
+  }
+  s->nfree = pool->slabcap;
+  s->cls = c;
+  s->idle = 0;
+  linkslab(pool, s);
+  pool->nslabs++;
+  return s;
+}
+
+
+/* Returns a block to its slab (with the pool lock held). */
+static void putblock (MemPool *pool, void *b) {
+  MemSlab *s = slabof(b);
+  nextblock(b) = s->free;
+  s->free = b;
+  if (s->nfree++ == 0)  /* slab was full? */
+    linkslab(pool, s);
+}
+
+
+/*
+** {======================================================
+** Thread magazines
+** =======================================================
+*/
+
+/* Free blocks of one size class cached by a thread. */
+typedef struct MemMagazine {
+  void *free;  /* free blocks (LIFO list) */
+  int n;  /* number of blocks in 'free' */
+  size_t nhit;  /* hits not yet added to the pool counters */
+} MemMagazine;
+
+
+/*
+** Magazines belong to OS threads, not to Lua threads: all coroutines
+** running on an OS thread share them, whatever thread created them.
+** An OS thread has one set per state it allocates from, kept in its
+** 'tlsets' list and in the 'threads' list of the state's pool. A set
+** is flushed and freed when its thread exits (see 'threadexit') and
+** emptied when its state is closed ('luaM_poolshutdown' clears its
+** 'g'; the thread frees it later). 'setlock' protects the 'threads'
+** lists and the 'g' fields; it is taken before any pool lock.
+*/
+typedef struct ThreadMags {
+  global_State *g;  /* state of the pool (NULL once it was closed) */
+  struct ThreadMags *gnext;  /* in 'g->mempool.threads' */
+  struct ThreadMags *tnext;  /* in 'tlsets' of its thread */
+  MemMagazine mag[NUM_SIZE_CLASSES];
+} ThreadMags;
+
+#if defined(__cplusplus)
+#define mags_threadlocal	thread_local
+#else
+#define mags_threadlocal	_Thread_local
+#endif
+
+static mags_threadlocal ThreadMags *tlsets = NULL;  /* sets of this thread */
+static mags_threadlocal ThreadMags *tlcur = NULL;  /* last set it used */
+
+static pthread_mutex_t setlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t setonce = PTHREAD_ONCE_INIT;
+static pthread_key_t setkey;  /* its destructor is 'threadexit' */
+
+
+/* Adds the pending hits of magazine 'm' to the counters of 'pool'. */
+static void foldhits (MemPool *pool, MemMagazine *m) {
+  pool->total_alloc += m->nhit;
+  pool->total_hit += m->nhit;
+  m->nhit = 0;
+}
+
+
+/* Gives back to the slabs all but 'keep' blocks of magazine 'm'. */
+static void flushmag (global_State *g, MemMagazine *m, int c, int keep) {
+  MemPool *pool = &g->mempool.pools[c];
+  l_mutex_lock(&g->mempool.lock);
+  foldhits(pool, m);
+  while (m->n > keep) {
+    void *b = m->free;
+    m->free = nextblock(b);
+    m->n--;
+    putblock(pool, b);
+  }
+  l_mutex_unlock(&g->mempool.lock);
+}
+
+
+/* Flushes set 't' and unlinks it from its state (with 'setlock' held). */
+static void detachset (ThreadMags *t) {
+  global_State *g = t->g;
+  ThreadMags **p;
+  int c;
+  for (c = 0; c < NUM_SIZE_CLASSES; c++)
+    flushmag(g, &t->mag[c], c, 0);
+  for (p = &g->mempool.threads; *p != t; p = &(*p)->gnext) ;
+  *p = t->gnext;
+  t->g = NULL;
+}
+
+
+/* Called when a thread that used the pool exits. */
+static void threadexit (void *ud) {
+  ThreadMags *t = tlsets;
+  UNUSED(ud);
+  pthread_mutex_lock(&setlock);
+  while (t != NULL) {
+    ThreadMags *next = t->tnext;
+    if (t->g != NULL)
+      detachset(t);
+    free(t);
+    t = next;
+  }
+  tlsets = tlcur = NULL;
+  pthread_mutex_unlock(&setlock);
+}
+
+
+static void initsetkey (void) {
+  pthread_key_create(&setkey, threadexit);
+}
+
+
+/*
+** Slow path of 'getmags': finds (or creates) the set of the running
+** thread for 'g', freeing the sets of closed states on the way.
+** Returns NULL if a new set cannot be allocated.
+*/
+static ThreadMags *findmags (global_State *g) {
+  ThreadMags **p = &tlsets;
+  ThreadMags *t;
+  pthread_once(&setonce, initsetkey);
+  pthread_mutex_lock(&setlock);
+  while ((t = *p) != NULL && t->g != g) {
+    if (t->g == NULL) {  /* state was closed? */
+      *p = t->tnext;
+      free(t);
+    }
+    else
+      p = &t->tnext;
+  }
+  if (t == NULL && (t = (ThreadMags *)calloc(1, sizeof(ThreadMags))) != NULL) {
+    t->g = g;
+    t->gnext = g->mempool.threads;
+    g->mempool.threads = t;
+    t->tnext = tlsets;
+    tlsets = t;
+    pthread_setspecific(setkey, t);  /* non-NULL: run 'threadexit' */
+  }
+  pthread_mutex_unlock(&setlock);
+  return (tlcur = t);
+}
+
+
+/*
+** Magazines of the running thread for 'g'. Only this thread changes
+** 'tlcur', and its 'g' changes only when it is some other state's.
+*/
+static ThreadMags *getmags (global_State *g) {
+  ThreadMags *t = tlcur;  /* one access to the thread-local variable */
+  if (l_likely(t != NULL && t->g == g))
+    return t;
+  return findmags(g);
+}
+
+
+/*
+** Refills the (empty) magazine 'm' of class 'c' with half its capacity
+** and returns one more block, or NULL if there is no memory. With no
+** magazine (NULL 'm') it just takes one block.
+*/
+static void *refill (global_State *g, MemMagazine *m, int c) {
+  MemPool *pool = &g->mempool.pools[c];
+  int n = (m != NULL) ? pool->magcap / 2 : 0;
+  void *p = NULL;
+  l_mutex_lock(&g->mempool.lock);
+  if (m != NULL)
+    foldhits(pool, m);
+  pool->total_alloc++;  /* this allocation is a miss */
+  while (n >= 0) {
+    MemSlab *s = pool->partial;
+    if (s == NULL && (s = newslab(g, c)) == NULL)
+      break;  /* no more memory */
+    s->idle = 0;
+    for (; s->nfree > 0 && n >= 0; n--) {
+      void *b = s->free;
+      s->free = nextblock(b);
+      s->nfree--;
+      if (p == NULL)
+        p = b;  /* first block goes to the caller */
+      else {
+        nextblock(b) = m->free;
+        m->free = b;
+        m->n++;
+      }
+    }
+    if (s->nfree == 0)  /* slab is full now? */
+      unlinkslab(pool, s);
+  }
+  l_mutex_unlock(&g->mempool.lock);
+  return p;
+}
+
+
+static void *poolget (lua_State *L, int c) {
+  global_State *g = G(L);
+  ThreadMags *t = getmags(g);
+  MemMagazine *m;
+  void *b;
+  if (l_unlikely(t == NULL))
+    return refill(g, NULL, c);
+  m = &t->mag[c];
+  b = m->free;
+  if (l_likely(b != NULL)) {
+    m->free = nextblock(b);
+    m->n--;
+    m->nhit++;
+    return b;
+  }
+  return refill(g, m, c);
+}
+
+
+static void poolput (lua_State *L, void *b, int c) {
+  global_State *g = G(L);
+  ThreadMags *t = getmags(g);
+  MemMagazine *m;
+  if (l_unlikely(t == NULL)) {  /* no magazines? */
+    l_mutex_lock(&g->mempool.lock);
+    putblock(&g->mempool.pools[c], b);
+    l_mutex_unlock(&g->mempool.lock);
+    return;
+  }
+  m = &t->mag[c];
+  if (l_unlikely(m->n >= g->mempool.pools[c].magcap))
+    flushmag(g, m, c, g->mempool.pools[c].magcap / 2);
+  nextblock(b) = m->free;
+  m->free = b;
+  m->n++;
+}
+
+/* }====================================================== */
+
+
+/*
+** Unmaps the empty slabs (with the pool lock held). Unless 'all' is
+** true, a slab goes only when it has been empty since the previous call,
+** so that a heap that shrinks and grows again with each collection does
+** not map and unmap its slabs every cycle.
+*/
+static void releaseslabs (global_State *g, int all) {
+  int c;
+  for (c = 0; c < NUM_SIZE_CLASSES; c++) {
+    MemPool *pool = &g->mempool.pools[c];
+    MemSlab *s = pool->partial;
+    while (s != NULL) {
+      MemSlab *next = s->next;
+      if (s->nfree < pool->slabcap)  /* in use? */
+        s->idle = 0;
+      else if (all || s->idle) {
+        unlinkslab(pool, s);
+        munmap(s, LUAI_SLABSIZE);
+        pool->nslabs--;
+      }
+      else
+        s->idle = 1;  /* release it next time, if still empty */
+      s = next;
+    }
+  }
+}
+
+
+/*
+** Reallocates a block: blocks of small sizes live in the pool, all the
+** others come from the allocation function. A block moving between the
+** two (or between size classes) is copied. Like the allocation
+** function, returns NULL (keeping the old block) when out of memory.
+*/
+static void *rawrealloc (lua_State *L, void *block, size_t os, size_t ns) {
+  global_State *g = G(L);
+  int oc = (block != NULL && smallsize(g, os)) ? sizeclass(g, os) : -1;
+  int nc = smallsize(g, ns) ? sizeclass(g, ns) : -1;
+  void *newblock;
+  if (oc < 0 && nc < 0)  /* no small block involved? */
+    return firsttry(g, block, os, ns);
+  else if (oc == nc)  /* same class? */
+    return block;  /* nothing to be done */
+  else if (ns == 0) {  /* freeing a small block? */
+    poolput(L, block, oc);
+    return NULL;
+  }
+  newblock = (nc >= 0) ? poolget(L, nc) : firsttry(g, NULL, 0, ns);
+  if (newblock != NULL && block != NULL) {
+    memcpy(newblock, block, (os < ns) ? os : ns);
+    if (oc >= 0)
+      poolput(L, block, oc);
+    else
+      callfrealloc(g, block, os, 0);
+  }
+  return newblock;
+}
+
+
+static void freeblock (lua_State *L, void *block, size_t osize) {
+  global_State *g = G(L);
+  if (smallsize(g, osize))
+    poolput(L, block, sizeclass(g, osize));
+  else
+    callfrealloc(g, block, osize, 0);
+}
+
+#else
+
+#define rawrealloc(L,block,os,ns)	firsttry(G(L), block, os, ns)
+#define freeblock(L,block,os)		callfrealloc(G(L), block, os, 0)
+
+#endif
+
+/* }======================================================= */
+
+
+
 
 
 /*
@@ -178,8 +617,11 @@ l_noret luaM_toobig (lua_State *L) {
 void luaM_free_ (lua_State *L, void *block, size_t osize) {
   global_State *g = G(L);
   lua_assert((osize == 0) == (block == NULL));
-  callfrealloc(g, block, osize, 0);
+  if (luaM_profison(g) && block != NULL)
+    luaM_proffree(L, block);
+  freeblock(L, block, osize);
   l_atomic_sub(&g->GCdebt, osize);
+  L->nfreed += osize;
 }
 
 
@@ -192,7 +634,7 @@ static void *tryagain (lua_State *L, void *block,
   global_State *g = G(L);
   if (cantryagain(g)) {
     luaC_fullgc(L, 1);  /* try to free some memory... */
-    return callfrealloc(g, block, osize, nsize);  /* try again */
+    return rawrealloc(L, block, osize, nsize);  /* try again */
   }
   else return NULL;  /* cannot run an emergency collection */
 }
@@ -211,7 +653,7 @@ void *luaM_realloc_ (lua_State *L, void *block, size_t osize, size_t nsize) {
   void *newblock;
   global_State *g = G(L);
   lua_assert((osize == 0) == (block == NULL));
-  newblock = firsttry(g, block, osize, nsize);
+  newblock = rawrealloc(L, block, osize, nsize);
   if (l_unlikely(newblock == NULL && nsize > 0)) {
     newblock = tryagain(L, block, osize, nsize);
     if (newblock == NULL)  /* still no memory? */
@@ -219,6 +661,13 @@ void *luaM_realloc_ (lua_State *L, void *block, size_t osize, size_t nsize) {
   }
   lua_assert((nsize == 0) == (newblock == NULL));
   l_atomic_add(&g->GCdebt, (l_mem)(nsize - osize));
+  if (luaM_profison(g)) {  /* as a free plus a new untyped block */
+    if (block != NULL)
+      luaM_proffree(L, block);
+    if (newblock != NULL)  /* a stack being moved is still 'L->stack.p' */
+      luaM_profalloc(L, newblock, nsize,
+                     (block != NULL && block == L->stack.p) ? PROFSTACK : -1);
+  }
   return newblock;
 }
 
@@ -254,42 +703,26 @@ void *luaM_malloc_ (lua_State *L, size_t size, int tag) {
     return NULL;  /* that's all */
   else {
     global_State *g = G(L);
-    void *newblock = firsttry(g, NULL, tag, size);
+    void *newblock = rawrealloc(L, NULL, tag, size);
     if (l_unlikely(newblock == NULL)) {
       newblock = tryagain(L, NULL, tag, size);
       if (newblock == NULL)
         luaM_error(L);
     }
     l_atomic_add(&g->GCdebt, size);
+    if (luaM_profison(g))
+      luaM_profalloc(L, newblock, size, tag);
     return newblock;
   }
 }
 
 
 /*
-** ========================================================
-** Memory Pool Implementation for Small Objects
+** {=======================================================
+** Memory pool interface
 ** ========================================================
 */
 
-static const size_t size_classes[NUM_SIZE_CLASSES] = {
-  8, 16, 24, 32, 48, 64, 96, 128, 192, 256, 512, 1024
-};
-
-static int get_size_class (size_t size) {
-  int lo = 0, hi = NUM_SIZE_CLASSES - 1;
-  while (lo < hi) {
-    int mid = (lo + hi) >> 1;
-    if (size_classes[mid] >= size)
-      hi = mid;
-    else
-      lo = mid + 1;
-  }
-  if (lo < NUM_SIZE_CLASSES && size_classes[lo] >= size)
-    return lo;
-  return -1;
-}
-
 /**
  * @brief Initializes the memory pool.
  *
@@ -297,45 +730,52 @@ static int get_size_class (size_t size) {
  */
 void luaM_poolinit (lua_State *L) {
   global_State *g = G(L);
-  int i;
+  int i, c = 0;
   for (i = 0; i < NUM_SIZE_CLASSES; i++) {
-    g->mempool.pools[i].free_list = NULL;
-    g->mempool.pools[i].object_size = size_classes[i];
-    g->mempool.pools[i].max_cache = 64;
-    g->mempool.pools[i].current_count = 0;
-    g->mempool.pools[i].total_alloc = 0;
-    g->mempool.pools[i].total_hit = 0;
+    MemPool *pool = &g->mempool.pools[i];
+    int magcap = cast_int(MAGBYTES / size_classes[i]);
+    pool->partial = NULL;
+    pool->object_size = size_classes[i];
+    pool->slabcap = 0;
+#if LUAI_MEMPOOL
+    pool->slabcap = cast_int((LUAI_SLABSIZE - SLABHEADER) / size_classes[i]);
+#endif
+    pool->magcap = (magcap < 4) ? 4 : (magcap > 64) ? 64 : magcap;
+    pool->nslabs = 0;
+    pool->total_alloc = 0;
+    pool->total_hit = 0;
+  }
+  g->mempool.classof[0] = 0;
+  for (i = 1; i <= LUAI_POOLMAX / 8; i++) {  /* sizes up to 8*i */
+    while (size_classes[c] < cast_sizet(i) * 8)
+      c++;
+    g->mempool.classof[i] = cast_byte(c);
   }
-  g->mempool.threshold = size_classes[NUM_SIZE_CLASSES - 1];
-  g->mempool.fallback_alloc = g->frealloc;
-  g->mempool.fallback_ud = g->ud;
-  g->mempool.enabled = 1;
-  g->mempool.small_limit = size_classes[NUM_SIZE_CLASSES - 1];
+  g->mempool.threshold = LUAI_POOLMAX;
+  g->mempool.enabled = LUAI_MEMPOOL;
+  g->mempool.threads = NULL;
   l_mutex_init(&g->mempool.lock);
 }
 
 /**
- * @brief Shuts down the memory pool, freeing all cached blocks.
+ * @brief Shuts down the memory pool, unmapping all its slabs.
  *
- * @param L The Lua state.
+ * Must be called after the last small block of the state was freed.
+ *
+ * @param L The Lua state (the main thread).
  */
 void luaM_poolshutdown (lua_State *L) {
   global_State *g = G(L);
-  int i;
+#if LUAI_MEMPOOL
+  pthread_mutex_lock(&setlock);
+  while (g->mempool.threads != NULL)  /* no thread can be using them */
+    detachset(g->mempool.threads);
+  pthread_mutex_unlock(&setlock);
   l_mutex_lock(&g->mempool.lock);
-  for (i = 0; i < NUM_SIZE_CLASSES; i++) {
-    MemPool *pool = &g->mempool.pools[i];
-    void *block = pool->free_list;
-    while (block) {
-      void *next = *(void **)block;
-      callfrealloc(g, block, pool->object_size, 0);
-      block = next;
-    }
-    pool->free_list = NULL;
-    pool->current_count = 0;
-  }
-  g->mempool.enabled = 0;
+  releaseslabs(g, 1);
   l_mutex_unlock(&g->mempool.lock);
+#endif
+  g->mempool.enabled = 0;
   l_mutex_destroy(&g->mempool.lock);
 }
 
@@ -344,37 +784,24 @@ void luaM_poolshutdown (lua_State *L) {
  *
  * @param L The Lua state.
  * @param size The size to allocate.
- * @return The allocated block, or NULL if allocation failed.
+ * @return The allocated block, or NULL if the size is not small or
+ * there is no memory. The block must be freed with 'luaM_free_' (or
+ * 'luaM_poolfree') with the same size.
  */
 void *luaM_poolalloc (lua_State *L, size_t size) {
+#if LUAI_MEMPOOL
   global_State *g = G(L);
-  if (!g->mempool.enabled || size == 0)
-    return NULL;
-
-  int idx = get_size_class(size);
-  if (idx < 0)
-    return NULL;
-
-  l_mutex_lock(&g->mempool.lock);
-  MemPool *pool = &g->mempool.pools[idx];
-  pool->total_alloc++;
-
-  if (pool->free_list != NULL) {
-    void *block = pool->free_list;
-    pool->free_list = *(void **)block;
-    pool->current_count--;
-    pool->total_hit++;
-    l_mutex_unlock(&g->mempool.lock);
-    return block;
-  }
-  l_mutex_unlock(&g->mempool.lock);
-
-  void *block = callfrealloc(g, NULL, 0, pool->object_size);
-  if (block == NULL)
+  void *block;
+  if (!smallsize(g, size))
     return NULL;
-
-  l_atomic_add(&g->GCdebt, pool->object_size);
+  block = poolget(L, sizeclass(g, size));
+  if (block != NULL)
+    l_atomic_add(&g->GCdebt, size);
   return block;
+#else
+  UNUSED(L); UNUSED(size);
+  return NULL;
+#endif
 }
 
 /**
@@ -385,88 +812,126 @@ void *luaM_poolalloc (lua_State *L, size_t size) {
  * @param size The size of the block.
  */
 void luaM_poolfree (lua_State *L, void *block, size_t size) {
-  global_State *g = G(L);
-  if (!g->mempool.enabled || block == NULL || size == 0)
-    return;
-
-  int idx = get_size_class(size);
-  if (idx < 0) {
+  if (block != NULL)
     luaM_free_(L, block, size);
-    return;
-  }
-
-  l_mutex_lock(&g->mempool.lock);
-  MemPool *pool = &g->mempool.pools[idx];
+}
 
-  if (pool->current_count >= pool->max_cache) {
-    l_mutex_unlock(&g->mempool.lock);
-    luaM_free_(L, block, pool->object_size);
-    return;
+/**
+ * @brief Gives back to the slabs all blocks cached by the running OS
+ * thread.
+ *
+ * @param L The Lua state.
+ */
+void luaM_poolflush (lua_State *L) {
+#if LUAI_MEMPOOL
+  global_State *g = G(L);
+  ThreadMags *t = getmags(g);
+  int c;
+  if (t != NULL) {
+    for (c = 0; c < NUM_SIZE_CLASSES; c++)
+      flushmag(g, &t->mag[c], c, 0);
   }
-
-  *(void **)block = pool->free_list;
-  pool->free_list = block;
-  pool->current_count++;
-  l_mutex_unlock(&g->mempool.lock);
+#else
+  UNUSED(L);
+#endif
 }
 
 /**
- * @brief Shrinks the memory pool by freeing excess cached blocks.
+ * @brief Shrinks the magazines of the running OS thread to half their
+ * capacity.
  *
  * @param L The Lua state.
  */
 void luaM_poolshrink (lua_State *L) {
+#if LUAI_MEMPOOL
   global_State *g = G(L);
-  int i;
-  l_mutex_lock(&g->mempool.lock);
-  for (i = 0; i < NUM_SIZE_CLASSES; i++) {
-    MemPool *pool = &g->mempool.pools[i];
-    int target = pool->max_cache >> 1;
-    while (pool->current_count > target && pool->free_list != NULL) {
-      void *block = pool->free_list;
-      pool->free_list = *(void **)block;
-      pool->current_count--;
-
-      // We must unlock to free, because luaM_free_ might want to update GCdebt or do other things.
-      // But wait, luaM_free_ calls callfrealloc, which is just realloc/free.
-      // It does atomic_sub GCdebt.
-      // However, if we simply free it here while holding the lock, it is safe as long as free doesn't re-enter pool.
-      // Standard free does not.
-      // But we are in poolshrink, which is called during GC?
-      // luaM_poolgc calls this.
-      // Let's check if it's safe to hold lock. Yes, it should be.
-
-      callfrealloc(g, block, pool->object_size, 0);
-      l_atomic_sub(&g->GCdebt, pool->object_size);
-    }
+  ThreadMags *t = getmags(g);
+  int c;
+  if (t == NULL)
+    return;
+  for (c = 0; c < NUM_SIZE_CLASSES; c++) {
+    if (t->mag[c].n > g->mempool.pools[c].magcap / 2)
+      flushmag(g, &t->mag[c], c, g->mempool.pools[c].magcap / 2);
   }
-  l_mutex_unlock(&g->mempool.lock);
+#else
+  UNUSED(L);
+#endif
 }
 
 /**
- * @brief Performs garbage collection on the memory pool (shrinks it).
+ * @brief Performs garbage collection on the memory pool: shrinks the
+ * magazines of the running OS thread and returns to the system the
+ * slabs that stayed empty since the previous call. (Magazines of other
+ * OS threads are bounded by their capacity and flushed when they
+ * exit.)
  *
  * @param L The Lua state.
  */
 void luaM_poolgc (lua_State *L) {
+#if LUAI_MEMPOOL
+  global_State *g = G(L);
   luaM_poolshrink(L);
+  l_mutex_lock(&g->mempool.lock);
+  releaseslabs(g, 0);
+  l_mutex_unlock(&g->mempool.lock);
+#else
+  UNUSED(L);
+#endif
 }
 
 /**
- * @brief Returns the total memory usage of the memory pool.
+ * @brief Returns the memory mapped by the memory pool.
  *
  * @param L The Lua state.
- * @return Total memory used by cached blocks.
+ * @return Total size of the slabs in use.
  */
 size_t luaM_poolgetusage (lua_State *L) {
   global_State *g = G(L);
   size_t total = 0;
   int i;
+  if (!g->mempool.enabled)
+    return 0;
   l_mutex_lock(&g->mempool.lock);
-  for (i = 0; i < NUM_SIZE_CLASSES; i++) {
-    MemPool *pool = &g->mempool.pools[i];
-    total += pool->current_count * pool->object_size;
-  }
+  for (i = 0; i < NUM_SIZE_CLASSES; i++)
+    total += cast_sizet(g->mempool.pools[i].nslabs) * LUAI_SLABSIZE;
   l_mutex_unlock(&g->mempool.lock);
   return total;
 }
+
+/**
+ * @brief Gets the statistics of a size class of the memory pool.
+ *
+ * Hits of other OS threads are counted only when their magazines are
+ * refilled or flushed.
+ *
+ * @param L The Lua state.
+ * @param c The size class (0 to NUM_SIZE_CLASSES - 1).
+ * @param st Receives the statistics.
+ * @return 0 if the pool is disabled or 'c' is not a class; 1 otherwise.
+ */
+int luaM_poolstats (lua_State *L, int c, MemPoolStats *st) {
+  global_State *g = G(L);
+  MemPool *pool;
+#if LUAI_MEMPOOL
+  ThreadMags *t;
+#endif
+  if (!g->mempool.enabled || c < 0 || c >= NUM_SIZE_CLASSES)
+    return 0;
+  pool = &g->mempool.pools[c];
+#if LUAI_MEMPOOL
+  t = getmags(g);
+#endif
+  l_mutex_lock(&g->mempool.lock);
+#if LUAI_MEMPOOL
+  if (t != NULL)
+    foldhits(pool, &t->mag[c]);  /* fold this thread's hits */
+#endif
+  st->size = pool->object_size;
+  st->allocs = pool->total_alloc;
+  st->hits = pool->total_hit;
+  st->slabs = cast_sizet(pool->nslabs);
+  l_mutex_unlock(&g->mempool.lock);
+  return 1;
+}
+
+/* }======================================================= */
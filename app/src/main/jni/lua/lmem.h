@@ -185,12 +185,22 @@ LUAI_FUNC l_noret luaM_toobig (lua_State *L);
 ** Memory Pool Functions
 */
 
+/**
+ * @brief Statistics of a size class of the memory pool.
+ */
+typedef struct MemPoolStats {
+  size_t size;    /**< Block size of the class. */
+  size_t allocs;  /**< Allocations of the class. */
+  size_t hits;    /**< Allocations served by a thread magazine. */
+  size_t slabs;   /**< Slabs currently mapped. */
+} MemPoolStats;
+
 /**
  * @brief Allocates memory from the memory pool.
  *
  * @param L The Lua state.
  * @param size The size to allocate.
- * @return Pointer to the allocated memory.
+ * @return Pointer to the allocated memory (NULL if 'size' is not small).
  */
 LUAI_FUNC void *luaM_poolalloc (lua_State *L, size_t size);
 
@@ -204,27 +214,46 @@ LUAI_FUNC void *luaM_poolalloc (lua_State *L, size_t size);
 LUAI_FUNC void luaM_poolfree (lua_State *L, void *block, size_t size);
 
 /**
- * @brief Shrinks the memory pool.
+ * @brief Gives back to the slabs all blocks cached by the running OS
+ * thread.
+ *
+ * @param L The Lua state.
+ */
+LUAI_FUNC void luaM_poolflush (lua_State *L);
+
+/**
+ * @brief Shrinks the block caches of a thread.
  *
  * @param L The Lua state.
  */
 LUAI_FUNC void luaM_poolshrink (lua_State *L);
 
 /**
- * @brief Runs garbage collection on the memory pool.
+ * @brief Runs garbage collection on the memory pool (returns empty
+ * slabs to the system).
  *
  * @param L The Lua state.
  */
 LUAI_FUNC void luaM_poolgc (lua_State *L);
 
 /**
- * @brief Gets the current usage of the memory pool.
+ * @brief Gets the memory mapped by the memory pool.
  *
  * @param L The Lua state.
  * @return usage in bytes.
  */
 LUAI_FUNC size_t luaM_poolgetusage (lua_State *L);
 
+/**
+ * @brief Gets the statistics of a size class of the memory pool.
+ *
+ * @param L The Lua state.
+ * @param c The size class.
+ * @param st Receives the statistics.
+ * @return 0 if there is no such class (or no pool); 1 otherwise.
+ */
+LUAI_FUNC int luaM_poolstats (lua_State *L, int c, MemPoolStats *st);
+
 /**
  * @brief Initializes the memory pool.
  *
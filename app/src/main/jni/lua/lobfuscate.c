@@ -29,6 +29,7 @@
 #include "lvm.h"
 #include "ltable.h"
 #include "lfunc.h"
+#include "ljit.h"
 #include "lstring.h"
 #include "lclass.h"
 #include "lthread.h"
@@ -1537,8 +1538,10 @@ int luaO_flatten (lua_State *L, Proto *f, int flags, unsigned int seed,
   }
   
   /* 更新函数原型 */
-  /* 释放旧代码 */
+  /* 释放旧代码（内联缓存和JIT机器码都由旧指令生成，一并丢弃） */
   luaM_freearray(L, f->code, f->sizecode);
+  luaF_freeicache(L, f);
+  luaJ_free(L, f);
   
   /* 分配新代码 */
   f->code = luaM_newvectorchecked(L, ctx->new_code_size, Instruction);
@@ -3513,13 +3516,13 @@ int luaO_executeVM (lua_State *L, Proto *f) {
         TString *key = tsvalue(rc);
         if (ttistable(upval)) {
            Table *h = hvalue(upval);
-           l_rwlock_rdlock(&h->lock);
+           luaH_rdlock(L, h);
            const TValue *res = luaH_getshortstr(h, key);
            if (!isempty(res)) {
               setobj2s(L, ra, res);
-              l_rwlock_unlock(&h->lock);
+              luaH_unlock(L, h);
            } else {
-              l_rwlock_unlock(&h->lock);
+              luaH_unlock(L, h);
               savepc(L); L->top.p = ci->top.p;
               luaV_finishget(L, upval, rc, ra, NULL);
            }
@@ -3587,13 +3590,13 @@ int luaO_executeVM (lua_State *L, Proto *f) {
       case OP_VARARG: { int n = c - 1; ci->u.l.savedpc = (const Instruction *)(f->code + pc); luaT_getvarargs(L, ci, base + a, n); break; }
       case OP_GETVARG: { luaT_getvararg(L, ci, base + a, s2v(base + c)); break; }
       case OP_VARARGPREP: { luaT_adjustvarargs(L, a, ci, cl->p); base = ci->func.p + 1; break; }
-      case OP_IS: { TValue *ra = s2v(base + a); TValue *rb = k + b; const char *typename_expected = getstr(tsvalue(rb)); const char *typename_actual; const TValue *tm = luaT_gettmbyobj(L, ra, TM_TYPE); if (!notm(tm) && ttisstring(tm)) typename_actual = getstr(tsvalue(tm)); else typename_actual = luaT_objtypename(L, ra); if ((strcmp(typename_actual, typename_expected) == 0) != flags) pc++; break; }
+      case OP_IS: { TValue *ra = s2v(base + a); TValue *rb = c ? s2v(base + b) : k + b; const char *typename_expected = getstr(tsvalue(rb)); const char *typename_actual; const TValue *tm = luaT_gettmbyobj(L, ra, TM_TYPE); if (!notm(tm) && ttisstring(tm)) typename_actual = getstr(tsvalue(tm)); else typename_actual = luaT_objtypename(L, ra); if ((strcmp(typename_actual, typename_expected) == 0) != flags) pc++; break; }
       case OP_TESTNIL: { TValue *rb = s2v(base + b); if (ttisnil(rb) != flags) pc++; break; }
       case OP_IN: { StkId ra = base + a; TValue *va = s2v(base + b); TValue *vb = s2v(base + c); if (ttisstring(va) && ttisstring(vb)) { const char *s1 = getstr(tsvalue(va)); const char *s2 = getstr(tsvalue(vb)); size_t l1 = tsslen(tsvalue(va)); size_t l2 = tsslen(tsvalue(vb)); int found = 0; if (l1 <= l2) { size_t i; for (i = 0; i <= l2 - l1; i++) { if (memcmp(s2 + i, s1, l1) == 0) { found = 1; break; } } } if (found) setbtvalue(s2v(ra)); else setbfvalue(s2v(ra)); } else { if (l_unlikely(!ttistable(vb))) { ci->u.l.savedpc = (const Instruction *)(f->code + pc); return 1; } const TValue *res = luaH_get(hvalue(vb), va); if (!ttisnil(res)) setbtvalue(s2v(ra)); else setbfvalue(s2v(ra)); } break; }
       case OP_SLICE: { StkId ra = base + a; StkId base_reg = base + b; TValue *src_table = s2v(base_reg); TValue *start_val = s2v(base_reg + 1); TValue *end_val = s2v(base_reg + 2); TValue *step_val = s2v(base_reg + 3); Table *t; Table *result_t; lua_Integer tlen; lua_Integer start_idx, end_idx, step; lua_Integer result_idx; if (l_unlikely(!ttistable(src_table))) { ci->u.l.savedpc = (const Instruction *)(f->code + pc); return 1; } t = hvalue(src_table); tlen = luaH_getn(t); if (ttisnil(start_val)) start_idx = 1; else if (ttisinteger(start_val)) start_idx = ivalue(start_val); else { ci->u.l.savedpc = (const Instruction *)(f->code + pc); return 1; } if (ttisnil(end_val)) end_idx = tlen; else if (ttisinteger(end_val)) end_idx = ivalue(end_val); else { ci->u.l.savedpc = (const Instruction *)(f->code + pc); return 1; } if (ttisnil(step_val)) step = 1; else if (ttisinteger(step_val)) step = ivalue(step_val); else { ci->u.l.savedpc = (const Instruction *)(f->code + pc); return 1; } if (step == 0) { ci->u.l.savedpc = (const Instruction *)(f->code + pc); return 1; } if (start_idx < 0) start_idx = tlen + start_idx + 1; if (end_idx < 0) end_idx = tlen + end_idx + 1; if (step > 0) { if (start_idx < 1) start_idx = 1; if (end_idx > tlen) end_idx = tlen; } else { if (start_idx > tlen) start_idx = tlen; if (end_idx < 1) end_idx = 1; } L->top.p = ra + 1; result_t = luaH_new(L); sethvalue2s(L, ra, result_t); result_idx = 1; if (step > 0) { lua_Integer idx; for (idx = start_idx; idx <= end_idx; idx += step) { const TValue *val = luaH_getint(t, idx); if (!ttisnil(val)) { TValue temp; setobj(L, &temp, val); luaH_setint(L, result_t, result_idx, &temp); } result_idx++; } } else { lua_Integer idx; for (idx = start_idx; idx >= end_idx; idx += step) { const TValue *val = luaH_getint(t, idx); if (!ttisnil(val)) { TValue temp; setobj(L, &temp, val); luaH_setint(L, result_t, result_idx, &temp); } result_idx++; } } checkGC(L, ra + 1); break; }
       case OP_NEWCLASS: { TString *classname = tsvalue(&k[bx]); ci->u.l.savedpc = (const Instruction *)(f->code + pc); luaC_newclass(L, classname); setobj2s(L, base + a, s2v(L->top.p - 1)); L->top.p--; checkGC(L, base + a + 1); break; }
       case OP_INHERIT: { TValue *rb = s2v(base + b); ci->u.l.savedpc = (const Instruction *)(f->code + pc); setobj2s(L, L->top.p, s2v(base + a)); L->top.p++; setobj2s(L, L->top.p, rb); L->top.p++; luaC_inherit(L, -2, -1); L->top.p -= 2; break; }
-      case OP_GETSUPER: { TString *key = tsvalue(&k[c]); ci->u.l.savedpc = (const Instruction *)(f->code + pc); setobj2s(L, L->top.p, s2v(base + b)); L->top.p++; luaC_super(L, -1, key); setobj2s(L, base + a, s2v(L->top.p - 1)); L->top.p -= 2; break; }
+      case OP_GETSUPER: { TString *key = tsvalue((flags) ? s2v(base + c) : k + c); ci->u.l.savedpc = (const Instruction *)(f->code + pc); setobj2s(L, L->top.p, s2v(base + b)); L->top.p++; luaC_super(L, -1, key); setobj2s(L, base + a, s2v(L->top.p - 1)); L->top.p -= 2; break; }
       case OP_SETMETHOD: { TString *key = tsvalue(&k[b]); TValue *rc = s2v(base + c); ci->u.l.savedpc = (const Instruction *)(f->code + pc); setobj2s(L, L->top.p, s2v(base + a)); L->top.p++; setobj2s(L, L->top.p, rc); L->top.p++; luaC_setmethod(L, -2, key, -1); L->top.p -= 2; break; }
       case OP_SETSTATIC: { TString *key = tsvalue(&k[b]); TValue *rc = s2v(base + c); ci->u.l.savedpc = (const Instruction *)(f->code + pc); setobj2s(L, L->top.p, s2v(base + a)); L->top.p++; setobj2s(L, L->top.p, rc); L->top.p++; luaC_setstatic(L, -2, key, -1); L->top.p -= 2; break; }
       case OP_NEWOBJ: { TValue *rb = s2v(base + b); int nargs = c - 1; ci->u.l.savedpc = (const Instruction *)(f->code + pc); setobj2s(L, L->top.p, rb); L->top.p++; for (int j = 0; j < nargs; j++) { setobj2s(L, L->top.p, s2v(base + a + 1 + j)); L->top.p++; } luaC_newobject(L, -(nargs + 1), nargs); setobj2s(L, base + a, s2v(L->top.p - 1)); L->top.p -= (nargs + 2); checkGC(L, base + a + 1); break; }
@@ -3602,7 +3605,7 @@ int luaO_executeVM (lua_State *L, Proto *f) {
       case OP_INSTANCEOF: { TValue *rb = s2v(base + b); luaD_checkstack(L, 2); ci->u.l.savedpc = (const Instruction *)(f->code + pc); setobj2s(L, L->top.p, s2v(base + a)); L->top.p++; setobj2s(L, L->top.p, rb); L->top.p++; int result = luaC_instanceof(L, -2, -1); L->top.p -= 2; if (result != flags) pc++; break; }
       case OP_IMPLEMENT: { TValue *rb = s2v(base + b); ci->u.l.savedpc = (const Instruction *)(f->code + pc); setobj2s(L, L->top.p, s2v(base + a)); L->top.p++; setobj2s(L, L->top.p, rb); L->top.p++; luaC_implement(L, -2, -1); L->top.p -= 2; break; }
       case OP_SETIFACEFLAG: { if (ttistable(s2v(base + a))) { Table *t = hvalue(s2v(base + a)); TValue key, val; setsvalue(L, &key, luaS_newliteral(L, "__flags")); const TValue *oldflags = luaH_getstr(t, tsvalue(&key)); lua_Integer fl = ttisinteger(oldflags) ? ivalue(oldflags) : 0; fl |= CLASS_FLAG_INTERFACE; setivalue(&val, fl); luaH_set(L, t, &key, &val); } break; }
-      case OP_ADDMETHOD: { TString *method_name = tsvalue(&k[b]); int param_count = c; if (ttistable(s2v(base + a))) { Table *t = hvalue(s2v(base + a)); TValue key; setsvalue(L, &key, luaS_newliteral(L, "__methods")); const TValue *methods_tv = luaH_getstr(t, tsvalue(&key)); if (ttistable(methods_tv)) { Table *methods = hvalue(methods_tv); TValue method_key, method_val; setsvalue(L, &method_key, method_name); setivalue(&method_val, param_count); luaH_set(L, methods, &method_key, &method_val); } } break; }
+      case OP_ADDMETHOD: { TString *method_name = tsvalue((flags) ? s2v(base + b) : k + b); int param_count = c; if (ttistable(s2v(base + a))) { Table *t = hvalue(s2v(base + a)); TValue key; setsvalue(L, &key, luaS_newliteral(L, "__methods")); const TValue *methods_tv = luaH_getstr(t, tsvalue(&key)); if (ttistable(methods_tv)) { Table *methods = hvalue(methods_tv); TValue method_key, method_val; setsvalue(L, &method_key, method_name); setivalue(&method_val, param_count); luaH_set(L, methods, &method_key, &method_val); } } break; }
       case OP_CASE: { StkId ra = base + a; TValue rb; setobj(L, &rb, s2v(base + b)); TValue rc; setobj(L, &rc, s2v(base + c)); Table *t; L->top.p = ra + 1; t = luaH_new(L); sethvalue2s(L, ra, t); luaH_setint(L, t, 1, &rb); luaH_setint(L, t, 2, &rc); checkGC(L, ra + 1); break; }
       case OP_CALL: { StkId ra = base + a; if (b) L->top.p = ra + b; ci->u.l.savedpc = (const Instruction *)(f->code + pc + 1); if (luaD_precall(L, ra, c - 1)) { luaV_execute(L, L->ci); } base = ci->func.p + 1; break; }
       case OP_TAILCALL: {
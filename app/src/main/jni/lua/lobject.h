@@ -523,6 +523,7 @@ typedef struct Struct {
   struct Table *def;    /**< Struct definition (type info). */
   int *gc_offsets;      /**< GC offsets array. */
   int n_gc_offsets;     /**< Number of GC offsets. */
+  struct StructDesc *desc; /**< Compiled field descriptors (NULL: not fetched yet). */
   size_t data_size;     /**< Size of the data block. */
   struct GCObject *parent; /**< Parent object (if this is a view). */
   lu_byte *data;        /**< Pointer to data. */
@@ -638,7 +639,22 @@ typedef struct Udata0 {
 #define LUA_VPROTO	makevariant(LUA_TPROTO, 0)
 
 
-typedef l_uint64 Instruction;
+/**
+ * @brief Inline cache of one instruction.
+ *
+ * String-keyed gets (OP_GETFIELD, OP_SELF, OP_GETTABUP) use the node
+ * hints: they are validated against the key before use, so a rehash
+ * (new node vector) simply turns them into misses and they are refilled
+ * by the next lookup. Quickenable instructions (arithmetic, order
+ * comparisons, OP_FORLOOP) use the counters.
+ */
+typedef struct InlineCache {
+  unsigned int slot;    /**< Node of the key in the indexed table. */
+  unsigned int tmslot;  /**< Node of '__index' in its metatable. */
+  unsigned int mslot;   /**< Node of the key in the '__index' table. */
+  lu_byte hits;    /**< Executions with quickenable operand types. */
+  lu_byte deopts;  /**< Times its quickened form was undone. */
+} InlineCache;
 
 
 /**
@@ -678,6 +694,11 @@ typedef struct AbsLineInfo {
 #define PF_VAHID	1  /* function has hidden vararg arguments */
 #define PF_VATAB	2  /* function has vararg table */
 #define PF_FIXED	4  /* prototype has parts in fixed memory */
+#define PF_METHOD	8  /* method: its first parameter is 'self' */
+#define PF_CLASSCODE	16  /* function nested (at any depth) in a method */
+
+/* flags that describe how a function sees 'self' (for access control) */
+#define PF_SELFMASK	(PF_METHOD | PF_CLASSCODE)
 
 /* a vararg function either has hidden args. or a vararg table */
 #define isvararg(p)	((p)->flag & (PF_VAHID | PF_VATAB))
@@ -723,6 +744,21 @@ LUAI_FUNC int luaF_callqueuepop (lua_State *L, CallQueue *q, int *nargs, TValue
 /*
 ** Function Prototypes
 */
+/**
+ * @brief Last value shape that passed an OP_CHECKTYPE.
+ *
+ * A value with the same variant tag and metatable (struct definition
+ * for structs) passes the same type object again, as long as no class
+ * changed since ('classversion').
+ */
+typedef struct TypeCache {
+  const GCObject *type;  /**< Type object (R[B]) of the check. */
+  const void *shape;  /**< Metatable or struct definition of the value. */
+  unsigned int version;  /**< 'classversion' when the entry was filled. */
+  lu_byte tag;  /**< Variant tag of the value (0: empty entry). */
+} TypeCache;
+
+
 /**
  * @brief Function prototype structure.
  */
@@ -758,6 +794,11 @@ typedef struct Proto {
   int is_sleeping; /**< Sleep status. */
   CallQueue *call_queue; /**< Call queue for sleep/wake. */
   struct VMCodeTable *vm_code_table;  /**< VM protection code table pointer. */
+  InlineCache *icache;  /**< Per-instruction inline caches (created lazily). */
+  int sizeicache;  /**< Size of 'icache' array. */
+  TypeCache *tcache;  /**< Per-instruction OP_CHECKTYPE caches (lazy). */
+  struct JitCode *jit;  /**< Machine code (see 'ljit.c'), or NULL. */
+  int jitcount;  /**< Hotness counter for the JIT (-1: not compilable). */
 } Proto;
 
 /* }======================================================= */
@@ -948,6 +989,8 @@ typedef struct SuperStruct {
   unsigned int nsize; /**< Size. */
   unsigned int ncapacity; /**< Capacity. */
   TValue *data; /**< Data. */
+  unsigned int *index; /**< Hash index into 'data' (NULL: 'data' is sorted). */
+  unsigned int nindex; /**< Number of slots in 'index' (a power of 2). */
 } SuperStruct;
 
 #define gco2superstruct(o)	check_exp((o)->tt == LUA_VSUPERSTRUCT, &((cast_u(o) - offsetof(SuperStruct, next))->superstruct))
@@ -1032,7 +1075,7 @@ typedef struct Table {
   struct GCObject *metatable; /**< Metatable pointer. */
   GCObject *gclist; /**< Garbage collector list. */
   lu_byte type;    /**< Custom type flag. */
-  l_rwlock_t lock; /**< Lock for thread safety. */
+  l_tablelock_t lock; /**< Lock for thread safety (one word). */
   struct Namespace *using_next; /**< Used namespaces. */
 } Table;
 
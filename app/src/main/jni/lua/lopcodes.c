@@ -19,7 +19,7 @@
 
 /* ORDER OP */
 
-LUAI_DDEF const lu_byte luaP_opmodes[NUM_OPCODES] = {
+LUAI_DDEF const lu_byte luaP_opmodes[NUM_VMOPCODES] = {
 /*       MM OT IT T  A  mode		   opcode  */
   opmode(0, 0, 0, 0, 1, iABC)		/* OP_MOVE */
  ,opmode(0, 0, 0, 0, 1, iAsBx)		/* OP_LOADI */
@@ -136,6 +136,30 @@ LUAI_DDEF const lu_byte luaP_opmodes[NUM_OPCODES] = {
  ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_GENERICWRAP */
  ,opmode(0, 0, 0, 0, 0, iABC)		/* OP_CHECKTYPE */
  ,opmode(0, 0, 0, 0, 0, iAx)		/* OP_EXTRAARG */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_ADDINT */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_SUBINT */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_MULINT */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_ADDFLT */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_SUBFLT */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_MULFLT */
+ ,opmode(0, 0, 0, 1, 0, iABC)		/* OP_LTINT */
+ ,opmode(0, 0, 0, 1, 0, iABC)		/* OP_LEINT */
+ ,opmode(0, 0, 0, 0, 1, iABx)		/* OP_FORLOOPINT */
+};
+
+
+/* ORDER OP (quickened opcodes only) */
+
+LUAI_DDEF const lu_byte luaP_genericops[NUM_VMOPCODES - NUM_OPCODES] = {
+  OP_ADD		/* OP_ADDINT */
+ ,OP_SUB		/* OP_SUBINT */
+ ,OP_MUL		/* OP_MULINT */
+ ,OP_ADD		/* OP_ADDFLT */
+ ,OP_SUB		/* OP_SUBFLT */
+ ,OP_MUL		/* OP_MULFLT */
+ ,OP_LT		/* OP_LTINT */
+ ,OP_LE		/* OP_LEINT */
+ ,OP_FORLOOP		/* OP_FORLOOPINT */
 };
 
 
@@ -11,7 +11,8 @@
 
 
 /*================================================================
-  We assume that instructions are unsigned 64-bit integers.
+  We assume that instructions are unsigned 64-bit integers (or 32-bit
+  ones when 'LUAI_COMPACTINST' is defined; see the second table).
   All instructions have an opcode in the first 9 bits.
   Instructions can have the following formats:
 
@@ -24,6 +25,17 @@ iAsBx              sBx (signed)(33)      |     A(16)      |   Op(9)     |
 iAx                           Ax(49)                     |   Op(9)     |
 isJ                           sJ (signed)(49)            |   Op(9)     |
 
+  Compact (32-bit) layout, identical to stock Lua 5.5:
+
+        3 3 2 2 2 2 2 2 2 2 2 2 1 1 1 1 1 1 1 1 1 1 0 0 0 0 0 0 0 0 0 0
+        1 0 9 8 7 6 5 4 3 2 1 0 9 8 7 6 5 4 3 2 1 0 9 8 7 6 5 4 3 2 1 0
+iABC          C(8)     |      B(8)     |k|     A(8)      |   Op(7)     |
+ivABC         vC(10)     |     vB(6)   |k|     A(8)      |   Op(7)     |
+iABx                Bx(17)               |     A(8)      |   Op(7)     |
+iAsBx              sBx (signed)(17)      |     A(8)      |   Op(7)     |
+iAx                           Ax(25)                     |   Op(7)     |
+isJ                           sJ (signed)(25)            |   Op(7)     |
+
   ('v' stands for "variant", 's' for "signed", 'x' for "extended.")
   A signed argument is represented in excess K: The represented value is
   the written unsigned value minus K, where K is half (rounded down) the
@@ -38,17 +50,26 @@ enum OpMode {iABC, ivABC, iABx, iAsBx, iAx, isJ};
 /*
 ** size and position of opcode arguments.
 */
+#if defined(LUAI_COMPACTINST)
+#define SIZE_C		8
+#define SIZE_vC		10
+#define SIZE_B		8
+#define SIZE_vB		6
+#define SIZE_A		8
+#define SIZE_OP		7
+#else
 #define SIZE_C		16
 #define SIZE_vC		20
 #define SIZE_B		16
 #define SIZE_vB		14
-#define SIZE_Bx		(SIZE_C + SIZE_B + 1)
 #define SIZE_A		16
+#define SIZE_OP		9
+#endif
+
+#define SIZE_Bx		(SIZE_C + SIZE_B + 1)
 #define SIZE_Ax		(SIZE_Bx + SIZE_A)
 #define SIZE_sJ		(SIZE_Bx + SIZE_A)
 
-#define SIZE_OP		9
-
 #define POS_OP		0
 
 #define POS_A		(POS_OP + SIZE_OP)
@@ -346,7 +367,7 @@ OP_ERRNNIL,/*	A Bx	raise error if R[A] ~= nil (K[Bx - 1] is global name)*/
 
 OP_VARARGPREP,/* 	(adjust varargs)				*/
 
-OP_IS,/*	A B C k	if ((type(R[A]) == K[B]) ~= k) then pc++	*/
+OP_IS,/*	A B C k	if ((type(R[A]) == K[B]) ~= k) then pc++ (R[B] if C)	*/
 
 OP_TESTNIL,/*	A B k	if (R[B] is nil) == k then pc++ else R[A] := R[B]	*/
 
@@ -355,7 +376,7 @@ OP_TESTNIL,/*	A B k	if (R[B] is nil) == k then pc++ else R[A] := R[B]	*/
 ------------------------------------------------------------------------*/
 OP_NEWCLASS,/*	A Bx	R[A] := 创建新类，类名为K[Bx]			*/
 OP_INHERIT,/*	A B	R[A].__parent := R[B]，设置类继承关系		*/
-OP_GETSUPER,/*	A B C	R[A] := R[B].__parent[K[C]:shortstring]	调用父类方法	*/
+OP_GETSUPER,/*	A B C k	R[A] := R[B].__parent[K[C]:shortstring]（k 时为 R[C]）	调用父类方法	*/
 OP_SETMETHOD,/*	A B C	R[A][K[B]:shortstring] := R[C]，设置类方法		*/
 OP_SETSTATIC,/*	A B C	R[A].__static[K[B]:shortstring] := R[C]，设置静态成员	*/
 OP_NEWOBJ,/*	A B C	R[A] := R[B]()，使用R[B]类创建新对象，参数C个	*/
@@ -364,7 +385,7 @@ OP_SETPROP,/*	A B C	R[A][K[B]:shortstring] := RK(C)，设置对象属性	*/
 OP_INSTANCEOF,/*A B C k	if ((R[A] instanceof R[B]) ~= k) then pc++	*/
 OP_IMPLEMENT,/*	A B	R[A] implements R[B]，类实现接口			*/
 OP_SETIFACEFLAG,/*A	设置R[A]为接口（设置CLASS_FLAG_INTERFACE）	*/
-OP_ADDMETHOD,/*	A B C	R[A].__methods[K[B]] := K[C]，添加接口方法签名	*/
+OP_ADDMETHOD,/*	A B C k	R[A].__methods[K[B]] := C（k 时为 R[B]），添加接口方法签名	*/
 
 OP_IN,/*	A B C	R[A] := R[B] in R[C]				*/
 
@@ -400,14 +421,36 @@ OP_GETCMDS,/*	A	R[A] := LXC_CMDS				*/
 OP_GETOPS,/*	A	R[A] := LXC_OPERATORS				*/
 OP_ASYNCWRAP,/*	A B	R[A] := async_wrap(R[B])			*/
 OP_GENERICWRAP,/* A B	R[A] := generic_wrap(R[B], R[B+1], R[B+2])	*/
-OP_CHECKTYPE,/*	A B C	if (check_type(R[A], R[B]) != true) error(K[C])	*/
+OP_CHECKTYPE,/*	A B C k	if (!(k and R[A] == nil) and check_type(R[A], R[B]) != true) error(K[C])
+			(error(R[B+1]) if C == MAXARG_C; a run of these
+			with the same A and C and B, B+1, ... is a union)	*/
 
-OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
+OP_EXTRAARG,/*	Ax	extra (larger) argument for previous opcode	*/
+
+/*
+** Quickened opcodes. The interpreter rewrites a generic instruction in
+** place into one of these after it has repeatedly seen the operand types
+** the variant handles; operands and encoding are those of the generic
+** opcode. They never appear in compiled or dumped code.
+*/
+OP_ADDINT,/*	A B C	R[A] := R[B] + R[C] (integers)			*/
+OP_SUBINT,/*	A B C	R[A] := R[B] - R[C] (integers)			*/
+OP_MULINT,/*	A B C	R[A] := R[B] * R[C] (integers)			*/
+OP_ADDFLT,/*	A B C	R[A] := R[B] + R[C] (floats)			*/
+OP_SUBFLT,/*	A B C	R[A] := R[B] - R[C] (floats)			*/
+OP_MULFLT,/*	A B C	R[A] := R[B] * R[C] (floats)			*/
+OP_LTINT,/*	A B k	if ((R[A] < R[B]) ~= k) then pc++ (integers)	*/
+OP_LEINT,/*	A B k	if ((R[A] <= R[B]) ~= k) then pc++ (integers)	*/
+OP_FORLOOPINT/*	A Bx	OP_FORLOOP for an integer loop			*/
 } OpCode;
 
 
+/* opcodes that can appear in compiled (and dumped) code */
 #define NUM_OPCODES	((int)(OP_EXTRAARG) + 1)
 
+/* all opcodes the interpreter executes, including quickened ones */
+#define NUM_VMOPCODES	((int)(OP_FORLOOPINT) + 1)
+
 
 
 /*================================================================
@@ -467,6 +510,10 @@ OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
   original operand was a float. (It must be corrected in case of
   metamethods.)
 
+  (*) A quickened opcode checks its operand types on each execution;
+  when they do not match, it rewrites itself back to its generic
+  opcode ('luaP_genericop') and the instruction is executed again.
+
 ================================================================*/
 
 
@@ -480,7 +527,8 @@ OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
 ** bit 7: instruction is an MM instruction (call a metamethod)
 */
 
-LUAI_DDEC(const lu_byte luaP_opmodes[NUM_OPCODES];)
+LUAI_DDEC(const lu_byte luaP_opmodes[NUM_VMOPCODES];)
+LUAI_DDEC(const lu_byte luaP_genericops[NUM_VMOPCODES - NUM_OPCODES];)
 
 #define getOpMode(m)	(cast(enum OpMode, luaP_opmodes[m] & 7))
 #define testAMode(m)	(luaP_opmodes[m] & (1 << 3))
@@ -489,6 +537,12 @@ LUAI_DDEC(const lu_byte luaP_opmodes[NUM_OPCODES];)
 #define testOTMode(m)	(luaP_opmodes[m] & (1 << 6))
 #define testMMMode(m)	(luaP_opmodes[m] & (1 << 7))
 
+/* generic opcode of a (possibly quickened) opcode */
+#define luaP_isquickened(o)	((int)(o) >= NUM_OPCODES)
+#define luaP_genericop(o)  \
+	(luaP_isquickened(o) ? cast(OpCode, luaP_genericops[(o) - NUM_OPCODES]) \
+	                     : (o))
+
 /* "out top" (set top for next instruction) */
 #define isOT(i)  \
 	((testOTMode(GET_OPCODE(i)) && GETARG_C(i) == 0) || \
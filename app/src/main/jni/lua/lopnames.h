@@ -45,8 +45,8 @@ static const char *const opnames[] = {
   "BANDK",
   "BORK",
   "BXORK",
-  "SHRI",
   "SHLI",
+  "SHRI",
   "ADD",
   "SUB",
   "MUL",
@@ -128,6 +128,15 @@ static const char *const opnames[] = {
   "GENERICWRAP",
   "CHECKTYPE",
   "EXTRAARG",
+  "ADDINT",
+  "SUBINT",
+  "MULINT",
+  "ADDFLT",
+  "SUBFLT",
+  "MULFLT",
+  "LTINT",
+  "LEINT",
+  "FORLOOPINT",
   NULL
 };
 
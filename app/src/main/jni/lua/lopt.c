@@ -0,0 +1,1387 @@
+/*
+** $Id: lopt.c $
+** Bytecode optimizer (constant propagation and inlining)
+** See Copyright Notice in lua.h
+*/
+
+#define lopt_c
+#define LUA_CORE
+
+#include "lprefix.h"
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "lua.h"
+
+#include "ldebug.h"
+#include "lgc.h"
+#include "lmem.h"
+#include "lobject.h"
+#include "lopcodes.h"
+#include "lopt.h"
+#include "lstate.h"
+#include "lvm.h"
+
+
+/*
+** The optimizer works on finished prototypes, one function at a time,
+** from the main function down to its nested functions, so that what is
+** known about the locals of a function is also known about the upvalues
+** of the functions nested in it.
+**
+** Everything rests on a simple fact about the code generated by the
+** parser: a register is only read while its variable (or temporary) is
+** alive, and each variable is written before it is read. So, when there
+** is exactly one instruction writing a register in the whole function,
+** and no nested function assigns it through an upvalue, every read of
+** that register sees the value written by that instruction. If it loads
+** a constant, reads can be replaced by that constant; if it creates a
+** closure, calls through that register always call that closure.
+**
+** Changes are done in place (replacing instructions and turning dead
+** ones into OP_NOP) and then the code is rebuilt without the OP_NOPs and
+** without the instructions no longer reachable, with inlined bodies in
+** the place of their calls. This repeats until nothing else changes.
+*/
+
+
+/* maximum number of registers of a function (as in 'lcode.c') */
+#define MAXREGS		255
+
+/* maximum number of instructions in the body of an inlined function */
+#define MAXINLINE	8
+
+/* maximum number of passes over a function */
+#define MAXROUNDS	16
+
+/* limit for relative line information (as in 'lcode.c') */
+#define LIMLINEDIFF	0x80
+
+
+#define NOPINSTR	CREATE_ABCk(OP_NOP, 0, 0, 0, 0)
+
+#define isreturn(op)  \
+	((op) == OP_RETURN || (op) == OP_RETURN0 || (op) == OP_RETURN1)
+
+#define ismmbin(op)  \
+	((op) == OP_MMBIN || (op) == OP_MMBINI || (op) == OP_MMBINK)
+
+/* values that can be propagated (and always compare without metamethods) */
+#define isfoldable(v)  \
+	(ttisnil(v) || ttisboolean(v) || ttisinteger(v) || ttisfloat(v) || \
+	 ttisstring(v))
+
+/* instructions that skip the following jump */
+#define istest(op)  \
+	(((op) >= OP_EQ && (op) <= OP_GEI) || (op) == OP_TEST || \
+	 (op) == OP_TESTSET)
+
+#define isnum(v)	(ttisinteger(v) || ttisfloat(v))
+
+
+/* kinds of knowledge about a value */
+#define KUNKNOWN	0
+#define KCONST		1	/* a constant */
+#define KCLOSURE	2	/* a closure of a known prototype */
+
+
+typedef struct Known {
+  lu_byte kind;
+  lu_byte depth;  /* KCLOSURE: 0 if created by this function, 1 by its parent */
+  TValue v;  /* KCONST: the value */
+  Proto *f;  /* KCLOSURE: its prototype */
+} Known;
+
+
+typedef struct OptState {
+  lua_State *L;
+  Proto *p;  /* function being optimized */
+  const Known *up;  /* what is known about upvalues of 'p' (or NULL) */
+  int level;
+  lu_byte *target;  /* instructions entered other than by fall-through */
+  int *splice;  /* start in 'pool' of the code replacing each call (or -1) */
+  lu_byte *splicen;  /* size of that code */
+  int nsplice;  /* number of calls being replaced */
+  Instruction *pool;  /* bodies of inlined calls */
+  int npool;
+  int sizepool;
+  int ndefs[MAXREGS];  /* number of instructions writing each register */
+  int defpc[MAXREGS];  /* last instruction writing it (-1: the entry) */
+  lu_byte wrup[MAXREGS];  /* assigned through an upvalue? */
+  lu_byte blockk[MAXREGS];  /* constant since the start of the block? */
+  TValue *blockv;  /* value of those constants */
+} OptState;
+
+
+
+/*
+** {======================================================
+** Instruction properties
+** =======================================================
+*/
+
+/*
+** Set '*first' and '*last' to the range of registers written by 'i'
+** (an empty range if none). Calls and other instructions with multiple
+** results may also clobber registers above their results, but those are
+** never alive at that point. Returns 0 for instructions the optimizer
+** does not know, so that it leaves their functions alone.
+*/
+static int regwrites (const Proto *p, Instruction i, int *first,
+                                                     int *last) {
+  int a = GETARG_A(i);
+  *first = *last = a;
+  switch (GET_OPCODE(i)) {
+    case OP_MOVE: case OP_LOADI: case OP_LOADF: case OP_LOADK:
+    case OP_LOADKX: case OP_LOADFALSE: case OP_LFALSESKIP: case OP_LOADTRUE:
+    case OP_GETUPVAL: case OP_GETTABUP: case OP_GETTABLE: case OP_GETI:
+    case OP_GETFIELD: case OP_NEWTABLE: case OP_ADDI: case OP_ADDK:
+    case OP_SUBK: case OP_MULK: case OP_MODK: case OP_POWK: case OP_DIVK:
+    case OP_IDIVK: case OP_BANDK: case OP_BORK: case OP_BXORK:
+    case OP_SHRI: case OP_SHLI: case OP_ADD: case OP_SUB: case OP_MUL:
+    case OP_MOD: case OP_POW: case OP_DIV: case OP_IDIV: case OP_BAND:
+    case OP_BOR: case OP_BXOR: case OP_SHL: case OP_SHR: case OP_UNM:
+    case OP_BNOT: case OP_NOT: case OP_LEN: case OP_CLOSURE:
+    case OP_TESTSET: case OP_GETVARG:
+      break;
+    case OP_LOADNIL: *last = a + GETARG_B(i); break;
+    case OP_SELF: *last = a + 1; break;
+    case OP_CONCAT: *last = a + GETARG_B(i) - 1; break;
+    case OP_CALL: case OP_VARARG: {
+      int c = GETARG_C(i);
+      *last = (c == 0) ? p->maxstacksize - 1 : a + c - 2;
+      break;
+    }
+    case OP_FORPREP: case OP_FORLOOP:
+    case OP_TFORPREP: case OP_TFORLOOP:
+      *last = a + 3;
+      break;
+    case OP_TFORCALL:
+      *first = a + 4;
+      *last = a + 3 + GETARG_C(i);
+      break;
+    case OP_SETUPVAL: case OP_SETTABUP: case OP_SETTABLE: case OP_SETI:
+    case OP_SETFIELD: case OP_MMBIN: case OP_MMBINI: case OP_MMBINK:
+    case OP_CLOSE: case OP_TBC: case OP_JMP: case OP_EQ: case OP_LT:
+    case OP_LE: case OP_EQK: case OP_EQI: case OP_LTI: case OP_LEI:
+    case OP_GTI: case OP_GEI: case OP_TEST: case OP_TAILCALL:
+    case OP_RETURN: case OP_RETURN0: case OP_RETURN1: case OP_SETLIST:
+    case OP_VARARGPREP: case OP_ERRNNIL: case OP_NOP: case OP_EXTRAARG:
+      *first = 1; *last = 0;  /* no registers */
+      break;
+    default: return 0;
+  }
+  if (*last >= p->maxstacksize)
+    *last = p->maxstacksize - 1;
+  return 1;
+}
+
+
+/*
+** Destination of the jump in instruction 'i' at 'pc', or -1 if it does
+** not jump.
+*/
+static int jumpto (Instruction i, int pc) {
+  switch (GET_OPCODE(i)) {
+    case OP_JMP: return pc + 1 + GETARG_sJ(i);
+    case OP_FORPREP: return pc + GETARG_Bx(i) + 2;
+    case OP_TFORPREP: return pc + GETARG_Bx(i) + 1;
+    case OP_FORLOOP: case OP_TFORLOOP: return pc + 1 - GETARG_Bx(i);
+    default: return -1;
+  }
+}
+
+
+/*
+** Change the jump in '*i', now at 'pc', to go to 'dest'.
+*/
+static void fixjumpto (Instruction *i, int pc, int dest) {
+  switch (GET_OPCODE(*i)) {
+    case OP_JMP: SETARG_sJ(*i, dest - pc - 1); break;
+    case OP_FORPREP: SETARG_Bx(*i, dest - pc - 2); break;
+    case OP_TFORPREP: SETARG_Bx(*i, dest - pc - 1); break;
+    default: SETARG_Bx(*i, pc + 1 - dest); break;  /* loops jump back */
+  }
+}
+
+
+/*
+** Store in 's' the instructions that may follow the one at 'pc', other
+** than 'pc + 1', and return their number; '*next' tells whether the
+** execution may go on to 'pc + 1'.
+*/
+static int branches (const Proto *p, int pc, int *s, int *next) {
+  Instruction i = p->code[pc];
+  *next = 1;
+  switch (GET_OPCODE(i)) {
+    case OP_JMP: case OP_TFORPREP:
+      *next = 0;
+      s[0] = jumpto(i, pc);
+      return 1;
+    case OP_FORPREP:
+      s[0] = jumpto(i, pc);
+      s[1] = s[0] - 1;  /* keep its OP_FORLOOP */
+      return 2;
+    case OP_FORLOOP: case OP_TFORLOOP:
+      s[0] = jumpto(i, pc);
+      return 1;
+    case OP_EQ: case OP_LT: case OP_LE: case OP_EQK: case OP_EQI:
+    case OP_LTI: case OP_LEI: case OP_GTI: case OP_GEI:
+    case OP_TEST: case OP_TESTSET:
+      s[0] = pc + 2;  /* skips its jump */
+      return 1;
+    case OP_LFALSESKIP:
+      *next = 0;
+      s[0] = pc + 2;
+      s[1] = pc + 1;  /* the skipped instruction must stay in place */
+      return 2;
+    case OP_RETURN: case OP_RETURN0: case OP_RETURN1:
+      *next = 0;
+      return 0;
+    default:
+      return 0;
+  }
+}
+
+
+/*
+** Instructions writing only their register A, and that can write their
+** result anywhere.
+*/
+static int hasresult (OpCode op) {
+  switch (op) {
+    case OP_MOVE: case OP_LOADI: case OP_LOADF: case OP_LOADK:
+    case OP_LOADFALSE: case OP_LOADTRUE: case OP_GETUPVAL:
+    case OP_GETTABUP: case OP_GETTABLE: case OP_GETI: case OP_GETFIELD:
+    case OP_UNM: case OP_BNOT: case OP_NOT: case OP_LEN:
+      return 1;
+    default:
+      return (OP_ADDI <= op && op <= OP_SHR);  /* arithmetic */
+  }
+}
+
+
+/*
+** LUA_OP* code of an arithmetic instruction, or -1. (ORDER OP)
+*/
+static int arithop (OpCode op) {
+  if (OP_ADD <= op && op <= OP_SHR)
+    return cast_int(op - OP_ADD) + LUA_OPADD;
+  else if (OP_ADDK <= op && op <= OP_BXORK)
+    return cast_int(op - OP_ADDK) + LUA_OPADD;
+  switch (op) {
+    case OP_ADDI: return LUA_OPADD;
+    case OP_SHRI: return LUA_OPSHR;
+    case OP_SHLI: return LUA_OPSHL;
+    default: return -1;
+  }
+}
+
+
+static int fitsBx (lua_Integer i) {
+  return (-OFFSET_sBx <= i && i <= MAXARG_Bx - OFFSET_sBx);
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Analysis
+** =======================================================
+*/
+
+/*
+** Whether upvalue 'uv' of 'f' may be assigned by 'f' or by a function
+** nested in it.
+*/
+static int upvalwritten (const Proto *f, int uv) {
+  int pc, i, u;
+  for (pc = 0; pc < f->sizecode; pc++) {
+    Instruction ins = f->code[pc];
+    if (GET_OPCODE(ins) == OP_SETUPVAL && GETARG_B(ins) == uv)
+      return 1;
+  }
+  for (i = 0; i < f->sizep; i++) {
+    const Proto *c = f->p[i];
+    for (u = 0; u < c->sizeupvalues; u++) {
+      if (!c->upvalues[u].instack && c->upvalues[u].idx == uv &&
+          upvalwritten(c, u))
+        return 1;
+    }
+  }
+  return 0;
+}
+
+
+/*
+** Count the writes to each register, mark the registers that nested
+** functions may assign, and mark the instructions entered by jumps.
+** Returns 0 if the function uses an unknown instruction.
+*/
+static int analyze (OptState *os) {
+  Proto *p = os->p;
+  int nentry = p->numparams + ((p->flag & PF_VATAB) ? 1 : 0);
+  int pc, r, j, u;
+  for (r = 0; r < MAXREGS; r++) {
+    os->ndefs[r] = (r < nentry);  /* parameters are written at entry */
+    os->defpc[r] = -1;
+    os->wrup[r] = 0;
+  }
+  memset(os->target, 0, p->sizecode + 1);
+  for (pc = 0; pc < p->sizecode; pc++) {
+    int first, last, next, n;
+    int s[2];
+    if (!regwrites(p, p->code[pc], &first, &last))
+      return 0;
+    for (r = (first < 0) ? 0 : first; r <= last; r++) {
+      os->ndefs[r]++;
+      os->defpc[r] = pc;
+    }
+    n = branches(p, pc, s, &next);
+    while (n--) {
+      if (0 <= s[n] && s[n] <= p->sizecode)
+        os->target[s[n]] = 1;
+    }
+  }
+  for (j = 0; j < p->sizep; j++) {
+    const Proto *c = p->p[j];
+    for (u = 0; u < c->sizeupvalues; u++) {
+      if (c->upvalues[u].instack && upvalwritten(c, u))
+        os->wrup[c->upvalues[u].idx] = 1;
+    }
+  }
+  return 1;
+}
+
+
+/*
+** A register always holding the value written by its only writer.
+*/
+static int isstable (OptState *os, int r) {
+  return (r < os->p->maxstacksize && os->ndefs[r] == 1 && !os->wrup[r]);
+}
+
+
+/*
+** Value loaded by instruction 'i', if it loads a constant.
+*/
+static int constload (OptState *os, Instruction i, TValue *v) {
+  switch (GET_OPCODE(i)) {
+    case OP_LOADI: setivalue(v, GETARG_sBx(i)); return 1;
+    case OP_LOADF: setfltvalue(v, cast_num(GETARG_sBx(i))); return 1;
+    case OP_LOADFALSE: setbfvalue(v); return 1;
+    case OP_LOADTRUE: setbtvalue(v); return 1;
+    case OP_LOADNIL: setnilvalue(v); return 1;
+    case OP_LOADK: {
+      const TValue *k = &os->p->k[GETARG_Bx(i)];
+      if (!isfoldable(k))
+        return 0;
+      setobj(os->L, v, k);
+      return 1;
+    }
+    default: return 0;
+  }
+}
+
+
+/*
+** A closure of 'f' created by the function being optimized is known only
+** if its upvalues always have the values of the variables they captured,
+** that is, if they capture stable registers.
+*/
+static void closureknown (OptState *os, Proto *f, Known *kn) {
+  int u;
+  kn->kind = KUNKNOWN;
+  for (u = 0; u < f->sizeupvalues; u++) {
+    if (f->upvalues[u].instack && !isstable(os, f->upvalues[u].idx))
+      return;
+  }
+  kn->kind = KCLOSURE;
+  kn->depth = 0;
+  kn->f = f;
+}
+
+
+/*
+** What is known about the value of register 'r'.
+*/
+static void regknown (OptState *os, int r, Known *kn) {
+  kn->kind = KUNKNOWN;
+  if (isstable(os, r) && os->defpc[r] >= 0) {
+    Instruction i = os->p->code[os->defpc[r]];
+    if (constload(os, i, &kn->v))
+      kn->kind = KCONST;
+    else if (GET_OPCODE(i) == OP_CLOSURE)
+      closureknown(os, os->p->p[GETARG_Bx(i)], kn);
+  }
+}
+
+
+/*
+** Whether register 'r' holds a known constant at the instruction being
+** folded: either it is always the same constant, or a constant was
+** loaded into it earlier in the same basic block (see 'foldpass').
+*/
+static int regconst (OptState *os, int r, TValue *v) {
+  Known kn;
+  regknown(os, r, &kn);
+  if (kn.kind == KCONST) {
+    setobj(os->L, v, &kn.v);
+    return 1;
+  }
+  else if (os->blockk[r]) {
+    setobj(os->L, v, &os->blockv[r]);
+    return 1;
+  }
+  return 0;
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Constant propagation
+** =======================================================
+*/
+
+/*
+** Index of constant 'v' in the function, adding it if needed; -1 if
+** the index would be larger than 'limit'.
+*/
+static int kindex (OptState *os, const TValue *v, int limit) {
+  Proto *p = os->p;
+  int k;
+  for (k = 0; k < p->sizek; k++) {
+    if (ttypetag(&p->k[k]) == ttypetag(v) && luaV_rawequalobj(&p->k[k], v))
+      return (k <= limit) ? k : -1;
+  }
+  if (k > limit)
+    return -1;
+  p->k = luaM_reallocvector(os->L, p->k, p->sizek, p->sizek + 1, TValue);
+  setobj(os->L, &p->k[k], v);
+  p->sizek++;
+  luaC_barrier(os->L, p, v);
+  return k;
+}
+
+
+/*
+** Build in '*i' an instruction loading constant 'v' into register 'a'.
+*/
+static int loadconst (OptState *os, int a, const TValue *v, Instruction *i) {
+  lua_Integer n;
+  int k;
+  switch (ttypetag(v)) {
+    case LUA_VNIL: *i = CREATE_ABCk(OP_LOADNIL, a, 0, 0, 0); return 1;
+    case LUA_VFALSE: *i = CREATE_ABCk(OP_LOADFALSE, a, 0, 0, 0); return 1;
+    case LUA_VTRUE: *i = CREATE_ABCk(OP_LOADTRUE, a, 0, 0, 0); return 1;
+    case LUA_VNUMINT:
+      if (fitsBx(ivalue(v))) {
+        *i = CREATE_ABx(OP_LOADI, a, cast_int(ivalue(v)) + OFFSET_sBx);
+        return 1;
+      }
+      break;
+    case LUA_VNUMFLT:
+      if (fltvalue(v) == 0)  /* may be -0.0 */
+        return 0;
+      if (luaV_flttointeger(fltvalue(v), &n, F2Ieq) && fitsBx(n)) {
+        *i = CREATE_ABx(OP_LOADF, a, cast_int(n) + OFFSET_sBx);
+        return 1;
+      }
+      break;
+    default: break;
+  }
+  k = kindex(os, v, MAXARG_Bx);
+  if (k < 0)
+    return 0;
+  *i = CREATE_ABx(OP_LOADK, a, k);
+  return 1;
+}
+
+
+/*
+** Whether integer operation 'op' over 'a' and 'b' overflows. The VM
+** turns such a result into a big integer instead of wrapping around, as
+** 'luaO_rawarith' does, so it must be left for run time.
+*/
+static int intoverflow (int op, lua_Integer a, lua_Integer b) {
+  lua_Integer r;
+  switch (op) {
+    case LUA_OPADD:  /* overflows iff the result sign differs from both */
+      r = l_castU2S(l_castS2U(a) + l_castS2U(b));
+      return ((a ^ r) & (b ^ r)) < 0;
+    case LUA_OPSUB:  /* overflows iff 'a' differs in sign from 'b' and 'r' */
+      r = l_castU2S(l_castS2U(a) - l_castS2U(b));
+      return ((a ^ b) & (a ^ r)) < 0;
+    case LUA_OPMUL:
+      if (a == 0 || b == 0)
+        return 0;
+      if (b == -1)
+        return (a == LUA_MININTEGER);
+      if (a == -1)
+        return (b == LUA_MININTEGER);
+      r = l_castU2S(l_castS2U(a) * l_castS2U(b));
+      return (r / b != a);
+    case LUA_OPUNM:
+      return (a == LUA_MININTEGER);
+    default:
+      return 0;
+  }
+}
+
+
+/*
+** Whether it is safe to fold an operation (as in 'lcode.c'): no errors
+** from division by zero or conversion of floats to integers, and no
+** integer overflow (see 'intoverflow').
+*/
+static int validop (int op, const TValue *v1, const TValue *v2) {
+  if (!isnum(v1) || !isnum(v2))
+    return 0;
+  if (ttisinteger(v1) && ttisinteger(v2) &&
+      intoverflow(op, ivalue(v1), ivalue(v2)))
+    return 0;
+  switch (op) {
+    case LUA_OPBAND: case LUA_OPBOR: case LUA_OPBXOR:
+    case LUA_OPSHL: case LUA_OPSHR: case LUA_OPBNOT: {
+      lua_Integer i;
+      return (luaV_tointegerns(v1, &i, LUA_FLOORN2I) &&
+              luaV_tointegerns(v2, &i, LUA_FLOORN2I));
+    }
+    case LUA_OPDIV: case LUA_OPIDIV: case LUA_OPMOD:
+      return (nvalue(v2) != 0);
+    default: return 1;
+  }
+}
+
+
+/*
+** Compute 'op' over constants and replace instruction 'pc' by a load of
+** the result (folds neither NaN nor 0.0, as 'lcode.c').
+*/
+static int foldop (OptState *os, int pc, int op, const TValue *v1,
+                                                 const TValue *v2) {
+  TValue res;
+  Instruction i;
+  if (!validop(op, v1, v2) || !luaO_rawarith(os->L, op, v1, v2, &res))
+    return 0;
+  if (ttisfloat(&res) &&
+      (luai_numisnan(fltvalue(&res)) || fltvalue(&res) == 0))
+    return 0;
+  if (!loadconst(os, GETARG_A(os->p->code[pc]), &res, &i))
+    return 0;
+  os->p->code[pc] = i;
+  return 1;
+}
+
+
+/*
+** Fold a binary arithmetic instruction over constants; its following
+** OP_MMBIN* becomes dead.
+*/
+static int foldarith (OptState *os, int pc) {
+  Proto *p = os->p;
+  Instruction i = p->code[pc];
+  OpCode op = GET_OPCODE(i);
+  TValue v1, v2;
+  if (pc + 1 >= p->sizecode || !ismmbin(GET_OPCODE(p->code[pc + 1])))
+    return 0;
+  if (op == OP_SHLI) {  /* sC << R[B] */
+    setivalue(&v1, GETARG_sC(i));
+    if (!regconst(os, GETARG_B(i), &v2))
+      return 0;
+  }
+  else {
+    if (!regconst(os, GETARG_B(i), &v1))
+      return 0;
+    if (op == OP_ADDI || op == OP_SHRI) {
+      setivalue(&v2, GETARG_sC(i));
+    }
+    else if (OP_ADDK <= op && op <= OP_BXORK) {
+      setobj(os->L, &v2, &p->k[GETARG_C(i)]);
+    }
+    else if (!regconst(os, GETARG_C(i), &v2))
+      return 0;
+  }
+  if (!foldop(os, pc, arithop(op), &v1, &v2))
+    return 0;
+  p->code[pc + 1] = NOPINSTR;
+  return 1;
+}
+
+
+/*
+** Whether integer 'i' fits in an sC argument (as 'fitsC' in 'lcode.c').
+*/
+static int fitssC (lua_Integer i) {
+  return (l_castS2U(i) + OFFSET_sC <= cast_uint(MAXARG_C));
+}
+
+
+/*
+** Use OP_ADDI for an addition with one operand known to be a small
+** integer, as the parser does when that operand is a literal.
+*/
+static int foldaddi (OptState *os, int pc) {
+  Proto *p = os->p;
+  Instruction i = p->code[pc];
+  Instruction mm = p->code[pc + 1];
+  int flip = 0;
+  int r = GETARG_B(i);
+  TValue v;
+  if (GET_OPCODE(mm) != OP_MMBIN)
+    return 0;
+  if (!regconst(os, GETARG_C(i), &v)) {
+    if (!regconst(os, GETARG_B(i), &v))
+      return 0;
+    r = GETARG_C(i);  /* addition is commutative */
+    flip = 1;
+  }
+  if (!ttisinteger(&v) || !fitssC(ivalue(&v)))
+    return 0;
+  p->code[pc] = CREATE_ABCk(OP_ADDI, GETARG_A(i), r,
+                            int2sC(cast_int(ivalue(&v))), 0);
+  p->code[pc + 1] = CREATE_ABCk(OP_MMBINI, r, int2sC(cast_int(ivalue(&v))),
+                                GETARG_C(mm), flip);
+  return 1;
+}
+
+
+static int foldunary (OptState *os, int pc) {
+  Instruction i = os->p->code[pc];
+  TValue v, res;
+  if (!regconst(os, GETARG_B(i), &v))
+    return 0;
+  switch (GET_OPCODE(i)) {
+    case OP_NOT: {
+      if (l_isfalse(&v)) { setbtvalue(&res); }
+      else { setbfvalue(&res); }
+      break;
+    }
+    case OP_LEN: {
+      if (!ttisstring(&v))
+        return 0;
+      setivalue(&res, cast(lua_Integer, tsslen(tsvalue(&v))));
+      break;
+    }
+    default: {  /* OP_UNM, OP_BNOT */
+      TValue zero;
+      setivalue(&zero, 0);
+      return foldop(os, pc, (GET_OPCODE(i) == OP_UNM) ? LUA_OPUNM
+                                                      : LUA_OPBNOT,
+                    &v, &zero);
+    }
+  }
+  return loadconst(os, GETARG_A(i), &res, &os->p->code[pc]);
+}
+
+
+/*
+** Order 'op' between two numbers. Mixed integer/float comparisons are
+** only done against immediates, as in the interpreter.
+*/
+static int numorder (OpCode op, const TValue *v1, const TValue *v2,
+                     int *cond) {
+  lua_Number n1, n2;
+  if (ttisinteger(v1) && ttisinteger(v2)) {
+    lua_Integer i1 = ivalue(v1), i2 = ivalue(v2);
+    switch (op) {
+      case OP_LT: case OP_LTI: *cond = (i1 < i2); break;
+      case OP_LE: case OP_LEI: *cond = (i1 <= i2); break;
+      case OP_GTI: *cond = (i1 > i2); break;
+      default: *cond = (i1 >= i2); break;  /* OP_GEI */
+    }
+    return 1;
+  }
+  if (!ttisfloat(v1) || !(ttisfloat(v2) || op >= OP_LTI))
+    return 0;
+  n1 = fltvalue(v1);
+  n2 = ttisfloat(v2) ? fltvalue(v2) : cast_num(ivalue(v2));
+  switch (op) {
+    case OP_LT: case OP_LTI: *cond = luai_numlt(n1, n2); break;
+    case OP_LE: case OP_LEI: *cond = luai_numle(n1, n2); break;
+    case OP_GTI: *cond = luai_numlt(n2, n1); break;
+    default: *cond = luai_numle(n2, n1); break;  /* OP_GEI */
+  }
+  return 1;
+}
+
+
+/*
+** Fold a test with a known outcome. When the test would skip its jump,
+** both become dead (unless something else jumps to that jump; then the
+** test becomes a jump over it); otherwise the jump is always taken.
+*/
+static int foldtest (OptState *os, int pc) {
+  Proto *p = os->p;
+  Instruction i = p->code[pc];
+  OpCode op = GET_OPCODE(i);
+  TValue v1, v2;
+  int cond;
+  if (pc + 1 >= p->sizecode || GET_OPCODE(p->code[pc + 1]) != OP_JMP ||
+      !regconst(os, GETARG_A(i), &v1))
+    return 0;
+  switch (op) {
+    case OP_TEST:
+      cond = !l_isfalse(&v1);
+      break;
+    case OP_EQ:
+      if (!regconst(os, GETARG_B(i), &v2))
+        return 0;
+      cond = luaV_rawequalobj(&v1, &v2);
+      break;
+    case OP_EQK:
+      cond = luaV_rawequalobj(&v1, &p->k[GETARG_B(i)]);
+      break;
+    case OP_EQI:
+      setivalue(&v2, GETARG_sB(i));
+      cond = isnum(&v1) && luaV_rawequalobj(&v1, &v2);
+      break;
+    case OP_LT: case OP_LE:
+      if (!regconst(os, GETARG_B(i), &v2) || !numorder(op, &v1, &v2, &cond))
+        return 0;
+      break;
+    default:  /* OP_LTI, OP_LEI, OP_GTI, OP_GEI */
+      setivalue(&v2, GETARG_sB(i));
+      if (!numorder(op, &v1, &v2, &cond))
+        return 0;
+      break;
+  }
+  if (cond != GETARG_k(i)) {  /* never jumps */
+    if (os->target[pc + 1])
+      p->code[pc] = CREATE_sJ(OP_JMP, 1 + OFFSET_sJ, 0);
+    else
+      p->code[pc] = p->code[pc + 1] = NOPINSTR;
+  }
+  else  /* always jumps */
+    p->code[pc] = NOPINSTR;
+  return 1;
+}
+
+
+/*
+** Update the constants known inside the current basic block after the
+** (possibly folded) instruction 'i'. Calls may clobber anything above
+** their function register; registers assigned through upvalues can
+** change at any call and are never tracked.
+*/
+static void blockupdate (OptState *os, Instruction i) {
+  int first, last, r;
+  TValue v;
+  regwrites(os->p, i, &first, &last);
+  switch (GET_OPCODE(i)) {
+    case OP_CALL: case OP_TAILCALL: case OP_TFORCALL: case OP_CONCAT:
+      first = GETARG_A(i);
+      last = MAXREGS - 1;
+      break;
+    default: break;
+  }
+  for (r = first; r <= last; r++)
+    os->blockk[r] = 0;
+  if (constload(os, i, &v)) {
+    for (r = first; r <= last; r++) {
+      if (!os->wrup[r]) {
+        os->blockk[r] = 1;
+        setobj(os->L, &os->blockv[r], &v);
+      }
+    }
+  }
+}
+
+
+static int foldpass (OptState *os) {
+  Proto *p = os->p;
+  int changed = 0;
+  int pc;
+  memset(os->blockk, 0, sizeof(os->blockk));
+  for (pc = 0; pc < p->sizecode; pc++) {
+    Instruction i = p->code[pc];
+    TValue v;
+    if (os->target[pc])  /* start of a new block? */
+      memset(os->blockk, 0, sizeof(os->blockk));
+    switch (GET_OPCODE(i)) {
+      case OP_JMP: {
+        if (GETARG_sJ(i) == 0 &&  /* jump to the next instruction? */
+            (pc == 0 || !istest(GET_OPCODE(p->code[pc - 1])))) {
+          p->code[pc] = NOPINSTR;
+          changed = 1;
+        }
+        break;
+      }
+      case OP_MOVE: {
+        if (regconst(os, GETARG_B(i), &v))
+          changed |= loadconst(os, GETARG_A(i), &v, &p->code[pc]);
+        break;
+      }
+      case OP_GETUPVAL: {
+        const Known *kn = (os->up != NULL) ? &os->up[GETARG_B(i)] : NULL;
+        if (kn != NULL && kn->kind == KCONST)
+          changed |= loadconst(os, GETARG_A(i), &kn->v, &p->code[pc]);
+        break;
+      }
+      case OP_UNM: case OP_BNOT: case OP_NOT: case OP_LEN:
+        changed |= foldunary(os, pc);
+        break;
+      case OP_EQ: case OP_LT: case OP_LE: case OP_EQK: case OP_EQI:
+      case OP_LTI: case OP_LEI: case OP_GTI: case OP_GEI: case OP_TEST:
+        changed |= foldtest(os, pc);
+        break;
+      default:
+        if (arithop(GET_OPCODE(i)) >= 0) {
+          if (foldarith(os, pc))
+            changed = 1;
+          else if (GET_OPCODE(i) == OP_ADD)
+            changed |= foldaddi(os, pc);
+        }
+        break;
+    }
+    blockupdate(os, p->code[pc]);
+  }
+  return changed;
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Inlining
+**
+** A call 'R[A](args)' is inlined when the instruction loading R[A]
+** (in the same straight-line code) gives a known closure of a small
+** function without loops, calls or nested functions. The body of the
+** callee is copied in place of the call with its registers moved to
+** R[A+1] on (where the call placed its arguments), its constants added
+** to the caller, and its upvalues read from wherever the caller sees
+** the same variables.
+** =======================================================
+*/
+
+/*
+** Where upvalue 'u' of a closure of 'f' lives for the function being
+** optimized: returns 1 for a register, 2 for an upvalue (with its index
+** in '*idx'), or 0 if it cannot reach it.
+*/
+static int upvalplace (OptState *os, const Proto *f, int depth, int u,
+                       int *idx) {
+  const Upvaldesc *uv = &f->upvalues[u];
+  Proto *p = os->p;
+  int j;
+  if (depth == 0) {  /* created by 'p' itself? */
+    *idx = uv->idx;
+    return uv->instack ? 1 : 2;
+  }
+  for (j = 0; j < p->sizeupvalues; j++) {  /* same variable of the parent */
+    if (p->upvalues[j].instack == uv->instack && p->upvalues[j].idx == uv->idx) {
+      *idx = j;
+      return 2;
+    }
+  }
+  return 0;
+}
+
+
+static int kremap (OptState *os, const Proto *f, int k, int limit) {
+  return kindex(os, &f->k[k], limit);
+}
+
+
+/*
+** Operand C of an instruction with an RK(C) operand.
+*/
+static int rkremap (OptState *os, const Proto *f, Instruction i, int base) {
+  if (GETARG_k(i))
+    return kremap(os, f, GETARG_C(i), MAXINDEXRK);
+  else
+    return base + GETARG_C(i);
+}
+
+
+/*
+** Translate instruction 'i' of 'f' to run in the function being
+** optimized, with the registers of 'f' starting at 'base'.
+*/
+static int translate (OptState *os, const Proto *f, int depth, int base,
+                      Instruction i, Instruction *res) {
+  OpCode op = GET_OPCODE(i);
+  int a = GETARG_A(i);
+  int b, c, idx, where;
+  switch (op) {
+    case OP_LOADI: case OP_LOADF: case OP_LOADFALSE: case OP_LOADTRUE:
+    case OP_LOADNIL: case OP_CONCAT: case OP_MMBINI:
+      break;
+    case OP_MOVE: case OP_UNM: case OP_BNOT: case OP_NOT: case OP_LEN:
+    case OP_GETI: case OP_ADDI: case OP_SHRI: case OP_SHLI: case OP_MMBIN:
+      SETARG_B(i, base + GETARG_B(i));
+      break;
+    case OP_GETTABLE: case OP_ADD: case OP_SUB: case OP_MUL: case OP_MOD:
+    case OP_POW: case OP_DIV: case OP_IDIV: case OP_BAND: case OP_BOR:
+    case OP_BXOR: case OP_SHL: case OP_SHR:
+      SETARG_B(i, base + GETARG_B(i));
+      SETARG_C(i, base + GETARG_C(i));
+      break;
+    case OP_GETFIELD: case OP_ADDK: case OP_SUBK: case OP_MULK:
+    case OP_MODK: case OP_POWK: case OP_DIVK: case OP_IDIVK:
+    case OP_BANDK: case OP_BORK: case OP_BXORK: {
+      if ((c = kremap(os, f, GETARG_C(i), MAXINDEXRK)) < 0)
+        return 0;
+      SETARG_B(i, base + GETARG_B(i));
+      SETARG_C(i, c);
+      break;
+    }
+    case OP_MMBINK: {
+      if ((b = kremap(os, f, GETARG_B(i), MAXINDEXRK)) < 0)
+        return 0;
+      SETARG_B(i, b);
+      break;
+    }
+    case OP_LOADK: {
+      if ((b = kremap(os, f, GETARG_Bx(i), MAXARG_Bx)) < 0)
+        return 0;
+      SETARG_Bx(i, b);
+      break;
+    }
+    case OP_SETTABLE: case OP_SETI: case OP_SETFIELD: {
+      if ((c = rkremap(os, f, i, base)) < 0)
+        return 0;
+      if (op == OP_SETTABLE)
+        SETARG_B(i, base + GETARG_B(i));
+      else if (op == OP_SETFIELD) {
+        if ((b = kremap(os, f, GETARG_B(i), MAXINDEXRK)) < 0)
+          return 0;
+        SETARG_B(i, b);
+      }
+      SETARG_C(i, c);
+      break;
+    }
+    case OP_GETUPVAL: {
+      if ((where = upvalplace(os, f, depth, GETARG_B(i), &idx)) == 0)
+        return 0;
+      *res = CREATE_ABCk((where == 1) ? OP_MOVE : OP_GETUPVAL,
+                         base + a, idx, 0, 0);
+      return 1;
+    }
+    case OP_GETTABUP: {
+      if ((where = upvalplace(os, f, depth, GETARG_B(i), &idx)) == 0 ||
+          (c = kremap(os, f, GETARG_C(i), MAXINDEXRK)) < 0)
+        return 0;
+      *res = CREATE_ABCk((where == 1) ? OP_GETFIELD : OP_GETTABUP,
+                         base + a, idx, c, 0);
+      return 1;
+    }
+    case OP_SETTABUP: {
+      if ((where = upvalplace(os, f, depth, a, &idx)) == 0 ||
+          (b = kremap(os, f, GETARG_B(i), MAXINDEXRK)) < 0 ||
+          (c = rkremap(os, f, i, base)) < 0)
+        return 0;
+      *res = CREATE_ABCk((where == 1) ? OP_SETFIELD : OP_SETTABUP,
+                         idx, b, c, GETARG_k(i));
+      return 1;
+    }
+    default:
+      return 0;  /* cannot be inlined */
+  }
+  SETARG_A(i, base + a);
+  *res = i;
+  return 1;
+}
+
+
+/*
+** Calls with all their results used by the next instruction ('f(g(x))'
+** or 'return x, g(y)') can be inlined when the callee returns exactly
+** one value: the next instruction then gets a fixed number of values.
+*/
+static int fixmultret (OptState *os, int pc, int a, int doit) {
+  Instruction *next = &os->p->code[pc + 1];
+  int b;
+  switch (GET_OPCODE(*next)) {
+    case OP_CALL: case OP_TAILCALL:
+      b = a - GETARG_A(*next) + 1;
+      break;
+    case OP_RETURN:
+      b = a - GETARG_A(*next) + 2;
+      break;
+    default:
+      return 0;
+  }
+  if (GETARG_B(*next) != 0 || b > MAXARG_B)
+    return 0;
+  if (doit)
+    SETARG_B(*next, b);
+  return 1;
+}
+
+
+/*
+** Try to inline the call at 'pc'. A tail call ('return f(x)') is
+** replaced by the body of the callee followed by a return of its
+** results (with the closing and frame information of the 'OP_RETURN'
+** that follows every 'OP_TAILCALL').
+*/
+static int inlinecall (OptState *os, int pc) {
+  Proto *p = os->p;
+  Instruction call = p->code[pc];
+  int a = GETARG_A(call);
+  int b = GETARG_B(call);
+  int tail = (GET_OPCODE(call) == OP_TAILCALL);
+  int c = tail ? 2 : GETARG_C(call);
+  int base = a + 1;
+  Instruction body[MAXINLINE + 2];
+  Instruction ret;
+  Known kn;
+  Proto *f;
+  int w, n, nres;
+  if (b == 0 || c > 2)
+    return 0;
+  if (tail) {
+    Instruction next = p->code[pc + 1];
+    if (GET_OPCODE(next) != OP_RETURN || GETARG_A(next) != a ||
+        GETARG_B(next) != 0)
+      return 0;
+  }
+  for (w = pc - 1; ; w--) {  /* find the instruction loading the function */
+    int first, last;
+    if (w < 0 || os->target[w + 1])
+      return 0;  /* not in the same straight-line code */
+    regwrites(p, p->code[w], &first, &last);
+    if (first <= a && a <= last)
+      break;
+  }
+  kn.kind = KUNKNOWN;
+  switch (GET_OPCODE(p->code[w])) {
+    case OP_MOVE:
+      regknown(os, GETARG_B(p->code[w]), &kn);
+      break;
+    case OP_GETUPVAL:
+      if (os->up != NULL)
+        kn = os->up[GETARG_B(p->code[w])];
+      break;
+    case OP_CLOSURE:
+      closureknown(os, p->p[GETARG_Bx(p->code[w])], &kn);
+      break;
+    default:
+      break;
+  }
+  if (kn.kind != KCLOSURE || kn.depth > 1)
+    return 0;
+  f = kn.f;
+  if (f->is_vararg || isvararg(f) || f->numparams != b - 1 || f->sizep > 0 ||
+      base + f->maxstacksize > MAXREGS)
+    return 0;
+  for (n = 0; !isreturn(GET_OPCODE(f->code[n])); n++) {
+    if (n == MAXINLINE || !translate(os, f, kn.depth, base, f->code[n],
+                                     &body[n]))
+      return 0;
+  }
+  ret = f->code[n];
+  if (GET_OPCODE(ret) == OP_RETURN0)
+    nres = 0;
+  else if (GET_OPCODE(ret) == OP_RETURN1)
+    nres = 1;
+  else if (GETARG_k(ret) || GETARG_B(ret) == 0 || GETARG_B(ret) > 2)
+    return 0;  /* closes upvalues or returns multiple values */
+  else
+    nres = GETARG_B(ret) - 1;
+  if (c == 0 && (nres != 1 || !fixmultret(os, pc, a, 0)))
+    return 0;
+  if (tail) {
+    if (nres == 1)
+      body[n++] = CREATE_ABCk(OP_RETURN, base + GETARG_A(ret), 2,
+                              GETARG_C(p->code[pc + 1]),
+                              GETARG_k(p->code[pc + 1]));
+    else
+      body[n++] = CREATE_ABCk(OP_RETURN, a, 1, GETARG_C(p->code[pc + 1]),
+                              GETARG_k(p->code[pc + 1]));
+  }
+  else if (c != 1) {  /* result is used? */
+    if (nres == 0)
+      body[n++] = CREATE_ABCk(OP_LOADNIL, a, 0, 0, 0);
+    else {
+      int src = base + GETARG_A(ret);
+      int l = n - 1;
+      if (l >= 0 && ismmbin(GET_OPCODE(body[l])))
+        l--;  /* metamethod also writes to the register of the operation */
+      if (l >= 0 && hasresult(GET_OPCODE(body[l])) &&
+          GETARG_A(body[l]) == src)
+        SETARG_A(body[l], a);  /* compute the result in place */
+      else
+        body[n++] = CREATE_ABCk(OP_MOVE, a, src, 0, 0);
+    }
+  }
+  if (c == 0)
+    fixmultret(os, pc, a, 1);
+  if (base + f->maxstacksize > p->maxstacksize)
+    p->maxstacksize = cast_byte(base + f->maxstacksize);
+  p->code[w] = NOPINSTR;  /* function value is not needed anymore */
+  os->splice[pc] = os->npool;
+  os->splicen[pc] = cast_byte(n);
+  os->nsplice++;
+  if (os->npool + n > os->sizepool) {
+    int newsize = 2 * (os->sizepool + n);
+    os->pool = luaM_reallocvector(os->L, os->pool, os->sizepool, newsize,
+                                  Instruction);
+    os->sizepool = newsize;
+  }
+  if (n > 0)
+    memcpy(os->pool + os->npool, body, n * sizeof(Instruction));
+  os->npool += n;
+  return 1;
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Rebuilding the code
+** =======================================================
+*/
+
+/*
+** Absolute line of each instruction of 'p'.
+*/
+static void getlines (const Proto *p, int *lines) {
+  int line = p->linedefined;
+  int nabs = 0;
+  int pc;
+  for (pc = 0; pc < p->sizecode; pc++) {
+    if (p->lineinfo[pc] != ABSLINEINFO)
+      line += p->lineinfo[pc];
+    else {
+      while (p->abslineinfo[nabs].pc < pc)
+        nabs++;
+      line = p->abslineinfo[nabs].line;
+    }
+    lines[pc] = line;
+  }
+}
+
+
+/*
+** Encode new line information for 'p' (as 'savelineinfo' in 'lcode.c').
+*/
+static void setlines (lua_State *L, Proto *p, const int *lines, int n) {
+  ls_byte *lineinfo = luaM_newvector(L, n, ls_byte);
+  AbsLineInfo *absinfo = NULL;
+  int nabs = 0, sizeabs = 0;
+  int previous = p->linedefined;
+  int iwthabs = 0;
+  int pc;
+  for (pc = 0; pc < n; pc++) {
+    int linedif = lines[pc] - previous;
+    if (abs(linedif) >= LIMLINEDIFF || iwthabs++ >= MAXIWTHABS) {
+      luaM_growvector(L, absinfo, nabs, sizeabs, AbsLineInfo, MAX_INT, "lines");
+      absinfo[nabs].pc = pc;
+      absinfo[nabs++].line = lines[pc];
+      linedif = ABSLINEINFO;
+      iwthabs = 1;
+    }
+    lineinfo[pc] = cast(ls_byte, linedif);
+    previous = lines[pc];
+  }
+  luaM_shrinkvector(L, absinfo, sizeabs, nabs, AbsLineInfo);
+  luaM_freearray(L, p->lineinfo, p->sizelineinfo);
+  luaM_freearray(L, p->abslineinfo, p->sizeabslineinfo);
+  p->lineinfo = lineinfo;
+  p->sizelineinfo = n;
+  p->abslineinfo = absinfo;
+  p->sizeabslineinfo = nabs;
+}
+
+
+/*
+** Rebuild the code without OP_NOPs and unreachable instructions, and
+** with inlined bodies in place of their calls. Returns whether the code
+** changed.
+*/
+static int rebuild (OptState *os) {
+  lua_State *L = os->L;
+  Proto *p = os->p;
+  int n = p->sizecode;
+  lu_byte *live = luaM_newvector(L, n, lu_byte);
+  int *work = luaM_newvector(L, n, int);
+  int *map = luaM_newvector(L, n + 1, int);
+  int *lines = NULL, *newlines = NULL;
+  Instruction *code;
+  int nwork = 0, newn = 0;
+  int pc, i;
+  memset(live, 0, n);
+  live[0] = 1;
+  work[nwork++] = 0;
+  if (!live[n - 1]) {  /* always keep the final return */
+    live[n - 1] = 1;
+    work[nwork++] = n - 1;
+  }
+  while (nwork > 0) {  /* mark reachable instructions */
+    int s[3], next, ns;
+    pc = work[--nwork];
+    ns = branches(p, pc, s, &next);
+    if (next)
+      s[ns++] = pc + 1;
+    while (ns--) {
+      if (0 <= s[ns] && s[ns] < n && !live[s[ns]]) {
+        live[s[ns]] = 1;
+        work[nwork++] = s[ns];
+      }
+    }
+  }
+  for (pc = 0; pc < n; pc++) {
+    map[pc] = newn;
+    if (!live[pc] || GET_OPCODE(p->code[pc]) == OP_NOP)
+      live[pc] = 0;
+    else
+      newn += (os->splice[pc] >= 0) ? os->splicen[pc] : 1;
+  }
+  map[n] = newn;
+  if (newn == n && os->nsplice == 0) {  /* nothing to do? */
+    luaM_freearray(L, live, n);
+    luaM_freearray(L, work, n);
+    luaM_freearray(L, map, n + 1);
+    return 0;
+  }
+  code = luaM_newvector(L, newn, Instruction);
+  if (p->lineinfo != NULL) {
+    lines = luaM_newvector(L, n, int);
+    newlines = luaM_newvector(L, newn, int);
+    getlines(p, lines);
+  }
+  for (pc = 0; pc < n; pc++) {
+    int at = map[pc];
+    if (!live[pc])
+      continue;
+    if (os->splice[pc] >= 0) {
+      for (i = 0; i < os->splicen[pc]; i++) {
+        code[at + i] = os->pool[os->splice[pc] + i];
+        if (newlines) newlines[at + i] = lines[pc];
+      }
+    }
+    else {
+      Instruction ins = p->code[pc];
+      int dest = jumpto(ins, pc);
+      if (dest >= 0)
+        fixjumpto(&ins, at, map[dest]);
+      code[at] = ins;
+      if (newlines) newlines[at] = lines[pc];
+    }
+  }
+  for (i = 0; i < p->sizelocvars; i++) {
+    LocVar *lv = &p->locvars[i];
+    lv->startpc = map[(lv->startpc <= n) ? lv->startpc : n];
+    lv->endpc = map[(lv->endpc <= n) ? lv->endpc : n];
+  }
+  luaM_freearray(L, p->code, p->sizecode);
+  p->code = code;
+  p->sizecode = newn;
+  if (newlines != NULL) {
+    setlines(L, p, newlines, newn);
+    luaM_freearray(L, lines, n);
+    luaM_freearray(L, newlines, newn);
+  }
+  luaM_freearray(L, live, n);
+  luaM_freearray(L, work, n);
+  luaM_freearray(L, map, n + 1);
+  return 1;
+}
+
+/* }====================================================== */
+
+
+
+/*
+** One pass over the function; returns whether it changed anything.
+*/
+static int optround (OptState *os) {
+  lua_State *L = os->L;
+  int n = os->p->sizecode;
+  int changed = 0;
+  int pc;
+  os->target = luaM_newvector(L, n + 1, lu_byte);
+  os->blockv = luaM_newvector(L, MAXREGS, TValue);
+  os->splice = luaM_newvector(L, n, int);
+  os->splicen = luaM_newvector(L, n, lu_byte);
+  os->nsplice = 0;
+  os->npool = 0;
+  for (pc = 0; pc < n; pc++)
+    os->splice[pc] = -1;
+  if (analyze(os)) {
+    changed = foldpass(os);
+    if (os->level >= LUAK_O2) {
+      for (pc = 0; pc < n; pc++) {
+        OpCode op = GET_OPCODE(os->p->code[pc]);
+        if (op == OP_CALL || op == OP_TAILCALL)
+          changed |= inlinecall(os, pc);
+      }
+    }
+    changed |= rebuild(os);
+  }
+  luaM_freearray(L, os->target, n + 1);
+  luaM_freearray(L, os->blockv, MAXREGS);
+  luaM_freearray(L, os->splice, n);
+  luaM_freearray(L, os->splicen, n);
+  return changed;
+}
+
+
+/*
+** What is known about the upvalues of the nested function 'c'.
+*/
+static void childknown (OptState *os, int ok, const Proto *c, Known *kn) {
+  int u;
+  for (u = 0; u < c->sizeupvalues; u++) {
+    const Upvaldesc *uv = &c->upvalues[u];
+    kn[u].kind = KUNKNOWN;
+    if (!ok)
+      continue;
+    else if (uv->instack)
+      regknown(os, uv->idx, &kn[u]);
+    else if (os->up != NULL)
+      kn[u] = os->up[uv->idx];
+    if (kn[u].kind == KCLOSURE)
+      kn[u].depth++;  /* seen from one level deeper */
+  }
+}
+
+
+static void optimize (lua_State *L, Proto *p, const Known *up, int level) {
+  OptState os;
+  int ok, i;
+  os.L = L;
+  os.p = p;
+  os.up = up;
+  os.level = level;
+  os.pool = NULL;
+  os.npool = os.sizepool = 0;
+  if (p->icache == NULL && p->tcache == NULL && p->jit == NULL) {
+    for (i = 0; i < MAXROUNDS; i++) {
+      if (!optround(&os))
+        break;
+    }
+  }
+  luaM_freearray(L, os.pool, os.sizepool);
+  os.target = luaM_newvector(L, p->sizecode + 1, lu_byte);
+  ok = analyze(&os);  /* analysis of the final code */
+  for (i = 0; i < p->sizep; i++) {
+    Proto *c = p->p[i];
+    Known *kn = luaM_newvector(L, c->sizeupvalues, Known);
+    childknown(&os, ok, c, kn);
+    optimize(L, c, kn, level);
+    luaM_freearray(L, kn, c->sizeupvalues);
+  }
+  luaM_freearray(L, os.target, p->sizecode + 1);
+}
+
+
+void luaK_optimize (lua_State *L, Proto *p, int level) {
+  if (level > LUAK_O0)
+    optimize(L, p, NULL, level);
+}
+
@@ -0,0 +1,39 @@
+/*
+** $Id: lopt.h $
+** Bytecode optimizer (constant propagation and inlining)
+** See Copyright Notice in lua.h
+*/
+
+#ifndef lopt_h
+#define lopt_h
+
+
+#include "lobject.h"
+
+
+/*
+** Optimization levels (see 'luaK_optimize').
+*/
+#define LUAK_O0		0	/* no optimization */
+#define LUAK_O1		1	/* constant propagation and dead branches */
+#define LUAK_O2		2	/* level 1 plus inlining of small functions */
+
+
+/**
+ * @brief Optimizes a finished prototype and all its nested prototypes.
+ *
+ * Level 1 propagates constants held in locals (and in upvalues that
+ * refer to them), folds arithmetic and comparisons over those constants
+ * and removes the branches that become unreachable. Level 2 also inlines
+ * calls to small straight-line Lua functions whose closure is known at
+ * the call site. Prototypes using instructions the optimizer does not
+ * understand are left unchanged.
+ *
+ * @param L The Lua state (used for memory allocation).
+ * @param p The prototype (usually a main function).
+ * @param level The optimization level.
+ */
+LUAI_FUNC void luaK_optimize (lua_State *L, Proto *p, int level);
+
+
+#endif
@@ -611,6 +611,53 @@ static void codename (LexState *ls, expdesc *e) {
 }
 
 
+/*
+** Returns the index of constant 's' if it can be the short-string key
+** of an instruction (arguments B and C have the same size), or -1 if
+** the key must go through a register, as in 'luaK_indexed'.
+*/
+static int kstrarg (FuncState *fs, TString *s) {
+  int k = luaK_stringK(fs, s);
+  return (k <= MAXARG_B && ttisshrstring(&fs->f->k[k])) ? k : -1;
+}
+
+
+/*
+** Loads string 's' into the next free register and returns that
+** register; the caller frees it.
+*/
+static int strtoreg (FuncState *fs, TString *s) {
+  expdesc e;
+  codestring(&e, s);
+  luaK_exp2nextreg(fs, &e);
+  return e.u.info;
+}
+
+
+/* Emits R[t][s] := R[v] (for tables built by the parser itself) */
+static void codesetfield (FuncState *fs, int t, TString *s, int v) {
+  int k = kstrarg(fs, s);
+  if (k >= 0)
+    luaK_codeABC(fs, OP_SETFIELD, t, k, v);
+  else {
+    luaK_codeABC(fs, OP_SETTABLE, t, strtoreg(fs, s), v);
+    fs->freereg--;
+  }
+}
+
+
+/* Emits R[r] := R[t][s] */
+static void codegetfield (FuncState *fs, int r, int t, TString *s) {
+  int k = kstrarg(fs, s);
+  if (k >= 0)
+    luaK_codeABC(fs, OP_GETFIELD, r, t, k);
+  else {
+    luaK_codeABC(fs, OP_GETTABLE, r, t, strtoreg(fs, s));
+    fs->freereg--;
+  }
+}
+
+
 static void checkforshadowing (LexState *ls, FuncState *fs, TString *name) {
   /*
   FuncState *f = fs;
@@ -922,14 +969,16 @@ static void singlevaraux (FuncState *fs, TString *n, expdesc *var, int base) {
     if (v >= 0) {  /* found? */
       Vardesc *vd = getlocalvardesc(fs, var->u.var.vidx);
       if (vd->vd.kind == GDKREG || vd->vd.kind == GDKCONST) {
-        expdesc key;
-        singlevaraux(fs, fs->ls->envn, var, 1);  /* get environment variable */
-        lua_assert(var->k != VVOID);  /* this one must exist */
-        codestring(&key, n);  /* key is variable name */
-        luaK_indexed(fs, var, &key);  /* env[varname] */
-        if (vd->vd.kind == GDKCONST) {
-           var->u.ind.ro = 1;
+        if (base) {
+          expdesc key;
+          singlevaraux(fs, fs->ls->envn, var, 1);  /* get environment variable */
+          lua_assert(var->k != VVOID);  /* this one must exist */
+          codestring(&key, n);  /* key is variable name */
+          luaK_indexed(fs, var, &key);  /* env[varname] */
         }
+        else  /* declared in an enclosing function, which emits no code */
+          init_exp(var, VINDEXUP, 0);  /* flag for the level using it */
+        var->u.ind.ro = (vd->vd.kind == GDKCONST);
         return;
       }
       if (v == VLOCAL && !base)
@@ -941,22 +990,15 @@ static void singlevaraux (FuncState *fs, TString *n, expdesc *var, int base) {
         singlevaraux(fs->prev, n, var, 0);  /* try upper levels */
         if (var->k == VLOCAL || var->k == VUPVAL)  /* local or upvalue? */
           idx  = newupvalue(fs, n, var);  /* will be a new upvalue */
-        else if (var->k == VINDEXED || var->k == VINDEXUP) {
-          /* global variable found in outer scope (resolved to _ENV.x) */
-          /* capture _ENV from outer scope */
-          idx = searchupvalue(fs, fs->ls->envn);
-          if (idx < 0) {
-             expdesc env;
-             singlevaraux(fs->prev, fs->ls->envn, &env, 1);
-             idx = newupvalue(fs, fs->ls->envn, &env);
-          }
-          var->k = VINDEXUP;  /* now indexed via upvalue */
-          var->u.ind.t = idx;
-          /* var->u.ind.idx and keystr are preserved */
-          /* We must re-internalize the key string in the current function's constants */
-          int k = luaK_stringK(fs, n);
-          var->u.ind.idx = k;
-          var->u.ind.keystr = k;
+        else if (var->k == VINDEXUP && base) {
+          /* global declared in an enclosing function: index this _ENV */
+          lu_byte ro = var->u.ind.ro;
+          expdesc key;
+          singlevaraux(fs, fs->ls->envn, var, 1);  /* get environment variable */
+          codestring(&key, n);
+          luaK_indexed(fs, var, &key);  /* env[varname] */
+          var->u.ind.ro = ro;
+          return;
         }
         else  /* it is a global or a constant */
           return;  /* don't need to do anything at this level */
@@ -1322,6 +1364,8 @@ static void open_func (LexState *ls, FuncState *fs, BlockCnt *bl) {
   f->source = ls->source;
   luaC_objbarrier(ls->L, f, f->source);
   f->maxstacksize = 2;  /* registers 0/1 are always valid */
+  if (fs->prev != NULL && (fs->prev->f->flag & PF_SELFMASK))
+    f->flag |= PF_CLASSCODE;  /* may see the 'self' of an enclosing method */
   enterblock(fs, bl, 0);
 }
 
@@ -1955,6 +1999,93 @@ static void parlist (LexState *ls, TString **varargname) {
 }
 
 
+/*
+** Type object that OP_CHECKTYPE tests for builtin type 't' (see
+** 'check_subtype_internal'), or NULL if 't' is not a builtin type.
+*/
+static const char *builtintype (ValType t) {
+  switch (t) {
+    case LVT_NUMBER: return "number";
+    case LVT_INT: return "int";
+    case LVT_FLT: return "float";
+    case LVT_BOOL: return "boolean";
+    case LVT_STR: return "string";
+    case LVT_TABLE: return "table";
+    case LVT_FUNC: return "function";
+    case LVT_USERDATA: return "userdata";
+    default: return NULL;
+  }
+}
+
+
+/*
+** Emits the run-time checks of the typed parameters of 'fs'. Only hints
+** naming a class, struct or type parameter are checked: hints made only
+** of builtin types are checked at compile time, and hints admitting
+** 'any' need no check. 'T?' sets 'k' to also accept nil.
+** A union ('C | D | string') becomes one OP_CHECKTYPE per alternative,
+** on the same value and name and with consecutive type registers; the
+** VM tries them in order and fails only when all of them fail.
+** The name of the parameter, for the error message, is K[C], or R[B+1]
+** of the last alternative when C is MAXARG_C (its index does not fit).
+*/
+static void checkparamtypes (LexState *ls, FuncState *fs) {
+  int i;
+  for (i = 0; i < fs->f->numparams; i++) {
+    Vardesc *vd = getlocalvardesc(fs, i);
+    TypeDesc *alts[MAX_TYPE_DESCS];
+    int nalts = 0;
+    int named = 0;
+    int nilable = 0;
+    int j;
+    if (vd->vd.hint == NULL) continue;
+    for (j = 0; j < MAX_TYPE_DESCS; j++) {
+      TypeDesc *td = &vd->vd.hint->descs[j];
+      if (td->type == LVT_NONE) continue;
+      else if (td->type == LVT_NULL || td->type == LVT_NIL) nilable = 1;
+      else if (td->type == LVT_NAME && td->typename != NULL) {
+        named = 1;
+        alts[nalts++] = td;
+      }
+      else if (builtintype(td->type) != NULL)
+        alts[nalts++] = td;
+      else { named = 0; break; }  /* 'any' (or unknown): no check */
+    }
+    if (named) {
+      expdesc e_val;
+      int base, k;
+      init_var(fs, &e_val, i);
+      luaK_exp2anyreg(fs, &e_val);
+      base = fs->freereg;
+      for (j = 0; j < nalts; j++) {  /* type objects to consecutive registers */
+        expdesc e_type;
+        TString *tname = alts[j]->typename;
+        if (alts[j]->type != LVT_NAME)
+          codestring(&e_type, luaS_new(ls->L, builtintype(alts[j]->type)));
+        else {
+          singlevaraux(fs, tname, &e_type, 1);
+          if (e_type.k == VVOID) {
+            expdesc key;
+            singlevaraux(fs, ls->envn, &e_type, 1);
+            codestring(&key, tname);
+            luaK_indexed(fs, &e_type, &key);
+          }
+        }
+        luaK_exp2nextreg(fs, &e_type);
+      }
+      k = luaK_stringK(fs, vd->vd.name);
+      if (k >= MAXARG_C) {  /* name does not fit in C? */
+        strtoreg(fs, vd->vd.name);  /* it goes after the last type */
+        k = MAXARG_C;
+      }
+      for (j = 0; j < nalts; j++)
+        luaK_codeABCk(fs, OP_CHECKTYPE, e_val.u.info, base + j, k, nilable);
+      fs->freereg = base;  /* free type registers */
+    }
+  }
+}
+
+
 /**
  * 解析函数体
  * 支持两种语法：
@@ -1978,6 +2109,7 @@ static void body (LexState *ls, expdesc *e, int ismethod, int line) {
     open_func(ls, &new_fs, &bl);
     luaX_next(ls);
     if (ismethod) {
+      new_fs.f->flag |= PF_METHOD;
       new_localvarliteral(ls, "self");
       adjustlocalvars(ls, 1);
     }
@@ -2022,42 +2154,11 @@ static void body (LexState *ls, expdesc *e, int ismethod, int line) {
   TString *varargname = NULL;
   parlist(ls, &varargname);
   checknext(ls, ')');
+  if (new_fs.nactvar > 0 &&
+      strcmp(getstr(getlocalvardesc(&new_fs, 0)->vd.name), "self") == 0)
+    new_fs.f->flag |= PF_METHOD;  /* 'self' is its first parameter */
 
-  {
-     int i;
-     for (i = 0; i < new_fs.f->numparams; i++) {
-        Vardesc *vd = getlocalvardesc(&new_fs, i);
-        if (vd->vd.hint) {
-           int j;
-           for (j = 0; j < MAX_TYPE_DESCS; j++) {
-              if (vd->vd.hint->descs[j].type == LVT_NAME && vd->vd.hint->descs[j].typename) {
-                 /* Using OP_CHECKTYPE A B C */
-                 expdesc e_val;
-                 init_var(&new_fs, &e_val, i);
-                 luaK_exp2anyreg(&new_fs, &e_val);
-                 int val_reg = e_val.u.info;
-
-                 expdesc e_type;
-                 singlevaraux(&new_fs, vd->vd.hint->descs[j].typename, &e_type, 1);
-                 if (e_type.k == VVOID) {
-                    expdesc key;
-                    singlevaraux(&new_fs, ls->envn, &e_type, 1);
-                    codestring(&key, vd->vd.hint->descs[j].typename);
-                    luaK_indexed(&new_fs, &e_type, &key);
-                 }
-                 luaK_exp2nextreg(&new_fs, &e_type);
-                 int type_reg = e_type.u.info;
-
-                 int name_k = luaK_stringK(&new_fs, vd->vd.name);
-
-                 luaK_codeABC(&new_fs, OP_CHECKTYPE, val_reg, type_reg, name_k);
-
-                 new_fs.freereg = type_reg; /* Free type_reg */
-              }
-           }
-        }
-     }
-  }
+  checkparamtypes(ls, &new_fs);
   
   if (ls->t.token == TK_REQUIRES) {
       is_generic_factory = 1;
@@ -2104,41 +2205,7 @@ static void body (LexState *ls, expdesc *e, int ismethod, int line) {
           }
       }
 
-      {
-         int i;
-         for (i = 0; i < impl_fs.f->numparams; i++) {
-            Vardesc *vd = getlocalvardesc(&impl_fs, i);
-            if (vd->vd.hint) {
-               int j;
-               for (j = 0; j < MAX_TYPE_DESCS; j++) {
-                  if (vd->vd.hint->descs[j].type == LVT_NAME && vd->vd.hint->descs[j].typename) {
-                 /* Using OP_CHECKTYPE A B C */
-                     expdesc e_val;
-                     init_var(&impl_fs, &e_val, i);
-                 luaK_exp2anyreg(&impl_fs, &e_val);
-                 int val_reg = e_val.u.info;
-
-                     expdesc e_type;
-                     singlevaraux(&impl_fs, vd->vd.hint->descs[j].typename, &e_type, 1);
-                     if (e_type.k == VVOID) {
-                        expdesc key;
-                        singlevaraux(&impl_fs, ls->envn, &e_type, 1);
-                        codestring(&key, vd->vd.hint->descs[j].typename);
-                        luaK_indexed(&impl_fs, &e_type, &key);
-                     }
-                     luaK_exp2nextreg(&impl_fs, &e_type);
-                 int type_reg = e_type.u.info;
-
-                 int name_k = luaK_stringK(&impl_fs, vd->vd.name);
-
-                 luaK_codeABC(&impl_fs, OP_CHECKTYPE, val_reg, type_reg, name_k);
-
-                 impl_fs.freereg = type_reg;
-                  }
-               }
-            }
-         }
-      }
+      checkparamtypes(ls, &impl_fs);
 
       /* Parse return type hint if any */
       if (testnext(ls, ':')) {
@@ -2506,41 +2573,7 @@ static void parse_generic_arrow_body(LexState *ls, FuncState *factory_fs, expdes
     }
 
     /* Type check injection */
-    {
-       int i;
-       for (i = 0; i < impl_fs.f->numparams; i++) {
-          Vardesc *vd = getlocalvardesc(&impl_fs, i);
-          if (vd->vd.hint) {
-             int j;
-             for (j = 0; j < MAX_TYPE_DESCS; j++) {
-                if (vd->vd.hint->descs[j].type == LVT_NAME && vd->vd.hint->descs[j].typename) {
-                 /* Using OP_CHECKTYPE A B C */
-                   expdesc e_val;
-                   init_var(&impl_fs, &e_val, i);
-                 luaK_exp2anyreg(&impl_fs, &e_val);
-                 int val_reg = e_val.u.info;
-
-                   expdesc e_type;
-                   singlevaraux(&impl_fs, vd->vd.hint->descs[j].typename, &e_type, 1);
-                   if (e_type.k == VVOID) {
-                      expdesc key;
-                      singlevaraux(&impl_fs, ls->envn, &e_type, 1);
-                      codestring(&key, vd->vd.hint->descs[j].typename);
-                      luaK_indexed(&impl_fs, &e_type, &key);
-                   }
-                   luaK_exp2nextreg(&impl_fs, &e_type);
-                 int type_reg = e_type.u.info;
-
-                 int name_k = luaK_stringK(&impl_fs, vd->vd.name);
-
-                 luaK_codeABC(&impl_fs, OP_CHECKTYPE, val_reg, type_reg, name_k);
-
-                 impl_fs.freereg = type_reg;
-                }
-             }
-          }
-       }
-    }
+    checkparamtypes(ls, &impl_fs);
 
     /* Expect => */
     if (ls->t.token == TK_MEAN) {
@@ -3087,7 +3120,6 @@ static void suffixedexp (LexState *ls, expdesc *v) {
         expdesc key;
         int reg;
         int jmp_skip;
-        int idx;
         
         /* 将表达式转换为寄存器 */
         luaK_dischargevars(fs, v);
@@ -3155,15 +3187,9 @@ static void suffixedexp (LexState *ls, expdesc *v) {
           luaX_next(ls);
         }
         
-        /* 使用 luaK_indexed 获取字段名常量索引，但不释放寄存器 */
-        /* 临时设置 v 的状态用于 luaK_indexed */
-        v->k = VNONRELOC;
-        v->u.info = reg;
-        luaK_indexed(fs, v, &key);  /* v 变成 VINDEXSTR，v->u.ind.idx 是常量索引 */
-        idx = v->u.ind.idx;
-        
-        /* 手动生成 GETFIELD 指令，结果存入 reg（覆盖原表的位置） */
-        luaK_codeABC(fs, OP_GETFIELD, reg, reg, idx);
+        /* 手动生成 GETFIELD 指令，结果存入 reg（覆盖原表的位置）；
+           常量索引放不进指令时改用寄存器中的键 */
+        codegetfield(fs, reg, reg, key.u.strval);
         
         /* 修复跳转目标：nil 时跳转到这里 */
         luaK_patchtohere(fs, jmp_skip);
@@ -4378,6 +4404,9 @@ static BinOpr subexpr (LexState *ls, expdesc *v, int limit) {
     if (uop == OPR_AWAIT) {
         FuncState *fs = ls->fs;
         expdesc f;
+        /* Operand first: a call result must not sit below 'yield' */
+        luaK_exp2nextreg(fs, v);
+        int base = v->u.info;
         /* Get coroutine.yield */
         singlevaraux(fs, luaS_newliteral(ls->L, "coroutine"), &f, 1);
         if (f.k == VVOID) {
@@ -4394,12 +4423,13 @@ static BinOpr subexpr (LexState *ls, expdesc *v, int limit) {
         luaK_exp2nextreg(fs, &f);
         int func_reg = f.u.info;
 
-        luaK_exp2nextreg(fs, v);
-        int arg_reg = v->u.info;
-
-        init_exp(v, VCALL, luaK_codeABC(fs, OP_CALL, func_reg, 2, 2));
-        fs->freereg = func_reg + 1;
+        luaK_reserveregs(fs, 1);
+        luaK_codeABC(fs, OP_MOVE, func_reg + 1, base, 0);
+        luaK_codeABC(fs, OP_CALL, func_reg, 2, 2);
         luaK_fixline(fs, line);
+        luaK_codeABC(fs, OP_MOVE, base, func_reg, 0);
+        fs->freereg = base + 1;
+        init_exp(v, VNONRELOC, base);
     } else {
         luaK_prefix(ls->fs, uop, v, line);
     }
@@ -4476,7 +4506,6 @@ static void cond_suffixedexp (LexState *ls, expdesc *v) {
         expdesc key;
         int reg;
         int jmp_skip;
-        int idx;
         
         luaK_dischargevars(fs, v);
         luaK_exp2nextreg(fs, v); reg = v->u.info;
@@ -4538,12 +4567,7 @@ static void cond_suffixedexp (LexState *ls, expdesc *v) {
           luaX_next(ls);
         }
         
-        v->k = VNONRELOC;
-        v->u.info = reg;
-        luaK_indexed(fs, v, &key);
-        idx = v->u.ind.idx;
-        
-        luaK_codeABC(fs, OP_GETFIELD, reg, reg, idx);
+        codegetfield(fs, reg, reg, key.u.strval);
         
         luaK_patchtohere(fs, jmp_skip);
         
@@ -6135,7 +6159,9 @@ static void typehint_free(LexState *ls) {
 
 static void th_emplace_desc(TypeHint *th, TypeDesc td) {
   for (int i = 0; i < MAX_TYPE_DESCS; i++) {
-    if (th->descs[i].type == td.type) return; /* Already present */
+    if (th->descs[i].type == td.type &&
+        (td.type != LVT_NAME || th->descs[i].typename == td.typename))
+      return; /* Already present */
     if (th->descs[i].type == LVT_NONE) {
       th->descs[i] = td;
       return;
@@ -6861,6 +6887,23 @@ static void asm_adddefine (LexState *ls, AsmContext *ctx, TString *name, lua_Int
 }
 
 
+/*
+** getglobal/setglobal 的全局变量名常量
+** 参数：
+**   ls - 词法状态
+**   name - 变量名
+** 返回值：
+**   名字在常量表中的索引（须能放进 GETTABUP/SETTABUP 的 B、C 参数）
+*/
+static int asm_globalk (LexState *ls, TString *name) {
+  int k = kstrarg(ls->fs, name);
+  if (k < 0)
+    luaK_semerror(ls, "global name does not fit in getglobal/setglobal "
+                      "(too many constants or name too long)");
+  return k;
+}
+
+
 /*
 ** 引用汇编标签（可能是前向引用）
 ** 参数：
@@ -7773,7 +7816,7 @@ static void asmstat_ex (LexState *ls, int line, AsmContext *parent_ctx) {
       int env_idx = env_exp.u.info;
 
       /* 获取常量索引 */
-      int k = luaK_stringK(fs, key_name);
+      int k = asm_globalk(ls, key_name);
 
       /* 生成 GETTABUP 指令 */
       Instruction inst = CREATE_ABCk(OP_GETTABUP, reg_dest, env_idx, k, 0);
@@ -7819,7 +7862,7 @@ static void asmstat_ex (LexState *ls, int line, AsmContext *parent_ctx) {
       int env_idx = env_exp.u.info;
 
       /* 获取常量索引 */
-      int k = luaK_stringK(fs, key_name);
+      int k = asm_globalk(ls, key_name);
 
       /* 生成 SETTABUP 指令: UpValue[A][K[B]] := RK(C) */
       /* A=env_idx, B=k, C=reg_src */
@@ -8840,7 +8883,7 @@ static void asm_parse_body (LexState *ls, FuncState *fs, AsmContext *ctx, int li
         luaK_semerror(ls, "cannot resolve _ENV for getglobal");
       }
       int env_idx = env_exp.u.info;
-      int k = luaK_stringK(fs, key_name);
+      int k = asm_globalk(ls, key_name);
       Instruction inst = CREATE_ABCk(OP_GETTABUP, reg_dest, env_idx, k, 0);
       luaK_code(fs, inst);
       luaK_fixline(fs, line);
@@ -8873,7 +8916,7 @@ static void asm_parse_body (LexState *ls, FuncState *fs, AsmContext *ctx, int li
         luaK_semerror(ls, "cannot resolve _ENV for setglobal");
       }
       int env_idx = env_exp.u.info;
-      int k = luaK_stringK(fs, key_name);
+      int k = asm_globalk(ls, key_name);
       Instruction inst = CREATE_ABCk(OP_SETTABUP, env_idx, k, reg_src, 0);
       luaK_code(fs, inst);
       luaK_fixline(fs, line);
@@ -9398,8 +9441,7 @@ static void class_method(LexState *ls, int class_reg, int is_static, int access_
   luaK_exp2anyreg(fs, &method_exp);
   
   /* 使用SETFIELD指令设置方法 */
-  int key_k = luaK_stringK(fs, method_name);
-  luaK_codeABC(fs, OP_SETFIELD, class_exp.u.info, key_k, method_exp.u.info);
+  codesetfield(fs, class_exp.u.info, method_name, method_exp.u.info);
   
   fs->freereg = class_reg + 1;  /* 释放临时寄存器 */
 }
@@ -9449,8 +9491,7 @@ static void class_property(LexState *ls, int class_reg, int is_static, int acces
   luaK_indexed(fs, &class_exp, &key_exp);
   luaK_exp2nextreg(fs, &class_exp);
   
-  int key_k = luaK_stringK(fs, prop_name);
-  luaK_codeABC(fs, OP_SETFIELD, class_exp.u.info, key_k, val_exp.u.info);
+  codesetfield(fs, class_exp.u.info, prop_name, val_exp.u.info);
   
   fs->freereg = class_reg + 1;
 }
@@ -9504,8 +9545,7 @@ static void class_getter(LexState *ls, int class_reg, int access_level) {
   
   /* 设置: getters_table[prop_name] = getter_func */
   luaK_exp2anyreg(fs, &method_exp);
-  int key_k = luaK_stringK(fs, prop_name);
-  luaK_codeABC(fs, OP_SETFIELD, class_exp.u.info, key_k, method_exp.u.info);
+  codesetfield(fs, class_exp.u.info, prop_name, method_exp.u.info);
   
   fs->freereg = class_reg + 1;
 }
@@ -9559,8 +9599,7 @@ static void class_setter(LexState *ls, int class_reg, int access_level) {
   
   /* 设置: setters_table[prop_name] = setter_func */
   luaK_exp2anyreg(fs, &method_exp);
-  int key_k = luaK_stringK(fs, prop_name);
-  luaK_codeABC(fs, OP_SETFIELD, class_exp.u.info, key_k, method_exp.u.info);
+  codesetfield(fs, class_exp.u.info, prop_name, method_exp.u.info);
   
   fs->freereg = class_reg + 1;
 }
@@ -9609,22 +9648,20 @@ static void class_abstract_method(LexState *ls, int class_reg, int is_static, in
   luaK_exp2nextreg(fs, &class_exp);
   
   /* 设置 abstracts[method_name] = param_count */
-  int method_k = luaK_stringK(fs, method_name);
   luaK_codeABx(fs, OP_LOADI, fs->freereg, param_count);
   luaK_reserveregs(fs, 1);
-  luaK_codeABC(fs, OP_SETFIELD, class_exp.u.info, method_k, fs->freereg - 1);
+  codesetfield(fs, class_exp.u.info, method_name, fs->freereg - 1);
   
   /* 同时标记类为抽象类 */
   /* 设置 __flags |= CLASS_FLAG_ABSTRACT */
   TString *flags_ts = luaS_newliteral(ls->L, "__flags");
-  int flags_k = luaK_stringK(fs, flags_ts);
   expdesc class_exp2;
   init_exp(&class_exp2, VNONRELOC, class_reg);
   
   /* 获取当前 flags */
   int flags_reg = fs->freereg;
   luaK_reserveregs(fs, 1);
-  luaK_codeABC(fs, OP_GETFIELD, flags_reg, class_reg, flags_k);
+  codegetfield(fs, flags_reg, class_reg, flags_ts);
   
   /* flags |= CLASS_FLAG_ABSTRACT (0x02) */
   luaK_codeABx(fs, OP_LOADI, fs->freereg, CLASS_FLAG_ABSTRACT);
@@ -9632,7 +9669,7 @@ static void class_abstract_method(LexState *ls, int class_reg, int is_static, in
   luaK_codeABC(fs, OP_BOR, flags_reg, flags_reg, fs->freereg - 1);
   
   /* 写回 flags */
-  luaK_codeABC(fs, OP_SETFIELD, class_reg, flags_k, flags_reg);
+  codesetfield(fs, class_reg, flags_ts, flags_reg);
   
   fs->freereg = class_reg + 1;  /* 释放临时寄存器 */
 }
@@ -9686,8 +9723,7 @@ static void class_final_method(LexState *ls, int class_reg, int is_static, int a
   codestring(&key_exp, method_name);
   luaK_exp2anyreg(fs, &method_exp);
   
-  int key_k = luaK_stringK(fs, method_name);
-  luaK_codeABC(fs, OP_SETFIELD, class_exp.u.info, key_k, method_exp.u.info);
+  codesetfield(fs, class_exp.u.info, method_name, method_exp.u.info);
   
   /* 将方法名添加到 __finals 表，标记为不可重写 */
   TString *finals_ts = luaS_newliteral(ls->L, "__finals");
@@ -9697,10 +9733,9 @@ static void class_final_method(LexState *ls, int class_reg, int is_static, int a
   luaK_exp2nextreg(fs, &class_exp);
   
   /* 设置 finals[method_name] = true */
-  int method_k = luaK_stringK(fs, method_name);
   luaK_codeABC(fs, OP_LOADTRUE, fs->freereg, 0, 0);
   luaK_reserveregs(fs, 1);
-  luaK_codeABC(fs, OP_SETFIELD, class_exp.u.info, method_k, fs->freereg - 1);
+  codesetfield(fs, class_exp.u.info, method_name, fs->freereg - 1);
   
   fs->freereg = class_reg + 1;  /* 释放临时寄存器 */
 }
@@ -9741,12 +9776,11 @@ static void classstat(LexState *ls, int line, int class_flags, int isexport) {
   if (class_flags != 0) {
     /* 获取 __flags 字段 */
     TString *flags_ts = luaS_newliteral(ls->L, "__flags");
-    int flags_k = luaK_stringK(fs, flags_ts);
     int flags_reg = fs->freereg;
     luaK_reserveregs(fs, 1);
     
     /* 读取当前 flags */
-    luaK_codeABC(fs, OP_GETFIELD, flags_reg, class_reg, flags_k);
+    codegetfield(fs, flags_reg, class_reg, flags_ts);
     
     /* flags |= class_flags */
     luaK_codeABx(fs, OP_LOADI, fs->freereg, class_flags);
@@ -9754,7 +9788,7 @@ static void classstat(LexState *ls, int line, int class_flags, int isexport) {
     luaK_codeABC(fs, OP_BOR, flags_reg, flags_reg, fs->freereg - 1);
     
     /* 写回 flags */
-    luaK_codeABC(fs, OP_SETFIELD, class_reg, flags_k, flags_reg);
+    codesetfield(fs, class_reg, flags_ts, flags_reg);
     
     fs->freereg = class_reg + 1;  /* 释放临时寄存器 */
   }
@@ -9986,8 +10020,16 @@ static void interfacestat(LexState *ls, int line) {
       checknext(ls, ')');
       
       /* 记录方法签名到接口表，值为参数个数 */
-      int method_k = luaK_stringK(fs, method_name);
-      luaK_codeABC(fs, OP_ADDMETHOD, iface_reg, method_k, param_count);
+      if (param_count > MAXARG_C)
+        errorlimit(fs, MAXARG_C, "interface method parameters");
+      int method_k = kstrarg(fs, method_name);
+      if (method_k >= 0)
+        luaK_codeABC(fs, OP_ADDMETHOD, iface_reg, method_k, param_count);
+      else {  /* 方法名放在寄存器中（k=1） */
+        luaK_codeABCk(fs, OP_ADDMETHOD, iface_reg, strtoreg(fs, method_name),
+                      param_count, 1);
+        fs->freereg--;
+      }
     }
     else if (ls->t.token == ';') {
       luaX_next(ls);
@@ -10539,6 +10581,21 @@ static void newexpr(LexState *ls, expdesc *v) {
 }
 
 
+/*
+** 生成 GETSUPER: R[r] = R[self].__parent[name]
+** 方法名的常量索引放不进 C 时，先把方法名载入寄存器并置 k=1
+*/
+static void codegetsuper (FuncState *fs, int r, int self, TString *name) {
+  int k = kstrarg(fs, name);
+  if (k >= 0)
+    luaK_codeABC(fs, OP_GETSUPER, r, self, k);
+  else {
+    luaK_codeABCk(fs, OP_GETSUPER, r, self, strtoreg(fs, name), 1);
+    fs->freereg--;
+  }
+}
+
+
 /*
 ** 解析 super 表达式
 ** 参数：
@@ -10575,8 +10632,7 @@ static void superexpr(LexState *ls, expdesc *v) {
 
     /* 生成 GETSUPER: base_reg = 父类 __init__ 方法 */
     TString *init_name = luaS_newliteral(ls->L, "__init__");
-    int method_k = luaK_stringK(fs, init_name);
-    luaK_codeABC(fs, OP_GETSUPER, base_reg, self_reg, method_k);
+    codegetsuper(fs, base_reg, self_reg, init_name);
 
     /* base_reg + 1 = self */
     luaK_codeABC(fs, OP_MOVE, base_reg + 1, self_reg, 0);
@@ -10637,8 +10693,7 @@ static void superexpr(LexState *ls, expdesc *v) {
     luaK_reserveregs(fs, 2);  /* 为 method 和 self 预留 */
     
     /* 生成 GETSUPER: base_reg = 父类方法 */
-    int method_k = luaK_stringK(fs, method_name);
-    luaK_codeABC(fs, OP_GETSUPER, base_reg, self_reg, method_k);
+    codegetsuper(fs, base_reg, self_reg, method_name);
     
     /* base_reg + 1 = self */
     luaK_codeABC(fs, OP_MOVE, base_reg + 1, self_reg, 0);
@@ -10678,10 +10733,9 @@ static void superexpr(LexState *ls, expdesc *v) {
     ** super.method - 只获取父类方法，不绑定 self
     */
     luaK_exp2anyreg(fs, &self_exp);
-    int method_k = luaK_stringK(fs, method_name);
     int result_reg = fs->freereg;
     luaK_reserveregs(fs, 1);
-    luaK_codeABC(fs, OP_GETSUPER, result_reg, self_exp.u.info, method_k);
+    codegetsuper(fs, result_reg, self_exp.u.info, method_name);
     
     init_exp(v, VNONRELOC, result_reg);
   }
@@ -0,0 +1,389 @@
+/*
+** $Id: lprof.c $
+** Sampling heap profiler (allocation sites)
+** See Copyright Notice in lua.h
+*/
+
+#define lprof_c
+#define LUA_CORE
+
+#include "lprefix.h"
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lua.h"
+
+#include "ldebug.h"
+#include "ldo.h"
+#include "lmem.h"
+#include "lobject.h"
+#include "lprof.h"
+#include "lstate.h"
+#include "ltm.h"
+
+
+/*
+** The profiler is driven by the memory manager: every thread counts
+** down the bytes it allocates in 'L->profleft', and each time the count
+** crosses a multiple of the rate the new block is sampled. A sample
+** walks the CallInfo chain of the allocating thread and keys a site by
+** the resulting collapsed stack plus the type of the block; it stands
+** for all the bytes the thread allocated since its previous sample.
+** Sampled blocks are kept in a hash table by address, so that freeing
+** one takes its bytes out of the live bytes of its site; 'filter' counts
+** the sampled blocks per address bucket and lets frees of the (many)
+** blocks that were not sampled skip the lock. Sites are only discarded
+** when the profiler is turned on again.
+*/
+
+
+/* size of the filter of sampled addresses (a power of 2) */
+#define PROFFILTER	4096
+
+/* initial size of the table of sampled blocks (a power of 2) */
+#define MINLIVE		256
+
+
+typedef struct HeapSite {
+  struct HeapSite *next;  /* in its hash chain */
+  unsigned int hash;
+  lu_mem nsamples;
+  lu_mem bytes;
+  lu_mem live;
+  size_t leaf;  /* offset of the innermost Lua frame in 'stack' */
+  char stack[1];  /* collapsed stack (variable size) */
+} HeapSite;
+
+
+typedef struct LiveBlock {
+  void *block;  /* NULL for empty slots */
+  HeapSite *site;
+  size_t weight;  /* bytes the sample stands for */
+} LiveBlock;
+
+
+typedef struct HeapProf {
+  l_mutex_t lock;  /* protects everything below but 'filter' */
+  double start;  /* when the profiler was turned on */
+  double stop;  /* when it was turned off (0 while running) */
+  HeapSite **sites;  /* hash table of sites */
+  int sizesites;  /* size of 'sites' (a power of 2) */
+  int nsites;
+  LiveBlock *live;  /* sampled blocks not yet freed */
+  size_t sizelive;  /* size of 'live' (a power of 2) */
+  size_t nlive;
+  _Atomic unsigned int filter[PROFFILTER];  /* sampled blocks per bucket */
+} HeapProf;
+
+
+static double profclock (void) {
+#if defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#else
+  return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+
+static size_t addrhash (void *block) {
+  size_t h = cast_sizet(point2uint(block)) >> 4;  /* blocks are aligned */
+  return h ^ (h >> 12) ^ (h >> 24);
+}
+
+#define filterof(hp,b)	(&(hp)->filter[addrhash(b) & (PROFFILTER - 1)])
+
+
+static unsigned int strhash (const char *s) {
+  unsigned int h = 2166136261u;  /* FNV-1a */
+  for (; *s; s++)
+    h = (h ^ cast_byte(*s)) * 16777619u;
+  return h;
+}
+
+
+/*
+** {======================================================
+** Sites and sampled blocks (called with 'hp->lock' held)
+** =======================================================
+*/
+
+static void clearsites (HeapProf *hp) {
+  int i;
+  for (i = 0; i < hp->sizesites; i++) {
+    HeapSite *s = hp->sites[i];
+    while (s != NULL) {
+      HeapSite *next = s->next;
+      free(s);
+      s = next;
+    }
+  }
+  free(hp->sites);
+  free(hp->live);
+  hp->sites = NULL;
+  hp->sizesites = hp->nsites = 0;
+  hp->live = NULL;
+  hp->sizelive = hp->nlive = 0;
+  memset(cast_voidp(hp->filter), 0, sizeof(hp->filter));
+}
+
+
+static HeapSite *getsite (HeapProf *hp, const char *stack, size_t leaf) {
+  unsigned int h = strhash(stack);
+  HeapSite *s;
+  size_t len;
+  if (hp->nsites >= hp->sizesites) {  /* grow the table? */
+    int size = (hp->sizesites == 0) ? 64 : 2 * hp->sizesites;
+    HeapSite **t = cast(HeapSite **, calloc(size, sizeof(HeapSite *)));
+    int i;
+    if (t == NULL)
+      return NULL;
+    for (i = 0; i < hp->sizesites; i++) {  /* rehash */
+      while ((s = hp->sites[i]) != NULL) {
+        hp->sites[i] = s->next;
+        s->next = t[s->hash & (size - 1)];
+        t[s->hash & (size - 1)] = s;
+      }
+    }
+    free(hp->sites);
+    hp->sites = t;
+    hp->sizesites = size;
+  }
+  for (s = hp->sites[h & (hp->sizesites - 1)]; s != NULL; s = s->next) {
+    if (s->hash == h && strcmp(s->stack, stack) == 0)
+      return s;
+  }
+  len = strlen(stack);
+  s = cast(HeapSite *, malloc(offsetof(HeapSite, stack) + len + 1));
+  if (s == NULL)
+    return NULL;
+  s->hash = h;
+  s->nsamples = s->bytes = s->live = 0;
+  s->leaf = leaf;
+  memcpy(s->stack, stack, len + 1);
+  s->next = hp->sites[h & (hp->sizesites - 1)];
+  hp->sites[h & (hp->sizesites - 1)] = s;
+  hp->nsites++;
+  return s;
+}
+
+
+static void putlive (LiveBlock *t, size_t size, LiveBlock *b) {
+  size_t i = addrhash(b->block) & (size - 1);
+  while (t[i].block != NULL)
+    i = (i + 1) & (size - 1);
+  t[i] = *b;
+}
+
+
+static int addlive (HeapProf *hp, void *block, HeapSite *s, size_t weight) {
+  LiveBlock b;
+  if (4 * (hp->nlive + 1) > 3 * hp->sizelive) {  /* grow the table? */
+    size_t size = (hp->sizelive == 0) ? MINLIVE : 2 * hp->sizelive;
+    LiveBlock *t = cast(LiveBlock *, calloc(size, sizeof(LiveBlock)));
+    size_t i;
+    if (t == NULL)
+      return 0;
+    for (i = 0; i < hp->sizelive; i++) {
+      if (hp->live[i].block != NULL)
+        putlive(t, size, &hp->live[i]);
+    }
+    free(hp->live);
+    hp->live = t;
+    hp->sizelive = size;
+  }
+  b.block = block;
+  b.site = s;
+  b.weight = weight;
+  putlive(hp->live, hp->sizelive, &b);
+  hp->nlive++;
+  l_atomic_add(filterof(hp, block), 1);
+  return 1;
+}
+
+
+/*
+** Removes a block from the table of sampled blocks (linear probing with
+** backward-shift deletion, so that there are no tombstones).
+*/
+static void removelive (HeapProf *hp, void *block) {
+  size_t mask = hp->sizelive - 1;
+  size_t i, j;
+  if (hp->sizelive == 0)
+    return;
+  for (i = addrhash(block) & mask; hp->live[i].block != block;
+       i = (i + 1) & mask) {
+    if (hp->live[i].block == NULL)
+      return;  /* not sampled (another block in the same bucket was) */
+  }
+  hp->live[i].site->live -= hp->live[i].weight;
+  hp->nlive--;
+  l_atomic_sub(filterof(hp, block), 1);
+  for (j = (i + 1) & mask; hp->live[j].block != NULL; j = (j + 1) & mask) {
+    size_t home = addrhash(hp->live[j].block) & mask;
+    if (((j - home) & mask) >= ((j - i) & mask)) {  /* may move to 'i'? */
+      hp->live[i] = hp->live[j];
+      i = j;
+    }
+  }
+  hp->live[i].block = NULL;
+}
+
+/* }====================================================== */
+
+
+/*
+** Appends to 'buff' the frame of 'ci' ("chunk:line", or "[C]"), with
+** the characters that have a meaning in collapsed stacks replaced.
+*/
+static char *addframe (char *buff, CallInfo *ci) {
+  if (isLua(ci)) {
+    Proto *p = ci_func(ci)->p;
+    char *s = buff;
+    if (p->source == NULL)
+      *buff++ = '?';
+    else {
+      luaO_chunkid(buff, getstr(p->source), tsslen(p->source));
+      buff += strlen(buff);
+    }
+    for (; s < buff; s++) {
+      if (*s == ' ' || *s == ';')
+        *s = '_';
+    }
+    buff += l_sprintf(buff, 16, ":%d",
+                      luaG_getfuncline(p, pcRel(ci->u.l.savedpc, p)));
+  }
+  else {
+    memcpy(buff, "[C]", 3);
+    buff += 3;
+  }
+  *buff++ = ';';
+  return buff;
+}
+
+
+static void sample (lua_State *L, HeapProf *hp, void *block, size_t weight,
+                    int tag) {
+  char stack[PROFMAXDEPTH * (LUA_IDSIZE + 16) + 16];
+  CallInfo *frames[PROFMAXDEPTH];
+  int n = 0;
+  char *p = stack;
+  char *leaf;
+  HeapSite *s;
+  if (tag != PROFSTACK && L->ci != NULL) {
+    CallInfo *ci;
+    for (ci = L->ci; ci != &L->base_ci && n < PROFMAXDEPTH; ci = ci->previous)
+      frames[n++] = ci;
+  }
+  leaf = p;
+  while (n-- > 0) {  /* outermost frame first */
+    if (isLua(frames[n]))
+      leaf = p;  /* site starts at the innermost Lua frame */
+    p = addframe(p, frames[n]);
+  }
+  strcpy(p, (tag > 0 && tag < LUA_TOTALTYPES - 1) ? ttypename(tag)
+          : (tag == PROFSTACK) ? "stack" : "memory");
+  l_mutex_lock(&hp->lock);
+  if (G(L)->profrate != 0 &&  /* not turned off meanwhile? */
+      (s = getsite(hp, stack, cast_sizet(leaf - stack))) != NULL) {
+    s->nsamples++;
+    s->bytes += weight;
+    if (block != NULL && addlive(hp, block, s, weight))
+      s->live += weight;
+  }
+  l_mutex_unlock(&hp->lock);
+}
+
+
+size_t luaM_profsetrate (lua_State *L, size_t rate) {
+  global_State *g = G(L);
+  HeapProf *hp = g->heapprof;
+  size_t old = g->profrate;
+  if (hp == NULL) {
+    if (rate == 0)
+      return 0;
+    hp = cast(HeapProf *, calloc(1, sizeof(HeapProf)));
+    if (hp == NULL)
+      luaM_error(L);
+    l_mutex_init(&hp->lock);
+    g->heapprof = hp;
+  }
+  l_mutex_lock(&hp->lock);
+  if (old == 0 && rate != 0) {  /* turning on? */
+    clearsites(hp);
+    hp->start = profclock();
+    hp->stop = 0;
+  }
+  else if (old != 0 && rate == 0)  /* turning off? */
+    hp->stop = profclock();
+  g->profrate = rate;
+  l_mutex_unlock(&hp->lock);
+  return old;
+}
+
+
+void luaM_profalloc (lua_State *L, void *block, size_t size, int tag) {
+  global_State *g = G(L);
+  size_t rate = g->profrate;
+  l_mem left = L->profleft - cast(l_mem, size);
+  if (left > 0 || rate == 0)
+    L->profleft = left;
+  else {  /* crossed one or more multiples of the rate */
+    size_t n = cast_sizet(-left) / rate + 1;
+    L->profleft = left + cast(l_mem, n * rate);
+    sample(L, g->heapprof, block, n * rate, tag);
+  }
+}
+
+
+void luaM_proffree (lua_State *L, void *block) {
+  HeapProf *hp = G(L)->heapprof;
+  if (l_atomic_load(filterof(hp, block)) != 0) {  /* maybe sampled? */
+    l_mutex_lock(&hp->lock);
+    removelive(hp, block);
+    l_mutex_unlock(&hp->lock);
+  }
+}
+
+
+int luaM_profsites (lua_State *L, HeapSiteInfo *sites, int max,
+                    double *elapsed) {
+  HeapProf *hp = G(L)->heapprof;
+  int i, n = 0;
+  if (hp == NULL)
+    return -1;
+  l_mutex_lock(&hp->lock);
+  *elapsed = ((hp->stop != 0) ? hp->stop : profclock()) - hp->start;
+  for (i = 0; i < hp->sizesites && n < max; i++) {
+    HeapSite *s;
+    for (s = hp->sites[i]; s != NULL && n < max; s = s->next) {
+      sites[n].stack = s->stack;
+      sites[n].leaf = s->stack + s->leaf;
+      sites[n].nsamples = s->nsamples;
+      sites[n].bytes = s->bytes;
+      sites[n].live = s->live;
+      n++;
+    }
+  }
+  n = hp->nsites;
+  l_mutex_unlock(&hp->lock);
+  return n;
+}
+
+
+void luaM_profclose (lua_State *L) {
+  global_State *g = G(L);
+  HeapProf *hp = g->heapprof;
+  g->profrate = 0;
+  if (hp != NULL) {
+    clearsites(hp);
+    l_mutex_destroy(&hp->lock);
+    free(hp);
+    g->heapprof = NULL;
+  }
+}
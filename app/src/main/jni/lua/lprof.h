@@ -0,0 +1,118 @@
+/*
+** $Id: lprof.h $
+** Sampling heap profiler (allocation sites)
+** See Copyright Notice in lua.h
+*/
+
+#ifndef lprof_h
+#define lprof_h
+
+
+#include "lobject.h"
+#include "lstate.h"
+
+
+/*
+** Default mean number of bytes between two samples.
+*/
+#if !defined(LUAI_PROFRATE)
+#define LUAI_PROFRATE	(512 * 1024)
+#endif
+
+
+/*
+** At most this many frames (innermost first) are kept for each sample.
+*/
+#define PROFMAXDEPTH	32
+
+
+/*
+** Tag of a thread stack being reallocated: its frames hold offsets
+** instead of pointers (see 'luaD_reallocstack'), so they are not walked.
+*/
+#define PROFSTACK	(-2)
+
+
+/**
+ * @brief Totals of one allocation site, as returned by 'luaM_profsites'.
+ *
+ * A site is a call stack plus the type of the allocated blocks. Byte
+ * counts are estimates: each sample stands for the bytes allocated since
+ * the previous one in the same thread.
+ */
+typedef struct HeapSiteInfo {
+  const char *stack;  /**< Collapsed stack: "frame;...;frame;type". */
+  const char *leaf;  /**< Innermost Lua frame, C frames below it and type
+                         (a suffix of 'stack'). */
+  lu_mem nsamples;  /**< Samples taken at this site. */
+  lu_mem bytes;  /**< Bytes allocated at this site. */
+  lu_mem live;  /**< Bytes from this site not yet freed. */
+} HeapSiteInfo;
+
+
+/*
+** Hooks called by the memory manager (see 'lmem.c'). They must only be
+** called while 'g->profrate' is non-zero, which is the only cost of the
+** profiler when it is off.
+*/
+#define luaM_profison(g)	l_unlikely((g)->profrate != 0)
+
+
+/**
+ * @brief Sets the sampling rate of the heap profiler.
+ *
+ * Turning the profiler on (from off) discards the sites of a previous
+ * run; changing the rate of a running profiler keeps them. Turning it
+ * off keeps the sites for 'luaM_profsites', but frees are no longer
+ * tracked, so their live bytes stop changing.
+ *
+ * @param L The Lua state.
+ * @param rate Mean bytes between samples (0 turns the profiler off).
+ * @return The previous rate (0 if it was off).
+ */
+LUAI_FUNC size_t luaM_profsetrate (lua_State *L, size_t rate);
+
+/**
+ * @brief Counts a new block and samples it when its thread crosses the
+ * next multiple of the rate.
+ * @param L The Lua state that allocated the block.
+ * @param block The block.
+ * @param size Its size.
+ * @param tag Its type tag (as given to 'luaM_malloc_'), PROFSTACK, or -1
+ * if unknown.
+ */
+LUAI_FUNC void luaM_profalloc (lua_State *L, void *block, size_t size, int tag);
+
+/**
+ * @brief Removes a block from the live bytes of its site, if it was
+ * sampled.
+ * @param L The Lua state.
+ * @param block The block being freed.
+ */
+LUAI_FUNC void luaM_proffree (lua_State *L, void *block);
+
+/**
+ * @brief Copies the totals of the sites seen since the profiler was
+ * turned on.
+ *
+ * At most 'max' sites are copied; the caller may retry with a larger
+ * array when the result exceeds it. The strings in the copies stay valid
+ * until the profiler is turned on again or the state is closed.
+ *
+ * @param L The Lua state.
+ * @param sites Array receiving the copies.
+ * @param max Size of 'sites'.
+ * @param elapsed Receives the seconds the profiler has been running.
+ * @return The number of sites, or -1 if the profiler never ran.
+ */
+LUAI_FUNC int luaM_profsites (lua_State *L, HeapSiteInfo *sites, int max,
+                              double *elapsed);
+
+/**
+ * @brief Frees the profiler of a state being closed.
+ * @param L The Lua state.
+ */
+LUAI_FUNC void luaM_profclose (lua_State *L);
+
+
+#endif
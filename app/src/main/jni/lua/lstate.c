@@ -23,6 +23,7 @@
 #include "lgc.h"
 #include "llex.h"
 #include "lmem.h"
+#include "lprof.h"
 #include "lstate.h"
 #include "lstring.h"
 #include "ltable.h"
@@ -278,6 +279,8 @@ static void f_luaopen (lua_State *L, void *ud) {
   luaS_init(L);
   luaT_init(L);
   luaX_init(L);
+  g->asyncwrap = luaS_newliteral(L, "__async_wrap");
+  luaC_fix(L, obj2gco(g->asyncwrap));  /* used by OP_ASYNCWRAP */
   g->gcstp = 0;  /* allow gc */
   setnilvalue(&g->nilvalue);  /* now state is complete */
   luai_userstateopen(L);
@@ -296,6 +299,11 @@ static void preinit_thread (lua_State *L, global_State *g) {
   L->ci = NULL;
   L->nci = 0;
   L->twups = L;  /* thread has no upvalues */
+  atomic_init(&L->nursery, NULL);
+  L->nurserynext = NULL;
+  atomic_init(&L->innursery, 0);
+  L->nfreed = 0;
+  L->profleft = 0;
   L->nCcalls = 0;
   L->errorJmp = NULL;
   L->hook = NULL;
@@ -317,6 +325,7 @@ static void preinit_thread (lua_State *L, global_State *g) {
  */
 static void close_state (lua_State *L) {
   global_State *g = G(L);
+  luaM_profclose(L);  /* stop sampling before objects are freed */
   if (!completestate(g))  /* closing a partially built state? */
     luaC_freeallobjects(L);  /* just collect its objects */
   else {  /* closing a fully built state */
@@ -327,10 +336,10 @@ static void close_state (lua_State *L) {
     luaC_freeallobjects(L);  /* collect all objects */
     luai_userstateclose(L);
   }
-  luaM_freearray(L, G(L)->strt.hash, G(L)->strt.size);
-  luaM_poolshutdown(L);  /* shutdown memory pool */
+  luaS_freetable(L);
   l_mutex_destroy(&g->lock);
   freestack(L);
+  luaM_poolshutdown(L);  /* shutdown memory pool (after its last block) */
   lua_assert(gettotalbytes(g) == sizeof(LG));
   (*g->frealloc)(g->ud, fromstate(L), sizeof(LG), 0);  /* free main block */
 }
@@ -461,6 +470,7 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud, unsigned seed) {
   L->marked = luaC_white(g);
   preinit_thread(L, g);
   g->allgc = obj2gco(L);  /* by now, only object is the main thread */
+  atomic_init(&g->nurseries, NULL);
   L->next = NULL;
   incnny(L);  /* main thread is always non yieldable */
   g->frealloc = f;
@@ -470,8 +480,12 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud, unsigned seed) {
   g->mainthread = L;
   g->seed = seed;
   g->gcstp = GCSTPGC;  /* no GC while building state */
-  g->strt.size = g->strt.nuse = 0;
-  g->strt.hash = NULL;
+  for (i = 0; i < STRSHARDS; i++) {
+    strshard *sh = &g->strt.shard[i];
+    l_tablelock_init(&sh->lock);
+    sh->buckets = NULL;
+    sh->nuse = 0;
+  }
   setnilvalue(&g->l_registry);
   g->panic = NULL;
   g->gcstate = GCSpause;
@@ -492,6 +506,24 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud, unsigned seed) {
   setgcparam(g->gcpause, LUAI_GCPAUSE);
   setgcparam(g->gcstepmul, LUAI_GCMUL);
   g->gcstepsize = LUAI_GCSTEPSIZE;
+  g->jitmode = 0;
+  g->sliceviews = 0;
+  g->parmarking = 0;
+  g->gcmarkthreads = 0;
+  g->markers = NULL;
+  g->gcbgsweep = 0;
+  g->bgsweeping = 0;
+  g->sweeper = NULL;
+  g->sweeptail = NULL;
+  g->gcstats = NULL;
+  g->profrate = 0;
+  g->heapprof = NULL;
+  g->classversion = 0;
+#if defined(LUAI_TABLELOCKS)
+  g->tablelocks = 1;
+#else
+  g->tablelocks = 0;  /* until the first 'thread.create' */
+#endif
   setgcparam(g->genmajormul, LUAI_GENMAJORMUL);
   g->genminormul = LUAI_GENMINORMUL;
   for (i=0; i < LUA_NUMTAGS; i++) g->mt[i] = NULL;
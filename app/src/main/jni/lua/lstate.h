@@ -158,13 +158,41 @@ struct lua_longjmp;  /* defined in ldo.c */
 /** @} */
 
 
+/*
+** The string table is split into 2^LUAI_STRSHARDBITS shards, each with
+** its own lock (see 'lstring.c').
+*/
+#if !defined(LUAI_STRSHARDBITS)
+#define LUAI_STRSHARDBITS	4
+#endif
+
+#define STRSHARDS	(1 << LUAI_STRSHARDBITS)
+
+
+/**
+ * @brief Bucket array of a string-table shard.
+ */
+typedef struct strbuckets {
+  int size;  /**< Number of buckets (a power of 2). */
+  TString *b[1];  /**< Buckets (linked lists of strings). */
+} strbuckets;
+
+
+/**
+ * @brief One shard of the string table.
+ */
+typedef struct strshard {
+  l_tablelock_t lock;  /**< Read-locked by lookups, write-locked by changes. */
+  strbuckets *buckets;  /**< Bucket array. */
+  int nuse;  /**< Number of elements. */
+} strshard;
+
+
 /**
  * @brief String table (hash table for strings).
  */
 typedef struct stringtable {
-  TString **hash;  /**< Array of buckets (linked lists of strings). */
-  int nuse;  /**< Number of elements. */
-  int size;  /**< Number of buckets. */
+  strshard shard[STRSHARDS];  /**< Shard of each hash (its low bits). */
 } stringtable;
 
 
@@ -268,21 +296,24 @@ struct CallInfo {
 ** 'global state', shared by all threads of this state
 */
 /*
-** Memory pool for small objects. Each pool manages objects of a specific
-** size class, using a simple free-list for quick allocation/deallocation.
+** Memory pool for small objects. Blocks of each size class are carved
+** from page-sized slabs; each OS thread keeps a small magazine of free
+** blocks per class, so that most allocations and frees touch no lock.
+** Magazines are refilled from (and flushed to) the slabs in batches.
 */
 #define NUM_SIZE_CLASSES    12
 
 /**
- * @brief Memory pool for small objects.
+ * @brief Memory pool for one size class.
  */
 typedef struct {
-  void *free_list;       /**< Free object list (LIFO stack). */
+  struct MemSlab *partial;  /**< Slabs with free blocks. */
   size_t object_size;    /**< Size of objects in this pool. */
-  int max_cache;         /**< Maximum cache size. */
-  int current_count;     /**< Current cached object count. */
+  int slabcap;           /**< Blocks per slab. */
+  int magcap;            /**< Maximum blocks in a thread magazine. */
+  int nslabs;            /**< Slabs currently mapped. */
   size_t total_alloc;    /**< Total allocations. */
-  size_t total_hit;      /**< Cache hits. */
+  size_t total_hit;      /**< Allocations served by a magazine. */
 } MemPool;
 
 /**
@@ -290,12 +321,11 @@ typedef struct {
  */
 typedef struct {
   MemPool pools[NUM_SIZE_CLASSES];  /**< Array of small object pools. */
+  lu_byte classof[129];              /**< Size class of each 8-byte size step. */
   size_t threshold;                  /**< Threshold for small vs large objects. */
-  lua_Alloc fallback_alloc;          /**< Fallback system allocator. */
-  void *fallback_ud;                 /**< User data for fallback allocator. */
   int enabled;                       /**< Whether memory pool is enabled. */
-  size_t small_limit;                /**< Upper limit for small objects. */
-  l_mutex_t lock;                    /**< Lock for memory pool access. */
+  l_mutex_t lock;                    /**< Lock for the slabs and counters. */
+  struct ThreadMags *threads;        /**< Magazines of the OS threads (see lmem.c). */
 } MemPoolArena;
 
 /**
@@ -327,7 +357,22 @@ typedef struct global_State {
   lu_byte gcpause;  /**< Size of pause between successive GCs. */
   lu_byte gcstepmul;  /**< GC "speed". */
   lu_byte gcstepsize;  /**< (log2 of) GC granularity. */
+  lu_byte jitmode;  /**< True if hot functions are compiled (see 'ljit.c'). */
+  lu_byte tablelocks;  /**< True once tables must be locked (several OS threads). */
+  lu_byte sliceviews;  /**< True if OP_SLICE may return views (see 'lvm.c'). */
+  lu_byte parmarking;  /**< True while helper threads are marking. */
+  int gcmarkthreads;  /**< Threads for parallel marking (<= 1: serial). */
+  struct GCMarkers *markers;  /**< Helper threads for marking (or NULL). */
+  lu_byte gcbgsweep;  /**< True if 'allgc' is swept by a background thread. */
+  lu_byte bgsweeping;  /**< True while the sweeper owns the old 'allgc' objects. */
+  struct GCSweeper *sweeper;  /**< Background sweeping thread (or NULL). */
+  GCObject *sweeptail;  /**< Last object of 'allgc' during a background sweep. */
+  struct GCStats *gcstats;  /**< Collector telemetry (NULL when off). */
+  size_t profrate;  /**< Mean bytes between heap samples (0: profiler off). */
+  struct HeapProf *heapprof;  /**< Heap profiler (see 'lprof.c'), or NULL. */
+  unsigned int classversion;  /**< Bumped when class members change (see 'lclass.c'). */
   GCObject *allgc;  /**< List of all collectable objects. */
+  _Atomic(lua_State *) nurseries;  /**< Threads whose nursery may have objects. */
   GCObject **sweepgc;  /**< Current position of sweep in list. */
   GCObject *finobj;  /**< List of collectable objects with finalizers. */
   GCObject *gray;  /**< List of gray objects. */
@@ -350,6 +395,7 @@ typedef struct global_State {
   struct lua_State *mainthread; /**< Main thread. */
   TString *memerrmsg;  /**< Message for memory-allocation errors. */
   TString *tmname[TM_N];  /**< Array with tag-method names. */
+  TString *asyncwrap;  /**< Name of the global that wraps async functions. */
   struct GCObject *mt[LUA_NUMTYPES];  /**< Metatables for basic types. */
   TString *strcache[STRCACHE_N][STRCACHE_M];  /**< Cache for strings in API. */
   lua_WarnFunction warnf;  /**< Warning function. */
@@ -380,6 +426,11 @@ struct lua_State {
   UpVal *openupval;  /**< List of open upvalues in this stack. */
   StkIdRel tbclist;  /**< List of to-be-closed variables. */
   GCObject *gclist; /**< List of gray objects. */
+  _Atomic(GCObject *) nursery;  /**< Objects created by this thread, not yet in 'allgc'. */
+  struct lua_State *nurserynext;  /**< Next thread in 'g->nurseries'. */
+  l_atomic innursery;  /**< Whether the thread is in 'g->nurseries'. */
+  lu_mem nfreed;  /**< Bytes freed through this thread (see 'luaM_free_'). */
+  l_mem profleft;  /**< Bytes to allocate before the next heap sample. */
   struct lua_State *twups;  /**< List of threads with open upvalues. */
   struct lua_longjmp *errorJmp;  /**< Current error recover point. */
   CallInfo base_ci;  /**< CallInfo for first level (C calling Lua). */
@@ -457,6 +508,14 @@ union GCUnion {
 #define obj2gco(v)	check_exp((v)->tt >= LUA_TSTRING, &(cast_u(v)->gc))
 
 
+/*
+** The state is about to run Lua code in another OS thread: from now on
+** its tables must be locked. (Called by the thread that creates the new
+** one, while it holds no table lock.)
+*/
+#define luaE_setmultithread(L)	(G(L)->tablelocks = 1)
+
+
 /* actual number of total bytes allocated */
 #define gettotalbytes(g)	cast(lu_mem, (g)->GCtotalbytes + l_atomic_load(&(g)->GCdebt))
 
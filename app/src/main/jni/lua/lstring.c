@@ -81,69 +81,166 @@ unsigned luaS_hashlongstr (TString *ts) {
 }
 
 
-static void tablerehash (TString **vect, int osize, int nsize) {
-  int i;
-  for (i = osize; i < nsize; i++)  /* clear new elements */
-    vect[i] = NULL;
-  for (i = 0; i < osize; i++) {  /* rehash old part of the array */
-    TString *p = vect[i];
-    vect[i] = NULL;
-    while (p) {  /* for each string in the list */
-      TString *hnext = p->u.hnext;  /* save next */
-      unsigned int h = lmod(p->hash, nsize);  /* new position */
-      p->u.hnext = vect[h];  /* chain it into array */
-      vect[h] = p;
-      p = hnext;
+/*
+** {======================================================
+** Sharded string table
+** =======================================================
+*/
+
+/*
+** A short string lives in the shard selected by the low bits of its
+** hash; the other bits select its bucket inside the shard. Each shard
+** has its own lock: lookups hold it as readers while they walk a chain
+** and check whether the string found is dead, so that no string can be
+** unlinked (and then freed, by the collector or by the background
+** sweeper) and no bucket array replaced under them; changes hold it as
+** writers. Lookups in different shards never contend.
+**
+** Lock order: 'g->lock' (held by the collector) before any shard lock.
+** Nothing that may take 'g->lock' (allocation included, as it can run
+** an emergency collection) is done while holding only a shard lock.
+*/
+
+#define shardof(g,h)	(&(g)->strt.shard[(h) & (STRSHARDS - 1)])
+
+#define bucketof(bk,h)	(&(bk)->b[lmod((h) >> LUAI_STRSHARDBITS, (bk)->size)])
+
+#define sizebuckets(n)	(offsetof(strbuckets, b) + cast_sizet(n) * sizeof(TString*))
+
+/* minimum number of buckets of a shard */
+#define MINSHARDSIZE	((MINSTRTABSIZE / STRSHARDS > 0) ? \
+                         MINSTRTABSIZE / STRSHARDS : 1)
+
+
+/*
+** Allocates an empty bucket array; returns NULL if there is no memory.
+*/
+static strbuckets *newbuckets (lua_State *L, int size) {
+  strbuckets *bk = cast(strbuckets *,
+                        luaM_realloc_(L, NULL, 0, sizebuckets(size)));
+  if (bk != NULL) {
+    int i;
+    bk->size = size;
+    for (i = 0; i < size; i++)
+      bk->b[i] = NULL;
+  }
+  return bk;
+}
+
+
+static void freebuckets (lua_State *L, strbuckets *bk) {
+  if (bk != NULL)
+    luaM_freemem(L, bk, sizebuckets(bk->size));
+}
+
+
+/*
+** Resizes shard 'sh' to 'nsize' buckets, unless its size is no longer
+** 'osize' (another thread resized it first). The new array is
+** allocated before taking the lock, and the old one freed after
+** releasing it (see "Lock order").
+*/
+static void resizeshard (lua_State *L, strshard *sh, int osize, int nsize) {
+  strbuckets *nbk = newbuckets(L, nsize);
+  strbuckets *old = NULL;
+  if (nbk == NULL)
+    return;  /* keep current size */
+  l_tablelock_wrlock(&sh->lock);
+  if (sh->buckets->size == osize) {
+    strbuckets *bk = sh->buckets;
+    int i;
+    for (i = 0; i < osize; i++) {
+      TString *p = bk->b[i];
+      while (p) {  /* for each string in the list */
+        TString *hnext = p->u.hnext;  /* save next */
+        TString **list = bucketof(nbk, p->hash);
+        p->u.hnext = *list;  /* chain it into new array */
+        *list = p;
+        p = hnext;
+      }
     }
+    old = bk;
+    sh->buckets = nbk;
+    nbk = NULL;
   }
+  l_tablelock_unlock(&sh->lock);
+  freebuckets(L, nbk);  /* not used */
+  freebuckets(L, old);  /* no lookup can be walking it now */
+}
+
+
+/*
+** Looks for a short string in shard 'sh' (with its lock held).
+*/
+static TString *lookupshrstr (strshard *sh, const char *str, size_t l,
+                                                unsigned int h) {
+  TString *ts;
+  for (ts = *bucketof(sh->buckets, h); ts != NULL; ts = ts->u.hnext) {
+    if (l == cast_uint(ts->shrlen) &&
+        (memcmp(str, getshrstr(ts), l * sizeof(char)) == 0))
+      return ts;
+  }
+  return NULL;
+}
+
+
+static void growshard (lua_State *L, strshard *sh) {
+  int size = sh->buckets->size;
+  if (size <= MAXSTRTB / 2)  /* can grow? */
+    resizeshard(L, sh, size, size * 2);
 }
 
 
 /**
- * @brief Resizes the string table.
+ * @brief Shrinks the string-table shards that became too sparse.
+ *
+ * Called by the collector (with 'g->lock' held).
  *
  * @param L The Lua state.
- * @param nsize The new size.
  */
-void luaS_resize (lua_State *L, int nsize) {
+void luaS_shrink (lua_State *L) {
   global_State *g = G(L);
-  l_mutex_lock(&g->lock);
-  stringtable *tb = &g->strt;
-  int osize = tb->size;
-  TString **newvect;
-  if (nsize < osize)  /* shrinking table? */
-    tablerehash(tb->hash, osize, nsize);  /* depopulate shrinking part */
-  /* Unlock during allocation to avoid holding lock? No, realloc might be safe, but rehash touches table. */
-  /* We must hold lock. But realloc might trigger GC? */
-  /* If GC runs, it might deadlock if it tries to take g->lock. */
-  /* luaM_reallocvector calls luaM_realloc_ calls luaC_fullgc if alloc fails. */
-  /* luaC_fullgc takes g->lock? */
-  /* If I lock here, and luaC_fullgc tries to lock, DEADLOCK! */
-  /* I must use recursive lock or check if locked? */
-  /* Or make GC assume lock is held? */
-
-  /* Assuming GC handles its own locking or we use recursive mutex. */
-  /* Standard pthreads mutex is NOT recursive by default. */
-  /* lthread implementation: depends. Windows CRITICAL_SECTION is recursive. */
-  /* pthread_mutex can be recursive if initialized with PTHREAD_MUTEX_RECURSIVE. */
-
-  /* I should make g->lock recursive. */
-
-  newvect = luaM_reallocvector(L, tb->hash, osize, nsize, TString*);
-  if (l_unlikely(newvect == NULL)) {  /* reallocation failed? */
-    if (nsize < osize)  /* was it shrinking table? */
-      tablerehash(tb->hash, nsize, osize);  /* restore to original size */
-    /* leave table as it was */
+  int i;
+  for (i = 0; i < STRSHARDS; i++) {
+    strshard *sh = &g->strt.shard[i];
+    int size = sh->buckets->size;
+    if (sh->nuse < size / 4 && size / 2 >= MINSHARDSIZE)
+      resizeshard(L, sh, size, size / 2);
   }
-  else {  /* allocation succeeded */
-    tb->hash = newvect;
-    tb->size = nsize;
-    if (nsize > osize)
-      tablerehash(newvect, osize, nsize);  /* rehash for new size */
+}
+
+
+/**
+ * @brief Total number of strings in the string table.
+ *
+ * @param g The global state.
+ * @return The number of strings.
+ */
+int luaS_nuse (global_State *g) {
+  int i, n = 0;
+  for (i = 0; i < STRSHARDS; i++)
+    n += g->strt.shard[i].nuse;
+  return n;
+}
+
+
+/**
+ * @brief Frees the bucket arrays of the string table.
+ *
+ * @param L The Lua state.
+ */
+void luaS_freetable (lua_State *L) {
+  global_State *g = G(L);
+  int i;
+  for (i = 0; i < STRSHARDS; i++) {
+    strshard *sh = &g->strt.shard[i];
+    freebuckets(L, sh->buckets);
+    sh->buckets = NULL;
   }
-  l_mutex_unlock(&g->lock);
 }
 
+/* }====================================================== */
+
 
 /**
  * @brief Clears the string cache.
@@ -168,10 +265,12 @@ void luaS_clearcache (global_State *g) {
 void luaS_init (lua_State *L) {
   global_State *g = G(L);
   int i, j;
-  stringtable *tb = &G(L)->strt;
-  tb->hash = luaM_newvector(L, MINSTRTABSIZE, TString*);
-  tablerehash(tb->hash, 0, MINSTRTABSIZE);  /* clear array */
-  tb->size = MINSTRTABSIZE;
+  for (i = 0; i < STRSHARDS; i++) {
+    strshard *sh = &g->strt.shard[i];
+    sh->buckets = newbuckets(L, MINSHARDSIZE);
+    if (sh->buckets == NULL)
+      luaM_error(L);
+  }
   /* pre-create memory-error message */
   g->memerrmsg = luaS_newliteral(L, MEMERRMSG);
   luaC_fix(L, obj2gco(g->memerrmsg));  /* it should never be collected */
@@ -229,72 +328,161 @@ TString *luaS_createlngstrobj (lua_State *L, size_t l) {
 /**
  * @brief Removes a string from the string table.
  *
+ * Called by the collector (with 'g->lock' held) when freeing the string.
+ *
  * @param L The Lua state.
  * @param ts The string to remove.
  */
-void luaS_remove (lua_State *L, TString *ts) {
-  stringtable *tb = &G(L)->strt;
-  TString **p = &tb->hash[lmod(ts->hash, tb->size)];
+static void unlinkshrstr (strshard *sh, TString *ts) {
+  TString **p = bucketof(sh->buckets, ts->hash);
   while (*p != ts)  /* find previous element */
     p = &(*p)->u.hnext;
   *p = (*p)->u.hnext;  /* remove element from its list */
-  tb->nuse--;
+  sh->nuse--;
 }
 
 
-static void growstrtab (lua_State *L, stringtable *tb) {
-  if (l_unlikely(tb->nuse == MAX_INT)) {  /* too many strings? */
-    luaC_fullgc(L, 1);  /* try to free some... */
-    if (tb->nuse == MAX_INT)  /* still too many? */
-      luaM_error(L);  /* cannot even create a message... */
-  }
-  if (tb->size <= MAXSTRTB / 2)  /* can grow string table? */
-    luaS_resize(L, tb->size * 2);
+void luaS_remove (lua_State *L, TString *ts) {
+  strshard *sh = shardof(G(L), ts->hash);
+  l_tablelock_wrlock(&sh->lock);
+  unlinkshrstr(sh, ts);
+  l_tablelock_unlock(&sh->lock);
 }
 
 
-/*
-** Checks whether short string exists and reuses it or creates a new one.
-*/
-static TString *internshrstr (lua_State *L, const char *str, size_t l) {
-  TString *ts;
+/**
+ * @brief Removes a dead string from the string table, unless it was
+ * resurrected meanwhile.
+ *
+ * Called by the background sweeper, which does not hold 'g->lock': the
+ * deadness of the string is checked again under the shard lock, which
+ * 'resurrectshrstr' also holds when it revives a string.
+ *
+ * @param L The Lua state.
+ * @param ts The string to remove.
+ * @return 1 if the string was removed (and can be freed); 0 otherwise.
+ */
+int luaS_removedead (lua_State *L, TString *ts) {
   global_State *g = G(L);
+  strshard *sh = shardof(g, ts->hash);
+  int dead;
+  l_tablelock_wrlock(&sh->lock);
+  dead = isdead(g, ts);
+  if (dead)
+    unlinkshrstr(sh, ts);
+  l_tablelock_unlock(&sh->lock);
+  return dead;
+}
 
-  l_mutex_lock(&g->lock);
 
-  stringtable *tb = &g->strt;
-  unsigned int h = luaS_hash(str, l, g->seed);
-  TString **list = &tb->hash[lmod(h, tb->size)];
-  lua_assert(str != NULL);  /* otherwise 'memcmp'/'memcpy' are undefined */
-  for (ts = *list; ts != NULL; ts = ts->u.hnext) {
-    if (l == cast_uint(ts->shrlen) &&
-        (memcmp(str, getshrstr(ts), l * sizeof(char)) == 0)) {
-      /* found! */
-      if (isdead(g, ts))  /* dead (but not collected yet)? */
-        changewhite(ts);  /* resurrect it */
-      l_mutex_unlock(&g->lock);
-      return ts;
-    }
-  }
-  /* else must create a new string */
-  if (tb->nuse >= tb->size) {  /* need to grow string table? */
-    growstrtab(L, tb);
-    /* Re-fetch list because resize might have changed table size/hash */
-    list = &tb->hash[lmod(h, tb->size)];
-  }
-  ts = createstrobj(L, l, LUA_VSHRSTR, h);
+/*
+** Creates a new short string and adds it to its shard, holding only the
+** shard lock. The object is allocated before taking that lock and is
+** handed to the collector (see 'luaC_linkobj') after releasing it. Returns NULL when the string
+** showed up meanwhile but is dead, which only 'resurrectshrstr' can
+** handle.
+*/
+static TString *addshrstr (lua_State *L, strshard *sh, const char *str,
+                                         size_t l, unsigned int h) {
+  global_State *g = G(L);
+  size_t totalsize = sizelstring(l);
+  GCObject *o = cast(GCObject *, luaM_newobject(L, LUA_VSHRSTR, totalsize));
+  TString *ts = gco2ts(o);
+  TString *old;
+  TString **list;
+  int grow;
+  o->marked = luaC_white(g);
+  o->tt = LUA_VSHRSTR;
+  ts->hash = h;
+  ts->extra = 0;
   ts->shrlen = cast(ls_byte, l);
   getshrstr(ts)[l] = '\0';  /* ending 0 */
   memcpy(getshrstr(ts), str, l * sizeof(char));
+  l_tablelock_wrlock(&sh->lock);
+  old = lookupshrstr(sh, str, l, h);
+  if (old != NULL) {  /* another thread added it first? */
+    l_tablelock_unlock(&sh->lock);
+    luaM_freemem(L, ts, totalsize);
+    return isdead(g, old) ? NULL : old;
+  }
+  list = bucketof(sh->buckets, h);
   ts->u.hnext = *list;
   *list = ts;
-  tb->nuse++;
+  grow = (++sh->nuse > sh->buckets->size);
+  l_tablelock_unlock(&sh->lock);
+  luaC_linkobj(L, o);
+  if (grow)
+    growshard(L, sh);
+  return ts;
+}
 
+
+/*
+** Slow path for a string found dead (collectable but not collected
+** yet): with 'g->lock' the sweeper cannot free it while it is made
+** alive again. Also used when a shard is full.
+*/
+static TString *resurrectshrstr (lua_State *L, strshard *sh,
+                                 const char *str, size_t l, unsigned int h) {
+  global_State *g = G(L);
+  TString *ts;
+  l_mutex_lock(&g->lock);
+  l_tablelock_wrlock(&sh->lock);
+  ts = lookupshrstr(sh, str, l, h);
+  if (ts != NULL) {
+    if (isdead(g, ts))  /* still dead? */
+      changewhite(ts);  /* resurrect it */
+  }
+  else {
+    TString **list;
+    if (l_unlikely(sh->nuse == MAX_INT)) {  /* too many strings? */
+      luaC_fullgc(L, 1);  /* try to free some... */
+      if (sh->nuse == MAX_INT)  /* still too many? */
+        luaM_error(L);  /* cannot even create a message... */
+    }
+    ts = createstrobj(L, l, LUA_VSHRSTR, h);
+    ts->shrlen = cast(ls_byte, l);
+    getshrstr(ts)[l] = '\0';  /* ending 0 */
+    memcpy(getshrstr(ts), str, l * sizeof(char));
+    list = bucketof(sh->buckets, h);  /* allocation may have resized it */
+    ts->u.hnext = *list;
+    *list = ts;
+    sh->nuse++;
+  }
+  l_tablelock_unlock(&sh->lock);
   l_mutex_unlock(&g->lock);
   return ts;
 }
 
 
+/*
+** Checks whether short string exists and reuses it or creates a new one.
+** Existing strings are found holding only the shard lock as a reader;
+** whether the string is dead must be checked under that lock too, as
+** the background sweeper may free it as soon as the lock is released.
+*/
+static TString *internshrstr (lua_State *L, const char *str, size_t l) {
+  global_State *g = G(L);
+  unsigned int h = luaS_hash(str, l, g->seed);
+  strshard *sh = shardof(g, h);
+  TString *ts;
+  int dead;
+  lua_assert(str != NULL);  /* otherwise 'memcmp'/'memcpy' are undefined */
+  l_tablelock_rdlock(&sh->lock);
+  ts = lookupshrstr(sh, str, l, h);
+  dead = (ts != NULL && isdead(g, ts));
+  l_tablelock_unlock(&sh->lock);
+  if (ts != NULL && !dead)
+    return ts;
+  if (ts == NULL && sh->nuse < MAX_INT) {
+    ts = addshrstr(L, sh, str, l, h);
+    if (ts != NULL)
+      return ts;
+  }
+  return resurrectshrstr(L, sh, str, l, h);
+}
+
+
 /**
  * @brief Creates a new string (or reuses an existing one).
  *
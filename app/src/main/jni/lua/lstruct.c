@@ -37,6 +37,7 @@
 #define KEY_FIELDS "__fields"
 #define KEY_NAME "__name"
 #define KEY_GC_OFFSETS "__gc_offsets"
+#define KEY_DESC "__desc"
 
 /* Keys for Field Info table */
 #define F_OFFSET "offset"
@@ -60,6 +61,50 @@ typedef struct {
     lu_byte inline_data[1]; /**< Placeholder for owned data. */
 } Array;
 
+/**
+ * @brief Compiled description of one struct field.
+ *
+ * Every reference held here ('name', 'def', 'deflt') is also stored in
+ * the field's info table, which keeps it alive.
+ */
+typedef struct FieldDesc {
+    TString *name;      /**< Field name. */
+    int offset;         /**< Offset inside the data block. */
+    int type;           /**< Field type (ST_INT, ST_STRUCT, etc.) */
+    int size;           /**< Size in bytes. */
+    int arr_len;        /**< Array length (ST_ARRAY). */
+    int arr_elem_type;  /**< Array element type (ST_ARRAY). */
+    int arr_elem_size;  /**< Array element size (ST_ARRAY). */
+    Table *def;         /**< Nested struct definition (if any). */
+    TValue deflt;       /**< Default value. */
+} FieldDesc;
+
+/**
+ * @brief Compiled struct definition, stored in the definition table
+ * under KEY_DESC.
+ *
+ * 'slots' maps the hash of a field name (masked with 'mask') to an index
+ * into 'fields' (-1 for an empty slot). When 'perfect' is set no two
+ * names share a slot, so a lookup needs one probe; otherwise slots are
+ * probed linearly and the table always has free slots.
+ */
+typedef struct StructDesc {
+    int size;           /**< Size of the data block. */
+    int *gc_offsets;    /**< GC offsets (inside the KEY_GC_OFFSETS userdata). */
+    int n_gc_offsets;   /**< Number of GC offsets. */
+    int nfields;        /**< Number of entries in 'fields'. */
+    unsigned int mask;  /**< Number of slots minus one. */
+    int perfect;        /**< Whether each name has its own slot. */
+    int *slots;         /**< Slot table (follows 'fields'). */
+    FieldDesc fields[1];
+} StructDesc;
+
+/* Largest field count for which a collision-free slot table is searched */
+#define MAXPERFECT 64
+
+#define fieldhash(ts) \
+    ((ts)->tt == LUA_VSHRSTR ? (ts)->hash : luaS_hashlongstr(ts))
+
 /* Forward declaration */
 static int array_index(lua_State *L);
 static int array_newindex(lua_State *L);
@@ -104,68 +149,147 @@ static void get_gc_offsets(lua_State *L, Table *def, int **offsets, int *count)
 }
 
 /**
- * @brief Retrieves information about a struct field.
+ * @brief Finds the descriptor of a field.
  *
- * @param L The Lua state.
- * @param fields The fields table.
+ * @param d The compiled struct definition.
  * @param key The field name.
- * @param[out] offset Field offset.
- * @param[out] type Field type.
- * @param[out] size Field size.
- * @param[out] nested_def Nested struct definition (if applicable).
- * @param[out] arr_len Array length (if applicable).
- * @param[out] arr_elem_type Array element type (if applicable).
- * @param[out] arr_elem_size Array element size (if applicable).
+ * @return The field descriptor, or NULL if there is no such field.
  */
-static void get_field_info(lua_State *L, Table *fields, TString *key, int *offset, int *type, int *size, Table **nested_def, int *arr_len, int *arr_elem_type, int *arr_elem_size) {
-    const TValue *v = luaH_getstr(fields, key);
-    if (ttistable(v)) {
-        Table *info = hvalue(v);
+static const FieldDesc *find_field(const StructDesc *d, TString *key) {
+    unsigned int i = fieldhash(key) & d->mask;
+    for (;;) {
+        int f = d->slots[i];
+        if (f >= 0) {
+            TString *name = d->fields[f].name;
+            if (name == key || (key->tt == LUA_VLNGSTR &&
+                                name->tt == LUA_VLNGSTR &&
+                                luaS_eqlngstr(name, key)))
+                return &d->fields[f];
+        }
+        if (f < 0 || d->perfect)
+            return NULL;
+        i = (i + 1) & d->mask;
+    }
+}
 
-        lua_pushstring(L, F_OFFSET);
-        TValue *vo = (TValue*)luaH_getstr(info, tsvalue(s2v(L->top.p - 1)));
-        if (!ttisnil(vo)) *offset = (int)ivalue(vo);
+/**
+ * @brief Returns the compiled definition of a struct.
+ *
+ * The descriptor is fetched from the definition table on first use and
+ * then cached in the struct.
+ *
+ * @param L The Lua state.
+ * @param s The struct.
+ * @return The descriptor, or NULL if the definition has none.
+ */
+static StructDesc *get_desc(lua_State *L, Struct *s) {
+    if (s->desc == NULL) {
+        lua_pushstring(L, KEY_DESC);
+        const TValue *v = luaH_getstr(s->def, tsvalue(s2v(L->top.p - 1)));
         lua_pop(L, 1);
+        if (ttisfulluserdata(v))
+            s->desc = (StructDesc *)getudatamem(uvalue(v));
+    }
+    return s->desc;
+}
 
-        lua_pushstring(L, F_TYPE);
-        TValue *vt = (TValue*)luaH_getstr(info, tsvalue(s2v(L->top.p - 1)));
-        if (!ttisnil(vt)) *type = (int)ivalue(vt);
-        lua_pop(L, 1);
+/**
+ * @brief Checks whether a slot table of 'mask' + 1 entries gives each
+ * hash its own slot.
+ */
+static int is_perfect(const unsigned int *hashes, int n, unsigned int mask) {
+    for (int i = 0; i < n; i++) {
+        for (int j = i + 1; j < n; j++) {
+            if ((hashes[i] & mask) == (hashes[j] & mask))
+                return 0;
+        }
+    }
+    return 1;
+}
 
-        lua_pushstring(L, F_SIZE);
-        TValue *vs = (TValue*)luaH_getstr(info, tsvalue(s2v(L->top.p - 1)));
-        if (!ttisnil(vs)) *size = (int)ivalue(vs);
+/**
+ * @brief Compiles the fields table of a definition into a StructDesc
+ * and stores it in the definition under KEY_DESC.
+ *
+ * Must run after KEY_SIZE and KEY_GC_OFFSETS have been set.
+ *
+ * @param L The Lua state.
+ * @param def The definition table.
+ * @param def_idx Stack index of 'def'.
+ * @param fields_idx Stack index of the fields table.
+ */
+static void compile_desc(lua_State *L, Table *def, int def_idx, int fields_idx) {
+    int nf = 0;
+    lua_pushnil(L);
+    while (lua_next(L, fields_idx) != 0) {
+        nf++;
         lua_pop(L, 1);
+    }
 
-        if (*type == ST_STRUCT) {
-            lua_pushstring(L, F_DEF);
-            TValue *vd = (TValue*)luaH_getstr(info, tsvalue(s2v(L->top.p - 1)));
-            if (!ttisnil(vd) && ttistable(vd)) *nested_def = hvalue(vd);
-            lua_pop(L, 1);
-        } else if (*type == ST_ARRAY) {
-            lua_pushstring(L, F_LEN);
-            TValue *vl = (TValue*)luaH_getstr(info, tsvalue(s2v(L->top.p - 1)));
-            if (!ttisnil(vl)) *arr_len = (int)ivalue(vl);
-            lua_pop(L, 1);
-
-            lua_pushstring(L, F_ELEM_TYPE);
-            TValue *vet = (TValue*)luaH_getstr(info, tsvalue(s2v(L->top.p - 1)));
-            if (!ttisnil(vet)) *arr_elem_type = (int)ivalue(vet);
-            lua_pop(L, 1);
+    /* Collect name hashes and choose the slot table size */
+    unsigned int *hashes = (unsigned int *)lua_newuserdatauv(L, (nf + 1) * sizeof(unsigned int), 0);
+    int k = 0;
+    lua_pushnil(L);
+    while (lua_next(L, fields_idx) != 0) {
+        hashes[k++] = fieldhash(tsvalue(s2v(L->top.p - 2)));
+        lua_pop(L, 1);
+    }
+    unsigned int nslots = 1;
+    while (nslots < (unsigned int)nf) nslots <<= 1;
+    int perfect = 0;
+    if (nf <= MAXPERFECT) {
+        for (unsigned int sz = nslots; sz <= nslots * 4; sz <<= 1) {
+            if (is_perfect(hashes, nf, sz - 1)) {
+                nslots = sz;
+                perfect = 1;
+                break;
+            }
+        }
+    }
+    if (!perfect)
+        nslots <<= 1;  /* keep free slots to stop probing */
+    lua_pop(L, 1);  /* hashes */
+
+    size_t fsize = offsetof(StructDesc, fields) + (nf + 1) * sizeof(FieldDesc);
+    StructDesc *d = (StructDesc *)lua_newuserdatauv(L, fsize + nslots * sizeof(int), 0);
+    d->size = get_int_field(L, def_idx, KEY_SIZE);
+    get_gc_offsets(L, def, &d->gc_offsets, &d->n_gc_offsets);
+    d->nfields = 0;
+    d->mask = nslots - 1;
+    d->perfect = perfect;
+    d->slots = (int *)((lu_byte *)d + fsize);
+    for (unsigned int i = 0; i < nslots; i++) d->slots[i] = -1;
 
-            lua_pushstring(L, F_ELEM_SIZE);
-            TValue *ves = (TValue*)luaH_getstr(info, tsvalue(s2v(L->top.p - 1)));
-            if (!ttisnil(ves)) *arr_elem_size = (int)ivalue(ves);
-            lua_pop(L, 1);
+    lua_pushnil(L);
+    while (lua_next(L, fields_idx) != 0) {
+        int info_idx = lua_gettop(L);
+        FieldDesc *f = &d->fields[d->nfields];
+        f->name = tsvalue(s2v(L->top.p - 2));
+        f->offset = get_int_field(L, info_idx, F_OFFSET);
+        f->type = get_int_field(L, info_idx, F_TYPE);
+        f->size = get_int_field(L, info_idx, F_SIZE);
+        f->arr_len = get_int_field(L, info_idx, F_LEN);
+        f->arr_elem_type = get_int_field(L, info_idx, F_ELEM_TYPE);
+        f->arr_elem_size = get_int_field(L, info_idx, F_ELEM_SIZE);
+        lua_pushstring(L, F_DEF);
+        lua_rawget(L, info_idx);
+        f->def = lua_istable(L, -1) ? hvalue(s2v(L->top.p - 1)) : NULL;
+        lua_pop(L, 1);
+        lua_pushstring(L, F_DEFAULT);
+        lua_rawget(L, info_idx);
+        setobj(L, &f->deflt, s2v(L->top.p - 1));
+        lua_pop(L, 1);
 
-            lua_pushstring(L, F_DEF);
-            TValue *vd = (TValue*)luaH_getstr(info, tsvalue(s2v(L->top.p - 1)));
-            if (!ttisnil(vd) && ttistable(vd)) *nested_def = hvalue(vd);
-            lua_pop(L, 1);
-        }
-    } else {
-        *type = -1;
+        unsigned int i = fieldhash(f->name) & d->mask;
+        while (d->slots[i] >= 0) i = (i + 1) & d->mask;
+        d->slots[i] = d->nfields++;
+        lua_pop(L, 1);
     }
+
+    lua_pushstring(L, KEY_DESC);
+    lua_pushvalue(L, -2);
+    lua_rawset(L, def_idx);
+    lua_pop(L, 1);  /* desc */
 }
 
 /**
@@ -189,6 +313,7 @@ void luaS_copystruct (lua_State *L, TValue *dest, const TValue *src) {
         s_dest->data_size = size;
         s_dest->gc_offsets = s_src->gc_offsets;
         s_dest->n_gc_offsets = s_src->n_gc_offsets;
+        s_dest->desc = s_src->desc;
     } else {
         /* Source is an Owner -> Create an Owner (Deep Copy) */
         s_dest = (Struct *)luaC_newobjdt(L, LUA_TSTRUCT, offsetof(Struct, inline_data) + size, 0);
@@ -198,6 +323,7 @@ void luaS_copystruct (lua_State *L, TValue *dest, const TValue *src) {
         s_dest->data_size = size;
         s_dest->gc_offsets = s_src->gc_offsets;
         s_dest->n_gc_offsets = s_src->n_gc_offsets;
+        s_dest->desc = s_src->desc;
         memcpy(s_dest->data, s_src->data, size);
     }
 
@@ -221,26 +347,12 @@ void luaS_structindex (lua_State *L, const TValue *t, TValue *key, StkId val) {
         return;
     }
     Struct *s = structvalue(t);
-    Table *def = s->def;
+    const StructDesc *d = get_desc(L, s);
+    const FieldDesc *f = (d != NULL) ? find_field(d, tsvalue(key)) : NULL;
 
-    /* Get fields table */
-    lua_pushstring(L, KEY_FIELDS);
-    const TValue *vf = luaH_getstr(def, tsvalue(s2v(L->top.p - 1)));
-    lua_pop(L, 1);
-    if (!ttistable(vf)) {
-        setnilvalue(s2v(val));
-        return;
-    }
-    Table *fields = hvalue(vf);
-
-    int offset, type, size;
-    Table *nested_def = NULL;
-    int arr_len = 0, arr_elem_type = 0, arr_elem_size = 0;
-    get_field_info(L, fields, tsvalue(key), &offset, &type, &size, &nested_def, &arr_len, &arr_elem_type, &arr_elem_size);
-
-    if (type == -1) {
+    if (f == NULL) {
         /* Check if key exists in definition table (e.g. __size, __name) */
-        const TValue *vdef = luaH_getstr(def, tsvalue(key));
+        const TValue *vdef = luaH_getstr(s->def, tsvalue(key));
         if (!isempty(vdef)) {
             setobj2s(L, val, vdef);
             return;
@@ -249,9 +361,9 @@ void luaS_structindex (lua_State *L, const TValue *t, TValue *key, StkId val) {
         return;
     }
 
-    lu_byte *p = s->data + offset;
+    lu_byte *p = s->data + f->offset;
 
-    switch (type) {
+    switch (f->type) {
         case ST_INT: {
             lua_Integer i;
             memcpy(&i, p, sizeof(i));
@@ -276,14 +388,19 @@ void luaS_structindex (lua_State *L, const TValue *t, TValue *key, StkId val) {
             v->value_.struct_ = new_s;
             v->tt_ = ctb(LUA_VSTRUCT);
 
-            new_s->def = nested_def;
-            new_s->data_size = size;
+            new_s->def = f->def;
+            new_s->data_size = f->size;
             new_s->parent = obj2gco(s);
             new_s->data = p;
             new_s->gc_offsets = NULL; /* Init before call */
             new_s->n_gc_offsets = 0;
+            new_s->desc = NULL;
 
-            get_gc_offsets(L, nested_def, &new_s->gc_offsets, &new_s->n_gc_offsets);
+            const StructDesc *nd = get_desc(L, new_s);
+            if (nd != NULL) {
+                new_s->gc_offsets = nd->gc_offsets;
+                new_s->n_gc_offsets = nd->n_gc_offsets;
+            }
 
             checkliveness(L, v);
             break;
@@ -309,10 +426,10 @@ void luaS_structindex (lua_State *L, const TValue *t, TValue *key, StkId val) {
             /* Restore val */
             val = restorestack(L, val_off);
 
-            arr->len = arr_len;
-            arr->size = arr_elem_size;
-            arr->type = arr_elem_type;
-            arr->def = nested_def;
+            arr->len = f->arr_len;
+            arr->size = f->arr_elem_size;
+            arr->type = f->arr_elem_type;
+            arr->def = f->def;
             arr->data = p; /* Point to struct data */
 
             /* Set metatable */
@@ -354,30 +471,21 @@ void luaS_structnewindex (lua_State *L, const TValue *t, TValue *key, TValue *va
         return;
     }
     Struct *s = structvalue(t);
-    Table *def = s->def;
-
-    lua_pushstring(L, KEY_FIELDS);
-    const TValue *vf = luaH_getstr(def, tsvalue(s2v(L->top.p - 1)));
-    lua_pop(L, 1);
-    if (!ttistable(vf)) {
+    const StructDesc *d = get_desc(L, s);
+    if (d == NULL) {
         luaG_runerror(L, "invalid struct definition");
         return;
     }
-    Table *fields = hvalue(vf);
 
-    int offset, type, size;
-    Table *nested_def = NULL;
-    int arr_len = 0, arr_elem_type = 0, arr_elem_size = 0;
-    get_field_info(L, fields, tsvalue(key), &offset, &type, &size, &nested_def, &arr_len, &arr_elem_type, &arr_elem_size);
-
-    if (type == -1) {
+    const FieldDesc *f = find_field(d, tsvalue(key));
+    if (f == NULL) {
         luaG_runerror(L, "field '%s' does not exist in struct", getstr(tsvalue(key)));
         return;
     }
 
-    lu_byte *p = s->data + offset;
+    lu_byte *p = s->data + f->offset;
 
-    switch (type) {
+    switch (f->type) {
         case ST_INT: {
             lua_Integer i;
             if (!ttisinteger(val)) {
@@ -406,10 +514,10 @@ void luaS_structnewindex (lua_State *L, const TValue *t, TValue *key, TValue *va
                 luaG_runerror(L, "expected struct for field '%s'", getstr(tsvalue(key)));
             }
             Struct *s_val = structvalue(val);
-            if (s_val->def != nested_def) {
+            if (s_val->def != f->def) {
                  luaG_runerror(L, "struct type mismatch for field '%s'", getstr(tsvalue(key)));
             }
-            memcpy(p, s_val->data, size);
+            memcpy(p, s_val->data, f->size);
             break;
         }
         case ST_STRING: {
@@ -426,13 +534,13 @@ void luaS_structnewindex (lua_State *L, const TValue *t, TValue *key, TValue *va
             }
             Array *arr = (Array *)getudatamem(uvalue(val));
             /* Check compatibility */
-            if (arr->len != arr_len || arr->size != arr_elem_size || arr->type != arr_elem_type) {
+            if (arr->len != (size_t)f->arr_len || arr->size != (size_t)f->arr_elem_size || arr->type != f->arr_elem_type) {
                 luaG_runerror(L, "array type/size mismatch for field '%s'", getstr(tsvalue(key)));
             }
-            if (arr->type == ST_STRUCT && arr->def != nested_def) {
+            if (arr->type == ST_STRUCT && arr->def != f->def) {
                 luaG_runerror(L, "array struct type mismatch for field '%s'", getstr(tsvalue(key)));
             }
-            memcpy(p, arr->data, size); /* Copy entire array data */
+            memcpy(p, arr->data, f->size); /* Copy entire array data */
             break;
         }
     }
@@ -468,13 +576,22 @@ static int struct_call (lua_State *L) {
     }
     Table *def = hvalue(s2v(L->top.p - lua_gettop(L))); /* 1st arg */
 
-    int size = get_int_field(L, 1, KEY_SIZE);
-    /* printf("struct_call: allocating %d bytes\n", size); */
+    const StructDesc *d = NULL;
+    lua_pushstring(L, KEY_DESC);
+    const TValue *vd = luaH_getstr(def, tsvalue(s2v(L->top.p - 1)));
+    lua_pop(L, 1);
+    if (ttisfulluserdata(vd)) d = (const StructDesc *)getudatamem(uvalue(vd));
+    if (d == NULL) {
+        luaL_error(L, "invalid struct definition");
+        return 0;
+    }
+
+    int size = d->size;
 
     /* Allocate struct */
     Struct *s = (Struct *)luaC_newobjdt(L, LUA_TSTRUCT, offsetof(Struct, inline_data) + size, 0);
 
-    /* Anchor s to stack immediately to prevent collection during get_gc_offsets */
+    /* Anchor s to stack */
     TValue *ret = s2v(L->top.p);
     ret->value_.struct_ = s;
     ret->tt_ = ctb(LUA_VSTRUCT);
@@ -483,87 +600,54 @@ static int struct_call (lua_State *L) {
     s->def = def;
     s->data_size = size;
     s->parent = NULL;
-    s->gc_offsets = NULL; /* Init to NULL before calling function that might GC */
-    s->n_gc_offsets = 0;
+    s->gc_offsets = d->gc_offsets;
+    s->n_gc_offsets = d->n_gc_offsets;
+    s->desc = (StructDesc *)d;
     s->data = s->inline_data.d;
     memset(s->data, 0, size);
 
-    /* Get GC offsets (might trigger GC) */
-    get_gc_offsets(L, def, &s->gc_offsets, &s->n_gc_offsets);
-
     /* Initialize with defaults */
-    lua_pushstring(L, KEY_FIELDS);
-    lua_rawget(L, 1);
-    if (lua_istable(L, -1)) {
-        int fields_idx = lua_gettop(L);
-        lua_pushnil(L);
-        while (lua_next(L, fields_idx) != 0) {
-            /* key, val (info) */
-            if (ttistable(s2v(L->top.p - 1))) {
-                Table *info = hvalue(s2v(L->top.p - 1));
-
-                lua_pushstring(L, F_OFFSET);
-                TValue *v_off = (TValue*)luaH_getstr(info, tsvalue(s2v(L->top.p - 1)));
-
-                lua_pushstring(L, F_TYPE);
-                TValue *v_type = (TValue*)luaH_getstr(info, tsvalue(s2v(L->top.p - 1)));
-
-                lua_pushstring(L, F_DEFAULT);
-                TValue *v_def = (TValue*)luaH_getstr(info, tsvalue(s2v(L->top.p - 1)));
-
-                lua_pushstring(L, F_SIZE);
-                TValue *v_size = (TValue*)luaH_getstr(info, tsvalue(s2v(L->top.p - 1)));
-
-                if (!ttisnil(v_off) && !ttisnil(v_type) && !ttisnil(v_def) && !ttisnil(v_size)) {
-                    /* Pop keys */
-                    lua_pop(L, 4);
-                    int offset = (int)ivalue(v_off);
-                    int type = (int)ivalue(v_type);
-                    int sz = (int)ivalue(v_size);
-                    lu_byte *p = s->data + offset;
-
-                    switch (type) {
-                        case ST_INT: {
-                            lua_Integer i = ivalue(v_def);
-                            memcpy(p, &i, sizeof(i));
-                            break;
-                        }
-                        case ST_FLOAT: {
-                            lua_Number n = fltvalue(v_def);
-                            memcpy(p, &n, sizeof(n));
-                            break;
-                        }
-                        case ST_BOOL: *p = !l_isfalse(v_def); break;
-                        case ST_STRUCT: {
-                            if (ttisstruct(v_def)) {
-                                Struct *def_s = structvalue(v_def);
-                                memcpy(p, def_s->data, sz);
-                            }
-                            break;
-                        }
-                        case ST_STRING: {
-                            if (ttisstring(v_def)) {
-                                TString *ts = tsvalue(v_def);
-                                memcpy(p, &ts, sizeof(TString *));
-                            }
-                            break;
-                        }
-                        case ST_ARRAY: {
-                            if (ttisfulluserdata(v_def)) {
-                                Array *arr = (Array *)getudatamem(uvalue(v_def));
-                                memcpy(p, arr->data, sz);
-                            }
-                            break;
-                        }
-                    }
-                } else {
-                    lua_pop(L, 4); /* Pop keys if nil check failed */
+    for (int i = 0; i < d->nfields; i++) {
+        const FieldDesc *f = &d->fields[i];
+        const TValue *v_def = &f->deflt;
+        lu_byte *p = s->data + f->offset;
+
+        if (ttisnil(v_def)) continue;
+        switch (f->type) {
+            case ST_INT: {
+                lua_Integer i = ivalue(v_def);
+                memcpy(p, &i, sizeof(i));
+                break;
+            }
+            case ST_FLOAT: {
+                lua_Number n = fltvalue(v_def);
+                memcpy(p, &n, sizeof(n));
+                break;
+            }
+            case ST_BOOL: *p = !l_isfalse(v_def); break;
+            case ST_STRUCT: {
+                if (ttisstruct(v_def)) {
+                    Struct *def_s = structvalue(v_def);
+                    memcpy(p, def_s->data, f->size);
                 }
+                break;
+            }
+            case ST_STRING: {
+                if (ttisstring(v_def)) {
+                    TString *ts = tsvalue(v_def);
+                    memcpy(p, &ts, sizeof(TString *));
+                }
+                break;
+            }
+            case ST_ARRAY: {
+                if (ttisfulluserdata(v_def)) {
+                    Array *arr = (Array *)getudatamem(uvalue(v_def));
+                    memcpy(p, arr->data, f->size);
+                }
+                break;
             }
-            lua_pop(L, 1);
         }
     }
-    lua_pop(L, 1); /* pop fields table */
 
     /* Apply arguments (if any) */
     if (lua_gettop(L) >= 2 && lua_istable(L, 2)) {
@@ -599,6 +683,7 @@ static int struct_define (lua_State *L) {
 
     lua_newtable(L); /* Def table */
     int def_idx = lua_gettop(L);
+    Table *def = hvalue(s2v(L->top.p - 1));
 
     lua_pushstring(L, KEY_NAME);
     lua_pushvalue(L, 1);
@@ -812,6 +897,8 @@ static int struct_define (lua_State *L) {
     }
     if (gc_offsets_arr) free(gc_offsets_arr);
 
+    compile_desc(L, def, def_idx, fields_idx);
+
     lua_pop(L, 1); /* Pop fields table */
 
     /* Set metatable for Def */
@@ -846,14 +933,15 @@ static int array_len(lua_State *L) {
  */
 static int array_index(lua_State *L) {
     Array *arr = (Array *)lua_touserdata(L, 1);
+    if (lua_type(L, 2) == LUA_TSTRING &&
+        lua_stringtonumber(L, lua_tostring(L, 2)) == 0) {
+        /* Not an index: look up a method (upvalue 1 holds 'array_methods') */
+        lua_pushvalue(L, 2);
+        if (lua_rawget(L, lua_upvalueindex(1)) != LUA_TNIL) return 1;
+        return luaL_error(L, "array has no method '%s'", lua_tostring(L, 2));
+    }
     int idx = (int)luaL_checkinteger(L, 2);
     if (idx < 1 || idx > (int)arr->len) {
-        if (lua_type(L, 2) == LUA_TSTRING) {
-             lua_getmetatable(L, 1);
-             lua_pushvalue(L, 2);
-             lua_rawget(L, -2);
-             if (!lua_isnil(L, -1)) return 1;
-        }
         return luaL_error(L, "array index out of bounds");
     }
 
@@ -905,6 +993,7 @@ static int array_index(lua_State *L) {
             s->data_size = arr->size;
             s->gc_offsets = gc_offsets;
             s->n_gc_offsets = n_gc_offsets;
+            s->desc = NULL;
 
             /* Set parent */
             s->parent = parent;
@@ -983,6 +1072,565 @@ static int array_newindex(lua_State *L) {
     return 0;
 }
 
+/*
+** {======================================================
+** Bulk operations on numeric arrays
+** =======================================================
+*/
+
+/*
+** 'vnum' packs VNUM_LANES lua_Numbers. Float kernels are written once
+** against these macros; without a vector unit 'vnum' is a single
+** lua_Number and the same loops run scalar. Integer and boolean kernels
+** are plain loops left to the compiler.
+*/
+#if LUA_FLOAT_TYPE == LUA_FLOAT_DOUBLE && defined(__AVX__)
+
+#include <immintrin.h>
+
+typedef __m256d vnum;
+#define VNUM_LANES	4
+#define vnum_load(p)	_mm256_loadu_pd(p)
+#define vnum_store(p,v)	_mm256_storeu_pd(p, v)
+#define vnum_set1(x)	_mm256_set1_pd(x)
+#define vnum_add(a,b)	_mm256_add_pd(a, b)
+#define vnum_sub(a,b)	_mm256_sub_pd(a, b)
+#define vnum_mul(a,b)	_mm256_mul_pd(a, b)
+#define vnum_div(a,b)	_mm256_div_pd(a, b)
+#define vnum_min(a,b)	_mm256_min_pd(a, b)
+#define vnum_max(a,b)	_mm256_max_pd(a, b)
+
+#elif LUA_FLOAT_TYPE == LUA_FLOAT_DOUBLE && defined(__SSE2__)
+
+#include <emmintrin.h>
+
+typedef __m128d vnum;
+#define VNUM_LANES	2
+#define vnum_load(p)	_mm_loadu_pd(p)
+#define vnum_store(p,v)	_mm_storeu_pd(p, v)
+#define vnum_set1(x)	_mm_set1_pd(x)
+#define vnum_add(a,b)	_mm_add_pd(a, b)
+#define vnum_sub(a,b)	_mm_sub_pd(a, b)
+#define vnum_mul(a,b)	_mm_mul_pd(a, b)
+#define vnum_div(a,b)	_mm_div_pd(a, b)
+#define vnum_min(a,b)	_mm_min_pd(a, b)
+#define vnum_max(a,b)	_mm_max_pd(a, b)
+
+#elif LUA_FLOAT_TYPE == LUA_FLOAT_DOUBLE && defined(__aarch64__) && \
+      defined(__ARM_NEON)
+
+#include <arm_neon.h>
+
+typedef float64x2_t vnum;
+#define VNUM_LANES	2
+#define vnum_load(p)	vld1q_f64(p)
+#define vnum_store(p,v)	vst1q_f64(p, v)
+#define vnum_set1(x)	vdupq_n_f64(x)
+#define vnum_add(a,b)	vaddq_f64(a, b)
+#define vnum_sub(a,b)	vsubq_f64(a, b)
+#define vnum_mul(a,b)	vmulq_f64(a, b)
+#define vnum_div(a,b)	vdivq_f64(a, b)
+/* not 'vminq'/'vmaxq', which propagate NaNs unlike 'minpd'/'maxpd' */
+#define vnum_min(a,b)	vbslq_f64(vcltq_f64(a, b), a, b)
+#define vnum_max(a,b)	vbslq_f64(vcgtq_f64(a, b), a, b)
+
+#else
+
+typedef lua_Number vnum;
+#define VNUM_LANES	1
+#define vnum_load(p)	(*(p))
+#define vnum_store(p,v)	(*(p) = (v))
+#define vnum_set1(x)	(x)
+#define vnum_add(a,b)	((a) + (b))
+#define vnum_sub(a,b)	((a) - (b))
+#define vnum_mul(a,b)	((a) * (b))
+#define vnum_div(a,b)	((a) / (b))
+#define vnum_min(a,b)	num_min(a, b)
+#define vnum_max(a,b)	num_max(a, b)
+
+#endif
+
+/*
+** Scalar versions. Like the SSE/AVX 'min'/'max' (and the NEON selects
+** above), they give the second operand when either one is a NaN.
+*/
+#define num_add(a,b)	((a) + (b))
+#define num_sub(a,b)	((a) - (b))
+#define num_mul(a,b)	((a) * (b))
+#define num_div(a,b)	((a) / (b))
+#define num_min(a,b)	((a) < (b) ? (a) : (b))
+#define num_max(a,b)	((a) > (b) ? (a) : (b))
+
+#define int_add(a,b)	intop(+, a, b)
+#define int_sub(a,b)	intop(-, a, b)
+#define int_mul(a,b)	intop(*, a, b)
+#define int_min(a,b)	((a) < (b) ? (a) : (b))
+#define int_max(a,b)	((a) > (b) ? (a) : (b))
+
+
+/* element-wise operations accepted by 'map' */
+enum { AOP_ADD, AOP_SUB, AOP_MUL, AOP_DIV, AOP_MIN, AOP_MAX };
+
+static const char *const array_ops[] =
+  {"add", "sub", "mul", "div", "min", "max", NULL};
+
+/* comparisons accepted by 'compare' */
+enum { ACMP_EQ, ACMP_NE, ACMP_LT, ACMP_LE, ACMP_GT, ACMP_GE };
+
+static const char *const array_cmps[] =
+  {"eq", "ne", "lt", "le", "gt", "ge", NULL};
+
+
+/*
+** Applies 'vop' ('sop' for the tail) to 'a' and either 'b' or the
+** scalar 'x', writing into 'out'.
+*/
+#define num_maploop(vop,sop) { \
+    size_t i = 0; \
+    if (b != NULL) { \
+        for (; i + VNUM_LANES <= n; i += VNUM_LANES) \
+            vnum_store(out + i, vop(vnum_load(a + i), vnum_load(b + i))); \
+        for (; i < n; i++) out[i] = sop(a[i], b[i]); \
+    } else { \
+        vnum vx = vnum_set1(x); \
+        for (; i + VNUM_LANES <= n; i += VNUM_LANES) \
+            vnum_store(out + i, vop(vnum_load(a + i), vx)); \
+        for (; i < n; i++) out[i] = sop(a[i], x); \
+    } \
+}
+
+static void num_map (int op, lua_Number *out, const lua_Number *a,
+                     const lua_Number *b, lua_Number x, size_t n) {
+    switch (op) {
+        case AOP_ADD: num_maploop(vnum_add, num_add); break;
+        case AOP_SUB: num_maploop(vnum_sub, num_sub); break;
+        case AOP_MUL: num_maploop(vnum_mul, num_mul); break;
+        case AOP_DIV: num_maploop(vnum_div, num_div); break;
+        case AOP_MIN: num_maploop(vnum_min, num_min); break;
+        case AOP_MAX: num_maploop(vnum_max, num_max); break;
+    }
+}
+
+#define int_maploop(sop) { \
+    size_t i; \
+    if (b != NULL) { for (i = 0; i < n; i++) out[i] = sop(a[i], b[i]); } \
+    else { for (i = 0; i < n; i++) out[i] = sop(a[i], x); } \
+}
+
+static void int_map (int op, lua_Integer *out, const lua_Integer *a,
+                     const lua_Integer *b, lua_Integer x, size_t n) {
+    switch (op) {
+        case AOP_ADD: int_maploop(int_add); break;
+        case AOP_SUB: int_maploop(int_sub); break;
+        case AOP_MUL: int_maploop(int_mul); break;
+        case AOP_MIN: int_maploop(int_min); break;
+        case AOP_MAX: int_maploop(int_max); break;
+    }
+}
+
+/*
+** Sum (or dot product, when 'b' is not NULL) of 'n' floats. Two vector
+** accumulators hide the latency of the additions; the order of the
+** additions therefore differs from a sequential loop.
+*/
+static lua_Number num_sum (const lua_Number *a, const lua_Number *b,
+                           size_t n) {
+    vnum acc0 = vnum_set1(0), acc1 = vnum_set1(0);
+    lua_Number lanes[VNUM_LANES];
+    lua_Number res = 0;
+    size_t i = 0;
+    if (b != NULL) {
+        for (; i + 2 * VNUM_LANES <= n; i += 2 * VNUM_LANES) {
+            acc0 = vnum_add(acc0, vnum_mul(vnum_load(a + i), vnum_load(b + i)));
+            acc1 = vnum_add(acc1, vnum_mul(vnum_load(a + i + VNUM_LANES),
+                                           vnum_load(b + i + VNUM_LANES)));
+        }
+    } else {
+        for (; i + 2 * VNUM_LANES <= n; i += 2 * VNUM_LANES) {
+            acc0 = vnum_add(acc0, vnum_load(a + i));
+            acc1 = vnum_add(acc1, vnum_load(a + i + VNUM_LANES));
+        }
+    }
+    vnum_store(lanes, vnum_add(acc0, acc1));
+    for (int k = 0; k < VNUM_LANES; k++) res += lanes[k];
+    for (; i < n; i++) res += (b != NULL) ? a[i] * b[i] : a[i];
+    return res;
+}
+
+/* Minimum ('ismax' == 0) or maximum of 'n' > 0 floats */
+static lua_Number num_minmax (const lua_Number *a, size_t n, int ismax) {
+    lua_Number lanes[VNUM_LANES];
+    lua_Number res = a[0];
+    size_t i = 0;
+    if (n >= VNUM_LANES) {
+        vnum acc = vnum_load(a);
+        for (i = VNUM_LANES; i + VNUM_LANES <= n; i += VNUM_LANES)
+            acc = ismax ? vnum_max(acc, vnum_load(a + i))
+                        : vnum_min(acc, vnum_load(a + i));
+        vnum_store(lanes, acc);
+        res = lanes[0];
+        for (int k = 1; k < VNUM_LANES; k++)
+            res = ismax ? num_max(res, lanes[k]) : num_min(res, lanes[k]);
+    }
+    for (; i < n; i++)
+        res = ismax ? num_max(res, a[i]) : num_min(res, a[i]);
+    return res;
+}
+
+#define cmploop(T,cop) { \
+    const T *a = (const T *)pa; \
+    size_t i; \
+    if (pb != NULL) { \
+        const T *b = (const T *)pb; \
+        for (i = 0; i < n; i++) out[i] = (a[i] cop b[i]); \
+    } else { \
+        for (i = 0; i < n; i++) out[i] = (a[i] cop x); \
+    } \
+}
+
+#define cmpswitch(T) \
+    switch (op) { \
+        case ACMP_EQ: cmploop(T, ==); break; \
+        case ACMP_NE: cmploop(T, !=); break; \
+        case ACMP_LT: cmploop(T, <); break; \
+        case ACMP_LE: cmploop(T, <=); break; \
+        case ACMP_GT: cmploop(T, >); break; \
+        case ACMP_GE: cmploop(T, >=); break; \
+    }
+
+static void num_compare (int op, lu_byte *out, const void *pa,
+                         const void *pb, lua_Number x, size_t n) {
+    cmpswitch(lua_Number);
+}
+
+static void int_compare (int op, lu_byte *out, const void *pa,
+                         const void *pb, lua_Integer x, size_t n) {
+    cmpswitch(lua_Integer);
+}
+
+static int num_cmpasc (const void *a, const void *b) {
+    lua_Number x = *(const lua_Number *)a, y = *(const lua_Number *)b;
+    return (x > y) - (x < y);
+}
+
+static int num_cmpdesc (const void *a, const void *b) {
+    return num_cmpasc(b, a);
+}
+
+static int int_cmpasc (const void *a, const void *b) {
+    lua_Integer x = *(const lua_Integer *)a, y = *(const lua_Integer *)b;
+    return (x > y) - (x < y);
+}
+
+static int int_cmpdesc (const void *a, const void *b) {
+    return int_cmpasc(b, a);
+}
+
+
+/**
+ * @brief Allocates an owned, zero-filled array and pushes it.
+ *
+ * @param L The Lua state.
+ * @param type Element type.
+ * @param size Element size.
+ * @param count Number of elements.
+ * @return The new array.
+ */
+static Array *new_array(lua_State *L, int type, size_t size, size_t count) {
+    Array *arr = (Array *)lua_newuserdatauv(L, sizeof(Array) + count * size, 1);
+    arr->len = count;
+    arr->size = size;
+    arr->type = type;
+    arr->def = NULL;
+    arr->data = arr->inline_data;
+    memset(arr->data, 0, count * size);
+    luaL_getmetatable(L, "struct.array");
+    lua_setmetatable(L, -2);
+    return arr;
+}
+
+/**
+ * @brief Checks that an argument is an int, float or bool array.
+ */
+static Array *check_numarray(lua_State *L, int arg) {
+    Array *arr = (Array *)luaL_checkudata(L, arg, "struct.array");
+    if (arr->type != ST_INT && arr->type != ST_FLOAT && arr->type != ST_BOOL)
+        luaL_argerror(L, arg, "int, float or bool array expected");
+    return arr;
+}
+
+/**
+ * @brief Checks that an argument is an array like 'arr' (same element
+ * type and length).
+ */
+static Array *check_samearray(lua_State *L, int arg, const Array *arr) {
+    Array *other = check_numarray(L, arg);
+    luaL_argcheck(L, other->type == arr->type && other->len == arr->len,
+                  arg, "array of the same type and length expected");
+    return other;
+}
+
+/**
+ * @brief Reads an optional range [i, j] (default: whole array).
+ *
+ * @param L The Lua state.
+ * @param arr The array.
+ * @param arg Stack index of 'i' ('j' follows it).
+ * @param[out] first 0-based index of the first element.
+ * @return Number of elements in the range.
+ */
+static size_t check_range(lua_State *L, const Array *arr, int arg, size_t *first) {
+    lua_Integer i = luaL_optinteger(L, arg, 1);
+    lua_Integer j = luaL_optinteger(L, arg + 1, (lua_Integer)arr->len);
+    *first = 0;
+    if (j < i) return 0;
+    luaL_argcheck(L, i >= 1, arg, "index out of bounds");
+    luaL_argcheck(L, (lua_Unsigned)j <= arr->len, arg + 1, "index out of bounds");
+    *first = (size_t)(i - 1);
+    return (size_t)(j - i + 1);
+}
+
+/* arr:fill(v [, i [, j]]) -> arr */
+static int array_fill(lua_State *L) {
+    Array *arr = check_numarray(L, 1);
+    size_t first, n = check_range(L, arr, 3, &first);
+    size_t k;
+    switch (arr->type) {
+        case ST_INT: {
+            lua_Integer *p = (lua_Integer *)arr->data + first;
+            lua_Integer v = luaL_checkinteger(L, 2);
+            for (k = 0; k < n; k++) p[k] = v;
+            break;
+        }
+        case ST_FLOAT: {
+            lua_Number *p = (lua_Number *)arr->data + first;
+            lua_Number v = luaL_checknumber(L, 2);
+            for (k = 0; k < n; k++) p[k] = v;
+            break;
+        }
+        default:
+            luaL_checkany(L, 2);
+            memset(arr->data + first, lua_toboolean(L, 2), n);
+            break;
+    }
+    lua_settop(L, 1);
+    return 1;
+}
+
+/* dst:copy(src [, di [, si [, sj]]]) -> dst */
+static int array_copy(lua_State *L) {
+    Array *dst = check_numarray(L, 1);
+    Array *src = check_numarray(L, 2);
+    luaL_argcheck(L, src->type == dst->type, 2, "array of the same type expected");
+    lua_Integer di = luaL_optinteger(L, 3, 1);
+    size_t first, n = check_range(L, src, 4, &first);
+    luaL_argcheck(L, di >= 1 && (lua_Unsigned)(di - 1) + n <= dst->len, 3,
+                  "destination out of bounds");
+    memmove(dst->data + (size_t)(di - 1) * dst->size,
+            src->data + first * src->size, n * src->size);
+    lua_settop(L, 1);
+    return 1;
+}
+
+/* arr:slice([i [, j]]) -> new array with elements i..j */
+static int array_slice(lua_State *L) {
+    Array *arr = check_numarray(L, 1);
+    size_t first, n = check_range(L, arr, 2, &first);
+    Array *res = new_array(L, arr->type, arr->size, n);
+    memcpy(res->data, arr->data + first * arr->size, n * arr->size);
+    return 1;
+}
+
+/* arr:map(op, x [, out]) -> out; 'x' is a number or an array */
+static int array_map(lua_State *L) {
+    Array *arr = check_numarray(L, 1);
+    int op = luaL_checkoption(L, 2, NULL, array_ops);
+    const Array *b = NULL;
+    Array *out;
+    luaL_argcheck(L, arr->type != ST_BOOL, 1, "int or float array expected");
+    luaL_argcheck(L, arr->type == ST_FLOAT || op != AOP_DIV, 2,
+                  "'div' needs a float array");
+    if (lua_isuserdata(L, 3))
+        b = check_samearray(L, 3, arr);
+    if (lua_isnoneornil(L, 4))
+        out = new_array(L, arr->type, arr->size, arr->len);
+    else {
+        out = check_samearray(L, 4, arr);
+        lua_settop(L, 4);
+    }
+    if (arr->type == ST_FLOAT) {
+        lua_Number x = (b == NULL) ? luaL_checknumber(L, 3) : 0;
+        num_map(op, (lua_Number *)out->data, (const lua_Number *)arr->data,
+                b ? (const lua_Number *)b->data : NULL, x, arr->len);
+    } else {
+        lua_Integer x = (b == NULL) ? luaL_checkinteger(L, 3) : 0;
+        int_map(op, (lua_Integer *)out->data, (const lua_Integer *)arr->data,
+                b ? (const lua_Integer *)b->data : NULL, x, arr->len);
+    }
+    return 1;
+}
+
+/* arr:compare(op, x [, out]) -> bool array; 'x' is a number or an array */
+static int array_compare(lua_State *L) {
+    Array *arr = check_numarray(L, 1);
+    int op = luaL_checkoption(L, 2, NULL, array_cmps);
+    const Array *b = NULL;
+    Array *out;
+    luaL_argcheck(L, arr->type != ST_BOOL, 1, "int or float array expected");
+    if (lua_isuserdata(L, 3))
+        b = check_samearray(L, 3, arr);
+    if (lua_isnoneornil(L, 4))
+        out = new_array(L, ST_BOOL, sizeof(lu_byte), arr->len);
+    else {
+        out = check_numarray(L, 4);
+        luaL_argcheck(L, out->type == ST_BOOL && out->len == arr->len, 4,
+                      "bool array of the same length expected");
+        lua_settop(L, 4);
+    }
+    if (arr->type == ST_FLOAT) {
+        lua_Number x = (b == NULL) ? luaL_checknumber(L, 3) : 0;
+        num_compare(op, out->data, arr->data, b ? b->data : NULL, x, arr->len);
+    } else {
+        lua_Integer x = (b == NULL) ? luaL_checkinteger(L, 3) : 0;
+        int_compare(op, out->data, arr->data, b ? b->data : NULL, x, arr->len);
+    }
+    return 1;
+}
+
+/* arr:sum([i [, j]]); for bool arrays, the number of true elements */
+static int array_sum(lua_State *L) {
+    Array *arr = check_numarray(L, 1);
+    size_t first, n = check_range(L, arr, 2, &first);
+    size_t k;
+    switch (arr->type) {
+        case ST_FLOAT:
+            lua_pushnumber(L, num_sum((const lua_Number *)arr->data + first, NULL, n));
+            break;
+        case ST_INT: {
+            const lua_Integer *p = (const lua_Integer *)arr->data + first;
+            lua_Integer s = 0;
+            for (k = 0; k < n; k++) s = int_add(s, p[k]);
+            lua_pushinteger(L, s);
+            break;
+        }
+        default: {
+            const lu_byte *p = arr->data + first;
+            lua_Integer s = 0;
+            for (k = 0; k < n; k++) s += (p[k] != 0);
+            lua_pushinteger(L, s);
+            break;
+        }
+    }
+    return 1;
+}
+
+static int minmax(lua_State *L, int ismax) {
+    Array *arr = check_numarray(L, 1);
+    size_t first, n = check_range(L, arr, 2, &first);
+    luaL_argcheck(L, arr->type != ST_BOOL, 1, "int or float array expected");
+    if (n == 0)
+        lua_pushnil(L);
+    else if (arr->type == ST_FLOAT)
+        lua_pushnumber(L, num_minmax((const lua_Number *)arr->data + first, n, ismax));
+    else {
+        const lua_Integer *p = (const lua_Integer *)arr->data + first;
+        lua_Integer res = p[0];
+        for (size_t k = 1; k < n; k++)
+            res = ismax ? int_max(res, p[k]) : int_min(res, p[k]);
+        lua_pushinteger(L, res);
+    }
+    return 1;
+}
+
+/* arr:min([i [, j]]) -> smallest element (nil if the range is empty) */
+static int array_min(lua_State *L) {
+    return minmax(L, 0);
+}
+
+/* arr:max([i [, j]]) -> largest element (nil if the range is empty) */
+static int array_max(lua_State *L) {
+    return minmax(L, 1);
+}
+
+/* a:dot(b) -> sum of a[i] * b[i] */
+static int array_dot(lua_State *L) {
+    Array *a = check_numarray(L, 1);
+    Array *b = check_samearray(L, 2, a);
+    luaL_argcheck(L, a->type != ST_BOOL, 1, "int or float array expected");
+    if (a->type == ST_FLOAT)
+        lua_pushnumber(L, num_sum((const lua_Number *)a->data,
+                                  (const lua_Number *)b->data, a->len));
+    else {
+        const lua_Integer *pa = (const lua_Integer *)a->data;
+        const lua_Integer *pb = (const lua_Integer *)b->data;
+        lua_Integer s = 0;
+        for (size_t k = 0; k < a->len; k++) s = int_add(s, int_mul(pa[k], pb[k]));
+        lua_pushinteger(L, s);
+    }
+    return 1;
+}
+
+/* arr:sort([desc]) -> arr */
+static int array_sort(lua_State *L) {
+    Array *arr = check_numarray(L, 1);
+    int desc = lua_toboolean(L, 2);
+    switch (arr->type) {
+        case ST_FLOAT:
+            qsort(arr->data, arr->len, arr->size, desc ? num_cmpdesc : num_cmpasc);
+            break;
+        case ST_INT:
+            qsort(arr->data, arr->len, arr->size, desc ? int_cmpdesc : int_cmpasc);
+            break;
+        default: {  /* bool: count the true elements and refill */
+            size_t ntrue = 0;
+            for (size_t k = 0; k < arr->len; k++) ntrue += (arr->data[k] != 0);
+            memset(arr->data, desc, desc ? ntrue : arr->len - ntrue);
+            memset(arr->data + (desc ? ntrue : arr->len - ntrue), !desc,
+                   desc ? arr->len - ntrue : ntrue);
+            break;
+        }
+    }
+    lua_settop(L, 1);
+    return 1;
+}
+
+/* a:equals(b) -> true if both arrays hold equal elements */
+static int array_equals(lua_State *L) {
+    Array *a = check_numarray(L, 1);
+    Array *b = check_numarray(L, 2);
+    int eq = (a->type == b->type && a->len == b->len);
+    if (eq && a->type == ST_FLOAT) {
+        const lua_Number *pa = (const lua_Number *)a->data;
+        const lua_Number *pb = (const lua_Number *)b->data;
+        for (size_t k = 0; eq && k < a->len; k++) eq = (pa[k] == pb[k]);
+    }
+    else if (eq && a->type == ST_INT)
+        eq = (memcmp(a->data, b->data, a->len * a->size) == 0);
+    else if (eq) {
+        for (size_t k = 0; eq && k < a->len; k++)
+            eq = ((a->data[k] != 0) == (b->data[k] != 0));
+    }
+    lua_pushboolean(L, eq);
+    return 1;
+}
+
+static const luaL_Reg array_methods[] = {
+  {"fill", array_fill},
+  {"copy", array_copy},
+  {"slice", array_slice},
+  {"map", array_map},
+  {"compare", array_compare},
+  {"sum", array_sum},
+  {"min", array_min},
+  {"max", array_max},
+  {"dot", array_dot},
+  {"sort", array_sort},
+  {"equals", array_equals},
+  {NULL, NULL}
+};
+
+/* }====================================================== */
+
 /* Proxy array implementation for basic types */
 static int array_typed_newindex(lua_State *L) {
     /* upvalue 1: type (string) */
@@ -1061,7 +1709,7 @@ static int safe_array_index(lua_State *L) {
     lua_pop(L, 1);
     int idx = (int)luaL_checkinteger(L, 2);
 
-    l_rwlock_rdlock(&h->lock);
+    luaH_rdlock(L, h);
     const TValue *res = luaH_getint(h, idx);
 
     if (!ttisnil(res) && ttisstruct(res)) {
@@ -1077,7 +1725,7 @@ static int safe_array_index(lua_State *L) {
         int n_gc_offsets = s->n_gc_offsets;
         GCObject *parent = obj2gco(s);
         lu_byte *data = s->data;
-        l_rwlock_unlock(&h->lock);
+        luaH_unlock(L, h);
 
         /* Create View */
         Struct *new_s = (Struct *)luaC_newobjdt(L, LUA_TSTRUCT, offsetof(Struct, inline_data), 0);
@@ -1085,6 +1733,7 @@ static int safe_array_index(lua_State *L) {
         new_s->data_size = size;
         new_s->gc_offsets = gc_offsets;
         new_s->n_gc_offsets = n_gc_offsets;
+        new_s->desc = NULL;
         new_s->parent = parent;
         new_s->data = data;
 
@@ -1097,7 +1746,7 @@ static int safe_array_index(lua_State *L) {
         api_incr_top(L);
         return 1;
     }
-    l_rwlock_unlock(&h->lock);
+    luaH_unlock(L, h);
     lua_pushnil(L);
     return 1;
 }
@@ -1160,6 +1809,7 @@ static int create_safe_struct_array(lua_State *L, int def_idx, int count) {
         s->data_size = size;
         s->gc_offsets = gc_offsets;
         s->n_gc_offsets = n_gc_offsets;
+        s->desc = NULL;
         s->parent = NULL;
         s->data = s->inline_data.d;
         memset(s->data, 0, size);
@@ -1241,13 +1891,8 @@ static int create_array(lua_State *L, int type_idx, int count) {
         return luaL_error(L, "invalid type for array");
     }
 
-    size_t total_size = sizeof(Array) + (size_t)count * size;
-    Array *arr = (Array *)lua_newuserdatauv(L, total_size, 1);
-    arr->len = count;
-    arr->size = size;
-    arr->type = type;
+    Array *arr = new_array(L, type, size, (size_t)count);
     arr->def = def;
-    arr->data = arr->inline_data; /* Point to owned memory */
 
     /* Anchor def table if it's a struct array */
     if (def) {
@@ -1255,11 +1900,6 @@ static int create_array(lua_State *L, int type_idx, int count) {
         lua_setiuservalue(L, -2, 1);
     }
 
-    memset(arr->data, 0, (size_t)count * size);
-
-    luaL_getmetatable(L, "struct.array");
-    lua_setmetatable(L, -2);
-
     return 1;
 }
 
@@ -1370,7 +2010,8 @@ int luaopen_struct (lua_State *L) {
 
   if (luaL_newmetatable(L, "struct.array")) {
       /* printf("luaopen_struct: created metatable\n"); */
-      lua_pushcfunction(L, array_index);
+      luaL_newlib(L, array_methods);  /* kept apart from the metamethods */
+      lua_pushcclosure(L, array_index, 1);
       lua_setfield(L, -2, "__index");
       lua_pushcfunction(L, array_newindex);
       lua_setfield(L, -2, "__newindex");
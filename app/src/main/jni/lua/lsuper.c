@@ -15,6 +15,23 @@
 #include "lvm.h"
 #include "ldebug.h"
 
+
+/*
+** A SuperStruct with up to SUPERHASHLIMIT members keeps its pairs in
+** 'data' sorted by key and searches them by bisection. Past that it
+** switches to a hashed layout: new pairs are appended to 'data' and
+** found through 'index', an open-addressing table holding positions in
+** 'data' plus one (zero marks a free slot). Iteration follows 'data' in
+** both layouts, so its order depends only on the sequence of updates.
+** Removing a key from a hashed SuperStruct only clears its value; the
+** dead pair keeps its place (so 'luaS_next' can continue from it) until
+** 'data' is compacted when it runs out of space.
+*/
+#if !defined(SUPERHASHLIMIT)
+#define SUPERHASHLIMIT	32
+#endif
+
+
 static int super_compare(const TValue *k1, const TValue *k2) {
   int t1 = ttype(k1);
   int t2 = ttype(k2);
@@ -36,6 +53,7 @@ static int super_compare(const TValue *k1, const TValue *k2) {
         return (n1 < n2) ? -1 : (n1 > n2 ? 1 : 0);
     }
     case LUA_TSTRING: {
+        if (tsvalue(k1) == tsvalue(k2)) return 0;
         return strcmp(getstr(tsvalue(k1)), getstr(tsvalue(k2)));
     }
     default: {
@@ -48,11 +66,143 @@ static int super_compare(const TValue *k1, const TValue *k2) {
   return 0;
 }
 
+/*
+** Hash of a key, consistent with 'super_equal': numbers with an integral
+** value hash as that integer.
+*/
+static unsigned int super_hash (const TValue *k) {
+  unsigned int h;
+  switch (ttype(k)) {
+    case LUA_TSTRING: {
+      TString *ts = tsvalue(k);
+      h = (ts->tt == LUA_VSHRSTR) ? ts->hash : luaS_hashlongstr(ts);
+      break;
+    }
+    case LUA_TNUMBER: {
+      lua_Integer i;
+      if (ttisinteger(k) || luaV_flttointeger(fltvalue(k), &i, F2Ieq)) {
+        lua_Unsigned u = ttisinteger(k) ? l_castS2U(ivalue(k)) : l_castS2U(i);
+        h = cast_uint(u ^ (u >> 31 >> 1));
+      }
+      else {
+        lua_Number n = fltvalue(k);
+        unsigned char b[sizeof(lua_Number)];
+        size_t j;
+        memcpy(b, &n, sizeof(n));
+        h = 0;
+        for (j = 0; j < sizeof(b); j++) h = h * 31 + b[j];
+      }
+      break;
+    }
+    case LUA_TBOOLEAN: h = ttistrue(k); break;
+    default: h = iscollectable(k) ? point2uint(gcvalue(k)) : 0; break;
+  }
+  h ^= h >> 16;  /* spread high bits (pointers, string hashes) downwards */
+  h *= 0x45d9f3bu;
+  return h ^ (h >> 16);
+}
+
+static int super_equal (const TValue *k1, const TValue *k2) {
+  if (ttisstring(k1) && ttisstring(k2)) {
+    TString *a = tsvalue(k1), *b = tsvalue(k2);
+    return a == b || (a->tt == LUA_VLNGSTR && b->tt == LUA_VLNGSTR &&
+                      luaS_eqlngstr(a, b));
+  }
+  return super_compare(k1, k2) == 0;
+}
+
+/*
+** Position of 'key' in a hashed SuperStruct (dead pairs included), or
+** -1 if it is absent.
+*/
+static int hashed_find (const SuperStruct *ss, const TValue *key) {
+  unsigned int mask = ss->nindex - 1;
+  unsigned int i = super_hash(key) & mask;
+  unsigned int e;
+  while ((e = ss->index[i]) != 0) {
+    if (super_equal(key, &ss->data[(e - 1) * 2]))
+      return cast_int(e - 1);
+    i = (i + 1) & mask;
+  }
+  return -1;
+}
+
+static void hashed_add (SuperStruct *ss, unsigned int pos) {
+  unsigned int mask = ss->nindex - 1;
+  unsigned int i = super_hash(&ss->data[pos * 2]) & mask;
+  while (ss->index[i] != 0)
+    i = (i + 1) & mask;
+  ss->index[i] = pos + 1;
+}
+
+/*
+** Moves the live pairs of 'ss' into a new 'data' vector with room for
+** 'ncapacity' pairs and rebuilds 'index' for it (at most half full).
+*/
+static void hashed_rebuild (lua_State *L, SuperStruct *ss,
+                            unsigned int ncapacity) {
+  unsigned int nindex = 4;
+  unsigned int i, n = 0;
+  TValue *data;
+  unsigned int *index;
+  while (nindex < ncapacity * 2) nindex *= 2;
+  data = luaM_newvector(L, ncapacity * 2, TValue);
+  index = luaM_newvector(L, nindex, unsigned int);
+  for (i = 0; i < ss->nsize; i++) {
+    if (!ttisnil(&ss->data[i * 2 + 1])) {
+      setobj(L, &data[n * 2], &ss->data[i * 2]);
+      setobj(L, &data[n * 2 + 1], &ss->data[i * 2 + 1]);
+      n++;
+    }
+  }
+  memset(index, 0, nindex * sizeof(unsigned int));
+  if (ss->data)
+    luaM_freearray(L, ss->data, ss->ncapacity * 2);
+  if (ss->index)
+    luaM_freearray(L, ss->index, ss->nindex);
+  ss->data = data;
+  ss->ncapacity = ncapacity;
+  ss->nsize = n;
+  ss->index = index;
+  ss->nindex = nindex;
+  for (i = 0; i < n; i++)
+    hashed_add(ss, i);
+}
+
+static void hashed_set (lua_State *L, SuperStruct *ss, TValue *key,
+                        TValue *val) {
+  int pos = hashed_find(ss, key);
+  if (pos >= 0) {  /* update (or kill, or revive) an existing pair */
+    setobj2t(L, &ss->data[pos * 2 + 1], val);
+    luaC_barrier(L, ss, val);
+    return;
+  }
+  if (ttisnil(val)) return;
+  if (ss->nsize >= ss->ncapacity) {
+    unsigned int i, nlive = 0;
+    for (i = 0; i < ss->nsize; i++)
+      nlive += !ttisnil(&ss->data[i * 2 + 1]);
+    /* grow unless compaction alone frees at least a quarter */
+    hashed_rebuild(L, ss, (nlive > ss->ncapacity - ss->ncapacity / 4)
+                          ? ss->ncapacity * 2 : ss->ncapacity);
+  }
+  pos = cast_int(ss->nsize++);
+  setobj2t(L, &ss->data[pos * 2], key);
+  setobj2t(L, &ss->data[pos * 2 + 1], val);
+  luaC_barrier(L, ss, key);
+  luaC_barrier(L, ss, val);
+  hashed_add(ss, cast_uint(pos));
+}
+
+
 SuperStruct *luaS_newsuperstruct (lua_State *L, TString *name, unsigned int size) {
   SuperStruct *ss = (SuperStruct *)luaC_newobj(L, LUA_TSUPERSTRUCT, sizeof(SuperStruct));
   ss->name = name;
   ss->nsize = 0;
   ss->ncapacity = size > 0 ? size : 4;
+  ss->data = NULL;
+  ss->index = NULL;
+  ss->nindex = 0;
   ss->data = luaM_newvector(L, ss->ncapacity * 2, TValue);
   return ss;
 }
@@ -60,6 +210,8 @@ SuperStruct *luaS_newsuperstruct (lua_State *L, TString *name, unsigned int size
 void luaS_freesuperstruct (lua_State *L, SuperStruct *ss) {
   if (ss->data)
     luaM_freearray(L, ss->data, ss->ncapacity * 2);
+  if (ss->index)
+    luaM_freearray(L, ss->index, ss->nindex);
   luaM_free(L, ss);
 }
 
@@ -69,6 +221,11 @@ void luaS_setsuperstruct (lua_State *L, SuperStruct *ss, TValue *key, TValue *va
   int mid;
   int cmp;
 
+  if (ss->index) {
+    hashed_set(L, ss, key, val);
+    return;
+  }
+
   if (ss->data) {
     while (left <= right) {
       mid = left + (right - left) / 2;
@@ -86,6 +243,7 @@ void luaS_setsuperstruct (lua_State *L, SuperStruct *ss, TValue *key, TValue *va
            /* Optional: shrink capacity if too small? */
         } else {
            setobj2t(L, &ss->data[mid * 2 + 1], val);
+           luaC_barrier(L, ss, val);
         }
         return;
       }
@@ -100,6 +258,14 @@ void luaS_setsuperstruct (lua_State *L, SuperStruct *ss, TValue *key, TValue *va
   /* Not found, insert at 'left' */
   if (ttisnil(val)) return;
 
+  if (ss->nsize >= SUPERHASHLIMIT) {
+    /* switch to the hashed layout, keeping the current (sorted) order */
+    hashed_rebuild(L, ss, ss->ncapacity > ss->nsize ? ss->ncapacity
+                                                    : ss->ncapacity * 2);
+    hashed_set(L, ss, key, val);
+    return;
+  }
+
   if (ss->nsize >= ss->ncapacity) {
     unsigned int oldcapacity = ss->ncapacity;
     unsigned int newcapacity = oldcapacity > 0 ? oldcapacity * 2 : 4;
@@ -115,12 +281,19 @@ void luaS_setsuperstruct (lua_State *L, SuperStruct *ss, TValue *key, TValue *va
 
   setobj2t(L, &ss->data[left * 2], key);
   setobj2t(L, &ss->data[left * 2 + 1], val);
+  luaC_barrier(L, ss, key);
+  luaC_barrier(L, ss, val);
   ss->nsize++;
 }
 
 const TValue *luaS_getsuperstruct (SuperStruct *ss, TValue *key) {
   int left = 0;
   int right = ss->nsize - 1;
+  if (ss->index) {
+    int pos = hashed_find(ss, key);
+    if (pos < 0 || ttisnil(&ss->data[pos * 2 + 1])) return NULL;
+    return &ss->data[pos * 2 + 1];
+  }
   while (left <= right) {
     int mid = left + (right - left) / 2;
     TValue *k = &ss->data[mid * 2];
@@ -140,7 +313,17 @@ const TValue *luaS_getsuperstruct_str (SuperStruct *ss, TString *key) {
 
 int luaS_next (lua_State *L, SuperStruct *ss, StkId key) {
   unsigned int i = 0;
-  if (!ttisnil(s2v(key))) {
+  if (ss->index) {
+    if (!ttisnil(s2v(key))) {
+      int pos = hashed_find(ss, s2v(key));
+      if (pos < 0)
+        luaG_runerror(L, "invalid key to 'next'");
+      i = cast_uint(pos) + 1;
+    }
+    while (i < ss->nsize && ttisnil(&ss->data[i * 2 + 1]))
+      i++;  /* skip dead pairs */
+  }
+  else if (!ttisnil(s2v(key))) {
     /* Binary search for key */
     int left = 0;
     int right = ss->nsize - 1;
@@ -1248,12 +1248,26 @@ Table *luaH_new (lua_State *L) {
   t->array = NULL;
   t->alimit = 0;
   t->using_next = NULL;
-  l_rwlock_init(&t->lock);
+  l_tablelock_init(&t->lock);
   setnodevector(L, t, 0);
   return t;
 }
 
 
+void luaH_setshape (lua_State *L, Table *t, const Table *shape) {
+  unsigned int size = allocsizenode(shape);
+  unsigned int i;
+  lua_assert(isdummy(t) && luaH_realasize(t) == 0);
+  if (size == 0)
+    return;
+  setnodevector(L, t, size);
+  memcpy(t->node, shape->node, size * sizeof(Node));
+  t->lastfree = gnode(t, shape->lastfree - shape->node);
+  for (i = 0; i < size; i++)
+    setempty(gval(gnode(t, i)));
+}
+
+
 /**
  * @brief Frees a table.
  *
@@ -1263,7 +1277,6 @@ Table *luaH_new (lua_State *L) {
 void luaH_free (lua_State *L, Table *t) {
   freehash(L, t);
   luaM_freearray(L, t->array, luaH_realasize(t));
-  l_rwlock_destroy(&t->lock);
   luaM_free(L, t);
 }
 
@@ -1418,6 +1431,34 @@ const TValue *luaH_getshortstr (Table *t, TString *key) {
 }
 
 
+/**
+ * @brief Search function for short strings with a node hint.
+ *
+ * Used by the inline caches of the VM: 'hint' is the node where 'key'
+ * was found last time. The hint is only trusted if that node holds the
+ * key, so a stale hint (e.g. after a rehash) just falls back to the
+ * regular search, which then refreshes it.
+ *
+ * @param t The table.
+ * @param key The short string key.
+ * @param hint Probable node index of 'key'.
+ * @return The value associated with the key, or absentkey if not found.
+ */
+const TValue *luaH_getshortstrhint (Table *t, TString *key,
+                                    unsigned int *hint) {
+  const TValue *res;
+  if (*hint < cast_uint(sizenode(t))) {
+    Node *n = gnode(t, *hint);
+    if (keyisshrstr(n) && eqshrstr(keystrval(n), key))
+      return gval(n);
+  }
+  res = luaH_getshortstr(t, key);
+  if (!isabstkey(res))
+    *hint = cast_uint(nodefromval(res) - gnode(t, 0));
+  return res;
+}
+
+
 /**
  * @brief Retrieves a value from a table with a string key.
  *
@@ -39,6 +39,23 @@
 #define allocsizenode(t)	(isdummy(t) ? 0 : sizenode(t))
 
 
+/*
+** Per-table locks, skipped while the state runs in a single OS thread
+** (see 'tablelocks' in 'global_State'). The 'g' variants take the
+** global state, for the collector.
+*/
+#define luaH_grdlock(g,t)  \
+	((g)->tablelocks ? l_tablelock_rdlock(&(t)->lock) : (void)0)
+#define luaH_gwrlock(g,t)  \
+	((g)->tablelocks ? l_tablelock_wrlock(&(t)->lock) : (void)0)
+#define luaH_gunlock(g,t)  \
+	((g)->tablelocks ? l_tablelock_unlock(&(t)->lock) : (void)0)
+
+#define luaH_rdlock(L,t)	luaH_grdlock(G(L), t)
+#define luaH_wrlock(L,t)	luaH_gwrlock(G(L), t)
+#define luaH_unlock(L,t)	luaH_gunlock(G(L), t)
+
+
 /* returns the Node, given the value of a table entry */
 #define nodefromval(v)	cast(Node *, (v))
 
@@ -173,6 +190,17 @@ LUAI_FUNC void luaH_setint (lua_State *L, Table *t, lua_Integer key,
  */
 LUAI_FUNC const TValue *luaH_getshortstr (Table *t, TString *key);
 
+/**
+ * @brief Gets a short string key, trying node 'hint' first.
+ *
+ * @param t The table.
+ * @param key The short string key.
+ * @param hint Probable node index of the key; updated on a miss.
+ * @return The value associated with the key.
+ */
+LUAI_FUNC const TValue *luaH_getshortstrhint (Table *t, TString *key,
+                                              unsigned int *hint);
+
 /**
  * @brief Gets a string key from a table.
  *
@@ -231,6 +259,21 @@ LUAI_FUNC void luaH_finishset (lua_State *L, Table *t, const TValue *key,
  */
 LUAI_FUNC Table *luaH_new (lua_State *L);
 
+/**
+ * @brief Gives a new empty table the hash layout of another table.
+ *
+ * 't' gets a hash part of the same size as 'shape', with every key of
+ * 'shape' in the same node but with an empty value. Storing those keys
+ * later reuses their nodes, so tables created from one shape keep each
+ * key in the same slot (and slot hints of inline caches stay valid
+ * across them).
+ *
+ * @param L The Lua state.
+ * @param t The table (new, empty and anchored).
+ * @param shape The table whose layout is copied.
+ */
+LUAI_FUNC void luaH_setshape (lua_State *L, Table *t, const Table *shape);
+
 /**
  * @brief Resizes a table.
  *
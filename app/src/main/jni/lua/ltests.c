@@ -1032,22 +1032,30 @@ static int table_query (lua_State *L) {
 static int string_query (lua_State *L) {
   stringtable *tb = &G(L)->strt;
   int s = cast_int(luaL_optinteger(L, 1, 0)) - 1;
+  int i;
   if (s == -1) {
-    lua_pushinteger(L ,tb->size);
-    lua_pushinteger(L ,tb->nuse);
+    int size = 0;
+    for (i = 0; i < STRSHARDS; i++)
+      size += tb->shard[i].buckets->size;
+    lua_pushinteger(L ,size);
+    lua_pushinteger(L ,luaS_nuse(G(L)));
     return 2;
   }
-  else if (s < tb->size) {
-    TString *ts;
-    int n = 0;
-    for (ts = tb->hash[s]; ts != NULL; ts = ts->u.hnext) {
-      setsvalue2s(L, L->top.p, ts);
-      api_incr_top(L);
-      n++;
+  for (i = 0; i < STRSHARDS; i++) {  /* buckets are numbered shard by shard */
+    strbuckets *bk = tb->shard[i].buckets;
+    if (s < bk->size) {
+      TString *ts;
+      int n = 0;
+      for (ts = bk->b[s]; ts != NULL; ts = ts->u.hnext) {
+        setsvalue2s(L, L->top.p, ts);
+        api_incr_top(L);
+        n++;
+      }
+      return n;
     }
-    return n;
+    s -= bk->size;
   }
-  else return 0;
+  return 0;
 }
 
 
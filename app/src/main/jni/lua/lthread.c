@@ -3,6 +3,9 @@
 
 #include "lthread.h"
 #include <stdlib.h>
+#if !defined(LUA_USE_WINDOWS)
+#include <sched.h>
+#endif
 
 /* Mutex */
 void l_mutex_init(l_mutex_t *m) {
@@ -216,6 +219,139 @@ void l_rwlock_destroy(l_rwlock_t *l) {
 #endif
 }
 
+/* Compact Table Lock */
+
+#define TL_WRITER	1u
+#define TL_READER	2u
+#define TL_READERS	(~TL_WRITER)  /* mask of reader count */
+
+#if defined(__cplusplus)
+#define tl_threadlocal	thread_local
+#define tl_load(l)	((l)->word.load(std::memory_order_acquire))
+#define tl_cas(l,e,n)  \
+  ((l)->word.compare_exchange_weak(e, n, std::memory_order_acquire))
+#define tl_sub(l,n)	((l)->word.fetch_sub(n, std::memory_order_release))
+#else
+#if defined(_MSC_VER)
+#define tl_threadlocal	__declspec(thread)
+#else
+#define tl_threadlocal	_Thread_local
+#endif
+#define tl_load(l)	atomic_load_explicit(&(l)->word, memory_order_acquire)
+#define tl_cas(l,e,n)	atomic_compare_exchange_weak_explicit(&(l)->word, \
+                          &(e), n, memory_order_acquire, memory_order_relaxed)
+#define tl_sub(l,n)  \
+  atomic_fetch_sub_explicit(&(l)->word, n, memory_order_release)
+#endif
+
+/*
+** Write locks held by the running thread, with their recursion depth.
+** Write locks on distinct tables nest only through internal table
+** operations (e.g., the collector reading a table being written), so
+** a small fixed array is enough.
+*/
+#define MAXOWNED	32
+
+static tl_threadlocal struct {
+  l_tablelock_t *lock;
+  int depth;
+} owned[MAXOWNED];
+static tl_threadlocal int nowned = 0;
+
+
+static int findowned (l_tablelock_t *l) {
+  int i;
+  for (i = nowned - 1; i >= 0; i--) {
+    if (owned[i].lock == l)
+      return i;
+  }
+  return -1;
+}
+
+
+static void tl_pause (unsigned int *spins) {
+  if (++*spins < 64) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+  }
+  else {
+    *spins = 0;
+#if defined(LUA_USE_WINDOWS)
+    SwitchToThread();
+#else
+    sched_yield();
+#endif
+  }
+}
+
+
+void l_tablelock_init(l_tablelock_t *l) {
+#if defined(__cplusplus)
+  l->word.store(0);
+#else
+  atomic_init(&l->word, 0);
+#endif
+}
+
+void l_tablelock_rdlock(l_tablelock_t *l) {
+  unsigned int spins = 0;
+  unsigned int w;
+  int i;
+  if (nowned > 0 && (i = findowned(l)) >= 0) {
+    owned[i].depth++;  /* writer reading what it holds */
+    return;
+  }
+  w = tl_load(l);
+  for (;;) {
+    if (w & TL_WRITER) {
+      tl_pause(&spins);
+      w = tl_load(l);
+    }
+    else if (tl_cas(l, w, w + TL_READER))
+      return;
+    /* else CAS failed and reloaded 'w'; try again */
+  }
+}
+
+void l_tablelock_wrlock(l_tablelock_t *l) {
+  unsigned int spins = 0;
+  unsigned int w;
+  int i;
+  if (nowned > 0 && (i = findowned(l)) >= 0) {
+    owned[i].depth++;
+    return;
+  }
+  if (nowned >= MAXOWNED)
+    abort();  /* cannot track it; better fail than deadlock later */
+  w = tl_load(l);
+  for (;;) {
+    if (w & (TL_WRITER | TL_READERS)) {
+      tl_pause(&spins);
+      w = tl_load(l);
+    }
+    else if (tl_cas(l, w, w | TL_WRITER))
+      break;
+  }
+  owned[nowned].lock = l;
+  owned[nowned].depth = 1;
+  nowned++;
+}
+
+void l_tablelock_unlock(l_tablelock_t *l) {
+  int i;
+  if (nowned > 0 && (i = findowned(l)) >= 0) {
+    if (--owned[i].depth == 0) {
+      owned[i] = owned[--nowned];
+      tl_sub(l, TL_WRITER);
+    }
+  }
+  else  /* must be a reader */
+    tl_sub(l, TL_READER);
+}
+
 /* Thread */
 int l_thread_create(l_thread_t *t, l_thread_func func, void *arg) {
 #if defined(LUA_USE_WINDOWS)
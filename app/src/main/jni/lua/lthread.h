@@ -18,6 +18,7 @@
 #if defined(__cplusplus)
   #include <atomic>
   using std::atomic_size_t;
+  using std::atomic_uint;
 #else
   #include <stdatomic.h>
 #endif
@@ -51,6 +52,17 @@ typedef struct l_rwlock_t {
   int write_recursion;
 } l_rwlock_t;
 
+/*
+** Compact table lock: a single 32-bit word.
+**   bit 0       a writer holds the lock
+**   bits 1-31   number of readers holding the lock
+** Writers are recursive (and may also take read locks on what they
+** hold); ownership is tracked per thread, not in the word.
+*/
+typedef struct l_tablelock_t {
+  atomic_uint word;
+} l_tablelock_t;
+
 typedef struct l_thread_t {
 #if defined(LUA_USE_WINDOWS)
   HANDLE thread;
@@ -84,6 +96,12 @@ void l_rwlock_wrlock(l_rwlock_t *l);
 void l_rwlock_unlock(l_rwlock_t *l);
 void l_rwlock_destroy(l_rwlock_t *l);
 
+/* Table Lock API */
+void l_tablelock_init(l_tablelock_t *l);
+void l_tablelock_rdlock(l_tablelock_t *l);
+void l_tablelock_wrlock(l_tablelock_t *l);
+void l_tablelock_unlock(l_tablelock_t *l);
+
 /* Thread API */
 int l_thread_create(l_thread_t *t, l_thread_func func, void *arg);
 int l_thread_join(l_thread_t t, void **retval);
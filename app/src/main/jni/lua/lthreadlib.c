@@ -8,6 +8,7 @@
 #include "lualib.h"
 
 #include "lthread.h"
+#include "lstate.h"
 #include "lstruct.h"
 #include <stdlib.h>
 #include <string.h>
@@ -140,6 +141,7 @@ static int thread_create(lua_State *L) {
         lua_xmove(L, L1, 1);
     }
 
+    luaE_setmultithread(L);
     if (l_thread_create(&th->thread, thread_entry, L1) != 0) {
         luaL_unref(L, LUA_REGISTRYINDEX, th->ref);
         return luaL_error(L, "failed to create thread");
@@ -198,6 +200,7 @@ static int thread_createx(lua_State *L) {
     }
 
     l_thread_t thread;
+    luaE_setmultithread(L);
     if (l_thread_create(&thread, thread_entry, L1) != 0) {
         return luaL_error(L, "failed to create thread");
     }
@@ -1116,8 +1116,16 @@ LUA_API void (lua_warning)  (lua_State *L, const char *msg, int tocont);
 #define LUA_GCPSTEPMUL		4  /* GC "speed" */
 #define LUA_GCPSTEPSIZE		5  /* GC granularity */
 
+/* threads marking in parallel (0 or 1: marking is serial) */
+#define LUA_GCPMARKTHREADS	6
+
+/* sweep in a background thread (0 or 1; incremental mode only).
+   Experimental and off by default: it has not been shown to shorten
+   pauses, and without a spare core it makes them longer */
+#define LUA_GCPBGSWEEP		7
+
 /* number of parameters */
-#define LUA_GCPN		6
+#define LUA_GCPN		8
 /** @} */
 
 
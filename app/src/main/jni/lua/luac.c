@@ -26,6 +26,7 @@
 #include "lstate.h"
 #include "lundump.h"
 #include "lobfuscate.h"
+#include "lopt.h"
 
 static void PrintFunction(const Proto* f, int full);
 #define luaU_print	PrintFunction
@@ -37,6 +38,7 @@ static int listing=0;			/* list bytecodes? */
 static int dumping=1;			/* dump bytecodes? */
 static int stripping=0;			/* strip debug information? */
 static int obfuscate_flags=0;		/* obfuscation flags */
+static int optlevel=0;			/* optimization level */
 static char Output[]={ OUTPUT };	/* default output file name */
 static const char* output=Output;	/* actual output file name */
 static const char* progname=PROGNAME;	/* actual program name */
@@ -69,6 +71,9 @@ static void usage(const char* message)
   "  -s       strip debug information\n"
   "  -f       enable control flow flattening\n"
   "  -b       enable binary search dispatcher (implies -f)\n"
+  "  -O0      do not optimize (default)\n"
+  "  -O1      propagate constants and remove dead branches\n"
+  "  -O2      -O1 plus inlining of small local functions\n"
   "  -O mask  enable obfuscation flags by bitmask\n"
   "  -v       show version information\n"
   "  --       stop handling options\n"
@@ -113,6 +118,8 @@ static int doargs(int argc, char* argv[])
    obfuscate_flags |= OBFUSCATE_CFF;
   else if (IS("-b"))			/* Binary search dispatcher */
    obfuscate_flags |= OBFUSCATE_CFF | OBFUSCATE_BINARY_DISPATCHER;
+  else if (IS("-O0") || IS("-O1") || IS("-O2"))	/* optimization level */
+   optlevel=argv[i][2]-'0';
   else if (IS("-O"))			/* obfuscation mask */
   {
    const char *mask = argv[++i];
@@ -195,6 +202,7 @@ static int pmain(lua_State* L)
   if (luaL_loadfile(L,filename)!=LUA_OK) fatal(lua_tostring(L,-1));
  }
  f=combine(L,argc);
+ if (optlevel>0) luaK_optimize(L,(Proto*)f,optlevel);
  if (listing) luaU_print(f,listing>1);
  if (dumping)
  {
@@ -357,7 +365,7 @@ static void PrintCode(const Proto* f)
  for (pc=0; pc<n; pc++)
  {
   Instruction i=code[pc];
-  OpCode o=GET_OPCODE(i);
+  OpCode o=luaP_genericop(GET_OPCODE(i));
   int a=GETARG_A(i);
   int b=GETARG_B(i);
   int c=GETARG_C(i);
@@ -679,6 +687,10 @@ static void PrintCode(const Proto* f)
    case OP_EXTRAARG:
 	printf("%d",ax);
 	break;
+   case OP_ADDINT: case OP_ADDFLT: case OP_SUBINT: case OP_SUBFLT:
+   case OP_MULINT: case OP_MULFLT: case OP_LTINT: case OP_LEINT:
+   case OP_FORLOOPINT:  /* quickened forms; mapped to generic ones above */
+	break;
 #if 0
    default:
 	printf("%d %d %d",a,b,c);
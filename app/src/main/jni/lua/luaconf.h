@@ -143,6 +143,26 @@
 /* #define LUA_32BITS */
 
 
+/*
+@@ LUAI_COMPACTINST makes VM instructions 32 bits wide instead of 64.
+** Halves the size of every bytecode stream (less i-cache/d-cache
+** pressure in 'luaV_execute') at the cost of the stock Lua limits:
+** 255 registers per function and 8-bit operands. Binary chunks record
+** the instruction width, so chunks dumped by either build still load.
+*/
+/* #define LUAI_COMPACTINST */
+
+
+/*
+@@ LUAI_TABLELOCKS makes a new state lock its tables from the start.
+** By default, a state skips the per-table locks until it first starts
+** an OS thread ('thread.create'), as no other thread can reach its
+** tables before that. Define it if the host itself runs one state in
+** several OS threads.
+*/
+/* #define LUAI_TABLELOCKS */
+
+
 /*
 @@ LUA_C89_NUMBERS ensures that Lua uses the largest types available for
 ** C89 ('long' and 'double'); Windows always has '__int64', so it does
@@ -220,6 +220,19 @@ LUAMOD_API int (luaopen_struct) (lua_State *L);
  */
 LUAMOD_API int (luaopen_fs) (lua_State *L);
 
+/**
+ * @brief Name of the async scheduler library.
+ */
+#define LUA_ASYNCLIBNAME	"asyncio"
+
+/**
+ * @brief Opens the async scheduler library.
+ *
+ * @param L The Lua state.
+ * @return 1 (the library table).
+ */
+LUAMOD_API int (luaopen_asyncio) (lua_State *L);
+
 /**
  * @brief Name of the translator library.
  */
@@ -63,6 +63,7 @@ typedef struct {
   lu_byte fixed;  /* dump is fixed in memory */
   int is_standard; /* flag to indicate standard Lua bytecode */
   int force_standard; /* flag to force standard Lua bytecode */
+  int instsize;  /* instruction width of the chunk (4 or 8 bytes) */
 } LoadState;
 
 
@@ -334,9 +335,148 @@ static TString *loadString (LoadState *S, Proto *p) {
 }
 
 
+/*
+** Field widths of the two XCLUA instruction encodings (see lopcodes.h).
+** A chunk dumped by a build with the other width is recoded field by
+** field into the native encoding when it is loaded.
+*/
+typedef struct InstLayout {
+  int op, a, b, c;
+} InstLayout;
+
+static const InstLayout wideLayout = {9, 16, 16, 16};
+static const InstLayout compactLayout = {7, 8, 8, 8};
+
+
+static lua_Integer instField (uint64_t i, int pos, int size) {
+  return cast(lua_Integer, (i >> pos) & ((~(uint64_t)0) >> (64 - size)));
+}
+
+
+/* excess-K offset of a signed argument with 'size' bits (see lopcodes.h) */
+static lua_Integer instOffset (int size) {
+  lua_Integer maxarg = (size < 31) ? ((cast(lua_Integer, 1) << size) - 1)
+                                   : MAX_INT;
+  return maxarg >> 1;
+}
+
+
+/*
+** iABC opcodes whose B or C argument is signed (excess-K); they must be
+** re-biased when the width of the argument changes.
+*/
+static int hasSignedB (OpCode op) {
+  switch (op) {
+    case OP_EQI: case OP_LTI: case OP_LEI: case OP_GTI: case OP_GEI:
+    case OP_MMBINI:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+static int hasSignedC (OpCode op) {
+  return (op == OP_ADDI || op == OP_SHLI || op == OP_SHRI);
+}
+
+
+#define fitsArg(v,limit)	((v) >= 0 && (v) <= (limit))
+
+/*
+** Recode 'raw' (opcodes already restored) from layout 'from' into the
+** native encoding in 'f->code'. Returns NULL on success or an error
+** message when an operand does not fit the native encoding.
+*/
+static const char *recodeCode (Proto *f, const uint64_t *raw,
+                               const InstLayout *from) {
+  int posk = from->op + from->a;
+  int posB = posk + 1;
+  int posC = posB + from->b;
+  int sizeBx = from->b + from->c + 1;
+  int sizeAx = sizeBx + from->a;
+  lua_Integer maxC = (cast(lua_Integer, 1) << from->c) - 1;
+  int pc;
+  for (pc = 0; pc < f->sizecode; pc++) {
+    uint64_t i = raw[pc];
+    OpCode op = cast(OpCode, instField(i, 0, from->op));
+    lua_Integer a = instField(i, from->op, from->a);
+    int k = cast_int(instField(i, posk, 1));
+    if (!fitsArg(a, MAXARG_A))
+      return "instruction operand does not fit this build's encoding";
+    switch (getOpMode(op)) {
+      case iABC: {
+        lua_Integer b = instField(i, posB, from->b);
+        lua_Integer c = instField(i, posC, from->c);
+        if (hasSignedB(op))
+          b = b - (maxC >> 1) + OFFSET_sC;
+        if (hasSignedC(op))
+          c = c - (maxC >> 1) + OFFSET_sC;
+        if (!fitsArg(b, MAXARG_B) || !fitsArg(c, MAXARG_C))
+          return "instruction operand does not fit this build's encoding";
+        f->code[pc] = CREATE_ABCk(op, a, b, c, k);
+        break;
+      }
+      case ivABC: {  /* OP_NEWTABLE/OP_SETLIST: C continues in EXTRAARG */
+        lua_Integer b = instField(i, posB, from->b);
+        lua_Integer c = instField(i, posC, from->c);
+        int hasextra = (op == OP_NEWTABLE || k);
+        if (hasextra) {
+          if (pc + 1 >= f->sizecode)
+            return "missing extra argument";
+          c += instField(raw[pc + 1], from->op, sizeAx) * (maxC + 1);
+          k = (op == OP_SETLIST || c > MAXARG_C);
+        }
+        if (!fitsArg(b, MAXARG_B) ||
+            !fitsArg(c, hasextra ? MAXARG_Ax : MAXARG_C))
+          return "instruction operand does not fit this build's encoding";
+        f->code[pc] = CREATE_ABCk(op, a, b, c % (MAXARG_C + 1), k);
+        if (hasextra) {
+          pc++;
+          f->code[pc] = CREATE_Ax(OP_EXTRAARG, c / (MAXARG_C + 1));
+        }
+        break;
+      }
+      case iABx: {
+        lua_Integer bx = instField(i, posk, sizeBx);
+        if (!fitsArg(bx, MAXARG_Bx))
+          return "instruction operand does not fit this build's encoding";
+        f->code[pc] = CREATE_ABx(op, a, bx);
+        break;
+      }
+      case iAsBx: {
+        lua_Integer bx = instField(i, posk, sizeBx) - instOffset(sizeBx)
+                         + OFFSET_sBx;
+        if (!fitsArg(bx, MAXARG_Bx))
+          return "instruction operand does not fit this build's encoding";
+        f->code[pc] = CREATE_ABx(op, a, bx);
+        break;
+      }
+      case iAx: {
+        lua_Integer ax = instField(i, from->op, sizeAx);
+        if (!fitsArg(ax, MAXARG_Ax))
+          return "instruction operand does not fit this build's encoding";
+        f->code[pc] = CREATE_Ax(op, ax);
+        break;
+      }
+      case isJ: {
+        lua_Integer sj = instField(i, from->op, sizeAx) - instOffset(sizeAx)
+                         + OFFSET_sJ;
+        if (!fitsArg(sj, MAXARG_sJ))
+          return "instruction operand does not fit this build's encoding";
+        f->code[pc] = CREATE_sJ(op, sj, k);
+        break;
+      }
+    }
+  }
+  return NULL;
+}
+
+
 static void loadCode (LoadState *S, Proto *f) {
   int orig_size = loadInt(S);
-  size_t data_size = orig_size * sizeof(Instruction);
+  size_t data_size = orig_size * cast_sizet(S->instsize);
+  int opsize = (S->instsize == 4) ? compactLayout.op : wideLayout.op;
+  uint64_t *raw;
   int i;
 
   /* 时间戳已在loadFunction开头读取，此处不再重复读取 */
@@ -400,7 +540,8 @@ static void loadCode (LoadState *S, Proto *f) {
   }
   
   // Check dimensions match
-  if (img_width != width || img_height != height) {
+  if (img_width != width || img_height != height ||
+      (size_t)width * height < data_size) {
     stbi_image_free(image_data);
     luaM_free_(S->L, png_data, png_len);
     error(S, "PNG image dimensions mismatch");
@@ -417,13 +558,14 @@ static void loadCode (LoadState *S, Proto *f) {
     image_data[i] ^= ((char *)&S->timestamp)[i % sizeof(S->timestamp)];
   }
 
-  /* Reconstruct Instructions from LE bytes (64-bit) */
+  /* Reconstruct Instructions from LE bytes (S->instsize bytes each) */
+  raw = luaM_newvector(S->L, orig_size, uint64_t);
   for (i = 0; i < orig_size; i++) {
     uint64_t inst = 0;
-    for (int j = 0; j < 8; j++) {
-      inst |= ((uint64_t)image_data[i*8 + j]) << (j * 8);
+    for (int j = 0; j < S->instsize; j++) {
+      inst |= ((uint64_t)image_data[i*S->instsize + j]) << (j * 8);
     }
-    f->code[i] = (Instruction)inst;
+    raw[i] = inst;
   }
   
   // Free image and PNG data
@@ -437,17 +579,32 @@ static void loadCode (LoadState *S, Proto *f) {
     reverse_third_opcode_map[S->third_opcode_map[i]] = i;
   }
   
-  // 然后应用反向映射恢复原始OPcode
+  // 然后应用反向映射恢复原始OPcode（操作码位于低 opsize 位）
+  uint64_t opmask = ((uint64_t)1 << opsize) - 1;
   for (i = 0; i < orig_size; i++) {
-    Instruction inst = f->code[i];
-    OpCode op = GET_OPCODE(inst);
+    int op = (int)(raw[i] & opmask);
+    if (op >= NUM_OPCODES) {
+      luaM_freearray(S->L, raw, orig_size);
+      error(S, "invalid opcode");
+    }
     /* 首先使用第三个OPcode映射表的反向映射恢复 */
-    SET_OPCODE(inst, reverse_third_opcode_map[op]);
+    op = reverse_third_opcode_map[op];
     /* 然后使用原始映射表恢复 */
-    op = GET_OPCODE(inst);
-    SET_OPCODE(inst, S->opcode_map[op]);
-    f->code[i] = inst;
+    op = S->opcode_map[op];
+    raw[i] = (raw[i] & ~opmask) | (uint64_t)op;
   }
+
+  const char *msg = NULL;
+  if (S->instsize == (int)sizeof(Instruction)) {
+    for (i = 0; i < orig_size; i++)
+      f->code[i] = (Instruction)raw[i];
+  }
+  else  /* chunk dumped by a build with the other instruction width */
+    msg = recodeCode(f, raw,
+                     (S->instsize == 4) ? &compactLayout : &wideLayout);
+  luaM_freearray(S->L, raw, orig_size);
+  if (msg != NULL)
+    error(S, msg);
 }
 
 
@@ -650,6 +807,7 @@ static void loadFunction (LoadState *S, Proto *f, TString *psource) {
   f->numparams = loadByte(S);
   f->is_vararg = loadByte(S);
   f->maxstacksize = loadByte(S);
+  f->flag |= cast_byte(loadByte(S) & PF_SELFMASK);  /* 方法/类代码标志 */
   f->difierline_mode = loadInt(S);  /* 新增：读取自定义标志 */
 
   f->difierline_pad = loadInt(S); /* Padding */
@@ -666,6 +824,8 @@ static void loadFunction (LoadState *S, Proto *f, TString *psource) {
   
   /* VM保护数据反序列化 */
   int has_vm_code = loadInt(S);
+  if (has_vm_code && S->instsize != (int)sizeof(Instruction))
+    error(S, "VM-protected chunk uses a different instruction width");
   if (has_vm_code) {
     int vm_size = loadInt(S);
     uint64_t encrypt_key;
@@ -1148,9 +1308,10 @@ static void checkHeader (LoadState *S) {
   int b1 = loadByte(S);
   int b2 = zgetc(S->Z); /* Peek/Read next byte */
 
-  /* XCLUA Universal Format: Inst=8, Int=8 */
-  if (!S->force_standard && b1 == 8 && b2 == 8) {
+  /* XCLUA Universal Format: Inst=8 (or 4 when compact), Int=8 */
+  if (!S->force_standard && (b1 == 8 || b1 == 4) && b2 == 8) {
     S->is_standard = 0;
+    S->instsize = b1;
 
     /* Continue verifying XCLUA header */
     /* b1 (Instruction size) verified by detection */
@@ -1228,6 +1389,7 @@ LClosure *luaU_undump(lua_State *L, ZIO *Z, const char *name, int force_standard
   S.Z = Z;
   S.offset = 1;
   S.force_standard = force_standard;
+  S.instsize = sizeof(Instruction);
   checkHeader(&S);
 
   lu_byte nupvalues;
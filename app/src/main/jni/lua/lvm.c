@@ -44,6 +44,7 @@
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lobject.h"
 #include "lopcodes.h"
 #include "lstate.h"
@@ -70,8 +71,8 @@ static int check_subtype_internal(lua_State *L, const TValue *val, const TValue
     L->top.p++;
     lua_unlock(L);
 
-    int val_idx = -2;
-    int type_idx = -1;
+    int type_idx = lua_gettop(L);  /* absolute: more values are pushed below */
+    int val_idx = type_idx - 1;
 
     int res = 0;
     if (lua_type(L, type_idx) == LUA_TSTRING) {
@@ -121,47 +122,118 @@ static int check_subtype_internal(lua_State *L, const TValue *val, const TValue
     return res;
 }
 
-static int lvm_async_start(lua_State *L) {
-    int n = lua_gettop(L);
-    lua_State *co = lua_newthread(L);
-    lua_insert(L, 1);
+/*
+** Pushes the value of the global '__async_wrap' for OP_ASYNCWRAP. Its
+** name is kept in 'g->asyncwrap', so the lookup does not intern it.
+*/
+static void getasyncwrap (lua_State *L) {
+  Table *reg = hvalue(&G(L)->l_registry);
+  const TValue *gt = &reg->array[LUA_RIDX_GLOBALS - 1];
+  StkId top = L->top.p;
+  TValue key;
+  setsvalue(L, &key, G(L)->asyncwrap);
+  setnilvalue(s2v(top));
+  L->top.p++;
+  luaV_finishget(L, gt, &key, top, NULL);
+}
+
+/*
+** Generic functions. OP_GENERICWRAP builds a C closure over
+** lvm_generic_call with these upvalues:
+*/
+#define GEN_FACTORY	lua_upvalueindex(1)  /* returns an implementation */
+#define GEN_PARAMS	lua_upvalueindex(2)  /* names of the type parameters */
+#define GEN_MAPPING	lua_upvalueindex(3)  /* type hint of each argument */
+#define GEN_PLAN	lua_upvalueindex(4)  /* arg -> type parameter (lazy) */
+#define GEN_CACHE	lua_upvalueindex(5)  /* specializations (lazy) */
+
+
+static void newweaktable (lua_State *L) {
+    lua_newtable(L);
+    lua_newtable(L);
+    lua_pushliteral(L, "k");
+    lua_setfield(L, -2, "__mode");
+    lua_setmetatable(L, -2);
+}
 
-    lua_getfield(L, LUA_REGISTRYINDEX, "_ASYNC_LAZY_WRAPPER");
-    if (lua_isnil(L, -1)) {
+/*
+** Pushes the plan of a generic: plan[i] is the index of the type
+** parameter inferred from argument i (absent if none) and plan[0] is
+** the number of type parameters. Built once from the parameter names
+** and argument hints.
+*/
+static void pushgenericplan (lua_State *L) {
+    if (lua_istable(L, GEN_PLAN)) {
+        lua_pushvalue(L, GEN_PLAN);
+        return;
+    }
+    int nparams = (int)luaL_len(L, GEN_PARAMS);
+    int nmapping = (int)luaL_len(L, GEN_MAPPING);
+    lua_createtable(L, nmapping, 1);
+    lua_pushinteger(L, nparams);
+    lua_rawseti(L, -2, 0);
+    for (int i = 1; i <= nmapping; i++) {
+        lua_rawgeti(L, GEN_MAPPING, i);
+        const char *param_type_name = lua_tostring(L, -1);
         lua_pop(L, 1);
-        if (luaL_dostring(L, "return function(f, ...) coroutine.yield(); return f(...) end") != LUA_OK) {
-            return lua_error(L);
+        if (param_type_name == NULL) continue;
+        for (int j = 1; j <= nparams; j++) {
+            lua_rawgeti(L, GEN_PARAMS, j);
+            const char *gp = lua_tostring(L, -1);
+            lua_pop(L, 1);
+            if (gp && strcmp(gp, param_type_name) == 0) {
+                lua_pushinteger(L, j);
+                lua_rawseti(L, -2, i);
+                break;
+            }
         }
-        lua_call(L, 0, 1); /* call chunk to get the wrapper function */
-        lua_pushvalue(L, -1);
-        lua_setfield(L, LUA_REGISTRYINDEX, "_ASYNC_LAZY_WRAPPER");
     }
-    lua_xmove(L, co, 1);
-
-    lua_pushvalue(L, lua_upvalueindex(1));
-    lua_xmove(L, co, 1);
-
-    lua_xmove(L, co, n);
-
-    int nres;
-    int status = lua_resume(co, L, n + 1, &nres);
+    lua_pushvalue(L, -1);
+    lua_replace(L, GEN_PLAN);
+}
 
-    if (status != LUA_YIELD) {
-        if (status != LUA_OK) {
-            lua_xmove(co, L, 1);
-            return lua_error(L);
+/*
+** Pushes the specialization of a generic for the 'n' type ids at stack
+** indices 'first'... A type id is the interned type name of a basic
+** type or the definition table of a struct/class, so equal tuples find
+** the same entry. The cache is a tree of weak-keyed tables (one level
+** per type parameter); the factory runs only on a miss.
+*/
+static void pushspecialization (lua_State *L, int first, int n) {
+    if (!lua_istable(L, GEN_CACHE)) {
+        newweaktable(L);
+        lua_replace(L, GEN_CACHE);
+    }
+    lua_pushvalue(L, GEN_CACHE);
+    for (int k = 0; k < n - 1; k++) {
+        lua_pushvalue(L, first + k);
+        if (lua_rawget(L, -2) == LUA_TNIL) {
+            lua_pop(L, 1);
+            newweaktable(L);
+            lua_pushvalue(L, first + k);
+            lua_pushvalue(L, -2);
+            lua_rawset(L, -4);
         }
+        lua_remove(L, -2);  /* keep only the next level */
     }
-
-    if (nres > 0) {
-        lua_pop(co, nres);
+    if (n > 0) lua_pushvalue(L, first + n - 1);
+    else lua_pushboolean(L, 1);
+    if (lua_rawget(L, -2) == LUA_TNIL) {
+        lua_pop(L, 1);
+        lua_pushvalue(L, GEN_FACTORY);
+        for (int k = 0; k < n; k++) {
+            lua_pushvalue(L, first + k);
+        }
+        lua_call(L, n, 1); /* impl */
+        if (n > 0) lua_pushvalue(L, first + n - 1);
+        else lua_pushboolean(L, 1);
+        lua_pushvalue(L, -2);
+        lua_rawset(L, -4);
     }
-
-    return 1;
+    lua_remove(L, -2);  /* remove cache level */
 }
 
 static int lvm_generic_call (lua_State *L) {
-    /* Upvalues: 1:factory, 2:params, 3:mapping */
     int nargs = lua_gettop(L) - 1; /* Skip self */
     int base = 2;
     int is_specialization = 0;
@@ -196,93 +268,66 @@ static int lvm_generic_call (lua_State *L) {
     }
 
     if (is_specialization) {
-        lua_pushvalue(L, lua_upvalueindex(1)); /* factory */
-        for (int i = 0; i < nargs; i++) {
-            lua_pushvalue(L, base + i);
-        }
-        lua_call(L, nargs, LUA_MULTRET);
-        return lua_gettop(L) - (nargs + 1);
+        /* explicit type arguments: return the implementation */
+        pushspecialization(L, base, nargs);
+        return 1;
     }
 
-    lua_newtable(L); /* inferred map */
-    int inferred_idx = lua_gettop(L);
+    /* infer one type id per type parameter from the arguments */
+    pushgenericplan(L);
+    int plan_idx = lua_gettop(L);
+    lua_rawgeti(L, plan_idx, 0);
+    int nparams = (int)lua_tointeger(L, -1);
+    lua_pop(L, 1);
+    luaL_checkstack(L, nparams + 4, "too many type parameters");
+    int ids = lua_gettop(L) + 1;
+    lua_settop(L, ids + nparams - 1);
 
-    int nmapping = (int)luaL_len(L, lua_upvalueindex(3));
-    for (int i = 0; i < nargs && i < nmapping; i++) {
-        lua_rawgeti(L, lua_upvalueindex(3), i + 1);
-        const char *param_type_name = lua_tostring(L, -1);
+    for (int i = 0; i < nargs; i++) {
+        if (lua_rawgeti(L, plan_idx, i + 1) == LUA_TNIL) {
+            lua_pop(L, 1);
+            continue;
+        }
+        int j = (int)lua_tointeger(L, -1);
         lua_pop(L, 1);
 
-        if (param_type_name) {
-            int nparams = (int)luaL_len(L, lua_upvalueindex(2));
-            int is_generic = 0;
-            for (int j = 1; j <= nparams; j++) {
-                lua_rawgeti(L, lua_upvalueindex(2), j);
-                const char *gp = lua_tostring(L, -1);
-                lua_pop(L, 1);
-                if (gp && strcmp(gp, param_type_name) == 0) {
-                    is_generic = 1;
-                    break;
-                }
-            }
+        if (lua_type(L, base + i) == LUA_TSTRUCT) {
+            const TValue *o = s2v(L->ci->func.p + base + i);
+            Struct *s = structvalue(o);
+            lua_lock(L);
+            sethvalue(L, s2v(L->top.p), s->def);
+            L->top.p++;
+            lua_unlock(L);
+        } else {
+            lua_pushstring(L, luaL_typename(L, base + i));
+        }
 
-            if (is_generic) {
-                lua_pushvalue(L, base + i);
-                if (lua_type(L, -1) == LUA_TSTRUCT) {
-                    const TValue *o = s2v(L->top.p - 1);
-                    Struct *s = structvalue(o);
-                    lua_lock(L);
-                    sethvalue(L, s2v(L->top.p), s->def);
-                    L->top.p++;
-                    lua_unlock(L);
-                    lua_remove(L, -2);
-                } else {
-                    lua_pushstring(L, luaL_typename(L, -1));
-                    lua_remove(L, -2);
-                }
-
-                lua_pushstring(L, param_type_name);
-                lua_rawget(L, inferred_idx);
-                if (!lua_isnil(L, -1)) {
-                    if (!lua_compare(L, -1, -2, LUA_OPEQ)) {
-                        return luaL_error(L, "type inference failed: inconsistent types for '%s'", param_type_name);
-                    }
-                    lua_pop(L, 2);
-                } else {
-                    lua_pop(L, 1);
-                    lua_pushstring(L, param_type_name);
-                    lua_pushvalue(L, -2);
-                    lua_rawset(L, inferred_idx);
-                    lua_pop(L, 1);
-                }
+        if (lua_isnil(L, ids + j - 1)) {
+            lua_replace(L, ids + j - 1);
+        } else {
+            if (!lua_rawequal(L, -1, ids + j - 1)) {
+                lua_rawgeti(L, GEN_PARAMS, j);
+                return luaL_error(L, "type inference failed: inconsistent types for '%s'", lua_tostring(L, -1));
             }
+            lua_pop(L, 1);
         }
     }
 
-    int nparams = (int)luaL_len(L, lua_upvalueindex(2));
-    lua_pushvalue(L, lua_upvalueindex(1));
-
     for (int j = 1; j <= nparams; j++) {
-        lua_rawgeti(L, lua_upvalueindex(2), j);
-        const char *gp = lua_tostring(L, -1);
-        lua_pop(L, 1);
-
-        lua_pushstring(L, gp);
-        lua_rawget(L, inferred_idx);
-        if (lua_isnil(L, -1)) {
-            return luaL_error(L, "could not infer type for '%s'", gp);
+        if (lua_isnil(L, ids + j - 1)) {
+            lua_rawgeti(L, GEN_PARAMS, j);
+            return luaL_error(L, "could not infer type for '%s'", lua_tostring(L, -1));
         }
     }
 
-    lua_call(L, nparams, 1); /* impl */
+    pushspecialization(L, ids, nparams);
 
     int impl_idx = lua_gettop(L);
-    lua_pushvalue(L, impl_idx);
     for (int i = 0; i < nargs; i++) {
        lua_pushvalue(L, base + i);
     }
     lua_call(L, nargs, LUA_MULTRET);
-    return lua_gettop(L) - impl_idx;
+    return lua_gettop(L) - impl_idx + 1;  /* results replaced 'impl' */
 }
 
 static int try_add(lua_Integer a, lua_Integer b, lua_Integer *r) {
@@ -796,6 +841,7 @@ void luaV_finishget (lua_State *L, const TValue *t, TValue *key, StkId val,
                       const TValue *slot) {
   int loop;  /* counter to avoid infinite loops */
   const TValue *tm;  /* metamethod */
+  struct GCObject *mt;
   for (loop = 0; loop < MAXTAGLOOP; loop++) {
     if (slot == LUA_NULLPTR) {
       if (ttistable(t)) {
@@ -806,24 +852,24 @@ void luaV_finishget (lua_State *L, const TValue *t, TValue *key, StkId val,
             do {
                Table *nth = ns->data;
                if (nth) {
-                  l_rwlock_rdlock(&nth->lock);
+                  luaH_rdlock(L, nth);
                   const TValue *res = luaH_get(nth, key);
                   if (!isempty(res)) {
                      setobj2s(L, val, res);
-                     l_rwlock_unlock(&nth->lock);
+                     luaH_unlock(L, nth);
                      return;
                   }
-                  l_rwlock_unlock(&nth->lock);
+                  luaH_unlock(L, nth);
                }
                ns = ns->using_next;
             } while (ns);
          }
 
-         l_rwlock_rdlock(&h->lock);
+         luaH_rdlock(L, h);
          const TValue *res = luaH_get(h, key);
          if (!isempty(res)) {
             setobj2s(L, val, res);
-            l_rwlock_unlock(&h->lock);
+            luaH_unlock(L, h);
             return;
          }
          tm = fasttm(L, h->metatable, TM_INDEX);
@@ -832,24 +878,24 @@ void luaV_finishget (lua_State *L, const TValue *t, TValue *key, StkId val,
             tm = fasttm(L, G(L)->mt[LUA_TTABLE], TM_INDEX);
          }
          if (tm == NULL) {
-            l_rwlock_unlock(&h->lock);
+            luaH_unlock(L, h);
             setnilvalue(s2v(val));
             return;
          }
-         l_rwlock_unlock(&h->lock);
+         luaH_unlock(L, h);
       } else if (ttisnamespace(t)) {
         Namespace *ns = nsvalue(t);
         do {
            Table *h = ns->data;
            if (h) {
-              l_rwlock_rdlock(&h->lock);
+              luaH_rdlock(L, h);
               const TValue *res = luaH_get(h, key);
               if (!isempty(res)) {
                  setobj2s(L, val, res);
-                 l_rwlock_unlock(&h->lock);
+                 luaH_unlock(L, h);
                  return;
               }
-              l_rwlock_unlock(&h->lock);
+              luaH_unlock(L, h);
            }
            ns = ns->using_next;
         } while (ns);
@@ -908,32 +954,30 @@ void luaV_finishget (lua_State *L, const TValue *t, TValue *key, StkId val,
          do {
             Table *nth = ns->data;
             if (nth) {
-               l_rwlock_rdlock(&nth->lock);
+               luaH_rdlock(L, nth);
                const TValue *res = luaH_get(nth, key);
                if (!isempty(res)) {
                   setobj2s(L, val, res);
-                  l_rwlock_unlock(&nth->lock);
+                  luaH_unlock(L, nth);
                   return;
                }
-               l_rwlock_unlock(&nth->lock);
+               luaH_unlock(L, nth);
             }
             ns = ns->using_next;
          } while (ns);
       }
 
-      l_rwlock_rdlock(&h->lock);
-      tm = fasttm(L, h->metatable, TM_INDEX);  /* table's metamethod */
+      mt = h->metatable;  /* one pointer load: no lock needed */
+      tm = fasttm(L, mt, TM_INDEX);  /* table's metamethod */
       if (tm == LUA_NULLPTR) /* no __index? try __mindex */
-        tm = fasttm(L, h->metatable, TM_MINDEX);
-      if (tm == LUA_NULLPTR && h->metatable == LUA_NULLPTR) {
+        tm = fasttm(L, mt, TM_MINDEX);
+      if (tm == LUA_NULLPTR && mt == LUA_NULLPTR) {
         tm = fasttm(L, G(L)->mt[LUA_TTABLE], TM_INDEX);
       }
       if (tm == LUA_NULLPTR) {  /* no metamethod? */
-        l_rwlock_unlock(&h->lock);
         setnilvalue(s2v(val));  /* result is nil */
         return;
       }
-      l_rwlock_unlock(&h->lock);
       /* else will try the metamethod */
     }
     if (ttisfunction(tm)) {  /* is metamethod a function? */
@@ -943,14 +987,14 @@ void luaV_finishget (lua_State *L, const TValue *t, TValue *key, StkId val,
     t = tm;  /* else try to access 'tm[key]' */
     if (ttistable(t)) {
       Table *h = hvalue(t);
-      l_rwlock_rdlock(&h->lock);
+      luaH_rdlock(L, h);
       const TValue *res = luaH_get(h, key);
       if (!isempty(res)) {
         setobj2s(L, val, res);
-        l_rwlock_unlock(&h->lock);
+        luaH_unlock(L, h);
         return;
       }
-      l_rwlock_unlock(&h->lock);
+      luaH_unlock(L, h);
     }
     /* else repeat (tail call 'luaV_finishget') */
   }
@@ -975,6 +1019,7 @@ void luaV_finishget (lua_State *L, const TValue *t, TValue *key, StkId val,
 void luaV_finishset (lua_State *L, const TValue *t, TValue *key,
                      TValue *val, const TValue *slot) {
   int loop;  /* counter to avoid infinite loops */
+  struct GCObject *mt;
   for (loop = 0; loop < MAXTAGLOOP; loop++) {
     const TValue *tm;  /* '__newindex' metamethod */
     if (slot != LUA_NULLPTR) {  /* is 't' a table? */
@@ -986,32 +1031,31 @@ void luaV_finishset (lua_State *L, const TValue *t, TValue *key,
          while (ns) {
             Table *nth = ns->data;
             if (nth) {
-               l_rwlock_rdlock(&nth->lock);
+               luaH_rdlock(L, nth);
                const TValue *res = luaH_get(nth, key);
                if (!isempty(res) && !isabstkey(res)) {
-                  l_rwlock_unlock(&nth->lock);
-                  l_rwlock_wrlock(&nth->lock);
+                  luaH_unlock(L, nth);
+                  luaH_wrlock(L, nth);
                   res = luaH_get(nth, key);
                   if (!isempty(res) && !isabstkey(res)) {
                      setobj2t(L, cast(TValue *, res), val);
                      luaC_barrierback(L, obj2gco(nth), val);
-                     l_rwlock_unlock(&nth->lock);
+                     luaH_unlock(L, nth);
                      return;
                   }
-                  l_rwlock_unlock(&nth->lock);
+                  luaH_unlock(L, nth);
                } else {
-                  l_rwlock_unlock(&nth->lock);
+                  luaH_unlock(L, nth);
                }
             }
             ns = ns->using_next;
          }
       }
 
-      l_rwlock_rdlock(&h->lock);
-      tm = fasttm(L, h->metatable, TM_NEWINDEX);  /* get metamethod */
-      l_rwlock_unlock(&h->lock);
+      mt = h->metatable;  /* one pointer load: no lock needed */
+      tm = fasttm(L, mt, TM_NEWINDEX);  /* get metamethod */
       if (tm == LUA_NULLPTR) {  /* no metamethod? */
-        l_rwlock_wrlock(&h->lock); /* Lock for writing */
+        luaH_wrlock(L, h); /* Lock for writing */
         /* Re-check slot? Calling luaH_finishset which might re-search if slot is absent key? */
         /* luaH_finishset calls luaH_newkey if slot is abstract. */
         /* But slot was passed in. It might be invalid now if we unlocked? */
@@ -1028,7 +1072,7 @@ void luaV_finishset (lua_State *L, const TValue *t, TValue *key,
         L->top.p--;
         invalidateTMcache(h);
         luaC_barrierback(L, obj2gco(h), val);
-        l_rwlock_unlock(&h->lock);
+        luaH_unlock(L, h);
         return;
       }
       /* else will try the metamethod */
@@ -1040,22 +1084,22 @@ void luaV_finishset (lua_State *L, const TValue *t, TValue *key,
          while (ns) {
             Table *h = ns->data;
             if (h) {
-               l_rwlock_rdlock(&h->lock);
+               luaH_rdlock(L, h);
                const TValue *res = luaH_get(h, key);
                if (!isempty(res) && !isabstkey(res)) {
-                  l_rwlock_unlock(&h->lock);
+                  luaH_unlock(L, h);
                   /* Found existing key, update it */
-                  l_rwlock_wrlock(&h->lock);
+                  luaH_wrlock(L, h);
                   res = luaH_get(h, key); /* Re-check under write lock */
                   if (!isempty(res) && !isabstkey(res)) {
                      setobj2t(L, cast(TValue *, res), val);
                      luaC_barrierback(L, obj2gco(h), val);
-                     l_rwlock_unlock(&h->lock);
+                     luaH_unlock(L, h);
                      return;
                   }
-                  l_rwlock_unlock(&h->lock);
+                  luaH_unlock(L, h);
                } else {
-                  l_rwlock_unlock(&h->lock);
+                  luaH_unlock(L, h);
                }
             }
             ns = ns->using_next;
@@ -1064,10 +1108,10 @@ void luaV_finishset (lua_State *L, const TValue *t, TValue *key,
          ns = first;
          if (ns && ns->data) {
             Table *h = ns->data;
-            l_rwlock_wrlock(&h->lock);
+            luaH_wrlock(L, h);
             luaH_set(L, h, key, val);
             luaC_barrierback(L, obj2gco(h), val);
-            l_rwlock_unlock(&h->lock);
+            luaH_unlock(L, h);
             return;
          }
          return;
@@ -1100,21 +1144,21 @@ void luaV_finishset (lua_State *L, const TValue *t, TValue *key,
       }
       else if (ttistable(t)) {
          Table *h = hvalue(t);
-         l_rwlock_wrlock(&h->lock);
+         luaH_wrlock(L, h);
          const TValue *res = luaH_get(h, key);
          if (!isempty(res) && !isabstkey(res)) {
             setobj2t(L, cast(TValue *, res), val);
             luaC_barrierback(L, obj2gco(h), val);
-            l_rwlock_unlock(&h->lock);
+            luaH_unlock(L, h);
             return;
          }
-         l_rwlock_unlock(&h->lock);
+         luaH_unlock(L, h);
          // Empty, check TM
-         l_rwlock_rdlock(&h->lock);
+         luaH_rdlock(L, h);
          tm = fasttm(L, h->metatable, TM_NEWINDEX);
-         l_rwlock_unlock(&h->lock);
+         luaH_unlock(L, h);
          if (tm == NULL) {
-            l_rwlock_wrlock(&h->lock);
+            luaH_wrlock(L, h);
             const TValue *newslot = luaH_get(h, key);
             sethvalue2s(L, L->top.p, h);
             L->top.p++;
@@ -1122,7 +1166,7 @@ void luaV_finishset (lua_State *L, const TValue *t, TValue *key,
             L->top.p--;
             invalidateTMcache(h);
             luaC_barrierback(L, obj2gco(h), val);
-            l_rwlock_unlock(&h->lock);
+            luaH_unlock(L, h);
             return;
          }
       } else {
@@ -1139,16 +1183,16 @@ void luaV_finishset (lua_State *L, const TValue *t, TValue *key,
     t = tm;  /* else repeat assignment over 'tm' */
     if (ttistable(t)) {
        Table *h = hvalue(t);
-       l_rwlock_wrlock(&h->lock);
+       luaH_wrlock(L, h);
        const TValue *res = luaH_get(h, key);
        if (!isempty(res) && !isabstkey(res)) {
           /* luaV_finishfastset just does setobj2t and barrier */
           setobj2t(L, cast(TValue *, res), val);
           luaC_barrierback(L, obj2gco(h), val);
-          l_rwlock_unlock(&h->lock);
+          luaH_unlock(L, h);
           return;
        }
-       l_rwlock_unlock(&h->lock);
+       luaH_unlock(L, h);
        /* else loop */
     }
     /* else 'return luaV_finishset(L, t, key, val, slot)' (loop) */
@@ -1896,12 +1940,12 @@ static void inopr (lua_State *L, StkId ra, TValue *a, TValue *b) {
     if (tryop(i1, i2, &r)) { \
        pc++; setivalue(s2v(ra), r); \
     } else { \
-       bigop(L, v1, v2, s2v(ra)); \
+       Protect(bigop(L, v1, v2, s2v(ra))); \
        pc++; \
     } \
   }  \
   else if (ttisbigint(v1) || ttisbigint(v2)) { \
-      bigop(L, v1, v2, s2v(ra)); \
+      Protect(bigop(L, v1, v2, s2v(ra))); \
       pc++; \
   } \
   else op_arithf_aux(L, v1, v2, fop); }
@@ -1927,13 +1971,13 @@ static void inopr (lua_State *L, StkId ra, TValue *a, TValue *b) {
        pc++; setivalue(s2v(ra), r); \
     } else { \
        TValue vimm; setivalue(&vimm, imm); \
-       bigop(L, v1, &vimm, s2v(ra)); \
+       Protect(bigop(L, v1, &vimm, s2v(ra))); \
        pc++; \
     } \
   }  \
   else if (ttisbigint(v1)) { \
       TValue vimm; setivalue(&vimm, imm); \
-      bigop(L, v1, &vimm, s2v(ra)); \
+      Protect(bigop(L, v1, &vimm, s2v(ra))); \
       pc++; \
   } \
   else if (ttisfloat(v1)) {  \
@@ -2052,6 +2096,39 @@ static void inopr (lua_State *L, StkId ra, TValue *a, TValue *b) {
   docondjump(); }
 
 
+/*
+** Quickened variants: each handles a single operand type and falls back
+** to its generic opcode 'gop' for anything else (including an integer
+** overflow, which the generic opcode turns into a big integer).
+*/
+#define op_quickint(tryop,gop) {  \
+  TValue *v1 = vRB(i);  \
+  TValue *v2 = vRC(i);  \
+  lua_Integer r;  \
+  if (l_likely(ttisinteger(v1) && ttisinteger(v2) &&  \
+               tryop(ivalue(v1), ivalue(v2), &r))) {  \
+    pc++; setivalue(s2v(RA(i)), r);  \
+  }  \
+  else deoptimize(gop); }
+
+#define op_quickflt(fop,gop) {  \
+  TValue *v1 = vRB(i);  \
+  TValue *v2 = vRC(i);  \
+  if (l_likely(ttisfloat(v1) && ttisfloat(v2))) {  \
+    pc++; setfltvalue(s2v(RA(i)), fop(L, fltvalue(v1), fltvalue(v2)));  \
+  }  \
+  else deoptimize(gop); }
+
+#define op_quickorder(opi,gop) {  \
+  TValue *ra = s2v(RA(i));  \
+  TValue *rb = vRB(i);  \
+  if (l_likely(ttisinteger(ra) && ttisinteger(rb))) {  \
+    int cond = opi(ivalue(ra), ivalue(rb));  \
+    docondjump();  \
+  }  \
+  else deoptimize(gop); }
+
+
 /**
  * @brief Order operations with immediate operand.
  *
@@ -2170,6 +2247,134 @@ static void inopr (lua_State *L, StkId ra, TValue *a, TValue *b) {
            luai_threadyield(L); }
 
 
+/*
+** Inline cache of the current instruction; the prototype's cache array
+** is created the first time one of its cached instructions runs.
+*/
+#define getic(p)  \
+	((l_unlikely((p)->icache == NULL) ? \
+	    halfProtect(luaF_initicache(L, p)) : cast_void(0)), \
+	 &(p)->icache[pc - 1 - (p)->code])
+
+
+/*
+** True if 'next' is another alternative of the union checked by 'i':
+** the alternatives of a union are consecutive OP_CHECKTYPE on the same
+** value and name, with consecutive type registers.
+*/
+#define isnextalt(i,next)  \
+	(GET_OPCODE(next) == OP_CHECKTYPE && GETARG_A(next) == GETARG_A(i) && \
+	 GETARG_C(next) == GETARG_C(i) && GETARG_B(next) == GETARG_B(i) + 1)
+
+
+/*
+** Name of type object 't' for a type-mismatch message.
+*/
+static const char *typeobjname (lua_State *L, const TValue *t) {
+  if (ttisstring(t))
+    return getstr(tsvalue(t));
+  else if (ttistable(t)) {
+    const TValue *res = luaH_getstr(hvalue(t), luaS_newliteral(L, "__name"));
+    if (!ttisstring(res))  /* a class? */
+      res = luaH_getstr(hvalue(t), luaS_newliteral(L, CLASS_KEY_NAME));
+    if (ttisstring(res))
+      return getstr(tsvalue(res));
+  }
+  return "unknown";
+}
+
+
+/*
+** Raises the error of a failed OP_CHECKTYPE, the instruction before
+** 'pc'; if it is the last alternative of a union, all alternatives
+** are listed as expected.
+*/
+static l_noret typemismatch (lua_State *L, const Proto *p,
+                             const Instruction *pc, StkId base) {
+  const Instruction *alt = pc - 1;
+  Instruction i = *alt;
+  ptrdiff_t b = savestack(L, base);
+  const TValue *rc = (GETARG_C(i) == MAXARG_C) ? s2v(base + GETARG_B(i) + 1)
+                                               : &p->k[GETARG_C(i)];
+  const char *name = getstr(tsvalue(rc));
+  const char *got = luaT_objtypename(L, s2v(base + GETARG_A(i)));
+  const char *expected;
+  while (alt > p->code && isnextalt(*(alt - 1), *alt))
+    alt--;  /* go to the first alternative */
+  expected = typeobjname(L, s2v(base + GETARG_B(*alt)));
+  while (++alt < pc) {  /* pushing may move the stack */
+    const char *t = typeobjname(L, s2v(restorestack(L, b) + GETARG_B(*alt)));
+    expected = luaO_pushfstring(L, "%s | %s", expected, t);
+  }
+  luaG_runerror(L, "Type mismatch for argument '%s': expected %s, got %s",
+                   name, expected, got);
+}
+
+
+/*
+** What, besides its variant tag, decides whether a value passes an
+** OP_CHECKTYPE: classes are checked through the metatable shared by
+** their instances, structs through their definition.
+*/
+#define typeshape(o)  \
+	(ttistable(o) ? cast(const void *, hvalue(o)->metatable) : \
+	 ttisfulluserdata(o) ? cast(const void *, uvalue(o)->metatable) : \
+	 ttisstruct(o) ? cast(const void *, structvalue(o)->def) : NULL)
+
+
+/*
+** Quickening. A generic instruction that keeps seeing the operand types
+** handled by a specialized variant is rewritten in place into it after
+** QUICKENWARMUP such executions; a variant whose guard fails rewrites
+** itself back ('deoptimize') and re-executes as the generic opcode. An
+** instruction deoptimized MAXQUICKDEOPT times stays generic. Prototypes
+** whose code is in fixed memory or run by the protected VM are never
+** rewritten.
+*/
+#define QUICKENWARMUP	8
+#define MAXQUICKDEOPT	4
+
+#define canquicken(p)  \
+	(!((p)->flag & PF_FIXED) && \
+	 !((p)->difierline_mode & OBFUSCATE_VM_PROTECT))
+
+#define quicken(qop)	{ \
+  if (canquicken(cl->p)) { \
+    InlineCache *qic = getic(cl->p); \
+    if (qic->deopts < MAXQUICKDEOPT && ++qic->hits >= QUICKENWARMUP) { \
+      qic->hits = 0; \
+      SET_OPCODE(*cast(Instruction *, pc - 1), qop); \
+    } \
+  } }
+
+/* quicken a binary arithmetic instruction on its operand types */
+#define quickenarith(iop,fop)	{ \
+  TValue *q1 = vRB(i); \
+  TValue *q2 = vRC(i); \
+  if (ttisinteger(q1) && ttisinteger(q2)) quicken(iop) \
+  else if (ttisfloat(q1) && ttisfloat(q2)) quicken(fop) }
+
+/* undo the quickening of the current instruction and run it again */
+#define deoptimize(op)	{ \
+  Instruction *dpc = cast(Instruction *, pc - 1); \
+  SET_OPCODE(*dpc, op); \
+  cl->p->icache[dpc - cl->p->code].deopts++; \
+  pc = dpc; }
+
+
+/*
+** Give the JIT a chance to run the frame natively from 'pc' (at function
+** entry and after backward jumps, which also count its hotness).
+*/
+#if LUA_USE_JIT
+#define jitrun()  \
+	{ if (l_unlikely(G(L)->jitmode) && !trap && luaJ_canenter(cl->p, pc))  \
+	    pc = luaJ_run(L, ci, base, pc); }
+#else
+#define jitrun()	((void)0)
+#endif
+
+
 /* fetch an instruction and prepare its execution */
 #define vmfetch()	{ \
   if (l_unlikely(trap)) {  /* stack reallocation or hooks? */ \
@@ -2184,6 +2389,273 @@ static void inopr (lua_State *L, StkId ra, TValue *a, TValue *b) {
 #define vmbreak		break
 
 
+/*
+** {==================================================================
+** Slice views
+** ===================================================================
+*/
+
+/*
+** While 'G(L)->sliceviews' is on, OP_SLICE answers slices of at least
+** SLICEVIEWMIN elements with a view instead of a copy: an empty table
+** whose own metatable keeps the source table, the source index of the
+** first element, the step and the length (at keys SV_SRC..SV_LEN), and
+** whose metamethods read through to the source. Until the view is first
+** written, changes to the source show through it; that first write
+** copies the elements into the view and drops its metatable, leaving an
+** ordinary table. Raw accesses bypass the metamethods and see the empty
+** table: 'rawlen' gives 0, 'next' finds no keys and 'rawget' gives nil;
+** 'setmetatable(view, nil)' leaves it empty.
+*/
+#if !defined(SLICEVIEWMIN)
+#define SLICEVIEWMIN	64
+#endif
+
+#define SV_SRC		1
+#define SV_FIRST	2
+#define SV_STEP		3
+#define SV_LEN		4
+
+
+/* Elements 'first', 'first' + 'step', ... ('len' of them) of table 't' */
+typedef struct SliceSrc {
+  Table *t;
+  lua_Integer first;
+  lua_Integer step;
+  lua_Integer len;
+} SliceSrc;
+
+
+static int sliceview_index (lua_State *L);
+
+
+/*
+** If 'mt' is the metatable of a slice view, fills 's' with the view's
+** state and returns 1; otherwise returns 0.
+*/
+static int getsliceview (lua_State *L, GCObject *mt, SliceSrc *s) {
+  const TValue *f;
+  if (mt == NULL || mt->tt != LUA_VTABLE)
+    return 0;
+  f = luaH_getshortstr(gco2t(mt), G(L)->tmname[TM_INDEX]);
+  if (!ttislcf(f) || fvalue(f) != sliceview_index)
+    return 0;
+  s->t = hvalue(luaH_getint(gco2t(mt), SV_SRC));
+  s->first = ivalue(luaH_getint(gco2t(mt), SV_FIRST));
+  s->step = ivalue(luaH_getint(gco2t(mt), SV_STEP));
+  s->len = ivalue(luaH_getint(gco2t(mt), SV_LEN));
+  return 1;
+}
+
+
+/* Pushes view field 'f' of the view at index 1 */
+static void sliceview_field (lua_State *L, int f) {
+  lua_getmetatable(L, 1);
+  lua_rawgeti(L, -1, f);
+  lua_remove(L, -2);
+}
+
+
+static int sliceview_index (lua_State *L) {
+  lua_Integer k, first, step, len;
+  int isnum;
+  if (lua_type(L, 2) != LUA_TNUMBER)
+    return 0;
+  k = lua_tointegerx(L, 2, &isnum);
+  sliceview_field(L, SV_LEN);
+  len = lua_tointeger(L, -1);
+  if (!isnum || k < 1 || k > len)
+    return 0;
+  sliceview_field(L, SV_FIRST);
+  first = lua_tointeger(L, -1);
+  sliceview_field(L, SV_STEP);
+  step = lua_tointeger(L, -1);
+  sliceview_field(L, SV_SRC);
+  lua_rawgeti(L, -1, first + (k - 1) * step);
+  return 1;
+}
+
+
+static int sliceview_len (lua_State *L) {
+  sliceview_field(L, SV_LEN);
+  return 1;
+}
+
+
+/* First write to a view: copy its elements in and drop the metatable */
+static int sliceview_newindex (lua_State *L) {
+  lua_Integer k, first, step, len;
+  lua_settop(L, 3);
+  sliceview_field(L, SV_FIRST);
+  first = lua_tointeger(L, -1);
+  sliceview_field(L, SV_STEP);
+  step = lua_tointeger(L, -1);
+  sliceview_field(L, SV_LEN);
+  len = lua_tointeger(L, -1);
+  sliceview_field(L, SV_SRC);  /* index 7 */
+  for (k = 1; k <= len; k++) {
+    lua_rawgeti(L, 7, first + (k - 1) * step);
+    lua_rawseti(L, 1, k);
+  }
+  lua_pushnil(L);
+  lua_setmetatable(L, 1);
+  lua_settop(L, 3);
+  lua_rawset(L, 1);
+  return 0;
+}
+
+
+static int sliceview_next (lua_State *L) {
+  lua_Integer k = lua_tointeger(L, 2);
+  lua_Integer len;
+  lua_len(L, 1);  /* the view may have been written meanwhile */
+  len = lua_tointeger(L, -1);
+  while (++k <= len) {
+    if (lua_geti(L, 1, k) != LUA_TNIL) {
+      lua_pushinteger(L, k);
+      lua_insert(L, -2);
+      return 2;
+    }
+    lua_pop(L, 1);
+  }
+  return 0;
+}
+
+
+static int sliceview_pairs (lua_State *L) {
+  lua_pushcfunction(L, sliceview_next);
+  lua_pushvalue(L, 1);
+  lua_pushinteger(L, 0);
+  return 3;
+}
+
+
+static void setmetafield (lua_State *L, Table *mt, TString *name,
+                          lua_CFunction f) {
+  TValue k, v;
+  setsvalue(L, &k, name);
+  setfvalue(&v, f);
+  luaH_set(L, mt, &k, &v);
+}
+
+
+/*
+** Stores in 'ra' a view of the 'n' elements 'first', 'first' + 'step',
+** ... of table 'src'.
+*/
+static void newsliceview (lua_State *L, StkId ra, Table *src,
+                          lua_Integer first, lua_Integer step,
+                          lua_Integer n) {
+  Table *view = luaH_new(L);
+  Table *mt;
+  TValue v;
+  sethvalue2s(L, ra, view);
+  mt = luaH_new(L);
+  view->metatable = obj2gco(mt);
+  luaH_resize(L, mt, SV_LEN, 4);
+  sethvalue(L, &v, src);
+  luaH_setint(L, mt, SV_SRC, &v);
+  setivalue(&v, first);
+  luaH_setint(L, mt, SV_FIRST, &v);
+  setivalue(&v, step);
+  luaH_setint(L, mt, SV_STEP, &v);
+  setivalue(&v, n);
+  luaH_setint(L, mt, SV_LEN, &v);
+  setmetafield(L, mt, G(L)->tmname[TM_INDEX], sliceview_index);
+  setmetafield(L, mt, G(L)->tmname[TM_NEWINDEX], sliceview_newindex);
+  setmetafield(L, mt, G(L)->tmname[TM_LEN], sliceview_len);
+  setmetafield(L, mt, luaS_newliteral(L, "__pairs"), sliceview_pairs);
+  invalidateTMcache(mt);
+}
+
+
+/*
+** Stores in 'ra' a new table with the 'n' elements 'first', 'first' +
+** 'step', ... of table 'src'. A run of consecutive elements inside the
+** array part of 'src' is copied as a block.
+*/
+static void slicecopy (lua_State *L, StkId ra, Table *src,
+                       lua_Integer first, lua_Integer step, lua_Integer n) {
+  Table *res = luaH_new(L);
+  lua_Integer j;
+  sethvalue2s(L, ra, res);
+  if (n <= 0)
+    return;
+  luaH_resize(L, res, cast_uint(n), 0);
+  if (step == 1 && first >= 1 &&
+      l_castS2U(first - 1 + n) <= luaH_realasize(src)) {
+    memcpy(res->array, src->array + (first - 1), cast_sizet(n) * sizeof(TValue));
+    return;
+  }
+  for (j = 0; j < n; j++) {
+    const TValue *val = luaH_getint(src, first + j * step);
+    if (!ttisnil(val)) {
+      TValue temp;
+      setobj(L, &temp, val);
+      luaH_setint(L, res, j + 1, &temp);
+    }
+  }
+}
+
+/* }================================================================== */
+
+
+/**
+ * @brief Inline-cached get of short string 'key' from table 'h'.
+ *
+ * Serves OP_GETFIELD, OP_SELF and OP_GETTABUP. Besides the receiver
+ * itself, it covers the usual class/method layout where the key lives
+ * in a plain '__index' table of the receiver's metatable, so method
+ * calls do not go through 'luaV_finishget'. Tables with namespaces,
+ * '__index' functions and longer chains are left to the generic path.
+ *
+ * @param L The Lua state.
+ * @param h The indexed table.
+ * @param key The short string key.
+ * @param ra Where to store the result.
+ * @param ic The inline cache of the instruction.
+ * @return 1 if the value was stored in 'ra', 0 if the generic path is needed.
+ */
+l_sinline int icgetshortstr (lua_State *L, Table *h, TString *key, StkId ra,
+                             InlineCache *ic) {
+  const TValue *res;
+  GCObject *mto;
+  Table *idx = NULL;
+  luaH_rdlock(L, h);
+  res = luaH_getshortstrhint(h, key, &ic->slot);
+  if (!isempty(res)) {
+    setobj2s(L, ra, res);
+    luaH_unlock(L, h);
+    return 1;
+  }
+  mto = (h->using_next == NULL) ? h->metatable : NULL;  /* read under lock */
+  luaH_unlock(L, h);
+  if (mto == NULL || mto->tt != LUA_VTABLE)
+    return 0;
+  luaH_rdlock(L, gco2t(mto));
+  if (!(gco2t(mto)->flags & (1u << TM_INDEX))) {
+    const TValue *tm = luaH_getshortstrhint(gco2t(mto),
+                           G(L)->tmname[TM_INDEX], &ic->tmslot);
+    if (ttistable(tm))
+      idx = hvalue(tm);
+  }
+  luaH_unlock(L, gco2t(mto));
+  if (idx != NULL) {
+    luaH_rdlock(L, idx);
+    if (idx->using_next == NULL) {  /* namespaces go to the generic path */
+      res = luaH_getshortstrhint(idx, key, &ic->mslot);
+      if (!isempty(res)) {
+        setobj2s(L, ra, res);
+        luaH_unlock(L, idx);
+        return 1;
+      }
+    }
+    luaH_unlock(L, idx);
+  }
+  return 0;
+}
+
+
 /**
  * @brief Main virtual machine execution loop.
  *
@@ -2230,6 +2702,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
   if (l_unlikely(trap))
     trap = luaG_tracecall(L);
   base = ci->func.p + 1;
+  jitrun();
   /* main loop of interpreter */
   for (;;) {
     Instruction i;  /* instruction being executed */
@@ -2319,19 +2792,8 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         TValue *upval = cl->upvals[GETARG_B(i)]->v.p;
         TValue *rc = KC(i);
         TString *key = tsvalue(rc);  /* key must be a short string */
-        if (ttistable(upval)) {
-           Table *h = hvalue(upval);
-           l_rwlock_rdlock(&h->lock);
-           const TValue *res = luaH_getshortstr(h, key);
-           if (!isempty(res)) {
-              setobj2s(L, ra, res);
-              l_rwlock_unlock(&h->lock);
-           } else {
-              l_rwlock_unlock(&h->lock);
-              Protect(luaV_finishget(L, upval, rc, ra, NULL));
-           }
-        }
-        else
+        if (!ttistable(upval) ||
+            !icgetshortstr(L, hvalue(upval), key, ra, getic(cl->p)))
           Protect(luaV_finishget(L, upval, rc, ra, NULL));
         vmbreak;
       }
@@ -2341,13 +2803,13 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         TValue *rc = vRC(i);
         if (ttistable(rb)) {
            Table *h = hvalue(rb);
-           l_rwlock_rdlock(&h->lock);
+           luaH_rdlock(L, h);
            const TValue *res = luaH_get_optimized(h, rc);
            if (!isempty(res)) {
               setobj2s(L, ra, res);
-              l_rwlock_unlock(&h->lock);
+              luaH_unlock(L, h);
            } else {
-              l_rwlock_unlock(&h->lock);
+              luaH_unlock(L, h);
               Protect(luaV_finishget(L, rb, rc, ra, NULL));
            }
         }
@@ -2361,13 +2823,13 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         int c = GETARG_C(i);
         if (ttistable(rb)) {
            Table *h = hvalue(rb);
-           l_rwlock_rdlock(&h->lock);
+           luaH_rdlock(L, h);
            const TValue *res = luaH_getint(h, c);
            if (!isempty(res)) {
               setobj2s(L, ra, res);
-              l_rwlock_unlock(&h->lock);
+              luaH_unlock(L, h);
            } else {
-              l_rwlock_unlock(&h->lock);
+              luaH_unlock(L, h);
               TValue key;
               setivalue(&key, c);
               Protect(luaV_finishget(L, rb, &key, ra, NULL));
@@ -2403,19 +2865,8 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         TValue *rb = vRB(i);
         TValue *rc = KC(i);
         TString *key = tsvalue(rc);  /* key must be a short string */
-        if (ttistable(rb)) {
-           Table *h = hvalue(rb);
-           l_rwlock_rdlock(&h->lock);
-           const TValue *res = luaH_getshortstr(h, key);
-           if (!isempty(res)) {
-              setobj2s(L, ra, res);
-              l_rwlock_unlock(&h->lock);
-           } else {
-              l_rwlock_unlock(&h->lock);
-              Protect(luaV_finishget(L, rb, rc, ra, NULL));
-           }
-        }
-        else
+        if (!ttistable(rb) ||
+            !icgetshortstr(L, hvalue(rb), key, ra, getic(cl->p)))
           Protect(luaV_finishget(L, rb, rc, ra, NULL));
         vmbreak;
       }
@@ -2426,14 +2877,14 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         TString *key = tsvalue(rb);  /* key must be a short string */
         if (ttistable(upval)) {
            Table *h = hvalue(upval);
-           l_rwlock_wrlock(&h->lock);
+           luaH_wrlock(L, h);
            const TValue *res = luaH_getshortstr(h, key);
            if (!isempty(res) && !isabstkey(res)) {
               setobj2t(L, cast(TValue *, res), rc);
               luaC_barrierback(L, obj2gco(h), rc);
-              l_rwlock_unlock(&h->lock);
+              luaH_unlock(L, h);
            } else {
-              l_rwlock_unlock(&h->lock);
+              luaH_unlock(L, h);
               Protect(luaV_finishset(L, upval, rb, rc, NULL));
            }
         }
@@ -2447,14 +2898,14 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         TValue *rc = RKC(i);  /* value */
         if (ttistable(s2v(ra))) {
            Table *h = hvalue(s2v(ra));
-           l_rwlock_wrlock(&h->lock);
+           luaH_wrlock(L, h);
            const TValue *res = luaH_get_optimized(h, rb);
            if (!isempty(res) && !isabstkey(res)) {
               setobj2t(L, cast(TValue *, res), rc);
               luaC_barrierback(L, obj2gco(h), rc);
-              l_rwlock_unlock(&h->lock);
+              luaH_unlock(L, h);
            } else {
-              l_rwlock_unlock(&h->lock);
+              luaH_unlock(L, h);
               Protect(luaV_finishset(L, s2v(ra), rb, rc, NULL));
            }
         }
@@ -2468,14 +2919,14 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         TValue *rc = RKC(i);
         if (ttistable(s2v(ra))) {
            Table *h = hvalue(s2v(ra));
-           l_rwlock_wrlock(&h->lock);
+           luaH_wrlock(L, h);
            const TValue *res = luaH_getint(h, c);
            if (!isempty(res) && !isabstkey(res)) {
               setobj2t(L, cast(TValue *, res), rc);
               luaC_barrierback(L, obj2gco(h), rc);
-              l_rwlock_unlock(&h->lock);
+              luaH_unlock(L, h);
            } else {
-              l_rwlock_unlock(&h->lock);
+              luaH_unlock(L, h);
               TValue key;
               setivalue(&key, c);
               Protect(luaV_finishset(L, s2v(ra), &key, rc, NULL));
@@ -2494,14 +2945,14 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         TString *key = tsvalue(rb);  /* key must be a short string */
         if (ttistable(s2v(ra))) {
            Table *h = hvalue(s2v(ra));
-           l_rwlock_wrlock(&h->lock);
+           luaH_wrlock(L, h);
            const TValue *res = luaH_getshortstr(h, key);
            if (!isempty(res) && !isabstkey(res)) {
               setobj2t(L, cast(TValue *, res), rc);
               luaC_barrierback(L, obj2gco(h), rc);
-              l_rwlock_unlock(&h->lock);
+              luaH_unlock(L, h);
            } else {
-              l_rwlock_unlock(&h->lock);
+              luaH_unlock(L, h);
               Protect(luaV_finishset(L, s2v(ra), rb, rc, NULL));
            }
         }
@@ -2561,20 +3012,19 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         TValue *rc = RKC(i);
         TString *key = tsvalue(rc);  /* key must be a string */
         setobj2s(L, ra + 1, rb);
-        if (ttistable(rb)) {
+        if (ttistable(rb) && key->tt == LUA_VSHRSTR) {
+          if (!icgetshortstr(L, hvalue(rb), key, ra, getic(cl->p)))
+            Protect(luaV_finishget(L, rb, rc, ra, NULL));
+        }
+        else if (ttistable(rb)) {
            Table *h = hvalue(rb);
-           l_rwlock_rdlock(&h->lock);
-           const TValue *res;
-           if (key->tt == LUA_VSHRSTR) {
-             res = luaH_getshortstr(h, key);
-           } else {
-             res = luaH_getstr(h, key);
-           }
+           luaH_rdlock(L, h);
+           const TValue *res = luaH_getstr(h, key);
            if (!isempty(res)) {
               setobj2s(L, ra, res);
-              l_rwlock_unlock(&h->lock);
+              luaH_unlock(L, h);
            } else {
-              l_rwlock_unlock(&h->lock);
+              luaH_unlock(L, h);
               Protect(luaV_finishget(L, rb, rc, ra, NULL));
            }
         }
@@ -2673,6 +3123,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         vmbreak;
       }
       vmcase(OP_ADD) {
+        quickenarith(OP_ADDINT, OP_ADDFLT);
         TValue *v1 = vRB(i);
         TValue *v2 = vRC(i);
         if (ttispointer(v1) && ttisinteger(v2)) {
@@ -2689,6 +3140,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         vmbreak;
       }
       vmcase(OP_SUB) {
+        quickenarith(OP_SUBINT, OP_SUBFLT);
         TValue *v1 = vRB(i);
         TValue *v2 = vRC(i);
         if (ttispointer(v1) && ttisinteger(v2)) {
@@ -2705,6 +3157,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         vmbreak;
       }
       vmcase(OP_MUL) {
+        quickenarith(OP_MULINT, OP_MULFLT);
         op_arith_overflow(L, try_mul, luai_nummul, luaB_mul);
         vmbreak;
       }
@@ -2884,6 +3337,8 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
       }
       vmcase(OP_JMP) {
         dojump(ci, i, 0);
+        if (GETARG_sJ(i) < 0)
+          jitrun();
         vmbreak;
       }
       vmcase(OP_EQ) {
@@ -2895,10 +3350,14 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         vmbreak;
       }
       vmcase(OP_LT) {
+        if (ttisinteger(s2v(RA(i))) && ttisinteger(vRB(i)))
+          quicken(OP_LTINT);
         op_order(L, l_lti, LTnum, lessthanothers);
         vmbreak;
       }
       vmcase(OP_LE) {
+        if (ttisinteger(s2v(RA(i))) && ttisinteger(vRB(i)))
+          quicken(OP_LEINT);
         op_order(L, l_lei, LEnum, lessequalothers);
         vmbreak;
       }
@@ -3090,7 +3549,9 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
       vmcase(OP_FORLOOP) {
         StkId ra = RA(i);
         if (ttisinteger(s2v(ra + 2))) {  /* integer loop? */
-          lua_Unsigned count = l_castS2U(ivalue(s2v(ra + 1)));
+          lua_Unsigned count;
+          quicken(OP_FORLOOPINT);
+          count = l_castS2U(ivalue(s2v(ra + 1)));
           if (count > 0) {  /* still more iterations? */
             lua_Integer step = ivalue(s2v(ra + 2));
             lua_Integer idx = ivalue(s2v(ra));  /* internal index */
@@ -3104,6 +3565,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         else if (floatforloop(ra))  /* float loop */
           pc -= GETARG_Bx(i);  /* jump back */
         updatetrap(ci);  /* allows a signal to break the loop */
+        jitrun();
         vmbreak;
       }
       vmcase(OP_FORPREP) {
@@ -3152,6 +3614,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         if (!ttisnil(s2v(ra + 4))) {  /* continue loop? */
           setobjs2s(L, ra + 2, ra + 4);  /* save control variable */
           pc -= GETARG_Bx(i);  /* jump back */
+          jitrun();
         }
         vmbreak;
       }}
@@ -3223,12 +3686,12 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
       }
       vmcase(OP_IS) {
         /*
-        ** OP_IS: Check if R[A] is of type K[B]
+        ** OP_IS: Check if R[A] is of type K[B] (R[B] if C)
         ** R[A] is K[B] - checks if type of R[A] matches string K[B]
         ** Supports __type metamethod for custom type names
         */
         TValue *ra = vRA(i);
-        TValue *rb = KB(i);
+        TValue *rb = GETARG_C(i) ? vRB(i) : KB(i);
         const char *typename_expected;
         const char *typename_actual;
         int cond;
@@ -3325,12 +3788,12 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
       vmcase(OP_GETSUPER) {
         /*
         ** Get super method
-        ** Format: OP_GETSUPER A B C
-        ** Function: R[A] := R[B].__parent[K[C]:shortstring]
+        ** Format: OP_GETSUPER A B C k
+        ** Function: R[A] := R[B].__parent[K[C]:shortstring] (R[C] if k)
         */
         StkId ra = RA(i);
         TValue *rb = vRB(i);
-        TString *key = tsvalue(&k[GETARG_C(i)]);
+        TString *key = tsvalue(TESTARG_k(i) ? vRC(i) : KC(i));
         /* Protect call */
         savestate(L, ci);
         setobj2s(L, L->top.p, rb);
@@ -3532,11 +3995,11 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
       vmcase(OP_ADDMETHOD) {
         /*
         ** Add method signature to interface
-        ** Format: OP_ADDMETHOD A B C
-        ** Function: R[A].__methods[K[B]] := C (param count)
+        ** Format: OP_ADDMETHOD A B C k
+        ** Function: R[A].__methods[K[B]] := C (param count; R[B] if k)
         */
         StkId ra = RA(i);
-        TString *method_name = tsvalue(&k[GETARG_B(i)]);
+        TString *method_name = tsvalue(TESTARG_k(i) ? vRB(i) : KB(i));
         int param_count = GETARG_C(i);
         if (ttistable(s2v(ra))) {
           Table *t = hvalue(s2v(ra));
@@ -3583,18 +4046,23 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         TValue *end_val = s2v(base_reg + 2);
         TValue *step_val = s2v(base_reg + 3);
         
-        Table *t;
-        Table *result_t;
+        SliceSrc src;
         lua_Integer tlen;
         lua_Integer start_idx, end_idx, step;
-        lua_Integer result_idx;
+        lua_Integer n;
         
         /* Check if source is a table */
         if (l_unlikely(!ttistable(src_table))) {
           luaG_typeerror(L, src_table, "slice");
         }
-        t = hvalue(src_table);
-        tlen = luaH_getn(t);
+        /* A slice of a view is taken from the view's own source */
+        if (!getsliceview(L, hvalue(src_table)->metatable, &src)) {
+          src.t = hvalue(src_table);
+          src.first = 1;
+          src.step = 1;
+          src.len = luaH_getn(src.t);
+        }
+        tlen = src.len;
         
         /* Parse start */
         if (ttisnil(start_val)) {
@@ -3681,37 +4149,20 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
           if (end_idx < 1) end_idx = 1;
         }
         
-        /* Create result table */
-        L->top.p = ra + 1;
-        result_t = luaH_new(L);
-        sethvalue2s(L, ra, result_t);
+        /* Number of elements */
+        if (step > 0)
+          n = (end_idx >= start_idx) ? (end_idx - start_idx) / step + 1 : 0;
+        else
+          n = (start_idx >= end_idx) ? (start_idx - end_idx) / -step + 1 : 0;
         
-        /* Copy elements */
-        result_idx = 1;
-        if (step > 0) {
-          lua_Integer idx;
-          for (idx = start_idx; idx <= end_idx; idx += step) {
-            const TValue *val = luaH_getint(t, idx);
-            if (!ttisnil(val)) {
-              TValue temp;
-              setobj(L, &temp, val);
-              luaH_setint(L, result_t, result_idx, &temp);
-            }
-            result_idx++;
-          }
-        }
-        else {  /* step < 0 */
-          lua_Integer idx;
-          for (idx = start_idx; idx >= end_idx; idx += step) {
-            const TValue *val = luaH_getint(t, idx);
-            if (!ttisnil(val)) {
-              TValue temp;
-              setobj(L, &temp, val);
-              luaH_setint(L, result_t, result_idx, &temp);
-            }
-            result_idx++;
-          }
-        }
+        /* Create result (a view or a copy) */
+        L->top.p = ra + 1;
+        if (G(L)->sliceviews && n >= SLICEVIEWMIN)
+          newsliceview(L, ra, src.t, src.first + (start_idx - 1) * src.step,
+                       step * src.step, n);
+        else
+          slicecopy(L, ra, src.t, src.first + (start_idx - 1) * src.step,
+                    step * src.step, n);
         
         checkGC(L, ra + 1);
         vmbreak;
@@ -3759,10 +4210,10 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
           ra = RA(i);
           sethvalue2s(L, ra, t);
           TValue val; sethvalue(L, &val, t);
-          l_rwlock_wrlock(&reg->lock);
+          luaH_wrlock(L, reg);
           luaH_set(L, reg, s2v(L->top.p - 1), &val);
           luaC_barrierback(L, obj2gco(reg), &val);
-          l_rwlock_unlock(&reg->lock);
+          luaH_unlock(L, reg);
           L->top.p--;
           checkGC(L, ra + 1);
         }
@@ -3777,23 +4228,23 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         setsvalue2s(L, L->top.p, key); /* anchor key */
         L->top.p++;
         const TValue *res;
-        l_rwlock_rdlock(&reg->lock);
+        luaH_rdlock(L, reg);
         res = luaH_getstr(reg, key);
         if (!isempty(res)) {
           setobj2s(L, ra, res);
-          l_rwlock_unlock(&reg->lock);
+          luaH_unlock(L, reg);
           L->top.p--;
         } else {
-          l_rwlock_unlock(&reg->lock);
+          luaH_unlock(L, reg);
           Table *t = luaH_new(L);
           updatebase(ci);
           ra = RA(i);
           sethvalue2s(L, ra, t);
           TValue val; sethvalue(L, &val, t);
-          l_rwlock_wrlock(&reg->lock);
+          luaH_wrlock(L, reg);
           luaH_set(L, reg, s2v(L->top.p - 1), &val);
           luaC_barrierback(L, obj2gco(reg), &val);
-          l_rwlock_unlock(&reg->lock);
+          luaH_unlock(L, reg);
           L->top.p--;
           checkGC(L, ra + 1);
         }
@@ -3801,8 +4252,13 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
       }
       vmcase(OP_ASYNCWRAP) {
         int b = GETARG_B(i);
-        lua_getglobal(L, "__async_wrap");
-        if (ttisfunction(s2v(L->top.p - 1))) {
+        const TValue *wrap;
+        /* 'L->top' may be below live registers: lookup from 'ci->top' */
+        Protect(getasyncwrap(L));
+        wrap = s2v(L->top.p - 1);
+        /* the built-in wrapper is not called: its closure is made here */
+        if (ttisfunction(wrap) &&
+            !(ttislcf(wrap) && fvalue(wrap) == luaB_async_wrap)) {
            updatebase(ci);
            TValue *rb = s2v(base + b);
            setobj2s(L, L->top.p, rb);
@@ -3814,14 +4270,13 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
            L->top.p--;
            checkGC(L, ra + 1);
         } else {
-           lua_pop(L, 1);
+           L->top.p--;
            CClosure *ncl = luaF_newCclosure(L, 1);
-           ncl->f = lvm_async_start;
+           ncl->f = luaB_async_start;
            updatebase(ci); /* stack might have moved */
            StkId ra = RA(i);
-           TValue *rb = s2v(base + b);
+           setobj(L, &ncl->upvalue[0], s2v(base + b));  /* 'b' may be 'ra' */
            setclCvalue(L, s2v(ra), ncl);
-           setobj(L, &ncl->upvalue[0], rb);
            checkGC(L, ra + 1);
         }
         vmbreak;
@@ -3831,8 +4286,8 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         updatebase(ci);
         int b = GETARG_B(i);
 
-        /* 1. Create Closure */
-        CClosure *ncl = luaF_newCclosure(L, 3);
+        /* 1. Create Closure (plan and cache are built on first call) */
+        CClosure *ncl = luaF_newCclosure(L, 5);
         ncl->f = lvm_generic_call;
 
         updatebase(ci); /* stack might have moved */
@@ -3840,6 +4295,8 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         setobj(L, &ncl->upvalue[0], s2v(base_args));
         setobj(L, &ncl->upvalue[1], s2v(base_args + 1));
         setobj(L, &ncl->upvalue[2], s2v(base_args + 2));
+        setnilvalue(&ncl->upvalue[3]);
+        setnilvalue(&ncl->upvalue[4]);
 
         StkId ra = RA(i);
         setclCvalue(L, s2v(ra), ncl); /* Anchor ncl in ra */
@@ -3885,20 +4342,39 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
       vmcase(OP_CHECKTYPE) {
         StkId ra = RA(i);
         TValue *rb = vRB(i);
-        TValue *rc = KC(i);
-
-        if (!check_subtype_internal(L, s2v(ra), rb)) {
-           const char *name = getstr(tsvalue(rc));
-           const char *expected = "unknown";
-           if (ttisstring(rb)) expected = getstr(tsvalue(rb));
-           else if (ttistable(rb)) {
-                Table *h = hvalue(rb);
-                TString *key_name = luaS_newliteral(L, "__name");
-                const TValue *res = luaH_getstr(h, key_name);
-                if (ttisstring(res)) expected = getstr(tsvalue(res));
-           }
-           luaG_runerror(L, "Type mismatch for argument '%s': expected %s, got %s",
-                          name, expected, luaT_objtypename(L, s2v(ra)));
+        TypeCache *tc;
+        int ok;
+        if (GETARG_k(i) && ttisnil(s2v(ra)))
+          ok = 1;  /* 'T?' accepts nil */
+        else {
+          if (l_unlikely(cl->p->tcache == NULL))
+            halfProtect(luaF_inittcache(L, cl->p));
+          tc = &cl->p->tcache[pc - 1 - cl->p->code];
+          if (iscollectable(rb) && tc->type == gcvalue(rb) &&
+              tc->tag == rawtt(s2v(ra)) && tc->shape == typeshape(s2v(ra)) &&
+              tc->version == G(L)->classversion)
+            ok = 1;  /* same kind of value passed this check before */
+          else {
+            Protect(ok = check_subtype_internal(L, s2v(ra), rb));
+            ra = RA(i);  /* stack may have moved */
+            rb = vRB(i);
+            if (ok && (ttisstring(rb) || ttistable(rb))) {
+              /* predicates (functions) are not cached: they may have state */
+              tc->type = gcvalue(rb);
+              tc->tag = rawtt(s2v(ra));
+              tc->shape = typeshape(s2v(ra));
+              tc->version = G(L)->classversion;
+            }
+          }
+        }
+        if (ok) {
+          Instruction ni = i;
+          while (isnextalt(ni, *pc))  /* skip the other alternatives */
+            ni = *(pc++);
+        }
+        else if (!isnextalt(i, *pc)) {  /* no alternative left? */
+          savestate(L, ci);
+          typemismatch(L, cl->p, pc, base);
         }
         vmbreak;
       }
@@ -3906,6 +4382,58 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         lua_assert(0);
         vmbreak;
       }
+      vmcase(OP_ADDINT) {
+        op_quickint(try_add, OP_ADD);
+        vmbreak;
+      }
+      vmcase(OP_SUBINT) {
+        op_quickint(try_sub, OP_SUB);
+        vmbreak;
+      }
+      vmcase(OP_MULINT) {
+        op_quickint(try_mul, OP_MUL);
+        vmbreak;
+      }
+      vmcase(OP_ADDFLT) {
+        op_quickflt(luai_numadd, OP_ADD);
+        vmbreak;
+      }
+      vmcase(OP_SUBFLT) {
+        op_quickflt(luai_numsub, OP_SUB);
+        vmbreak;
+      }
+      vmcase(OP_MULFLT) {
+        op_quickflt(luai_nummul, OP_MUL);
+        vmbreak;
+      }
+      vmcase(OP_LTINT) {
+        op_quickorder(l_lti, OP_LT);
+        vmbreak;
+      }
+      vmcase(OP_LEINT) {
+        op_quickorder(l_lei, OP_LE);
+        vmbreak;
+      }
+      vmcase(OP_FORLOOPINT) {
+        StkId ra = RA(i);
+        if (l_likely(ttisinteger(s2v(ra + 2)))) {
+          lua_Unsigned count = l_castS2U(ivalue(s2v(ra + 1)));
+          if (count > 0) {  /* still more iterations? */
+            lua_Integer step = ivalue(s2v(ra + 2));
+            lua_Integer idx = ivalue(s2v(ra));  /* internal index */
+            chgivalue(s2v(ra + 1), count - 1);  /* update counter */
+            idx = intop(+, idx, step);  /* add step to index */
+            chgivalue(s2v(ra), idx);  /* update internal index */
+            setivalue(s2v(ra + 3), idx);  /* and control variable */
+            pc -= GETARG_Bx(i);  /* jump back */
+          }
+          updatetrap(ci);  /* allows a signal to break the loop */
+          jitrun();
+        }
+        else
+          deoptimize(OP_FORLOOP);
+        vmbreak;
+      }
     }
   }
 }
@@ -130,6 +130,8 @@ LUAI_FUNC void luaV_finishset (lua_State *L, const TValue *t, TValue *key,
                                              TValue *val, const TValue *slot);
 LUAI_FUNC void luaV_finishOp (lua_State *L);
 LUAI_FUNC int luaB_next (lua_State *L);
+LUAI_FUNC int luaB_async_wrap (lua_State *L);
+LUAI_FUNC int luaB_async_start (lua_State *L);
 /**
  * @brief Main execution loop of the Lua virtual machine.
  * @param L Lua state.
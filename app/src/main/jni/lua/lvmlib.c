@@ -9,6 +9,7 @@
 #include "lprefix.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "lua.h"
@@ -18,6 +19,10 @@
 #include "lstate.h"
 #include "lobject.h"
 #include "ldo.h"
+#include "ljit.h"
+#include "lmem.h"
+#include "lgc.h"
+#include "lprof.h"
 
 
 static int vm_execute (lua_State *L) {
@@ -102,10 +107,27 @@ static int vm_tointeger (lua_State *L) {
 }
 
 
+/* 内存池命中率（所有大小类的总和；没有内存池时为 nil） */
+static void pushpoolhitrate (lua_State *L) {
+  MemPoolStats st;
+  size_t allocs = 0, hits = 0;
+  int c;
+  for (c = 0; luaM_poolstats(L, c, &st); c++) {
+    allocs += st.allocs;
+    hits += st.hits;
+  }
+  if (c == 0)
+    lua_pushnil(L);
+  else
+    lua_pushnumber(L, allocs ? (lua_Number)hits / (lua_Number)allocs : 0);
+}
+
+
 static int vm_gcinfo (lua_State *L) {
   /* 获取GC信息，使用标准Lua API */
   lua_pushinteger(L, lua_gc(L, LUA_GCCOUNT, 0) * 1024 + lua_gc(L, LUA_GCCOUNTB, 0));
-  return 1;
+  pushpoolhitrate(L);
+  return 2;
 }
 
 
@@ -118,9 +140,256 @@ static int vm_gettop (lua_State *L) {
 
 static int vm_memory (lua_State *L) {
   /* 获取内存使用情况，使用标准Lua API */
+  MemPoolStats st;
+  int c;
   lua_pushinteger(L, lua_gc(L, LUA_GCCOUNT, 0) * 1024 + lua_gc(L, LUA_GCCOUNTB, 0));
   lua_pushinteger(L, lua_gc(L, LUA_GCCOUNT, 0));
-  return 2;
+  /* 内存池统计：每个大小类一项 {size, allocs, hits, hitrate, slabs} */
+  lua_createtable(L, 0, 3);
+  lua_pushinteger(L, (lua_Integer)luaM_poolgetusage(L));
+  lua_setfield(L, -2, "mapped");
+  pushpoolhitrate(L);
+  lua_setfield(L, -2, "hitrate");
+  lua_newtable(L);
+  for (c = 0; luaM_poolstats(L, c, &st); c++) {
+    lua_createtable(L, 0, 5);
+    lua_pushinteger(L, (lua_Integer)st.size);
+    lua_setfield(L, -2, "size");
+    lua_pushinteger(L, (lua_Integer)st.allocs);
+    lua_setfield(L, -2, "allocs");
+    lua_pushinteger(L, (lua_Integer)st.hits);
+    lua_setfield(L, -2, "hits");
+    lua_pushnumber(L, st.allocs ? (lua_Number)st.hits / (lua_Number)st.allocs : 0);
+    lua_setfield(L, -2, "hitrate");
+    lua_pushinteger(L, (lua_Integer)st.slabs);
+    lua_setfield(L, -2, "slabs");
+    lua_rawseti(L, -2, c + 1);
+  }
+  lua_setfield(L, -2, "classes");
+  return 3;
+}
+
+
+static int cmptime (const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+
+/* 第 p 百分位（t 已排序，n > 0） */
+static double percentile (const double *t, int n, double p) {
+  int i = (int)(p * n + 0.999999) - 1;
+  return t[i < 0 ? 0 : (i >= n ? n - 1 : i)];
+}
+
+
+/* 把 ring 中 kind 类（-1 为全部）的停顿汇总为 {n, p50, p99, max}（单位：秒） */
+static void pushpauses (lua_State *L, const GCStats *st, double *t, int kind) {
+  int nring = (st->nring < GCSTATSRING) ? (int)st->nring : GCSTATSRING;
+  int i, n = 0;
+  for (i = 0; i < nring; i++) {
+    if (kind < 0 || st->ring[i].kind == kind)
+      t[n++] = st->ring[i].time;
+  }
+  qsort(t, n, sizeof(double), cmptime);
+  lua_createtable(L, 0, 4);
+  lua_pushinteger(L, n);
+  lua_setfield(L, -2, "n");
+  lua_pushnumber(L, n ? percentile(t, n, 0.50) : 0);
+  lua_setfield(L, -2, "p50");
+  lua_pushnumber(L, n ? percentile(t, n, 0.99) : 0);
+  lua_setfield(L, -2, "p99");
+  lua_pushnumber(L, n ? t[n - 1] : 0);
+  lua_setfield(L, -2, "max");
+}
+
+
+static int vm_gcstats (lua_State *L) {
+  /* GC遥测：vm.gcstats(true) 开启并清零，vm.gcstats(false) 关闭；
+     返回当前统计，关闭时返回 nil。停顿的分位数只针对最近的 GCSTATSRING 次 */
+  static const char *const phases[GCNPHASES] = {
+    "propagate", "atomic", "sweep", "finalizers"};
+  static const char *const kinds[GCNPAUSES] = {
+    "step", "minor", "major", "full", "emergency"};
+  GCStats *st;
+  double *t;
+  int i;
+  if (!lua_isnoneornil(L, 1))
+    luaC_setstats(L, lua_toboolean(L, 1));
+  st = (GCStats *)lua_newuserdatauv(L, sizeof(GCStats), 0);  /* 快照 */
+  if (!luaC_getstats(L, st)) {
+    lua_pushnil(L);
+    return 1;
+  }
+  t = (double *)lua_newuserdatauv(L, GCSTATSRING * sizeof(double), 0);
+  lua_createtable(L, 0, 16);
+  lua_pushinteger(L, (lua_Integer)st->ncycles);
+  lua_setfield(L, -2, "cycles");
+  lua_pushinteger(L, (lua_Integer)st->nminor);
+  lua_setfield(L, -2, "minor");
+  lua_pushinteger(L, (lua_Integer)st->nmajor);
+  lua_setfield(L, -2, "major");
+  lua_pushinteger(L, (lua_Integer)st->npauses[GCPFULL]);
+  lua_setfield(L, -2, "full");
+  lua_pushinteger(L, (lua_Integer)st->npauses[GCPEMERGENCY]);
+  lua_setfield(L, -2, "emergency");
+  lua_pushinteger(L, (lua_Integer)st->nring);
+  lua_setfield(L, -2, "pauses");
+  lua_pushnumber(L, st->pausetime);
+  lua_setfield(L, -2, "pausetime");
+  lua_pushinteger(L, (lua_Integer)st->marked);
+  lua_setfield(L, -2, "marked");
+  lua_pushinteger(L, (lua_Integer)st->lastmarked);
+  lua_setfield(L, -2, "lastmarked");
+  lua_pushinteger(L, (lua_Integer)st->swept);
+  lua_setfield(L, -2, "swept");
+  lua_createtable(L, 0, GCNPHASES);  /* 各阶段的墙钟时间（秒） */
+  for (i = 0; i < GCNPHASES; i++) {
+    lua_pushnumber(L, st->phasetime[i]);
+    lua_setfield(L, -2, phases[i]);
+  }
+  lua_setfield(L, -2, "phases");
+  lua_createtable(L, 0, GCNPHASES);  /* 各阶段在单次停顿中最长的一段（秒） */
+  for (i = 0; i < GCNPHASES; i++) {
+    lua_pushnumber(L, st->phasemax[i]);
+    lua_setfield(L, -2, phases[i]);
+  }
+  lua_setfield(L, -2, "phasemax");
+  pushpauses(L, st, t, -1);  /* 全部停顿 */
+  lua_setfield(L, -2, "pause");
+  lua_createtable(L, 0, GCNPAUSES);  /* 按类别 */
+  for (i = 0; i < GCNPAUSES; i++) {
+    pushpauses(L, st, t, i);
+    lua_pushinteger(L, (lua_Integer)st->npauses[i]);
+    lua_setfield(L, -2, "count");  /* 总次数（不限于最近） */
+    lua_setfield(L, -2, kinds[i]);
+  }
+  lua_setfield(L, -2, "kinds");
+  return 1;
+}
+
+
+static int vm_heapprof (lua_State *L) {
+  /* 堆分析器：vm.heapprof(n) 平均每分配 n 字节采样一次（true 为默认间隔
+     LUAI_PROFRATE，0 或 false 关闭），运行中可随时调整；不带参数只查询。
+     返回原来的间隔（关闭时为 0） */
+  size_t old;
+  if (lua_isnoneornil(L, 1))
+    old = G(L)->profrate;
+  else if (lua_isboolean(L, 1))
+    old = luaM_profsetrate(L, lua_toboolean(L, 1) ? LUAI_PROFRATE : 0);
+  else {
+    lua_Integer n = luaL_checkinteger(L, 1);
+    luaL_argcheck(L, n >= 0, 1, "negative sampling rate");
+    old = luaM_profsetrate(L, (size_t)n);
+  }
+  lua_pushinteger(L, (lua_Integer)old);
+  return 1;
+}
+
+
+/* 把各分配点的快照放进栈顶的 userdata；分析器从未开启时返回 NULL */
+static HeapSiteInfo *heapsites (lua_State *L, int *n, double *elapsed) {
+  int max = 64;
+  HeapSiteInfo *s;
+  s = (HeapSiteInfo *)lua_newuserdatauv(L, max * sizeof(HeapSiteInfo), 0);
+  while ((*n = luaM_profsites(L, s, max, elapsed)) > max) {  /* 放不下？ */
+    max = *n + 16;  /* 期间可能还有新的分配点 */
+    lua_pop(L, 1);
+    s = (HeapSiteInfo *)lua_newuserdatauv(L, max * sizeof(HeapSiteInfo), 0);
+  }
+  return (*n < 0) ? NULL : s;
+}
+
+
+static int cmpleaf (const void *a, const void *b) {
+  return strcmp(((const HeapSiteInfo *)a)->leaf,
+                ((const HeapSiteInfo *)b)->leaf);
+}
+
+
+static int cmpbytes (const void *a, const void *b) {  /* 降序 */
+  lu_mem x = ((const HeapSiteInfo *)a)->bytes;
+  lu_mem y = ((const HeapSiteInfo *)b)->bytes;
+  return (x < y) - (x > y);
+}
+
+
+static int vm_heapreport (lua_State *L) {
+  /* 堆分析报告：按分配点（最内层 Lua 帧、其下的 C 帧与类型）合并调用栈，
+     按分配字节降序列出前 n 个（默认 20）的分配量、分配速率与存活量；
+     从未开启时返回 nil */
+  int top = (int)luaL_optinteger(L, 1, 20);
+  HeapSiteInfo *s;
+  double elapsed, secs;
+  lu_mem bytes = 0, live = 0, samples = 0;
+  int n, m, i;
+  char line[LUA_IDSIZE + 128];
+  luaL_Buffer b;
+  s = heapsites(L, &n, &elapsed);
+  if (s == NULL) {
+    lua_pushnil(L);
+    return 1;
+  }
+  qsort(s, n, sizeof(HeapSiteInfo), cmpleaf);
+  for (i = m = 0; i < n; i++) {  /* 合并同一分配点的不同调用栈 */
+    bytes += s[i].bytes;
+    live += s[i].live;
+    samples += s[i].nsamples;
+    if (m > 0 && strcmp(s[m - 1].leaf, s[i].leaf) == 0) {
+      s[m - 1].bytes += s[i].bytes;
+      s[m - 1].live += s[i].live;
+      s[m - 1].nsamples += s[i].nsamples;
+    }
+    else
+      s[m++] = s[i];
+  }
+  qsort(s, m, sizeof(HeapSiteInfo), cmpbytes);
+  secs = (elapsed > 0) ? elapsed : 1;
+  luaL_buffinit(L, &b);
+  snprintf(line, sizeof(line),
+           "heap profile: %.2f s, %lu samples, "
+           "%.1f KB allocated (%.1f KB/s), %.1f KB live%s\n",
+           elapsed, (unsigned long)samples, bytes / 1024.0,
+           bytes / 1024.0 / secs, live / 1024.0,
+           G(L)->profrate ? "" : " (stopped)");
+  luaL_addstring(&b, line);
+  luaL_addstring(&b, "    alloc KB       KB/s    live KB  samples  site\n");
+  for (i = 0; i < m && i < top; i++) {
+    snprintf(line, sizeof(line), "%12.1f %10.1f %10.1f %8lu  %s\n",
+             s[i].bytes / 1024.0, s[i].bytes / 1024.0 / secs,
+             s[i].live / 1024.0, (unsigned long)s[i].nsamples, s[i].leaf);
+    luaL_addstring(&b, line);
+  }
+  luaL_pushresult(&b);
+  return 1;
+}
+
+
+static int vm_heapdump (lua_State *L) {
+  /* 写出折叠调用栈文件（flamegraph.pl 的输入格式）：每行
+     "帧;...;帧;类型 字节数"；what 为 "alloc"（默认，分配字节）或 "live" */
+  static const char *const whats[] = {"alloc", "live", NULL};
+  const char *fname = luaL_checkstring(L, 1);
+  int what = luaL_checkoption(L, 2, "alloc", whats);
+  HeapSiteInfo *s;
+  double elapsed;
+  int n, i, ok;
+  FILE *f;
+  s = heapsites(L, &n, &elapsed);
+  if (s == NULL)
+    return luaL_error(L, "heap profiler was never started");
+  f = fopen(fname, "w");
+  if (f == NULL)
+    return luaL_fileresult(L, 0, fname);
+  for (i = 0; i < n; i++) {
+    lu_mem v = what ? s[i].live : s[i].bytes;
+    if (v > 0)
+      fprintf(f, "%s %lu\n", s[i].stack, (unsigned long)v);
+  }
+  ok = !ferror(f);
+  ok = (fclose(f) == 0) && ok;
+  return luaL_fileresult(L, ok, fname);
 }
 
 
@@ -285,6 +554,25 @@ static int vm_gcinc (lua_State *L) {
 }
 
 
+static int vm_jit (lua_State *L) {
+  /* 开关基线JIT：无参数时返回当前状态，平台不支持时始终为false */
+  if (!lua_isnoneornil(L, 1))
+    luaJ_setmode(L, lua_toboolean(L, 1));
+  lua_pushboolean(L, G(L)->jitmode);
+  return 1;
+}
+
+
+static int vm_sliceview (lua_State *L) {
+  /* 开关切片视图：开启后较大的 t[i:j:k] 返回引用原表的视图，首次写入时才复制为普通表。
+     视图是带私有元表的空表：rawlen 为 0、next 为 nil，setmetatable(v, nil) 后为空表 */
+  if (!lua_isnoneornil(L, 1))
+    G(L)->sliceviews = cast_byte(lua_toboolean(L, 1));
+  lua_pushboolean(L, G(L)->sliceviews);
+  return 1;
+}
+
+
 static int vm_getregistry (lua_State *L) {
   /* 获取注册表 */
   lua_pushvalue(L, LUA_REGISTRYINDEX);
@@ -467,6 +755,10 @@ static const luaL_Reg vm_funcs[] = {
   {"memory", vm_memory},
   {"gcstep", vm_gcstep},
   {"gccollect", vm_gccollect},
+  {"gcstats", vm_gcstats},
+  {"heapprof", vm_heapprof},
+  {"heapreport", vm_heapreport},
+  {"heapdump", vm_heapdump},
   {"newthread", vm_newthread},
   {"status", vm_status},
   {"resume", vm_resume},
@@ -480,6 +772,8 @@ static const luaL_Reg vm_funcs[] = {
   {"gcsetpause", vm_gcsetpause},
   {"gcsetstepmul", vm_gcsetstepmul},
   {"gcinc", vm_gcinc},
+  {"jit", vm_jit},
+  {"sliceview", vm_sliceview},
   {"getregistry", vm_getregistry},
   {"getglobalenv", vm_getglobalenv},
   {"setglobalenv", vm_setglobalenv},
@@ -67,7 +67,7 @@ static int vm_compile(lua_State *L, Proto *p) {
     Instruction inst = p->code[i];
     lua_createtable(L, 0, 9);
 
-    lua_pushinteger(L, GET_OPCODE(inst));
+    lua_pushinteger(L, luaP_genericop(GET_OPCODE(inst)));
     lua_setfield(L, -2, "op");
 
     lua_pushinteger(L, GETARG_A(inst));
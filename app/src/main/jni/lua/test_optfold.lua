@@ -0,0 +1,22 @@
+-- luac -O1/-O2 must not fold integer arithmetic that overflows: the VM
+-- turns such results into big integers instead of wrapping around.
+-- Run at every level; each must print the same lines and end in "OK":
+--   lxclua test_optfold.lua
+--   luac -O1 -o t.out test_optfold.lua && lxclua t.out
+--   luac -O2 -o t.out test_optfold.lua && lxclua t.out
+local max = 9223372036854775807
+local min = -max - 1
+local one, two, mone = 1, 2, -1
+
+local r = {
+  max + one, max + 1, min - one, min - 1, one - min,
+  max * two, min * mone, mone * min, max * max,
+  -min,
+  max + 0, min + one, max - max, max * mone,  -- these fold
+}
+for i = 1, #r do print(i, r[i]) end
+assert(tostring(max + one) == "9223372036854775808")
+assert(tostring(min - one) == "-9223372036854775809")
+assert(tostring(max * two) == "18446744073709551614")
+assert(min + one == -max and max * mone == -max)
+print("OK")